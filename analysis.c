@@ -0,0 +1,756 @@
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gspro.h"
+#include "stream.h"
+#include "n64rd.h"
+#include "diff.h"
+#include "r4300.h"
+#include "analysis.h"
+
+
+#define _ANALYSIS_RDRAM(_a)     (((_a) >= 0x80000000) && ((_a) < 0x80800000))
+#define _ANALYSIS_PRINTABLE(_c) ((((_c) >= 0x20) && ((_c) < 0x7F)) || ((_c) == '\t') || ((_c) == '\n'))
+
+
+/* Private function declarations */
+uint32_t _analysis_code_pc(uint32_t pc);
+void _analysis_add_xref(ANALYSIS_PART *part, uint32_t target, uint32_t from, uint32_t word, uint8_t kind);
+void _analysis_add_string(ANALYSIS_PART *part, uint32_t address, uint32_t length);
+void _analysis_code(ANALYSIS *a, ANALYSIS_PART *part);
+void _analysis_strings(ANALYSIS *a, ANALYSIS_PART *part);
+int _analysis_compare(const void *x, const void *y);
+void *_analysis_worker(void *arg);
+int _analysis_sink_write(GS_SINK *sink, const uint8_t *buf, size_t size);
+void _analysis_heap_down(ANALYSIS *a, uint32_t *heap, uint32_t *cursor, uint32_t count, uint32_t i);
+
+
+/* Private functions */
+
+/* Code in a ROM or uncached dump runs from KSEG0; j / jal targets are relative to that */
+uint32_t _analysis_code_pc(uint32_t pc) {
+    if (((pc & 0xF0000000) == 0x80000000) || ((pc & 0xF0000000) == 0x90000000)) {
+        return pc;
+    }
+
+    return 0x80000000 | (pc & 0x0FFFFFFF);
+}
+
+void _analysis_add_xref(ANALYSIS_PART *part, uint32_t target, uint32_t from, uint32_t word, uint8_t kind) {
+    ANALYSIS_XREF *xref;
+
+    if (part->xref_count == part->xref_capacity) {
+        part->xref_capacity = part->xref_capacity ? (part->xref_capacity * 2) : 0x400;
+        part->xrefs = realloc(part->xrefs, part->xref_capacity * sizeof(ANALYSIS_XREF));
+        if (!part->xrefs) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+
+    xref = &part->xrefs[part->xref_count++];
+    xref->target = target;
+    xref->from = from;
+    xref->word = word;
+    xref->kind = kind;
+}
+
+void _analysis_add_string(ANALYSIS_PART *part, uint32_t address, uint32_t length) {
+    if (part->string_count == part->string_capacity) {
+        part->string_capacity = part->string_capacity ? (part->string_capacity * 2) : 0x100;
+        part->strings = realloc(part->strings, part->string_capacity * sizeof(ANALYSIS_STRING));
+        if (!part->strings) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+
+    part->strings[part->string_count].address = address;
+    part->strings[part->string_count].length = length;
+    part->string_count++;
+}
+
+/*
+ * Decode every word of a part. Decoding starts ANALYSIS_WARMUP bytes early so
+ * a lui just before the part is still paired with its low half.
+ */
+void _analysis_code(ANALYSIS *a, ANALYSIS_PART *part) {
+    const R4300_OP *op;
+    uint32_t hi[32];
+    uint32_t live[32] = { 0 };  /* Instruction number + 1 of each register's lui */
+    uint32_t pos = (part->start > ANALYSIS_WARMUP) ? (part->start - ANALYSIS_WARMUP) : 0;
+    uint32_t n = 0;
+    uint32_t word;
+    uint32_t pc;
+    uint32_t target;
+    uint32_t rs;
+    bool record;
+    bool flush = false;
+
+    for (; (pos + 4) <= part->end; pos += 4, n++) {
+        word = get_be32(&a->data[pos]);
+        pc = a->address + pos;
+        record = (pos >= part->start);
+
+        if (record && _ANALYSIS_RDRAM(word)) {
+            _analysis_add_xref(part, word, pc, word, ANALYSIS_POINTER);
+        }
+
+        op = r4300_decode(word);
+        if (!op) {
+            memset(live, 0, sizeof(live));
+            flush = false;
+            continue;
+        }
+        if (record && word) {
+            part->insns++;
+        }
+
+        if (record && (op->flags & (R4300_BRANCH | R4300_JUMP))) {
+            if (op->format == R4300_F_TARGET) {
+                target = r4300_target(word, op, _analysis_code_pc(pc));
+                if (_ANALYSIS_RDRAM(target)) {
+                    _analysis_add_xref(part, target, pc, word,
+                        (op->flags & R4300_LINK) ? ANALYSIS_CALL : ANALYSIS_JUMP);
+                }
+            }
+            else if (op->flags & R4300_BRANCH) {
+                _analysis_add_xref(part, r4300_target(word, op, pc), pc, word, ANALYSIS_BRANCH);
+            }
+        }
+
+        /* The low half of a lui pair */
+        rs = R4300_RS(word);
+        if ((op->flags & (R4300_MEM | R4300_LO)) && live[rs] && ((n + 1 - live[rs]) <= ANALYSIS_HILO_WINDOW)) {
+            if (R4300_OPCODE(word) == 0x0D) {
+                target = hi[rs] | R4300_UIMM(word);
+            }
+            else {
+                target = hi[rs] + R4300_IMM(word);
+            }
+            if (record && _ANALYSIS_RDRAM(target)) {
+                _analysis_add_xref(part, target, pc, word, ANALYSIS_HILO);
+            }
+        }
+
+        /* Any other write to a register ends its upper half */
+        if (R4300_OPCODE(word) == 0x0F) {
+            hi[R4300_RT(word)] = R4300_UIMM(word) << 16;
+            live[R4300_RT(word)] = n + 1;
+        }
+        else {
+            if (op->flags & R4300_WRT) {
+                live[R4300_RT(word)] = 0;
+            }
+            if (op->flags & R4300_WRD) {
+                live[R4300_RD(word)] = 0;
+            }
+        }
+        live[0] = 0;
+
+        /* Nothing survives past the delay slot of a j / jr */
+        if (flush) {
+            memset(live, 0, sizeof(live));
+            flush = false;
+        }
+        if (op->flags & R4300_END) {
+            flush = true;
+        }
+    }
+}
+
+/* Strings that start in the part; they may run into the lookahead */
+void _analysis_strings(ANALYSIS *a, ANALYSIS_PART *part) {
+    const uint8_t *data = a->data;
+    uint32_t limit = MIN(a->size, part->end + ANALYSIS_LOOKAHEAD);
+    uint32_t pos = part->start;
+    uint32_t len;
+
+    while (pos < part->end) {
+        if (!_ANALYSIS_PRINTABLE(data[pos]) || (pos && _ANALYSIS_PRINTABLE(data[pos - 1]))) {
+            pos++;
+            continue;
+        }
+
+        for (len = 1; ((pos + len) < limit) && (len <= ANALYSIS_MAX_STRING) &&
+            _ANALYSIS_PRINTABLE(data[pos + len]); len++);
+
+        if (((pos + len) < limit) && !data[pos + len] &&
+            (len >= ANALYSIS_MIN_STRING) && (len <= ANALYSIS_MAX_STRING)) {
+            _analysis_add_string(part, a->address + pos, len);
+        }
+        pos += len;
+    }
+}
+
+/* Order cross-references by target, then source */
+int _analysis_compare(const void *x, const void *y) {
+    const ANALYSIS_XREF *p = x;
+    const ANALYSIS_XREF *q = y;
+
+    if (p->target != q->target) {
+        return (p->target < q->target) ? -1 : 1;
+    }
+    if (p->from != q->from) {
+        return (p->from < q->from) ? -1 : 1;
+    }
+
+    return 0;
+}
+
+void *_analysis_worker(void *arg) {
+    ANALYSIS *a = arg;
+    ANALYSIS_PART *part;
+
+    for (;;) {
+        pthread_mutex_lock(&a->lock);
+        while ((a->next == a->ready) && (a->next < a->count) && !a->failed) {
+            pthread_cond_wait(&a->cond, &a->lock);
+        }
+        if ((a->next >= a->count) || a->failed) {
+            pthread_mutex_unlock(&a->lock);
+            break;
+        }
+        part = &a->parts[a->next++];
+        pthread_mutex_unlock(&a->lock);
+
+        _analysis_code(a, part);
+        _analysis_strings(a, part);
+        qsort(part->xrefs, part->xref_count, sizeof(ANALYSIS_XREF), _analysis_compare);
+    }
+
+    return NULL;
+}
+
+int _analysis_sink_write(GS_SINK *sink, const uint8_t *buf, size_t size) {
+    ANALYSIS *a = sink->context;
+
+    if (size > (size_t)(a->size - a->received)) {
+        return 1;
+    }
+    memcpy(&a->buf[a->received], buf, size);
+    analysis_feed(a, a->received + size);
+
+    return 0;
+}
+
+/* Restore the min-heap of parts (keyed by each part's next cross-reference) below `i` */
+void _analysis_heap_down(ANALYSIS *a, uint32_t *heap, uint32_t *cursor, uint32_t count, uint32_t i) {
+    uint32_t child;
+    uint32_t t;
+
+    for (;;) {
+        child = (i * 2) + 1;
+        if (child >= count) {
+            break;
+        }
+        if (((child + 1) < count) && (_analysis_compare(
+            &a->parts[heap[child + 1]].xrefs[cursor[heap[child + 1]]],
+            &a->parts[heap[child]].xrefs[cursor[heap[child]]]) < 0)) {
+            child++;
+        }
+        if (_analysis_compare(&a->parts[heap[child]].xrefs[cursor[heap[child]]],
+            &a->parts[heap[i]].xrefs[cursor[heap[i]]]) >= 0) {
+            break;
+        }
+        t = heap[i];
+        heap[i] = heap[child];
+        heap[child] = t;
+        i = child;
+    }
+}
+
+
+/* Public functions */
+
+/*
+ * Start analyzing `size` bytes based at `address`. With `data`, the whole
+ * image is present; with NULL, it is streamed in through analysis_sink() or
+ * by writing to `buf` and calling analysis_feed().
+ */
+int analysis_begin(ANALYSIS *a, const uint8_t *data, uint32_t address, uint32_t size) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t i;
+    int n;
+
+    memset(a, 0, sizeof(ANALYSIS));
+    if (!size) {
+        fprintf(stderr, "Nothing to analyze\n");
+        return 1;
+    }
+
+    if (!data) {
+        a->buf = alloc(size);
+        data = a->buf;
+    }
+    a->data = data;
+    a->address = address;
+    a->size = size;
+
+    a->count = (size + ANALYSIS_PART_SIZE - 1) / ANALYSIS_PART_SIZE;
+    a->parts = alloc(a->count * sizeof(ANALYSIS_PART));
+    memset(a->parts, 0, a->count * sizeof(ANALYSIS_PART));
+    for (i = 0; i < a->count; i++) {
+        a->parts[i].start = i * ANALYSIS_PART_SIZE;
+        a->parts[i].end = MIN(size, (i + 1) * ANALYSIS_PART_SIZE);
+    }
+
+    pthread_mutex_init(&a->lock, NULL);
+    pthread_cond_init(&a->cond, NULL);
+
+    a->thread_count = MAX(1, MIN(cpus, ANALYSIS_THREADS_MAX));
+    a->thread_count = MIN((uint32_t)a->thread_count, a->count);
+    a->threads = alloc(a->thread_count * sizeof(pthread_t));
+    for (n = 0; n < a->thread_count; n++) {
+        if (pthread_create(&a->threads[n], NULL, _analysis_worker, a)) {
+            fprintf(stderr, "Unable to start analysis threads\n");
+            a->thread_count = n;
+            analysis_end(a, false);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* `received` bytes of the image are now present; hand out the parts they complete */
+void analysis_feed(ANALYSIS *a, uint32_t received) {
+    uint32_t ready;
+
+    if (received >= a->size) {
+        ready = a->count;
+    }
+    else if (received > ANALYSIS_LOOKAHEAD) {
+        ready = (received - ANALYSIS_LOOKAHEAD) / ANALYSIS_PART_SIZE;
+    }
+    else {
+        ready = 0;
+    }
+
+    pthread_mutex_lock(&a->lock);
+    a->received = received;
+    if (ready > a->ready) {
+        a->ready = ready;
+        pthread_cond_broadcast(&a->cond);
+    }
+    pthread_mutex_unlock(&a->lock);
+}
+
+/* Stream the image in, e.g. from gs_read_rom_sink() */
+void analysis_sink(ANALYSIS *a, GS_SINK *sink) {
+    gs_sink_callback(sink, _analysis_sink_write, a);
+}
+
+/* Wait for the workers; without `complete`, the remaining parts are abandoned */
+int analysis_end(ANALYSIS *a, bool complete) {
+    int n;
+
+    pthread_mutex_lock(&a->lock);
+    if (!complete || (a->received < a->size)) {
+        a->failed = true;
+    }
+    pthread_cond_broadcast(&a->cond);
+    pthread_mutex_unlock(&a->lock);
+
+    for (n = 0; n < a->thread_count; n++) {
+        pthread_join(a->threads[n], NULL);
+    }
+    a->thread_count = 0;
+
+    return a->failed;
+}
+
+/* Write the index: the parts' sorted cross-references are merged as they are written */
+int analysis_save(ANALYSIS *a, const char *filename) {
+    FILE *fp;
+    char *tmp;
+    uint8_t header[ANALYSIS_HEADER_SIZE] = { 0 };
+    uint8_t buf[ANALYSIS_XREF_SIZE];
+    uint32_t *heap;
+    uint32_t *cursor;
+    uint32_t heap_count = 0;
+    uint32_t xrefs = 0;
+    uint32_t strings = 0;
+    uint32_t insns = 0;
+    uint32_t text = 0;
+    uint32_t i;
+    uint32_t j;
+    ANALYSIS_XREF *xref;
+    ANALYSIS_STRING *string;
+    ANALYSIS_PART *part;
+    int result;
+
+    if (a->failed) {
+        return 1;
+    }
+
+    heap = alloc((a->count + 1) * sizeof(uint32_t));
+    cursor = alloc((a->count + 1) * sizeof(uint32_t));
+    for (i = 0; i < a->count; i++) {
+        xrefs += a->parts[i].xref_count;
+        strings += a->parts[i].string_count;
+        insns += a->parts[i].insns;
+        for (j = 0; j < a->parts[i].string_count; j++) {
+            text += a->parts[i].strings[j].length + 1;
+        }
+        cursor[i] = 0;
+        if (a->parts[i].xref_count) {
+            heap[heap_count++] = i;
+        }
+    }
+
+    memcpy(header, ANALYSIS_MAGIC, 4);
+    put_le16(&header[4], ANALYSIS_VERSION);
+    put_le32(&header[8], a->address);
+    put_le32(&header[12], a->size);
+    put_le32(&header[16], insns);
+    put_le32(&header[20], xrefs);
+    put_le32(&header[24], strings);
+    put_le32(&header[28], text);
+    put_le64(&header[32], time(NULL));
+
+    tmp = alloc(strlen(filename) + 8);
+    sprintf(tmp, "%s.tmp", filename);
+    fp = fopen(tmp, "wb");
+    if (!fp) {
+        fprintf(stderr, "Unable to create `%s`\n", tmp);
+        free(tmp);
+        free(heap);
+        free(cursor);
+        return 1;
+    }
+    fwrite(header, sizeof(header), 1, fp);
+
+    /* K-way merge of the sorted parts */
+    for (i = heap_count; i--; ) {
+        _analysis_heap_down(a, heap, cursor, heap_count, i);
+    }
+    while (heap_count) {
+        part = &a->parts[heap[0]];
+        xref = &part->xrefs[cursor[heap[0]]++];
+
+        memset(buf, 0, sizeof(buf));
+        put_le32(&buf[0], xref->target);
+        put_le32(&buf[4], xref->from);
+        put_le32(&buf[8], xref->word);
+        buf[12] = xref->kind;
+        fwrite(buf, sizeof(buf), 1, fp);
+
+        if (cursor[heap[0]] == part->xref_count) {
+            heap[0] = heap[--heap_count];
+        }
+        _analysis_heap_down(a, heap, cursor, heap_count, 0);
+    }
+
+    /* Parts are in address order, and so are their strings */
+    text = 0;
+    for (i = 0; i < a->count; i++) {
+        for (j = 0; j < a->parts[i].string_count; j++) {
+            string = &a->parts[i].strings[j];
+            put_le32(&buf[0], string->address);
+            put_le32(&buf[4], text);
+            put_le32(&buf[8], string->length);
+            fwrite(buf, ANALYSIS_STRING_SIZE, 1, fp);
+            text += string->length + 1;
+        }
+    }
+    for (i = 0; i < a->count; i++) {
+        for (j = 0; j < a->parts[i].string_count; j++) {
+            string = &a->parts[i].strings[j];
+            fwrite(&a->data[string->address - a->address], string->length + 1, 1, fp);
+        }
+    }
+
+    fflush(fp);
+    fdatasync(fileno(fp));
+    result = ferror(fp);
+    result |= fclose(fp);
+    if (result || rename(tmp, filename)) {
+        fprintf(stderr, "Unable to write `%s`\n", filename);
+        unlink(tmp);
+        result = 1;
+    }
+
+    free(tmp);
+    free(heap);
+    free(cursor);
+
+    return result;
+}
+
+void analysis_free(ANALYSIS *a) {
+    uint32_t i;
+
+    if (a->thread_count) {
+        analysis_end(a, false);
+    }
+    for (i = 0; i < a->count; i++) {
+        free(a->parts[i].xrefs);
+        free(a->parts[i].strings);
+    }
+    free(a->parts);
+    free(a->threads);
+    free(a->buf);
+    if (a->count) {
+        pthread_mutex_destroy(&a->lock);
+        pthread_cond_destroy(&a->cond);
+    }
+    memset(a, 0, sizeof(ANALYSIS));
+}
+
+int analysis_open(ANALYSIS_INDEX *index, const char *filename) {
+    struct stat st;
+    uint64_t need;
+    int fd;
+
+    memset(index, 0, sizeof(ANALYSIS_INDEX));
+
+    fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Unable to open `%s` for reading\n", filename);
+        return 1;
+    }
+    if (fstat(fd, &st) || (st.st_size < ANALYSIS_HEADER_SIZE)) {
+        fprintf(stderr, "`%s` is not an analysis index\n", filename);
+        close(fd);
+        return 1;
+    }
+    index->map_size = st.st_size;
+    index->map = mmap(NULL, index->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (index->map == MAP_FAILED) {
+        index->map = NULL;
+        fprintf(stderr, "Unable to map `%s`\n", filename);
+        return 1;
+    }
+
+    index->address = get_le32(&index->map[8]);
+    index->size = get_le32(&index->map[12]);
+    index->insns = get_le32(&index->map[16]);
+    index->xref_count = get_le32(&index->map[20]);
+    index->string_count = get_le32(&index->map[24]);
+    index->text_size = get_le32(&index->map[28]);
+
+    need = ANALYSIS_HEADER_SIZE + ((uint64_t)index->xref_count * ANALYSIS_XREF_SIZE) +
+        ((uint64_t)index->string_count * ANALYSIS_STRING_SIZE) + index->text_size;
+    if (memcmp(index->map, ANALYSIS_MAGIC, 4) || (get_le16(&index->map[4]) != ANALYSIS_VERSION) ||
+        (need != index->map_size)) {
+        fprintf(stderr, "`%s` is not an analysis index\n", filename);
+        analysis_close(index);
+        return 1;
+    }
+
+    index->xrefs = &index->map[ANALYSIS_HEADER_SIZE];
+    index->strings = &index->xrefs[index->xref_count * ANALYSIS_XREF_SIZE];
+    index->text = (const char *)&index->strings[index->string_count * ANALYSIS_STRING_SIZE];
+
+    return 0;
+}
+
+void analysis_close(ANALYSIS_INDEX *index) {
+    if (index->map) {
+        munmap(index->map, index->map_size);
+    }
+    memset(index, 0, sizeof(ANALYSIS_INDEX));
+}
+
+void analysis_xref(ANALYSIS_INDEX *index, uint32_t i, ANALYSIS_XREF *xref) {
+    const uint8_t *p = &index->xrefs[i * ANALYSIS_XREF_SIZE];
+
+    xref->target = get_le32(&p[0]);
+    xref->from = get_le32(&p[4]);
+    xref->word = get_le32(&p[8]);
+    xref->kind = p[12];
+}
+
+/* Count the references to `target`; the first is at index `*first` */
+uint32_t analysis_refs(ANALYSIS_INDEX *index, uint32_t target, uint32_t *first) {
+    uint32_t lo = 0;
+    uint32_t hi = index->xref_count;
+    uint32_t mid;
+    uint32_t i;
+
+    while (lo < hi) {
+        mid = lo + ((hi - lo) / 2);
+        if (get_le32(&index->xrefs[mid * ANALYSIS_XREF_SIZE]) < target) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    *first = lo;
+
+    for (i = lo; (i < index->xref_count) && (get_le32(&index->xrefs[i * ANALYSIS_XREF_SIZE]) == target); i++);
+
+    return i - lo;
+}
+
+/* The string containing `address`, or NULL; `*start` is its address */
+const char *analysis_string(ANALYSIS_INDEX *index, uint32_t address, uint32_t *start) {
+    const uint8_t *p;
+    uint32_t lo = 0;
+    uint32_t hi = index->string_count;
+    uint32_t mid;
+
+    /* Last string starting at or before `address` */
+    while (lo < hi) {
+        mid = lo + ((hi - lo) / 2);
+        if (get_le32(&index->strings[mid * ANALYSIS_STRING_SIZE]) <= address) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    if (!lo) {
+        return NULL;
+    }
+
+    p = &index->strings[(lo - 1) * ANALYSIS_STRING_SIZE];
+    *start = get_le32(&p[0]);
+    if ((address - *start) > get_le32(&p[8])) {
+        return NULL;
+    }
+
+    return &index->text[get_le32(&p[4])];
+}
+
+/* The default index name for a dump; "repo:name" becomes "repo_name.idx" so -Q can take an address */
+char *analysis_path(const char *spec) {
+    char *path = alloc(strlen(spec) + 8);
+    char *p;
+
+    sprintf(path, "%s.idx", spec);
+    for (p = path; *p; p++) {
+        if (*p == ':') {
+            *p = '_';
+        }
+    }
+
+    return path;
+}
+
+/* Analyze a dump file or "repo:snapshot" based at `address`, writing the index to `filename` */
+int analysis_run(char *spec, uint32_t address, char *filename) {
+    CAPTURE capture;
+    ANALYSIS a;
+    char *path = filename;
+    uint64_t t;
+    int result;
+
+    if (capture_open(&capture, spec, address)) {
+        return 1;
+    }
+    if (!path) {
+        path = analysis_path(spec);
+    }
+
+    t = now_ns();
+    result = analysis_begin(&a, capture.data, capture.address, capture.size);
+    if (!result) {
+        printf("Analyzing 0x%08X - 0x%08X with %d threads...\n", a.address, a.address + a.size - 1,
+            a.thread_count);
+        analysis_feed(&a, a.size);
+        result = analysis_end(&a, true) || analysis_save(&a, path);
+    }
+    if (!result) {
+        printf("Wrote `%s` in %.2f s\n", path, (now_ns() - t) / 1e9);
+        result = analysis_summary(path);
+    }
+
+    analysis_free(&a);
+    capture_close(&capture);
+    if (path != filename) {
+        free(path);
+    }
+
+    return result;
+}
+
+/* Print the counts of an index */
+int analysis_summary(const char *filename) {
+    ANALYSIS_INDEX index;
+    uint32_t counts[6] = { 0 };
+    uint32_t i;
+
+    if (analysis_open(&index, filename)) {
+        return 1;
+    }
+
+    for (i = 0; i < index.xref_count; i++) {
+        counts[MIN(index.xrefs[(i * ANALYSIS_XREF_SIZE) + 12], 5)]++;
+    }
+    printf("0x%08X - 0x%08X: %u instructions, %u strings\n", index.address,
+        index.address + index.size - 1, index.insns, index.string_count);
+    printf("References: %u calls, %u jumps, %u branches, %u hi/lo pairs, %u pointers\n",
+        counts[ANALYSIS_CALL], counts[ANALYSIS_JUMP], counts[ANALYSIS_BRANCH],
+        counts[ANALYSIS_HILO], counts[ANALYSIS_POINTER]);
+
+    analysis_close(&index);
+
+    return 0;
+}
+
+/* Summarize an index, or with "index:address", list the references to an address */
+int analysis_query(char *spec) {
+    static const char *kinds[] = { "", "call", "jump", "branch", "hi/lo", "pointer" };
+    ANALYSIS_INDEX index;
+    ANALYSIS_XREF xref;
+    uint32_t target;
+    uint32_t first;
+    uint32_t count;
+    uint32_t start;
+    uint32_t i;
+    const char *text;
+    char *name = split_spec(spec);
+    char *err;
+    char insn[64];
+
+    if (!name) {
+        return analysis_summary(spec);
+    }
+
+    target = strtoul(name, &err, 0);
+    if (!*name || *err) {
+        fprintf(stderr, "Invalid address\n");
+        parse_error(name, (err - name));
+        return 1;
+    }
+    if (analysis_open(&index, spec)) {
+        return 1;
+    }
+
+    text = analysis_string(&index, target, &start);
+    if (text) {
+        printf("0x%08X is in string 0x%08X: \"%s\"\n", target, start, text);
+    }
+
+    count = analysis_refs(&index, target, &first);
+    printf("%u references to 0x%08X\n", count, target);
+    for (i = first; i < (first + count); i++) {
+        analysis_xref(&index, i, &xref);
+        if (xref.kind == ANALYSIS_POINTER) {
+            snprintf(insn, sizeof(insn), ".word   0x%08X", xref.word);
+        }
+        else {
+            r4300_disasm(xref.word, (xref.kind == ANALYSIS_BRANCH) ? xref.from : _analysis_code_pc(xref.from),
+                insn, sizeof(insn));
+        }
+        printf("  0x%08X  %-8s %s\n", xref.from, kinds[MIN(xref.kind, 5)], insn);
+    }
+
+    analysis_close(&index);
+
+    return 0;
+}
@@ -0,0 +1,132 @@
+
+#ifndef _ANALYSIS_H_
+#define _ANALYSIS_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gspro.h"
+
+
+/*
+ * Dump analysis: the image is split into parts that worker threads scan as
+ * soon as their data is present, so a dump can be analyzed while it is still
+ * being read. Each part yields:
+ *
+ *   - Cross-references: j / jal and branch targets, lui + addiu / ori / load /
+ *     store address pairs, and words that point into RDRAM.
+ *   - Strings: NUL-terminated runs of printable ASCII.
+ *
+ * The index file is mapped as-is for lookups. All integers are little-endian:
+ *
+ *   Header          ANALYSIS_HEADER_SIZE bytes
+ *   Cross-refs      ANALYSIS_XREF_SIZE bytes each, sorted by target then source:
+ *                   target, source, instruction word (u32), kind (u8), padding
+ *   Strings         ANALYSIS_STRING_SIZE bytes each, sorted by address:
+ *                   address, text offset, length (u32)
+ *   Text            The strings, each NUL-terminated
+ */
+#define ANALYSIS_MAGIC          "N64X"
+#define ANALYSIS_VERSION        1
+#define ANALYSIS_HEADER_SIZE    48
+#define ANALYSIS_XREF_SIZE      16
+#define ANALYSIS_STRING_SIZE    12
+
+#define ANALYSIS_PART_SIZE      0x40000 /* Bytes per work item */
+#define ANALYSIS_LOOKAHEAD      0x1000  /* Bytes past its part a worker may read */
+#define ANALYSIS_WARMUP         0x100   /* Bytes before its part a worker decodes for lui state */
+#define ANALYSIS_HILO_WINDOW    32      /* Instructions a lui stays usable */
+#define ANALYSIS_MIN_STRING     4
+#define ANALYSIS_MAX_STRING     0x400
+#define ANALYSIS_THREADS_MAX    32
+
+enum _analysis_kinds {
+    ANALYSIS_CALL       = 1,    /* jal */
+    ANALYSIS_JUMP       = 2,    /* j */
+    ANALYSIS_BRANCH     = 3,
+    ANALYSIS_HILO       = 4,    /* lui + addiu / ori / load / store */
+    ANALYSIS_POINTER    = 5     /* A data word */
+};
+
+struct _analysis_xref {
+    uint32_t        target;
+    uint32_t        from;
+    uint32_t        word;
+    uint8_t         kind;
+};
+typedef struct _analysis_xref ANALYSIS_XREF;
+
+struct _analysis_string {
+    uint32_t        address;
+    uint32_t        length;
+};
+typedef struct _analysis_string ANALYSIS_STRING;
+
+/* One work item and its results */
+struct _analysis_part {
+    uint32_t        start;      /* Offsets into the image */
+    uint32_t        end;
+    uint32_t        insns;      /* Non-zero words that decode as instructions */
+    ANALYSIS_XREF * xrefs;
+    uint32_t        xref_count;
+    uint32_t        xref_capacity;
+    ANALYSIS_STRING *strings;
+    uint32_t        string_count;
+    uint32_t        string_capacity;
+};
+typedef struct _analysis_part ANALYSIS_PART;
+
+struct _analysis {
+    const uint8_t * data;
+    uint8_t *       buf;        /* Owned image, when data is streamed in */
+    uint32_t        address;
+    uint32_t        size;
+    uint32_t        received;
+    ANALYSIS_PART * parts;
+    uint32_t        count;
+    uint32_t        next;       /* Next part to hand out */
+    uint32_t        ready;      /* Parts whose data (and lookahead) is present */
+    bool            failed;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    pthread_t *     threads;
+    int             thread_count;
+};
+typedef struct _analysis ANALYSIS;
+
+/* A mapped index file */
+struct _analysis_index {
+    uint8_t *       map;
+    size_t          map_size;
+    uint32_t        address;
+    uint32_t        size;
+    uint32_t        insns;
+    uint32_t        xref_count;
+    uint32_t        string_count;
+    const uint8_t * xrefs;
+    const uint8_t * strings;
+    const char *    text;
+    uint32_t        text_size;
+};
+typedef struct _analysis_index ANALYSIS_INDEX;
+
+
+/* Function declarations */
+int analysis_begin(ANALYSIS *a, const uint8_t *data, uint32_t address, uint32_t size);
+void analysis_feed(ANALYSIS *a, uint32_t received);
+void analysis_sink(ANALYSIS *a, GS_SINK *sink);
+int analysis_end(ANALYSIS *a, bool complete);
+int analysis_save(ANALYSIS *a, const char *filename);
+void analysis_free(ANALYSIS *a);
+int analysis_open(ANALYSIS_INDEX *index, const char *filename);
+void analysis_close(ANALYSIS_INDEX *index);
+void analysis_xref(ANALYSIS_INDEX *index, uint32_t i, ANALYSIS_XREF *xref);
+uint32_t analysis_refs(ANALYSIS_INDEX *index, uint32_t target, uint32_t *first);
+const char *analysis_string(ANALYSIS_INDEX *index, uint32_t address, uint32_t *start);
+char *analysis_path(const char *spec);
+int analysis_run(char *spec, uint32_t address, char *filename);
+int analysis_summary(const char *filename);
+int analysis_query(char *spec);
+
+#endif /* _ANALYSIS_H_ */
@@ -0,0 +1,510 @@
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(HAS_ZLIB_H)
+    #include <zlib.h>
+#endif /* defined(HAS_ZLIB_H) */
+
+#include "gspro.h"
+#include "stream.h"
+#include "n64rd.h"
+#include "archive.h"
+
+
+/* Private function declarations */
+int _archive_write_all(int fd, const uint8_t *buf, size_t size);
+void _archive_compress(ARCHIVE_FRAME *f);
+void *_archive_worker(void *arg);
+void _archive_hand(ARCHIVE *a, ARCHIVE_FRAME *f, uint32_t size);
+bool _archive_same(ARCHIVE *a, const uint8_t *entry, ARCHIVE_FRAME *f);
+int _archive_flush(ARCHIVE *a);
+int _archive_sink_write(GS_SINK *sink, const uint8_t *buf, size_t size);
+int _archive_frame(ARCHIVE_READER *r, uint32_t n);
+
+
+/* Private functions */
+
+int _archive_write_all(int fd, const uint8_t *buf, size_t size) {
+    ssize_t len;
+
+    while (size) {
+        len = write(fd, buf, size);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ERRORPRINT("write() failed: %s\n", strerror(errno));
+
+            return 1;
+        }
+        buf += len;
+        size -= len;
+    }
+
+    return 0;
+}
+
+/* Run on a worker thread; only touches the frame */
+void _archive_compress(ARCHIVE_FRAME *f) {
+    uint32_t i;
+    #if defined(HAS_ZLIB_H)
+        uLongf csize = compressBound(ARCHIVE_FRAME_SIZE);
+    #endif /* defined(HAS_ZLIB_H) */
+
+    f->hash = hash64(f->data, f->size, 0);
+    f->codec = ARCHIVE_CODEC_RAW;
+    f->csize = f->size;
+
+    for (i = 0; (i < f->size) && !f->data[i]; i++);
+    if (i == f->size) {
+        f->codec = ARCHIVE_CODEC_ZERO;
+        f->csize = 0;
+    }
+    #if defined(HAS_ZLIB_H)
+    else if ((compress2(f->cdata, &csize, f->data, f->size, Z_DEFAULT_COMPRESSION) == Z_OK) &&
+        (csize < f->size)) {
+        f->codec = ARCHIVE_CODEC_DEFLATE;
+        f->csize = csize;
+    }
+    #endif /* defined(HAS_ZLIB_H) */
+}
+
+void *_archive_worker(void *arg) {
+    ARCHIVE *a = arg;
+    ARCHIVE_FRAME *f;
+
+    for (;;) {
+        pthread_mutex_lock(&a->lock);
+        while ((a->next == a->filled) && !a->closing) {
+            pthread_cond_wait(&a->work, &a->lock);
+        }
+        if (a->next == a->filled) {
+            pthread_mutex_unlock(&a->lock);
+            break;
+        }
+        f = &a->slots[a->next++ % a->slot_count];
+        pthread_mutex_unlock(&a->lock);
+
+        _archive_compress(f);
+
+        pthread_mutex_lock(&a->lock);
+        f->done = true;
+        pthread_cond_broadcast(&a->done);
+        pthread_mutex_unlock(&a->lock);
+    }
+
+    return NULL;
+}
+
+/* A frame is full; queue it for compression */
+void _archive_hand(ARCHIVE *a, ARCHIVE_FRAME *f, uint32_t size) {
+    f->size = size;
+    f->done = false;
+
+    pthread_mutex_lock(&a->lock);
+    a->filled++;
+    pthread_cond_signal(&a->work);
+    pthread_mutex_unlock(&a->lock);
+}
+
+/* Read a written frame back, and check it holds exactly the data in `f` */
+bool _archive_same(ARCHIVE *a, const uint8_t *entry, ARCHIVE_FRAME *f) {
+    uint64_t offset = get_le64(&entry[0]);
+    uint32_t csize = get_le32(&entry[8]);
+    uint8_t *stored;
+    uint8_t *data = NULL;
+    bool same = false;
+    #if defined(HAS_ZLIB_H)
+        uLongf out = f->size;
+    #endif /* defined(HAS_ZLIB_H) */
+
+    if ((entry[12] != f->codec) || (csize != f->csize) || !(stored = malloc(csize))) {
+        return false;
+    }
+    if (pread(a->fd, stored, csize, offset) == csize) {
+        if (entry[12] == ARCHIVE_CODEC_RAW) {
+            same = !memcmp(stored, f->data, f->size);
+        }
+        #if defined(HAS_ZLIB_H)
+        else if ((entry[12] == ARCHIVE_CODEC_DEFLATE) && (data = malloc(f->size))) {
+            same = (uncompress(data, &out, stored, csize) == Z_OK) && (out == f->size) &&
+                !memcmp(data, f->data, f->size);
+        }
+        #endif /* defined(HAS_ZLIB_H) */
+    }
+    free(data);
+    free(stored);
+
+    return same;
+}
+
+/* Write out the oldest frame in flight, once it has been compressed */
+int _archive_flush(ARCHIVE *a) {
+    ARCHIVE_FRAME *f = &a->slots[a->written % a->slot_count];
+    uint8_t *entry = &a->index[a->written * ARCHIVE_ENTRY_SIZE];
+    uint32_t i;
+
+    pthread_mutex_lock(&a->lock);
+    while (!f->done) {
+        pthread_cond_wait(&a->done, &a->lock);
+    }
+    pthread_mutex_unlock(&a->lock);
+
+    a->hashes[a->written] = f->hash;
+    put_le64(&entry[0], a->offset);
+    put_le32(&entry[8], f->csize);
+    entry[12] = f->codec;
+
+    if (f->codec == ARCHIVE_CODEC_ZERO) {
+        put_le64(&entry[0], 0);
+        a->zero_frames++;
+        a->written++;
+        return 0;
+    }
+
+    /* A few thousand frames at most; a linear search will do. A hash is only a hint */
+    for (i = 0; i < a->written; i++) {
+        if ((a->hashes[i] == f->hash) && (a->index[(i * ARCHIVE_ENTRY_SIZE) + 12] != ARCHIVE_CODEC_ZERO) &&
+            _archive_same(a, &a->index[i * ARCHIVE_ENTRY_SIZE], f)) {
+            memcpy(entry, &a->index[i * ARCHIVE_ENTRY_SIZE], ARCHIVE_ENTRY_SIZE);
+            a->duplicate_frames++;
+            a->written++;
+            return 0;
+        }
+    }
+
+    if (_archive_write_all(a->fd, ((f->codec == ARCHIVE_CODEC_DEFLATE) ? f->cdata : f->data), f->csize)) {
+        return 1;
+    }
+    a->offset += f->csize;
+    a->written++;
+
+    return 0;
+}
+
+int _archive_sink_write(GS_SINK *sink, const uint8_t *buf, size_t size) {
+    return archive_write(sink->context, buf, size);
+}
+
+/* Decompress frame `n` into the reader's frame buffer, unless it is already there */
+int _archive_frame(ARCHIVE_READER *r, uint32_t n) {
+    const uint8_t *entry = &r->index[n * ARCHIVE_ENTRY_SIZE];
+    uint64_t offset = get_le64(&entry[0]);
+    uint32_t csize = get_le32(&entry[8]);
+    uint32_t len = MIN(r->frame_size, r->size - (n * r->frame_size));
+    int result = 1;
+    #if defined(HAS_ZLIB_H)
+        uLongf out = len;
+    #endif /* defined(HAS_ZLIB_H) */
+
+    if (r->cached == n) {
+        return 0;
+    }
+    r->cached = -1;
+
+    if ((entry[12] != ARCHIVE_CODEC_ZERO) &&
+        ((offset < ARCHIVE_HEADER_SIZE) || ((offset + csize) > (ARCHIVE_HEADER_SIZE + r->stored)))) {
+        fprintf(stderr, "Frame %u points outside the archive\n", n);
+        return 1;
+    }
+
+    switch (entry[12]) {
+        case ARCHIVE_CODEC_ZERO:
+            memset(r->frame, 0, len);
+            result = 0;
+            break;
+
+        case ARCHIVE_CODEC_RAW:
+            if (csize == len) {
+                memcpy(r->frame, &r->map[offset], len);
+                result = 0;
+            }
+            break;
+
+        #if defined(HAS_ZLIB_H)
+        case ARCHIVE_CODEC_DEFLATE:
+            result = (uncompress(r->frame, &out, &r->map[offset], csize) != Z_OK) || (out != len);
+            break;
+        #endif /* defined(HAS_ZLIB_H) */
+    }
+
+    if (result) {
+        fprintf(stderr, "Frame %u is corrupt\n", n);
+        return 1;
+    }
+    r->cached = n;
+
+    return 0;
+}
+
+
+/* Public functions */
+
+/* Start writing an archive of `size` bytes based at `address`, fed by archive_write() */
+int archive_begin(ARCHIVE *a, const char *filename, uint32_t address, uint32_t size) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint8_t header[ARCHIVE_HEADER_SIZE] = { 0 };
+    uint32_t i;
+    int n;
+
+    memset(a, 0, sizeof(ARCHIVE));
+    if (!size) {
+        fprintf(stderr, "Nothing to archive\n");
+        return 1;
+    }
+
+    a->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (a->fd == -1) {
+        fprintf(stderr, "Unable to open `%s` for writing\n", filename);
+        return 1;
+    }
+    /* Zeros until archive_end() fills it in */
+    if (_archive_write_all(a->fd, header, sizeof(header))) {
+        close(a->fd);
+        return 1;
+    }
+
+    a->address = address;
+    a->size = size;
+    a->count = (uint32_t)(((uint64_t)size + ARCHIVE_FRAME_SIZE - 1) / ARCHIVE_FRAME_SIZE);
+    a->offset = ARCHIVE_HEADER_SIZE;
+    a->index = alloc(a->count * ARCHIVE_ENTRY_SIZE);
+    memset(a->index, 0, a->count * ARCHIVE_ENTRY_SIZE);
+    a->hashes = alloc(a->count * sizeof(uint64_t));
+
+    a->thread_count = MAX(1, MIN(cpus, ARCHIVE_THREADS_MAX));
+    a->thread_count = MIN((uint32_t)a->thread_count, a->count);
+    a->slot_count = a->thread_count * ARCHIVE_QUEUE;
+    a->slots = alloc(a->slot_count * sizeof(ARCHIVE_FRAME));
+    memset(a->slots, 0, a->slot_count * sizeof(ARCHIVE_FRAME));
+    for (i = 0; i < a->slot_count; i++) {
+        a->slots[i].data = alloc(ARCHIVE_FRAME_SIZE);
+        #if defined(HAS_ZLIB_H)
+            a->slots[i].cdata = alloc(compressBound(ARCHIVE_FRAME_SIZE));
+        #endif /* defined(HAS_ZLIB_H) */
+    }
+
+    pthread_mutex_init(&a->lock, NULL);
+    pthread_cond_init(&a->work, NULL);
+    pthread_cond_init(&a->done, NULL);
+
+    a->threads = alloc(a->thread_count * sizeof(pthread_t));
+    for (n = 0; n < a->thread_count; n++) {
+        if (pthread_create(&a->threads[n], NULL, _archive_worker, a)) {
+            fprintf(stderr, "Unable to start compression threads\n");
+            a->thread_count = n;
+            archive_end(a, false);
+            unlink(filename);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Append the next `size` bytes of the image; full frames go to the workers */
+int archive_write(ARCHIVE *a, const uint8_t *buf, size_t size) {
+    ARCHIVE_FRAME *f;
+    uint32_t frame;
+    uint32_t offset;
+    uint32_t frame_size;
+    uint32_t len;
+
+    if (size > (size_t)(a->size - a->received)) {
+        return 1;
+    }
+
+    while (size) {
+        frame = a->received / ARCHIVE_FRAME_SIZE;
+        offset = a->received % ARCHIVE_FRAME_SIZE;
+        frame_size = MIN(ARCHIVE_FRAME_SIZE, a->size - (frame * ARCHIVE_FRAME_SIZE));
+
+        /* Wait for a free slot, writing out what the workers have finished */
+        while ((frame - a->written) >= a->slot_count) {
+            if (_archive_flush(a)) {
+                return 1;
+            }
+        }
+        f = &a->slots[frame % a->slot_count];
+
+        len = MIN(size, frame_size - offset);
+        memcpy(&f->data[offset], buf, len);
+        a->received += len;
+        buf += len;
+        size -= len;
+
+        if ((offset + len) == frame_size) {
+            _archive_hand(a, f, frame_size);
+        }
+    }
+
+    return 0;
+}
+
+/* Stream the image in, e.g. from gs_read_rom_sink() */
+void archive_sink(ARCHIVE *a, GS_SINK *sink) {
+    gs_sink_callback(sink, _archive_sink_write, a);
+}
+
+/*
+ * Stop the workers and, with `complete`, write the remaining frames, the index
+ * and the header. An archive that is not complete is left without a header.
+ */
+int archive_end(ARCHIVE *a, bool complete) {
+    uint8_t header[ARCHIVE_HEADER_SIZE] = { 0 };
+    uint32_t i;
+    int result = 0;
+    int n;
+
+    if (!complete || (a->received < a->size)) {
+        result = 1;
+    }
+    while (!result && (a->written < a->filled)) {
+        result = _archive_flush(a);
+    }
+
+    pthread_mutex_lock(&a->lock);
+    a->closing = true;
+    pthread_cond_broadcast(&a->work);
+    pthread_mutex_unlock(&a->lock);
+
+    for (n = 0; n < a->thread_count; n++) {
+        pthread_join(a->threads[n], NULL);
+    }
+
+    if (!result) {
+        memcpy(header, ARCHIVE_MAGIC, 4);
+        put_le16(&header[4], ARCHIVE_VERSION);
+        put_le32(&header[8], a->address);
+        put_le32(&header[12], a->size);
+        put_le32(&header[16], ARCHIVE_FRAME_SIZE);
+        put_le32(&header[20], a->count);
+        put_le64(&header[24], a->offset);
+
+        result = _archive_write_all(a->fd, a->index, a->count * ARCHIVE_ENTRY_SIZE);
+        if (!result && (pwrite(a->fd, header, sizeof(header), 0) != sizeof(header))) {
+            fprintf(stderr, "Unable to write the archive header: %s\n", strerror(errno));
+            result = 1;
+        }
+    }
+    result |= close(a->fd);
+
+    for (i = 0; i < a->slot_count; i++) {
+        free(a->slots[i].data);
+        free(a->slots[i].cdata);
+    }
+    free(a->slots);
+    free(a->threads);
+    free(a->hashes);
+    free(a->index);
+    pthread_mutex_destroy(&a->lock);
+    pthread_cond_destroy(&a->work);
+    pthread_cond_destroy(&a->done);
+    a->slots = NULL;
+    a->threads = NULL;
+    a->hashes = NULL;
+    a->index = NULL;
+    a->thread_count = 0;
+
+    return result;
+}
+
+int archive_open(ARCHIVE_READER *r, const char *filename) {
+    struct stat st;
+    uint64_t index;
+    int fd;
+
+    memset(r, 0, sizeof(ARCHIVE_READER));
+    r->cached = -1;
+
+    fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Unable to open `%s` for reading\n", filename);
+        return 1;
+    }
+    if (fstat(fd, &st) || (st.st_size < ARCHIVE_HEADER_SIZE)) {
+        fprintf(stderr, "`%s` is not an archive\n", filename);
+        close(fd);
+        return 1;
+    }
+    r->map_size = st.st_size;
+    r->map = mmap(NULL, r->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (r->map == MAP_FAILED) {
+        r->map = NULL;
+        fprintf(stderr, "Unable to map `%s`\n", filename);
+        return 1;
+    }
+
+    if (memcmp(r->map, ARCHIVE_MAGIC, 4) || (get_le16(&r->map[4]) != ARCHIVE_VERSION)) {
+        fprintf(stderr, "`%s` is not an archive, or was cut short\n", filename);
+        archive_close(r);
+        return 1;
+    }
+    r->address = get_le32(&r->map[8]);
+    r->size = get_le32(&r->map[12]);
+    r->frame_size = get_le32(&r->map[16]);
+    r->count = get_le32(&r->map[20]);
+    index = get_le64(&r->map[24]);
+
+    if (!r->frame_size || !r->size ||
+        (r->count != (((uint64_t)r->size + r->frame_size - 1) / r->frame_size)) ||
+        (index < ARCHIVE_HEADER_SIZE) || ((index + ((uint64_t)r->count * ARCHIVE_ENTRY_SIZE)) > r->map_size)) {
+        fprintf(stderr, "`%s` is corrupt\n", filename);
+        archive_close(r);
+        return 1;
+    }
+    r->index = &r->map[index];
+    r->stored = index - ARCHIVE_HEADER_SIZE;
+    r->frame = alloc(r->frame_size);
+
+    return 0;
+}
+
+/* Read `size` bytes at `address`, decompressing only the frames they cover */
+int archive_read(ARCHIVE_READER *r, uint32_t address, uint8_t *buf, uint32_t size) {
+    uint32_t offset = address - r->address;
+    uint32_t n;
+    uint32_t start;
+    uint32_t len;
+
+    if ((address < r->address) || (((uint64_t)offset + size) > r->size)) {
+        fprintf(stderr, "0x%08X - 0x%08X is not in the archive\n", address, address + size - 1);
+        return 1;
+    }
+
+    while (size) {
+        n = offset / r->frame_size;
+        start = offset % r->frame_size;
+        len = MIN(size, r->frame_size - start);
+        if (_archive_frame(r, n)) {
+            return 1;
+        }
+        memcpy(buf, &r->frame[start], len);
+
+        buf += len;
+        offset += len;
+        size -= len;
+    }
+
+    return 0;
+}
+
+void archive_close(ARCHIVE_READER *r) {
+    if (r->map) {
+        munmap(r->map, r->map_size);
+    }
+    free(r->frame);
+    memset(r, 0, sizeof(ARCHIVE_READER));
+    r->cached = -1;
+}
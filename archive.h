@@ -0,0 +1,111 @@
+
+#ifndef _ARCHIVE_H_
+#define _ARCHIVE_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gspro.h"
+
+
+/*
+ * Seekable compressed dumps: the image is cut into frames of ARCHIVE_FRAME_SIZE
+ * bytes, and worker threads compress each one on its own while the dump is
+ * still being read. Reading any span back decompresses only the frames it covers.
+ *
+ * Archive file (little-endian):
+ *
+ *   Header   ARCHIVE_HEADER_SIZE bytes: "N64Z", version (u16), reserved (u16),
+ *            address (u32), image size (u32), frame size (u32), frame count
+ *            (u32), index offset (u64).
+ *   Frames   Back to back, in address order. All-zero frames take no space,
+ *            a frame identical to an earlier one points at it (as the mirrors
+ *            in an oversized ROM dump do; a hash match is read back and
+ *            compared before it is trusted), and frames that do not shrink are
+ *            stored raw.
+ *   Index    ARCHIVE_ENTRY_SIZE bytes per frame: offset (u64), stored size
+ *            (u32), codec (u8), then reserved bytes.
+ *
+ * The header is written last, so a dump that was cut short has no index and
+ * is refused.
+ */
+#define ARCHIVE_MAGIC       "N64Z"
+#define ARCHIVE_VERSION     1
+#define ARCHIVE_HEADER_SIZE 32
+#define ARCHIVE_ENTRY_SIZE  16
+#define ARCHIVE_FRAME_SIZE  0x10000
+#define ARCHIVE_THREADS_MAX 16
+#define ARCHIVE_QUEUE       4       /* Frames in flight per worker */
+
+/* Frame codecs */
+enum _archive_codecs {
+    ARCHIVE_CODEC_RAW       = 0,
+    ARCHIVE_CODEC_ZERO      = 1,    /* All-zero frame; no data */
+    ARCHIVE_CODEC_DEFLATE   = 2
+};
+
+/* A frame being filled, compressed or written */
+struct _archive_frame {
+    uint8_t *       data;
+    uint32_t        size;
+    uint8_t *       cdata;
+    uint32_t        csize;
+    uint8_t         codec;
+    uint64_t        hash;
+    bool            done;       /* Compressed; ready to be written */
+};
+typedef struct _archive_frame ARCHIVE_FRAME;
+
+/* An archive being written */
+struct _archive {
+    int             fd;
+    uint32_t        address;
+    uint32_t        size;
+    uint32_t        count;      /* Frames in the image */
+    uint8_t *       index;
+    uint64_t *      hashes;     /* Of the frames written, for finding duplicate candidates */
+    ARCHIVE_FRAME * slots;      /* Frame n is in slots[n % slot_count] */
+    uint32_t        slot_count;
+    uint32_t        received;
+    uint32_t        filled;     /* Frames handed to the workers */
+    uint32_t        next;       /* Next frame a worker takes */
+    uint32_t        written;
+    uint64_t        offset;     /* End of the frames in the file */
+    uint32_t        zero_frames;
+    uint32_t        duplicate_frames;
+    bool            closing;
+    pthread_mutex_t lock;
+    pthread_cond_t  work;
+    pthread_cond_t  done;
+    pthread_t *     threads;
+    int             thread_count;
+};
+typedef struct _archive ARCHIVE;
+
+/* An archive mapped for reading */
+struct _archive_reader {
+    uint8_t *       map;
+    size_t          map_size;
+    uint32_t        address;
+    uint32_t        size;
+    uint32_t        frame_size;
+    uint32_t        count;
+    const uint8_t * index;
+    uint64_t        stored;     /* Bytes of frame data in the file */
+    uint8_t *       frame;      /* The last frame decompressed */
+    int64_t         cached;     /* Its number; -1 for none */
+};
+typedef struct _archive_reader ARCHIVE_READER;
+
+
+/* Function declarations */
+int archive_begin(ARCHIVE *a, const char *filename, uint32_t address, uint32_t size);
+int archive_write(ARCHIVE *a, const uint8_t *buf, size_t size);
+void archive_sink(ARCHIVE *a, GS_SINK *sink);
+int archive_end(ARCHIVE *a, bool complete);
+int archive_open(ARCHIVE_READER *r, const char *filename);
+int archive_read(ARCHIVE_READER *r, uint32_t address, uint8_t *buf, uint32_t size);
+void archive_close(ARCHIVE_READER *r);
+
+#endif /* _ARCHIVE_H_ */
@@ -0,0 +1,824 @@
+/*
+    bench - n64rd performance benchmarks
+
+    Runs host-side code paths against simulated or recorded sessions, so they
+    can be measured on machines without a parallel port.
+*/
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "except.h"
+#include "gspro.h"
+#include "stream.h"
+#include "n64rd.h"
+#include "gssim.h"
+#include "record.h"
+#include "bridge.h"
+#include "memmap.h"
+#include "lazy.h"
+
+
+/* Benchmark options (from command line arguments) */
+struct _bench_options {
+    char *      recording;
+    char *      bridge;
+    uint32_t    address;
+    uint32_t    length;
+    uint32_t    iterations;
+    bool        csv;
+};
+typedef struct _bench_options BENCH_OPTIONS;
+
+/* How bench_link() reads */
+enum _bench_link_modes {
+    BENCH_LINK_STOCK,
+    BENCH_LINK_FAST,        /* Through a fast transfer stub */
+    BENCH_LINK_STEPPED      /* Through a resumable transfer, a few nybbles per step */
+};
+
+
+void bench_usage(void);
+int bench_record(char *filename, uint32_t address, uint32_t size, bool rom);
+int bench_replay(BENCH_OPTIONS *options, char *recording, bool rom);
+int bench_link(BENCH_OPTIONS *options, int mode);
+int bench_lazy(BENCH_OPTIONS *options);
+int bench_bridge(BENCH_OPTIONS *options, char *name);
+int bench_exch(BENCH_OPTIONS *options, int width);
+int bench_upgrade(BENCH_OPTIONS *options);
+int bench_hex_dump(BENCH_OPTIONS *options);
+void bench_report(const char *name, STATS *cpu, STATS *wall, uint64_t bytes, double ops);
+uint8_t bench_in(uint16_t port);
+void bench_out(uint8_t data, uint16_t port);
+uint8_t bench_bridge_in(uint16_t port);
+void bench_bridge_out(uint8_t data, uint16_t port);
+uint8_t bench_loop_in(uint16_t port);
+void bench_loop_out(uint8_t data, uint16_t port);
+
+/* Engine internals (gspro.c) */
+uint8_t _gs_exch_8(uint8_t out);
+uint32_t _gs_exch_32(uint32_t out);
+void _gs_upgrade(GS_SOURCE *source);
+
+
+/* Simulator behind the counting port callbacks */
+static GS_SIM *_bench_sim = NULL;
+static uint64_t _bench_port_ops = 0;
+
+/* Bridge callbacks behind the counting ones */
+static uint8_t (*_bench_bridge_in)(uint16_t) = NULL;
+static void (*_bench_bridge_out)(uint8_t, uint16_t) = NULL;
+static uint64_t _bench_strobes = 0;
+static bool _bench_strobe = false;
+
+/* Loopback port: echoes each nybble, with the handshake bits the engine expects */
+static uint8_t _bench_loop_nybble = 0;
+static bool _bench_loop_ready = false;
+
+static bool _bench_csv = false;
+
+
+int main(int argc, char **argv) {
+    BENCH_OPTIONS options;
+    char tmp[] = "/tmp/n64rd-bench-XXXXXX";
+    char tmp_read[] = "/tmp/n64rd-bench-XXXXXX";
+    char *err = 0;
+    int result;
+    int fd;
+    int c;
+
+    memset(&options, 0, sizeof(options));
+    options.address = 0x80000000;
+    options.length = 0x00400000;
+    options.iterations = 5;
+
+    while ((c = getopt(argc, argv, "hr:a:l:n:mb:")) != -1) {
+        switch (c) {
+            case 'h':
+                bench_usage();
+                return 0;
+
+            case 'r':
+                options.recording = optarg;
+                break;
+
+            case 'a':
+                options.address = strtoll(optarg, &err, 0);
+                if (err[0]) {
+                    fprintf(stderr, "Invalid address\n");
+                    return 1;
+                }
+                break;
+
+            case 'l':
+                options.length = strtoll(optarg, &err, 0);
+                if (err[0]) {
+                    fprintf(stderr, "Invalid length\n");
+                    return 1;
+                }
+                break;
+
+            case 'n':
+                options.iterations = strtoul(optarg, &err, 0);
+                if (err[0] || !options.iterations) {
+                    fprintf(stderr, "Invalid iteration count\n");
+                    return 1;
+                }
+                break;
+
+            case 'm':
+                options.csv = true;
+                break;
+
+            case 'b':
+                options.bridge = optarg;
+                break;
+
+            default:
+                bench_usage();
+                return 1;
+        }
+    }
+
+    _bench_csv = options.csv;
+    if (_bench_csv) {
+        printf("name,bytes,runs,cpu_ns_per_byte,cpu_stddev,cpu_min,wall_ns_per_byte,wall_stddev,port_ops_per_byte\n");
+    }
+
+    /* Without a real recording, record simulated -d and -r sessions */
+    if (!options.recording) {
+        fd = mkstemp(tmp);
+        if (fd != -1) {
+            close(fd);
+            fd = mkstemp(tmp_read);
+        }
+        if (fd == -1) {
+            fprintf(stderr, "Unable to create a temporary recording\n");
+            unlink(tmp);
+            return 1;
+        }
+        close(fd);
+        if (bench_record(tmp, options.address, options.length, true) ||
+            bench_record(tmp_read, options.address, options.length, false)) {
+            unlink(tmp);
+            unlink(tmp_read);
+            return 1;
+        }
+        options.recording = tmp;
+    }
+
+    /* The engine's loops, without a simulator behind them */
+    result = bench_exch(&options, 8);
+    result |= bench_exch(&options, 32);
+    result |= bench_replay(&options, options.recording, true);
+    if (options.recording == tmp) {
+        result |= bench_replay(&options, tmp_read, false);
+        unlink(tmp);
+        unlink(tmp_read);
+    }
+    result |= bench_upgrade(&options);
+    result |= bench_hex_dump(&options);
+
+    result |= bench_link(&options, BENCH_LINK_STOCK);
+    result |= bench_link(&options, BENCH_LINK_FAST);
+    result |= bench_link(&options, BENCH_LINK_STEPPED);
+    result |= bench_lazy(&options);
+    result |= bench_bridge(&options, options.bridge);
+
+    return result;
+}
+
+void bench_usage(void) {
+    printf("Usage: bench [options]\n");
+    printf("Options:\n");
+    printf("  -h            Print usage and quit.\n");
+    printf("  -r <file>     Replay a recorded -d session (default: record one\n");
+    printf("                against the simulator first).\n");
+    printf("  -a <address>  Address of the recorded -d session (default 0x80000000).\n");
+    printf("  -l <length>   Length of the recorded -d session (default 0x00400000).\n");
+    printf("  -n <count>    Iterations (default 5).\n");
+    printf("  -m            Machine-readable (CSV) output.\n");
+    printf("  -b <name>     Read through a running gsserve bridge (default: fork one\n");
+    printf("                on the simulator).\n");
+}
+
+/* Record a READ_ROM (or with !rom, a READ) session against the simulator */
+int bench_record(char *filename, uint32_t address, uint32_t size, bool rom) {
+    GS_CONFIG config;
+    GS_SIM sim;
+    GS_RANGE range[2] = { { address, size }, { 0, 0 } };
+    uint8_t *data = alloc(size);
+    uint32_t i;
+    int result = 0;
+
+    gs_sim_init(&sim, 0x00800000);
+    for (i = 0; i < sim.ram_size; i++) {
+        sim.ram[i] = (i * 2654435761U) >> 24;
+    }
+
+    memset(&config, 0, sizeof(config));
+    gs_sim_attach(&sim, &config);
+    if (record_open(filename, &config) || gs_init(&config)) {
+        gs_sim_free(&sim);
+        free(data);
+        return 1;
+    }
+
+    if (gs_enter() || (rom ? gs_read_rom(data, range, NULL) : (gs_read(data, range, NULL) || gs_exit()))) {
+        fprintf(stderr, "%s\n", "Simulated session failed");
+        result = 1;
+    }
+
+    gs_quit();
+    result |= record_close();
+    gs_sim_free(&sim);
+    free(data);
+
+    return result;
+}
+
+/*
+ * Replay a -d (or with !rom, a -r) session at full speed and time the host
+ * side: the checksum and unpack loops of gs_read_rom() or gs_read()
+ */
+int bench_replay(BENCH_OPTIONS *options, char *recording, bool rom) {
+    GS_CONFIG config;
+    REPLAY_STATS replay;
+    STATS cpu = { 0 };
+    STATS wall = { 0 };
+    GS_RANGE range[2];
+    uint8_t *data = alloc(options->length + 4);
+    uint64_t t_cpu;
+    uint64_t t_wall;
+    uint32_t i;
+    int result = 0;
+
+    memset(&config, 0, sizeof(config));
+    if (replay_open(recording, false, &config) || gs_init(&config)) {
+        free(data);
+        return 1;
+    }
+
+    for (i = 0; i < options->iterations; i++) {
+        replay_rewind();
+        range[0].address = options->address;
+        range[0].size = options->length;
+        range[1].address = 0;
+        range[1].size = 0;
+
+        t_cpu = cpu_ns();
+        t_wall = now_ns();
+        if (gs_enter() || (rom ? gs_read_rom(data, range, NULL) : (gs_read(data, range, NULL) || gs_exit()))) {
+            fprintf(stderr, "%s\n", "Replay failed");
+            result = 1;
+            break;
+        }
+        stats_add(&cpu, cpu_ns() - t_cpu);
+        stats_add(&wall, now_ns() - t_wall);
+    }
+
+    gs_quit();
+    if (replay_close(&replay)) {
+        fprintf(stderr, "Host diverged from the recording in %llu of %llu exchanges\n",
+            (unsigned long long)replay.mismatches, (unsigned long long)replay.played);
+        result = 1;
+    }
+
+    if (!result) {
+        bench_report(rom ? "replay_read_rom" : "replay_read", &cpu, &wall, options->length, -1);
+    }
+    free(data);
+
+    return result;
+}
+
+/*
+ * Read through the simulator, counting port accesses; on hardware each one
+ * costs about a microsecond.
+ */
+int bench_link(BENCH_OPTIONS *options, int mode) {
+    static const char *names[] = { "link_read_stock", "link_read_fast", "link_read_stepped" };
+    GS_CONFIG config;
+    GS_TRANSFER transfer;
+    GS_SIM sim;
+    STATS cpu = { 0 };
+    STATS wall = { 0 };
+    GS_RANGE range[2] = { { 0x80000000, options->length }, { 0, 0 } };
+    uint8_t image[GS_FAST_HDR_ENTRY + 4] = { 'G', 'S', 'F', 'S' };
+    uint8_t *data = alloc(options->length);
+    uint64_t t_cpu;
+    uint64_t t_wall;
+    uint64_t ops = 0;
+    uint32_t i;
+    int result = 0;
+
+    /* Every other page empty, as in a typical RDRAM image */
+    gs_sim_init(&sim, 0x00800000);
+    for (i = 0; i < sim.ram_size; i++) {
+        sim.ram[i] = (i & 0x1000) ? 0 : ((i * 2654435761U) >> 24);
+    }
+    _bench_sim = &sim;
+
+    memset(&config, 0, sizeof(config));
+    config.in_callback = bench_in;
+    config.out_callback = bench_out;
+    config.virtual_port = true;
+    if (gs_init(&config)) {
+        gs_sim_free(&sim);
+        free(data);
+        return 1;
+    }
+
+    /* A header-only stub at the top of RDRAM; the simulator supplies the behaviour */
+    put_be32(&image[GS_FAST_HDR_LOAD], 0x807FF000);
+    put_be32(&image[GS_FAST_HDR_HOOK], sim.hook);
+    if (gs_enter() || ((mode == BENCH_LINK_FAST) && gs_fast_start(image, sizeof(image)))) {
+        fprintf(stderr, "%s\n", "Simulated session failed");
+        result = 1;
+    }
+
+    for (i = 0; !result && (i < options->iterations); i++) {
+        _bench_port_ops = 0;
+        t_cpu = cpu_ns();
+        t_wall = now_ns();
+        if (mode == BENCH_LINK_STEPPED) {
+            if (gs_transfer_begin(&transfer, NULL, GS_CMD_READ, data, range,
+                GS_TRANSFER_ENTER | GS_TRANSFER_EXIT)) {
+                result = 1;
+                break;
+            }
+            while (gs_transfer_step(&transfer, 64) == GS_TRANSFER_RUNNING);
+            result = gs_transfer_end(&transfer);
+        }
+        else if (gs_enter() || gs_read(data, range, NULL) || gs_exit()) {
+            result = 1;
+        }
+        if (result) {
+            fprintf(stderr, "%s\n", "Simulated session failed");
+            break;
+        }
+        stats_add(&cpu, cpu_ns() - t_cpu);
+        stats_add(&wall, now_ns() - t_wall);
+        ops = _bench_port_ops;
+
+        if (memcmp(data, sim.ram, options->length)) {
+            fprintf(stderr, "%s\n", "Simulated read returned the wrong data");
+            result = 1;
+        }
+    }
+
+    gs_quit();
+    gs_sim_free(&sim);
+    free(data);
+
+    if (!result) {
+        bench_report(names[mode], &cpu, &wall, options->length, (double)ops / options->length);
+    }
+
+    return result;
+}
+
+/*
+ * Look up one word in every BENCH_LAZY_STRIDE pages of a lazy view on the
+ * simulator, as a pointer walk would; only the pages touched are read. Then
+ * check that refreshed and invalidated pages see the simulator's new contents.
+ */
+#define BENCH_LAZY_STRIDE 16
+int bench_lazy(BENCH_OPTIONS *options) {
+    GS_CONFIG config;
+    GS_SIM sim;
+    MEMMAP map;
+    LAZY lazy;
+    STATS cpu = { 0 };
+    STATS wall = { 0 };
+    uint64_t t_cpu;
+    uint64_t t_wall;
+    uint64_t ops = 0;
+    uint32_t page = sysconf(_SC_PAGESIZE);
+    uint32_t touched = 0;
+    uint32_t sum;
+    uint32_t i;
+    uint32_t j;
+    int result = 0;
+
+    gs_sim_init(&sim, 0x00800000);
+    for (i = 0; i < sim.ram_size; i++) {
+        sim.ram[i] = (i & 0x1000) ? 0 : ((i * 2654435761U) >> 24);
+    }
+    _bench_sim = &sim;
+
+    memset(&config, 0, sizeof(config));
+    config.in_callback = bench_in;
+    config.out_callback = bench_out;
+    config.virtual_port = true;
+    if (gs_init(&config)) {
+        gs_sim_free(&sim);
+        return 1;
+    }
+    memmap_init(&map, sim.ram_size);
+
+    for (i = 0; !result && (i < options->iterations); i++) {
+        _bench_port_ops = 0;
+        t_cpu = cpu_ns();
+        t_wall = now_ns();
+        if (lazy_open(&lazy, &map, 0x80000000, options->length, true)) {
+            result = 1;
+            break;
+        }
+        sum = 0;
+        for (j = 0, touched = 0; j < options->length; j += page * BENCH_LAZY_STRIDE, touched++) {
+            sum += get_be32(&lazy.data[j]);
+        }
+        result = lazy_check(&lazy, 0x80000000, options->length);
+        stats_add(&cpu, cpu_ns() - t_cpu);
+        stats_add(&wall, now_ns() - t_wall);
+        ops = _bench_port_ops;
+
+        for (j = 0; !result && (j < options->length); j += page * BENCH_LAZY_STRIDE) {
+            sum -= get_be32(&sim.ram[j]);
+        }
+        if (!result && sum) {
+            fprintf(stderr, "%s\n", "Lazy view returned the wrong data");
+            result = 1;
+        }
+        lazy_close(&lazy);
+    }
+
+    /* Touched pages keep what was read until refreshed or invalidated */
+    if (!result && !lazy_open(&lazy, &map, 0x80000000, page * 2, true)) {
+        sum = lazy.data[0] + lazy.data[page];
+        sim.ram[0] ^= 0xFF;
+        sim.ram[page] ^= 0xFF;
+        if ((lazy.data[0] + lazy.data[page]) != sum) {
+            result = 1;
+        }
+        result |= lazy_refresh(&lazy, 0x80000000, 1);
+        result |= (lazy.data[0] != sim.ram[0]);
+        result |= lazy_invalidate(&lazy, 0x80000000 + page, 1);
+        result |= (lazy.data[page] != sim.ram[page]);
+        result |= lazy_check(&lazy, 0x80000000, page * 2);
+        if (result) {
+            fprintf(stderr, "%s\n", "Lazy view did not see the new contents");
+        }
+        lazy_close(&lazy);
+    }
+    else {
+        result = 1;
+    }
+
+    memmap_free(&map);
+    gs_quit();
+    gs_sim_free(&sim);
+
+    if (!result) {
+        bench_report("lazy_view", &cpu, &wall, (uint64_t)touched * page, (double)ops / ((uint64_t)touched * page));
+    }
+
+    return result;
+}
+
+/*
+ * Read through a shared-memory bridge, served by a child process on the
+ * simulator; or with `name`, by a running gsserve, whose memory is not checked.
+ */
+int bench_bridge(BENCH_OPTIONS *options, char *name) {
+    GS_CONFIG config;
+    GS_CONFIG device;
+    BRIDGE_STATS served;
+    GS_SIM sim;
+    STATS cpu = { 0 };
+    STATS wall = { 0 };
+    GS_RANGE range[2] = { { options->address, options->length }, { 0, 0 } };
+    uint8_t *data = alloc(options->length);
+    uint32_t phys = options->address & 0x1FFFFFFF;
+    char own[32];
+    uint64_t t_cpu;
+    uint64_t t_wall;
+    uint64_t ops = 0;
+    uint64_t strobes = 0;
+    pid_t server = -1;
+    uint32_t i;
+    int result = 0;
+
+    if (!name) {
+        gs_sim_init(&sim, 0x00800000);
+        for (i = 0; i < sim.ram_size; i++) {
+            sim.ram[i] = (i & 0x1000) ? 0 : ((i * 2654435761U) >> 24);
+        }
+
+        snprintf(own, sizeof(own), "n64rd-bench-%d", (int)getpid());
+        name = own;
+        if (bridge_listen(name)) {
+            gs_sim_free(&sim);
+            free(data);
+            return 1;
+        }
+        fflush(stdout);
+        server = fork();
+        if (!server) {
+            memset(&device, 0, sizeof(device));
+            gs_sim_attach(&sim, &device);
+            _exit(bridge_serve(&device, &served));
+        }
+        if (server == -1) {
+            fprintf(stderr, "%s\n", "Unable to start a bridge server");
+            bridge_unlisten();
+            gs_sim_free(&sim);
+            free(data);
+            return 1;
+        }
+    }
+
+    memset(&config, 0, sizeof(config));
+    if (!bridge_open(name, &config)) {
+        _bench_bridge_in = config.in_callback;
+        _bench_bridge_out = config.out_callback;
+        config.in_callback = bench_bridge_in;
+        config.out_callback = bench_bridge_out;
+        result = gs_init(&config);
+    }
+    else {
+        result = 1;
+    }
+
+    for (i = 0; !result && (i < options->iterations); i++) {
+        _bench_port_ops = 0;
+        _bench_strobes = 0;
+        t_cpu = cpu_ns();
+        t_wall = now_ns();
+        if (gs_enter() || gs_read(data, range, NULL) || gs_exit()) {
+            fprintf(stderr, "%s\n", "Bridged session failed");
+            result = 1;
+            break;
+        }
+        stats_add(&cpu, cpu_ns() - t_cpu);
+        stats_add(&wall, now_ns() - t_wall);
+        ops = _bench_port_ops;
+        strobes = _bench_strobes;
+
+        if ((server != -1) && ((phys + options->length) <= sim.ram_size) &&
+            memcmp(data, &sim.ram[phys], options->length)) {
+            fprintf(stderr, "%s\n", "Bridged read returned the wrong data");
+            result = 1;
+        }
+    }
+
+    gs_quit();
+    bridge_close();
+    if (server != -1) {
+        kill(server, SIGTERM);
+        waitpid(server, NULL, 0);
+        bridge_unlisten();
+        gs_sim_free(&sim);
+    }
+    free(data);
+
+    if (!result) {
+        bench_report("bridge_read", &cpu, &wall, options->length, (double)ops / options->length);
+        if (!_bench_csv && strobes) {
+            printf("%-24s %8.2f ns per nybble exchange (wall)\n", "", wall.mean / strobes);
+        }
+    }
+
+    return result;
+}
+
+/* _gs_exch_8() or _gs_exch_32() against the loopback port, after one warm-up run */
+int bench_exch(BENCH_OPTIONS *options, int width) {
+    GS_CONFIG config;
+    STATS cpu = { 0 };
+    STATS wall = { 0 };
+    uint64_t t_cpu;
+    uint64_t t_wall;
+    uint32_t count = options->length / (width / 8);
+    uint32_t check = 0;
+    uint32_t i;
+    uint32_t j;
+    int result = 0;
+
+    memset(&config, 0, sizeof(config));
+    config.in_callback = bench_loop_in;
+    config.out_callback = bench_loop_out;
+    config.virtual_port = true;
+    if (gs_init(&config)) {
+        return 1;
+    }
+
+    _try {
+        for (i = 0; i <= options->iterations; i++) {
+            t_cpu = cpu_ns();
+            t_wall = now_ns();
+            if (width == 8) {
+                for (j = 0; j < count; j++) {
+                    check += _gs_exch_8(j) ^ (uint8_t)j;
+                }
+            }
+            else {
+                for (j = 0; j < count; j++) {
+                    check += _gs_exch_32(j * 2654435761U) ^ (j * 2654435761U);
+                }
+            }
+            if (i) {
+                stats_add(&cpu, cpu_ns() - t_cpu);
+                stats_add(&wall, now_ns() - t_wall);
+            }
+        }
+    }
+    _catch (e) {
+        fprintf(stderr, "%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
+        result = 1;
+    }
+
+    gs_quit();
+
+    if (!result && check) {
+        fprintf(stderr, "%s\n", "Loopback returned the wrong data");
+        result = 1;
+    }
+    if (!result) {
+        bench_report((width == 8) ? "exch_8" : "exch_32", &cpu, &wall, count * (width / 8), -1);
+    }
+
+    return result;
+}
+
+/* The data phase of gs_upgrade() and its 12-bit sum, without the flashing delay */
+int bench_upgrade(BENCH_OPTIONS *options) {
+    GS_CONFIG config;
+    GS_SOURCE source;
+    GS_SIM sim;
+    STATS cpu = { 0 };
+    STATS wall = { 0 };
+    uint8_t *image = alloc(sizeof(sim.gs_rom));
+    uint64_t t_cpu;
+    uint64_t t_wall;
+    uint32_t i;
+    int result = 0;
+
+    for (i = 0; i < sizeof(sim.gs_rom); i++) {
+        image[i] = (i * 2654435761U) >> 24;
+    }
+
+    gs_sim_init(&sim, 0x00400000);
+    memset(&config, 0, sizeof(config));
+    gs_sim_attach(&sim, &config);
+    if (gs_init(&config)) {
+        gs_sim_free(&sim);
+        free(image);
+        return 1;
+    }
+
+    _try {
+        for (i = 0; i <= options->iterations; i++) {
+            gs_source_memory(&source, image, sizeof(sim.gs_rom));
+
+            t_cpu = cpu_ns();
+            t_wall = now_ns();
+            _gs_upgrade(&source);
+            if (i) {
+                stats_add(&cpu, cpu_ns() - t_cpu);
+                stats_add(&wall, now_ns() - t_wall);
+            }
+
+            /* Checksum valid, ROM verified */
+            if ((_gs_exch_8(0) != 1) || (_gs_exch_8(0) != 1)) {
+                fprintf(stderr, "%s\n", "Simulated upgrade failed");
+                result = 1;
+                break;
+            }
+        }
+    }
+    _catch (e) {
+        fprintf(stderr, "%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
+        result = 1;
+    }
+
+    gs_quit();
+    if (!result && memcmp(sim.gs_rom, image, sizeof(sim.gs_rom))) {
+        fprintf(stderr, "%s\n", "Simulated upgrade stored the wrong data");
+        result = 1;
+    }
+    gs_sim_free(&sim);
+    free(image);
+
+    if (!result) {
+        bench_report("upgrade", &cpu, &wall, sizeof(sim.gs_rom), -1);
+    }
+
+    return result;
+}
+
+/* Format up to 1MB with hex_dump(), with stdout sent to /dev/null */
+int bench_hex_dump(BENCH_OPTIONS *options) {
+    STATS cpu = { 0 };
+    STATS wall = { 0 };
+    uint32_t size = MIN(options->length, 0x00100000);
+    uint8_t *data = alloc(size);
+    uint64_t t_cpu;
+    uint64_t t_wall;
+    uint32_t i;
+    int saved;
+    int fd;
+
+    for (i = 0; i < size; i++) {
+        data[i] = (i * 2654435761U) >> 24;
+    }
+
+    fflush(stdout);
+    saved = dup(STDOUT_FILENO);
+    fd = open("/dev/null", O_WRONLY);
+    if ((saved == -1) || (fd == -1)) {
+        fprintf(stderr, "%s\n", "Unable to redirect stdout");
+        free(data);
+        return 1;
+    }
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+
+    for (i = 0; i <= options->iterations; i++) {
+        t_cpu = cpu_ns();
+        t_wall = now_ns();
+        hex_dump(data, 0x80000000, size);
+        fflush(stdout);
+        if (i) {
+            stats_add(&cpu, cpu_ns() - t_cpu);
+            stats_add(&wall, now_ns() - t_wall);
+        }
+    }
+
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    free(data);
+
+    bench_report("hex_dump", &cpu, &wall, size, -1);
+
+    return 0;
+}
+
+uint8_t bench_in(uint16_t port) {
+    _bench_port_ops++;
+
+    return gs_sim_in(_bench_sim);
+}
+
+void bench_out(uint8_t data, uint16_t port) {
+    _bench_port_ops++;
+    gs_sim_out(_bench_sim, data);
+}
+
+uint8_t bench_bridge_in(uint16_t port) {
+    _bench_port_ops++;
+
+    return _bench_bridge_in(port);
+}
+
+/* Counts rising strobes: one per nybble exchanged */
+void bench_bridge_out(uint8_t data, uint16_t port) {
+    _bench_port_ops++;
+    if ((data & 0x10) && !_bench_strobe) {
+        _bench_strobes++;
+    }
+    _bench_strobe = (data & 0x10);
+    _bench_bridge_out(data, port);
+}
+
+uint8_t bench_loop_in(uint16_t port) {
+    return _bench_loop_ready ? ((((_bench_loop_nybble ^ 0x08) << 4) | 0x08)) : 0;
+}
+
+void bench_loop_out(uint8_t data, uint16_t port) {
+    _bench_loop_ready = !!(data & 0x10);
+    _bench_loop_nybble = data & 0x0F;
+}
+
+/* `ops` is the port accesses per byte, or negative when not counted */
+void bench_report(const char *name, STATS *cpu, STATS *wall, uint64_t bytes, double ops) {
+    if (_bench_csv) {
+        printf("%s,%llu,%llu,%.4f,%.4f,%.4f,%.4f,%.4f,", name,
+            (unsigned long long)bytes, (unsigned long long)cpu->count,
+            cpu->mean / bytes, stats_stddev(cpu) / bytes, cpu->min / bytes,
+            wall->mean / bytes, stats_stddev(wall) / bytes);
+        if (ops >= 0) {
+            printf("%.2f", ops);
+        }
+        printf("\n");
+        return;
+    }
+
+    printf("%-24s %8.2f ns/byte cpu (+/- %.2f, min %.2f)  %8.2f ns/byte wall  [%llu bytes x %llu]\n",
+        name,
+        cpu->mean / bytes, stats_stddev(cpu) / bytes, cpu->min / bytes,
+        wall->mean / bytes,
+        (unsigned long long)bytes, (unsigned long long)cpu->count);
+    if (ops >= 0) {
+        printf("%-24s %8.2f port ops/byte\n", "", ops);
+    }
+}
@@ -0,0 +1,372 @@
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gspro.h"
+#include "n64rd.h"
+#include "bridge.h"
+
+
+/* Busy-wait hint; lets the sibling hyperthread run */
+#if defined(__x86_64__) || defined(__i386__)
+#define BRIDGE_RELAX()  __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define BRIDGE_RELAX()  __asm__ __volatile__("yield")
+#else
+#define BRIDGE_RELAX()  do { } while (0)
+#endif
+
+#define BRIDGE_LOAD(_p)         __atomic_load_n((_p), __ATOMIC_ACQUIRE)
+#define BRIDGE_STORE(_p, _v)    __atomic_store_n((_p), (_v), __ATOMIC_RELEASE)
+
+/* The shared mailbox; each counter has a single writer */
+struct _bridge_mailbox {
+    char        magic[4];
+    uint16_t    version;
+    uint16_t    reserved;
+    uint32_t    server;
+    uint32_t    client;
+
+    uint32_t    head __attribute__((aligned(64)));  /* Client */
+    uint64_t    reply __attribute__((aligned(64))); /* Server */
+    uint8_t     ring[BRIDGE_RING] __attribute__((aligned(64)));
+};
+typedef struct _bridge_mailbox BRIDGE_MAILBOX;
+
+/* Client state */
+struct _bridge {
+    BRIDGE_MAILBOX *    box;
+    uint32_t            head;   /* Local copy; only the client writes it */
+    uint8_t             status; /* Last status published */
+    bool                lost;
+};
+
+
+/* Server state */
+struct _bridge_server {
+    BRIDGE_MAILBOX *    box;
+    char *              path;
+};
+
+
+/* Private variables */
+static struct _bridge _bridge = { 0 };
+static struct _bridge_server _bridge_server = { 0 };
+static volatile sig_atomic_t _bridge_stop = 0;
+static uint32_t _bridge_spin_limit = 0;
+
+
+/* Private function declarations */
+void _bridge_signal(int sig);
+bool _bridge_alive(uint32_t pid);
+void _bridge_pause(uint32_t spins);
+char *_bridge_path(const char *name);
+bool _bridge_wait(uint32_t seq);
+uint8_t _bridge_in(uint16_t port);
+void _bridge_out(uint8_t data, uint16_t port);
+
+
+/* Private functions */
+
+void _bridge_signal(int sig) {
+    _bridge_stop = 1;
+}
+
+bool _bridge_alive(uint32_t pid) {
+    return (pid && (!kill(pid, 0) || (errno != ESRCH)));
+}
+
+/*
+ * Wait a moment for the other side. With one CPU, the other side cannot run
+ * while this one spins, so give it the CPU straight away.
+ */
+void _bridge_pause(uint32_t spins) {
+    if (!_bridge_spin_limit) {
+        _bridge_spin_limit = ((sysconf(_SC_NPROCESSORS_ONLN) > 1) ? 0x400 : 1);
+    }
+    if (spins < _bridge_spin_limit) {
+        BRIDGE_RELAX();
+    }
+    else {
+        sched_yield();
+    }
+}
+
+/* shm_open() names start with a slash */
+char *_bridge_path(const char *name) {
+    char *p = alloc(strlen(name) + 2);
+
+    sprintf(p, "/%s", name);
+
+    return p;
+}
+
+/* Spin until the server has applied `seq` writes; false if it stopped answering */
+bool _bridge_wait(uint32_t seq) {
+    uint64_t reply;
+    uint64_t deadline = 0;
+    uint32_t spins = 0;
+
+    while (((reply = BRIDGE_LOAD(&_bridge.box->reply)) >> 32) != seq) {
+        _bridge_pause(spins);
+
+        /* Only look at the clock once in a while */
+        if (!(++spins & 0x3FFF)) {
+            if (!deadline) {
+                deadline = now_ns() + BRIDGE_TIMEOUT_NS;
+            }
+            else if (now_ns() > deadline) {
+                if (!_bridge.lost) {
+                    fprintf(stderr, "%s\n", "Bridge server is not responding");
+                    _bridge.lost = true;
+                }
+                return false;
+            }
+        }
+    }
+    _bridge.status = reply;
+    _bridge.lost = false;
+
+    return true;
+}
+
+uint8_t _bridge_in(uint16_t port) {
+    /* A silent server leaves the status as it was; the protocol's timeouts take over */
+    _bridge_wait(_bridge.head);
+
+    return _bridge.status;
+}
+
+void _bridge_out(uint8_t data, uint16_t port) {
+    /* A full ring waits for the server to drain it */
+    if ((uint32_t)(_bridge.head - (BRIDGE_LOAD(&_bridge.box->reply) >> 32)) >= BRIDGE_RING) {
+        if (!_bridge_wait(_bridge.head)) {
+            return;
+        }
+    }
+
+    _bridge.box->ring[_bridge.head % BRIDGE_RING] = data;
+    _bridge.head++;
+    BRIDGE_STORE(&_bridge.box->head, _bridge.head);
+}
+
+
+/* Public functions */
+
+/* Replace the port with the bridge server listening on `name` */
+int bridge_open(const char *name, GS_CONFIG *config) {
+    struct stat st;
+    char *path = _bridge_path(name);
+    uint32_t client;
+    void *map;
+    int fd;
+
+    fd = shm_open(path, O_RDWR, 0);
+    free(path);
+    if ((fd == -1) || fstat(fd, &st) || (st.st_size < sizeof(BRIDGE_MAILBOX))) {
+        fprintf(stderr, "No bridge server on `%s`\n", name);
+        if (fd != -1) close(fd);
+        return 1;
+    }
+    map = mmap(NULL, sizeof(BRIDGE_MAILBOX), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Unable to map `%s`: %s\n", name, strerror(errno));
+        return 1;
+    }
+
+    memset(&_bridge, 0, sizeof(_bridge));
+    _bridge.box = map;
+    if (memcmp(_bridge.box->magic, BRIDGE_MAGIC, 4) || (_bridge.box->version != BRIDGE_VERSION) ||
+        !_bridge_alive(BRIDGE_LOAD(&_bridge.box->server))) {
+        fprintf(stderr, "No bridge server on `%s`\n", name);
+        bridge_close();
+        return 1;
+    }
+
+    /* One client at a time; a client that died without detaching is replaced */
+    client = BRIDGE_LOAD(&_bridge.box->client);
+    if ((client && _bridge_alive(client)) ||
+        !__atomic_compare_exchange_n(&_bridge.box->client, &client, (uint32_t)getpid(),
+            false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        fprintf(stderr, "Bridge `%s` is in use by process %u\n", name, client);
+        bridge_close();
+        return 1;
+    }
+
+    /* Carry on from where the last client left off */
+    _bridge.head = BRIDGE_LOAD(&_bridge.box->head);
+    if (!_bridge_wait(_bridge.head)) {
+        BRIDGE_STORE(&_bridge.box->client, 0);
+        bridge_close();
+        return 1;
+    }
+
+    config->in_callback = _bridge_in;
+    config->out_callback = _bridge_out;
+    config->virtual_port = true;
+
+    return 0;
+}
+
+/* Detach from the server */
+void bridge_close(void) {
+    if (!_bridge.box) {
+        return;
+    }
+    if (BRIDGE_LOAD(&_bridge.box->client) == (uint32_t)getpid()) {
+        BRIDGE_STORE(&_bridge.box->client, 0);
+    }
+    munmap(_bridge.box, sizeof(BRIDGE_MAILBOX));
+    _bridge.box = NULL;
+}
+
+/* Create the mailbox `name`, for bridge_serve() to answer (perhaps in a child process) */
+int bridge_listen(const char *name) {
+    BRIDGE_MAILBOX *box;
+    struct stat st;
+    char *path = _bridge_path(name);
+    void *map;
+    int fd;
+
+    /* Leftovers from a server that is gone are replaced */
+    fd = shm_open(path, O_RDWR, 0);
+    if (fd != -1) {
+        map = MAP_FAILED;
+        if (!fstat(fd, &st) && (st.st_size >= sizeof(BRIDGE_MAILBOX))) {
+            map = mmap(NULL, sizeof(BRIDGE_MAILBOX), PROT_READ, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (map != MAP_FAILED) {
+            box = map;
+            if (!memcmp(box->magic, BRIDGE_MAGIC, 4) && _bridge_alive(BRIDGE_LOAD(&box->server))) {
+                fprintf(stderr, "Bridge `%s` is already served by process %u\n", name, box->server);
+                munmap(map, sizeof(BRIDGE_MAILBOX));
+                free(path);
+                return 1;
+            }
+            munmap(map, sizeof(BRIDGE_MAILBOX));
+        }
+        shm_unlink(path);
+    }
+
+    fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if ((fd == -1) || ftruncate(fd, sizeof(BRIDGE_MAILBOX))) {
+        fprintf(stderr, "Unable to create bridge `%s`: %s\n", name, strerror(errno));
+        if (fd != -1) {
+            close(fd);
+            shm_unlink(path);
+        }
+        free(path);
+        return 1;
+    }
+    map = mmap(NULL, sizeof(BRIDGE_MAILBOX), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Unable to map `%s`: %s\n", name, strerror(errno));
+        shm_unlink(path);
+        free(path);
+        return 1;
+    }
+
+    box = map;
+    memcpy(box->magic, BRIDGE_MAGIC, 4);
+    box->version = BRIDGE_VERSION;
+    BRIDGE_STORE(&box->server, (uint32_t)getpid());
+
+    _bridge_server.box = box;
+    _bridge_server.path = path;
+
+    return 0;
+}
+
+/* Unmap and remove the mailbox */
+void bridge_unlisten(void) {
+    if (!_bridge_server.box) {
+        return;
+    }
+    if (BRIDGE_LOAD(&_bridge_server.box->server) == (uint32_t)getpid()) {
+        BRIDGE_STORE(&_bridge_server.box->server, 0);
+    }
+    munmap(_bridge_server.box, sizeof(BRIDGE_MAILBOX));
+    shm_unlink(_bridge_server.path);
+    free(_bridge_server.path);
+    _bridge_server.box = NULL;
+    _bridge_server.path = NULL;
+}
+
+/*
+ * Feed everything posted to the mailbox through the port callbacks of `device`
+ * (typically a simulator) until interrupted, then remove the mailbox.
+ */
+int bridge_serve(GS_CONFIG *device, BRIDGE_STATS *stats) {
+    BRIDGE_MAILBOX *box = _bridge_server.box;
+    uint64_t idle = 0;
+    uint32_t client = 0;
+    uint32_t tail;
+    uint32_t head;
+    uint32_t spins = 0;
+
+    if (!box) {
+        return 1;
+    }
+    memset(stats, 0, sizeof(BRIDGE_STATS));
+
+    tail = BRIDGE_LOAD(&box->reply) >> 32;
+    BRIDGE_STORE(&box->reply, ((uint64_t)tail << 32) | device->in_callback(device->port + 1));
+    BRIDGE_STORE(&box->server, (uint32_t)getpid());
+
+    _bridge_stop = 0;
+    signal(SIGINT, _bridge_signal);
+    signal(SIGTERM, _bridge_signal);
+
+    while (!_bridge_stop) {
+        head = BRIDGE_LOAD(&box->head);
+        if (head == tail) {
+            _bridge_pause(spins);
+
+            /* Back off when nobody is talking; the next exchange wakes it */
+            if (!(++spins & 0x3FFF)) {
+                if (!idle) {
+                    idle = now_ns() + BRIDGE_IDLE_NS;
+                }
+                else if (now_ns() > idle) {
+                    usleep(50);
+                }
+            }
+            continue;
+        }
+        spins = 0;
+        idle = 0;
+        stats->writes += head - tail;
+
+        while (tail != head) {
+            device->out_callback(box->ring[tail % BRIDGE_RING], device->port);
+            tail++;
+        }
+        BRIDGE_STORE(&box->reply, ((uint64_t)tail << 32) | device->in_callback(device->port + 1));
+
+        stats->batches++;
+        if (BRIDGE_LOAD(&box->client) != client) {
+            client = BRIDGE_LOAD(&box->client);
+            stats->sessions += !!client;
+        }
+    }
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+
+    bridge_unlisten();
+
+    return 0;
+}
@@ -0,0 +1,49 @@
+
+#ifndef _BRIDGE_H_
+#define _BRIDGE_H_
+
+#include <stdint.h>
+
+#include "gspro.h"
+
+
+/*
+ * Shared-memory bridge: the port callbacks of a GS_CONFIG, carried to a server
+ * process (gsserve) through a mailbox in POSIX shared memory, /dev/shm/<name>.
+ *
+ *   Header:  "N64B", version (u16), reserved (u16), server pid (u32), client
+ *            pid (u32, 0 for none), then on cache lines of their own:
+ *              head    data register writes posted by the client (u32)
+ *              reply   (writes applied by the server << 32) | status (u64)
+ *   Ring:    BRIDGE_RING data register writes, indexed by count % BRIDGE_RING.
+ *
+ * The mailbox is lock-free, with one writer per counter. Data register writes
+ * are posted without waiting for the server. A status read waits until the
+ * server has applied every write posted before it, and returns the status the
+ * server published with them, so the client sees exactly what a port would.
+ * Both sides spin rather than sleep, which keeps a nybble exchange well under
+ * a microsecond; an idle server backs off after BRIDGE_IDLE_NS.
+ */
+#define BRIDGE_MAGIC        "N64B"
+#define BRIDGE_VERSION      1
+#define BRIDGE_RING         0x1000
+#define BRIDGE_IDLE_NS      100000000ULL
+#define BRIDGE_TIMEOUT_NS   1000000000ULL  /* Client gives up on a silent server */
+
+/* Server counters */
+struct _bridge_stats {
+    uint64_t    writes;
+    uint64_t    batches;    /* Times the server woke to new writes */
+    uint64_t    sessions;
+};
+typedef struct _bridge_stats BRIDGE_STATS;
+
+
+/* Function declarations */
+int bridge_open(const char *name, GS_CONFIG *config);
+void bridge_close(void);
+int bridge_listen(const char *name);
+void bridge_unlisten(void);
+int bridge_serve(GS_CONFIG *device, BRIDGE_STATS *stats);
+
+#endif /* _BRIDGE_H_ */
@@ -0,0 +1,303 @@
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gspro.h"
+#include "stream.h"
+#include "n64rd.h"
+#include "codes.h"
+
+
+/* Private function declarations */
+void _codes_append(CODE_LIST *list, const void *data, uint32_t size);
+int _codes_name(char *p, const char *filename, int lineno);
+int _codes_sink_write(GS_SINK *sink, const uint8_t *buf, size_t size);
+
+
+/* Private functions */
+
+/* Grow the list; `data` is always allocated GS_CODES_MAX bytes */
+void _codes_append(CODE_LIST *list, const void *data, uint32_t size) {
+    memcpy(&list->data[list->size], data, size);
+    list->size += size;
+}
+
+/* Trim a name in place; returns its length, or -1 if it is empty or too long */
+int _codes_name(char *p, const char *filename, int lineno) {
+    int len = strlen(p);
+
+    while (len && isspace(p[len - 1])) {
+        p[--len] = '\0';
+    }
+    if (!len || (len > GS_CODES_NAME)) {
+        fprintf(stderr, "%s:%d: names must be 1 to %d characters\n", filename, lineno, GS_CODES_NAME);
+        return -1;
+    }
+
+    return len;
+}
+
+int _codes_sink_write(GS_SINK *sink, const uint8_t *buf, size_t size) {
+    CODE_LIST *list = sink->context;
+
+    if (size > (size_t)(GS_CODES_MAX - list->size)) {
+        return 1;
+    }
+    _codes_append(list, buf, size);
+
+    return 0;
+}
+
+
+/* Public functions */
+
+void codes_init(CODE_LIST *list) {
+    memset(list, 0, sizeof(CODE_LIST));
+    list->data = alloc(GS_CODES_MAX);
+}
+
+void codes_free(CODE_LIST *list) {
+    free(list->data);
+    free(list->games);
+    memset(list, 0, sizeof(CODE_LIST));
+}
+
+/* Find the game records in `data`; fails if the list is malformed */
+int codes_index(CODE_LIST *list) {
+    uint32_t pos;
+    uint32_t len;
+    uint32_t count = 0;
+
+    for (pos = 0; pos < list->size; pos += len) {
+        len = gs_codes_game_size(&list->data[pos], list->size - pos);
+        if (!len) {
+            fprintf(stderr, "Malformed code list at 0x%04X\n", pos);
+            return 1;
+        }
+        count++;
+    }
+
+    free(list->games);
+    list->games = alloc((count + 1) * sizeof(CODE_GAME));
+    list->count = count;
+
+    for (pos = 0, count = 0; count < list->count; pos += len, count++) {
+        len = gs_codes_game_size(&list->data[pos], list->size - pos);
+        list->games[count].name = (const char *)&list->data[pos];
+        list->games[count].offset = pos;
+        list->games[count].size = len;
+    }
+
+    return 0;
+}
+
+/* Parse a code list file into wire format */
+int codes_load(CODE_LIST *list, const char *filename) {
+    FILE *fp;
+    char *line = NULL;
+    size_t line_size = 0;
+    char *p;
+    char *err;
+    uint8_t buf[6];
+    uint32_t game = 0;      /* Offset of the current game's cheat count */
+    uint32_t cheat = 0;     /* Offset of the current cheat's code count */
+    uint32_t address;
+    uint32_t value;
+    uint32_t i;
+    int lineno = 0;
+    int len;
+
+    codes_init(list);
+
+    fp = fopen(filename, "r");
+    if (!fp) {
+        fprintf(stderr, "Unable to open `%s` for reading\n", filename);
+        return 1;
+    }
+
+    while (getline(&line, &line_size, fp) != -1) {
+        lineno++;
+        p = line;
+        while (isspace(*p)) p++;
+        if (!*p || (*p == '#')) {
+            continue;
+        }
+
+        /* Leave room for the longest entry */
+        if ((list->size + GS_CODES_NAME + 3) > GS_CODES_MAX) {
+            fprintf(stderr, "%s:%d: code list exceeds %u bytes\n", filename, lineno, GS_CODES_MAX);
+            goto fail;
+        }
+
+        if (*p == '"') {
+            p++;
+            if ((err = strchr(p, '"'))) {
+                *err = '\0';
+            }
+            if ((len = _codes_name(p, filename, lineno)) < 0) {
+                goto fail;
+            }
+            _codes_append(list, p, len + 1);
+            game = list->size;
+            cheat = 0;
+            _codes_append(list, "", 1);
+        }
+        else if ((*p == '.') || (*p == '+')) {
+            if (!game) {
+                fprintf(stderr, "%s:%d: cheat outside a game\n", filename, lineno);
+                goto fail;
+            }
+            if (list->data[game] == 0xFF) {
+                fprintf(stderr, "%s:%d: too many cheats\n", filename, lineno);
+                goto fail;
+            }
+            buf[0] = (*p == '+') ? GS_CODES_ACTIVE : 0;
+            buf[1] = 0;
+            p++;
+            if ((len = _codes_name(p, filename, lineno)) < 0) {
+                goto fail;
+            }
+            _codes_append(list, p, len + 1);
+            _codes_append(list, buf, 2);
+            cheat = list->size - 1;
+            list->data[game]++;
+        }
+        else {
+            value = 0;
+            address = strtoul(p, &err, 16);
+            if ((err != p) && isspace(*err)) {
+                p = err;
+                value = strtoul(p, &err, 16);
+            }
+            if ((err == p) || (value > 0xFFFF) || (*err && !isspace(*err))) {
+                fprintf(stderr, "%s:%d: expected `<address> <value>`\n", filename, lineno);
+                goto fail;
+            }
+            if (!cheat) {
+                fprintf(stderr, "%s:%d: code outside a cheat\n", filename, lineno);
+                goto fail;
+            }
+            if (list->data[cheat] == 0xFF) {
+                fprintf(stderr, "%s:%d: too many codes\n", filename, lineno);
+                goto fail;
+            }
+            put_be32(&buf[0], address);
+            put_be16(&buf[4], value);
+            _codes_append(list, buf, 6);
+            list->data[cheat]++;
+        }
+    }
+
+    free(line);
+    fclose(fp);
+
+    /* ADD_CODE replaces games by name, so names must be unique */
+    if (codes_index(list)) {
+        codes_free(list);
+        return 1;
+    }
+    for (i = 0; i < list->count; i++) {
+        if (codes_find(list, list->games[i].name) != &list->games[i]) {
+            fprintf(stderr, "%s: game `%s` is listed twice\n", filename, list->games[i].name);
+            codes_free(list);
+            return 1;
+        }
+    }
+
+    return 0;
+
+fail:
+    free(line);
+    fclose(fp);
+    codes_free(list);
+
+    return 1;
+}
+
+/* Write a code list file; NULL writes to stdout */
+int codes_save(CODE_LIST *list, const char *filename) {
+    FILE *fp = stdout;
+    const uint8_t *p;
+    uint32_t i;
+    int cheats;
+    int codes;
+    int result;
+
+    if (filename) {
+        fp = fopen(filename, "w");
+        if (!fp) {
+            fprintf(stderr, "Unable to open `%s` for writing\n", filename);
+            return 1;
+        }
+    }
+
+    fprintf(fp, "# n64rd code list: %u games\n", list->count);
+    for (i = 0; i < list->count; i++) {
+        p = &list->data[list->games[i].offset];
+        fprintf(fp, "\n\"%s\"\n", (const char *)p);
+        p += strlen((const char *)p) + 1;
+
+        for (cheats = *p++; cheats; cheats--) {
+            fprintf(fp, "%c%s\n", (p[strlen((const char *)p) + 1] & GS_CODES_ACTIVE) ? '+' : '.', (const char *)p);
+            p += strlen((const char *)p) + 2;
+
+            for (codes = *p++; codes; codes--, p += 6) {
+                fprintf(fp, "%08X %04X\n", get_be32(&p[0]), get_be16(&p[4]));
+            }
+        }
+    }
+
+    if (!filename) {
+        return 0;
+    }
+    result = ferror(fp);
+    result |= fclose(fp);
+
+    return result;
+}
+
+CODE_GAME *codes_find(CODE_LIST *list, const char *name) {
+    uint32_t i;
+
+    for (i = 0; i < list->count; i++) {
+        if (!strcmp(list->games[i].name, name)) {
+            return &list->games[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Collect the games in `list` that `unit` lacks or holds differently into the
+ * empty list `changes`, ready for gs_add_codes(); returns how many there are
+ */
+uint32_t codes_diff(CODE_LIST *list, CODE_LIST *unit, CODE_LIST *changes) {
+    CODE_GAME *game;
+    CODE_GAME *old;
+    uint32_t i;
+
+    for (i = 0; i < list->count; i++) {
+        game = &list->games[i];
+        old = codes_find(unit, game->name);
+        if (old && (old->size == game->size) &&
+            !memcmp(&unit->data[old->offset], &list->data[game->offset], game->size)) {
+            continue;
+        }
+
+        printf("  %c %s\n", old ? '*' : '+', game->name);
+        _codes_append(changes, &list->data[game->offset], game->size);
+    }
+    codes_index(changes);
+
+    return changes->count;
+}
+
+/* Collect gs_get_codes() or gs_read_codes() output; call codes_index() afterwards */
+void codes_sink(CODE_LIST *list, GS_SINK *sink) {
+    gs_sink_callback(sink, _codes_sink_write, list);
+}
@@ -0,0 +1,49 @@
+
+#ifndef _CODES_H_
+#define _CODES_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gspro.h"
+
+
+/*
+ * A code list, held in the GS wire format (see GS_CODES_CHUNK) and indexed by
+ * game, so it can be sent as-is and compared game by game.
+ *
+ * Code list files are text:
+ *
+ *   # comment
+ *   "Game name"
+ *   .Cheat name        Cheat, off by default
+ *   +Cheat name        Cheat, on by default
+ *   8033B21D 0064      Code: address and value, in hex
+ */
+struct _code_game {
+    const char *    name;
+    uint32_t        offset;
+    uint32_t        size;
+};
+typedef struct _code_game CODE_GAME;
+
+struct _code_list {
+    uint8_t *       data;
+    uint32_t        size;
+    CODE_GAME *     games;
+    uint32_t        count;
+};
+typedef struct _code_list CODE_LIST;
+
+
+/* Function declarations */
+void codes_init(CODE_LIST *list);
+void codes_free(CODE_LIST *list);
+int codes_index(CODE_LIST *list);
+int codes_load(CODE_LIST *list, const char *filename);
+int codes_save(CODE_LIST *list, const char *filename);
+CODE_GAME *codes_find(CODE_LIST *list, const char *name);
+uint32_t codes_diff(CODE_LIST *list, CODE_LIST *unit, CODE_LIST *changes);
+void codes_sink(CODE_LIST *list, GS_SINK *sink);
+
+#endif /* _CODES_H_ */
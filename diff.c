@@ -0,0 +1,328 @@
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define _DIFF_X86
+    #include <immintrin.h>
+#endif /* defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) */
+
+#include "gspro.h"
+#include "n64rd.h"
+#include "store.h"
+#include "plan.h"
+#include "diff.h"
+
+
+/* Kernel: first offset >= pos where any capture differs from the first */
+typedef size_t (*DIFF_KERNEL)(const uint8_t **caps, int count, size_t pos, size_t size);
+
+
+/* Private function declarations */
+size_t _diff_next_scalar(const uint8_t **caps, int count, size_t pos, size_t size);
+#if defined(_DIFF_X86)
+size_t _diff_next_sse2(const uint8_t **caps, int count, size_t pos, size_t size);
+size_t _diff_next_avx2(const uint8_t **caps, int count, size_t pos, size_t size);
+#endif /* defined(_DIFF_X86) */
+DIFF_KERNEL _diff_kernel(const char **name);
+
+
+/* Private functions */
+
+/* Portable fallback: one 64-bit word at a time */
+size_t _diff_next_scalar(const uint8_t **caps, int count, size_t pos, size_t size) {
+    uint64_t a, b, x;
+    int j;
+
+    while ((pos + 8) <= size) {
+        memcpy(&a, &caps[0][pos], 8);
+        x = 0;
+        for (j = 1; j < count; j++) {
+            memcpy(&b, &caps[j][pos], 8);
+            x |= a ^ b;
+        }
+        if (x) {
+            break;
+        }
+        pos += 8;
+    }
+
+    for (; pos < size; pos++) {
+        for (j = 1; j < count; j++) {
+            if (caps[j][pos] != caps[0][pos]) {
+                return pos;
+            }
+        }
+    }
+
+    return size;
+}
+
+#if defined(_DIFF_X86)
+__attribute__((target("sse2")))
+size_t _diff_next_sse2(const uint8_t **caps, int count, size_t pos, size_t size) {
+    __m128i a, b;
+    uint32_t mask;
+    int j;
+
+    while ((pos + 16) <= size) {
+        a = _mm_loadu_si128((const __m128i *)&caps[0][pos]);
+        mask = 0;
+        for (j = 1; j < count; j++) {
+            b = _mm_loadu_si128((const __m128i *)&caps[j][pos]);
+            mask |= ~_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) & 0xFFFF;
+        }
+        if (mask) {
+            return pos + __builtin_ctz(mask);
+        }
+        pos += 16;
+    }
+
+    return _diff_next_scalar(caps, count, pos, size);
+}
+
+/* Skips identical data 64 bytes per iteration, then pinpoints within 32 */
+__attribute__((target("avx2")))
+size_t _diff_next_avx2(const uint8_t **caps, int count, size_t pos, size_t size) {
+    __m256i a0, a1, x;
+    uint32_t mask;
+    int j;
+
+    while ((pos + 64) <= size) {
+        a0 = _mm256_loadu_si256((const __m256i *)&caps[0][pos]);
+        a1 = _mm256_loadu_si256((const __m256i *)&caps[0][pos + 32]);
+        x = _mm256_setzero_si256();
+        for (j = 1; j < count; j++) {
+            x = _mm256_or_si256(x, _mm256_xor_si256(a0,
+                _mm256_loadu_si256((const __m256i *)&caps[j][pos])));
+            x = _mm256_or_si256(x, _mm256_xor_si256(a1,
+                _mm256_loadu_si256((const __m256i *)&caps[j][pos + 32])));
+        }
+        if (!_mm256_testz_si256(x, x)) {
+            break;
+        }
+        pos += 64;
+    }
+
+    while ((pos + 32) <= size) {
+        a0 = _mm256_loadu_si256((const __m256i *)&caps[0][pos]);
+        mask = 0;
+        for (j = 1; j < count; j++) {
+            x = _mm256_loadu_si256((const __m256i *)&caps[j][pos]);
+            mask |= ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a0, x));
+        }
+        if (mask) {
+            return pos + __builtin_ctz(mask);
+        }
+        pos += 32;
+    }
+
+    return _diff_next_sse2(caps, count, pos, size);
+}
+#endif /* defined(_DIFF_X86) */
+
+/* Pick the widest kernel this CPU supports */
+DIFF_KERNEL _diff_kernel(const char **name) {
+    #if defined(_DIFF_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            *name = "avx2";
+            return _diff_next_avx2;
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            *name = "sse2";
+            return _diff_next_sse2;
+        }
+    #endif /* defined(_DIFF_X86) */
+
+    *name = "scalar";
+
+    return _diff_next_scalar;
+}
+
+
+/* Public functions */
+
+/*
+ * Open a capture. An existing file is mapped as a raw image based at
+ * `address`; otherwise the spec is taken as "repo:snapshot".
+ */
+int capture_open(CAPTURE *capture, char *spec, uint32_t address) {
+    SNAPSHOT snap;
+    struct stat st;
+    char *name;
+    int fd;
+
+    memset(capture, 0, sizeof(CAPTURE));
+
+    fd = open(spec, O_RDONLY);
+    if (fd != -1) {
+        if (fstat(fd, &st) || !S_ISREG(st.st_mode) || !st.st_size) {
+            fprintf(stderr, "`%s` is not a usable capture\n", spec);
+            close(fd);
+            return 1;
+        }
+        capture->map_size = st.st_size;
+        capture->data = mmap(NULL, capture->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (capture->data == MAP_FAILED) {
+            capture->data = NULL;
+            capture->map_size = 0;
+            fprintf(stderr, "Unable to map `%s`\n", spec);
+            return 1;
+        }
+        madvise(capture->data, capture->map_size, MADV_SEQUENTIAL);
+        capture->address = address;
+        capture->size = MIN(capture->map_size, (size_t)UINT32_MAX);
+
+        return 0;
+    }
+
+    name = split_spec(spec);
+    if (!name) {
+        fprintf(stderr, "Unable to open capture `%s`\n", spec);
+        return 1;
+    }
+    if (snapshot_open(&snap, spec, name)) {
+        name[-1] = ':';
+        return 1;
+    }
+    name[-1] = ':';
+
+    capture->address = snap.address;
+    capture->size = snap.size;
+    capture->data = alloc(snap.size);
+    if (snapshot_read(&snap, snap.address, capture->data, snap.size)) {
+        snapshot_close(&snap);
+        capture_close(capture);
+        return 1;
+    }
+    snapshot_close(&snap);
+
+    return 0;
+}
+
+void capture_close(CAPTURE *capture) {
+    if (capture->map_size) {
+        munmap(capture->data, capture->map_size);
+    }
+    else {
+        free(capture->data);
+    }
+    memset(capture, 0, sizeof(CAPTURE));
+}
+
+/*
+ * Find every byte that differs in any capture, and coalesce them into spans.
+ * Changed bytes separated by `gap` or fewer unchanged bytes share a span.
+ * Span data is taken from the last capture.
+ */
+int diff_captures(CAPTURE *captures, int count, uint32_t gap, PLAN *plan) {
+    const uint8_t **caps;
+    DIFF_KERNEL kernel;
+    const char *name;
+    size_t size;
+    size_t start;
+    size_t end;
+    size_t next;
+    int i;
+
+    if (count < 2) {
+        fprintf(stderr, "%s\n", "Need at least two captures to compare");
+        return 1;
+    }
+
+    size = captures[0].size;
+    caps = alloc(count * sizeof(uint8_t *));
+    for (i = 0; i < count; i++) {
+        if (captures[i].address != captures[0].address) {
+            fprintf(stderr, "Captures start at different addresses (0x%08X, 0x%08X)\n",
+                captures[0].address, captures[i].address);
+            free(caps);
+            return 1;
+        }
+        if (captures[i].size != size) {
+            fprintf(stderr, "Warning: captures differ in size; comparing the common 0x%X bytes\n",
+                (uint32_t)MIN(size, (size_t)captures[i].size));
+        }
+        size = MIN(size, (size_t)captures[i].size);
+        caps[i] = captures[i].data;
+    }
+
+    kernel = _diff_kernel(&name);
+    DEBUGPRINT("Using %s kernel\n", name);
+
+    start = kernel(caps, count, 0, size);
+    while (start < size) {
+        end = start + 1;
+        for (;;) {
+            next = kernel(caps, count, end, size);
+            if ((next >= size) || ((next - end) > gap)) {
+                break;
+            }
+            end = next + 1;
+        }
+
+        plan_add(plan, captures[0].address + start, end - start, &caps[count - 1][start]);
+
+        start = (next < size) ? next : size;
+    }
+
+    free(caps);
+
+    return 0;
+}
+
+/* Compare a comma-separated list of captures, printing and saving the spans */
+int diff_run(char *list, uint32_t address, uint32_t gap, char *filename) {
+    CAPTURE *captures;
+    PLAN plan;
+    char *spec;
+    char *save = NULL;
+    uint64_t t;
+    uint64_t bytes = 0;
+    int count = 1;
+    int opened = 0;
+    int result = 1;
+    int i;
+
+    for (spec = list; *spec; spec++) {
+        if (*spec == ',') count++;
+    }
+    captures = alloc(count * sizeof(CAPTURE));
+
+    for (spec = strtok_r(list, ",", &save); spec; spec = strtok_r(NULL, ",", &save)) {
+        if (capture_open(&captures[opened], spec, address)) {
+            goto done;
+        }
+        bytes += captures[opened].size;
+        opened++;
+    }
+
+    plan_init(&plan);
+    t = now_ns();
+    if (!diff_captures(captures, opened, gap, &plan)) {
+        t = now_ns() - t;
+
+        plan_print(&plan);
+        printf("Compared %d captures in %.3f ms (%.1f MB/s)\n",
+            opened, t / 1e6, (t ? ((bytes * 1e3) / t) : 0.0));
+
+        result = filename ? plan_save(&plan, filename) : 0;
+    }
+    plan_free(&plan);
+
+done:
+    for (i = 0; i < opened; i++) {
+        capture_close(&captures[i]);
+    }
+    free(captures);
+
+    return result;
+}
@@ -0,0 +1,29 @@
+
+#ifndef _DIFF_H_
+#define _DIFF_H_
+
+#include <stdint.h>
+
+#include "plan.h"
+
+
+/* Default gap tolerance; one range header (address + size) costs 8 bytes */
+#define DIFF_DEFAULT_GAP 8
+
+/* One capture being compared: a raw image file or a repository snapshot */
+struct _capture {
+    uint8_t *   data;
+    uint32_t    address;
+    uint32_t    size;
+    size_t      map_size;   /* Non-zero when `data` is a file mapping */
+};
+typedef struct _capture CAPTURE;
+
+
+/* Function declarations */
+int capture_open(CAPTURE *capture, char *spec, uint32_t address);
+void capture_close(CAPTURE *capture);
+int diff_captures(CAPTURE *captures, int count, uint32_t gap, PLAN *plan);
+int diff_run(char *list, uint32_t address, uint32_t gap, char *filename);
+
+#endif /* _DIFF_H_ */
@@ -5,6 +5,6 @@
 
 
 /* Protected variables */
-jmp_buf _exception_env;
-Exception _exception_list[_EXCEPTION_LIST_SIZE] = { { 0 } };
-int _exception_stack = 0;
+_Thread_local jmp_buf _exception_env;
+_Thread_local Exception _exception_list[_EXCEPTION_LIST_SIZE] = { { 0 } };
+_Thread_local int _exception_stack = 0;
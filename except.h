@@ -23,10 +23,10 @@ typedef struct _exception Exception;
 
 #define _EXCEPTION_LIST_SIZE 16
 
-/* Protected variables */
-extern jmp_buf _exception_env;
-extern Exception _exception_list[_EXCEPTION_LIST_SIZE];
-extern int _exception_stack;
+/* Protected variables; per thread, so a helper thread (see lazy.h) can _try on its own */
+extern _Thread_local jmp_buf _exception_env;
+extern _Thread_local Exception _exception_list[_EXCEPTION_LIST_SIZE];
+extern _Thread_local int _exception_stack;
 
 
 /* Syntactic sugar! Yum! */
@@ -0,0 +1,433 @@
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gspro.h"
+#include "n64rd.h"
+#include "memmap.h"
+#include "freeze.h"
+
+
+/* Per-run state: the condition READ and the current WRITE plan */
+struct _freeze {
+    FREEZE_ENTRY *  entries;
+    int             count;
+
+    GS_RANGE *      reads;      /* NULL without conditions */
+    uint8_t *       read_buffer;
+
+    FREEZE_ENTRY ** list;       /* Scratch for sorting */
+    uint8_t *       enabled;    /* Per entry, as of the last tick */
+    GS_RANGE *      writes;
+    uint8_t *       write_buffer;
+    uint32_t        write_total;
+    int             write_ranges;
+    int             write_count;
+    bool            planned;
+
+    uint64_t        replans;
+    uint64_t        skipped;    /* Writes held off by their condition */
+};
+typedef struct _freeze FREEZE;
+
+
+/* Private variables */
+static volatile sig_atomic_t _freeze_stop = 0;
+
+
+/* Private function declarations */
+void _freeze_signal(int sig);
+int _freeze_compare(const void *a, const void *b);
+int _freeze_ranges(FREEZE_ENTRY **list, int n, GS_RANGE *ranges, uint32_t *total);
+bool _freeze_test(FREEZE *fz, FREEZE_ENTRY *e);
+void _freeze_plan(FREEZE *fz);
+int _freeze_tick(FREEZE *fz);
+
+
+/* Private functions */
+
+void _freeze_signal(int sig) {
+    _freeze_stop = 1;
+}
+
+int _freeze_compare(const void *a, const void *b) {
+    const FREEZE_ENTRY *ea = *(const FREEZE_ENTRY **)a;
+    const FREEZE_ENTRY *eb = *(const FREEZE_ENTRY **)b;
+
+    return (ea->address > eb->address) - (ea->address < eb->address);
+}
+
+/*
+ * Sort `list` and merge overlapping and adjacent entries into the fewest
+ * ranges, recording where each entry lands in the packed buffer. Returns the
+ * number of ranges; `ranges` must have room for n + 1 (it is terminated).
+ */
+int _freeze_ranges(FREEZE_ENTRY **list, int n, GS_RANGE *ranges, uint32_t *total) {
+    GS_RANGE *last = NULL;
+    uint32_t last_offset = 0;
+    uint32_t end;
+    int i;
+
+    qsort(list, n, sizeof(FREEZE_ENTRY *), _freeze_compare);
+
+    *total = 0;
+    for (i = 0; i < n; i++) {
+        end = list[i]->address + list[i]->width;
+
+        if (last && (list[i]->address <= (last->address + last->size))) {
+            last->size = MAX(last->size, end - last->address);
+        }
+        else {
+            if (last) {
+                *total += last->size;
+                last++;
+            }
+            else {
+                last = ranges;
+            }
+            last->address = list[i]->address;
+            last->size = list[i]->width;
+            last_offset = *total;
+        }
+        list[i]->offset = last_offset + (list[i]->address - last->address);
+    }
+    if (last) {
+        *total += last->size;
+        last++;
+    }
+    else {
+        last = ranges;
+    }
+    last->address = 0;
+    last->size = 0;
+
+    return (last - ranges);
+}
+
+/* Does the condition hold in the last READ? */
+bool _freeze_test(FREEZE *fz, FREEZE_ENTRY *e) {
+    uint8_t *p = &fz->read_buffer[e->offset];
+    uint32_t value;
+
+    switch (e->width) {
+        case 1:
+            value = p[0];
+            break;
+
+        case 2:
+            value = get_be16(p);
+            break;
+
+        default:
+            value = get_be32(p);
+            break;
+    }
+
+    return ((value == e->value) == (e->kind == FREEZE_IF_EQUAL));
+}
+
+/*
+ * Work out which writes are enabled, and rebuild the WRITE ranges and packed
+ * values when that set has changed. Entries are packed in list order, so where
+ * they overlap the later value wins.
+ */
+void _freeze_plan(FREEZE *fz) {
+    FREEZE_ENTRY *e;
+    bool changed = !fz->planned;
+    uint8_t on;
+    int n = 0;
+    int i;
+
+    for (i = 0; i < fz->count; i++) {
+        e = &fz->entries[i];
+        if (e->kind != FREEZE_WRITE) {
+            continue;
+        }
+
+        on = ((e->condition < 0) || _freeze_test(fz, &fz->entries[e->condition]));
+        if (!on) {
+            fz->skipped++;
+        }
+        if (on != fz->enabled[i]) {
+            fz->enabled[i] = on;
+            changed = true;
+        }
+    }
+    if (!changed) {
+        return;
+    }
+
+    for (i = 0; i < fz->count; i++) {
+        if ((fz->entries[i].kind == FREEZE_WRITE) && fz->enabled[i]) {
+            fz->list[n++] = &fz->entries[i];
+        }
+    }
+    fz->write_count = n;
+    fz->write_ranges = _freeze_ranges(fz->list, n, fz->writes, &fz->write_total);
+
+    for (i = 0; i < fz->count; i++) {
+        e = &fz->entries[i];
+        if ((e->kind != FREEZE_WRITE) || !fz->enabled[i]) {
+            continue;
+        }
+
+        switch (e->width) {
+            case 1:
+                fz->write_buffer[e->offset] = e->value;
+                break;
+
+            case 2:
+                put_be16(&fz->write_buffer[e->offset], e->value);
+                break;
+
+            default:
+                put_be32(&fz->write_buffer[e->offset], e->value);
+                break;
+        }
+    }
+
+    fz->planned = true;
+    fz->replans++;
+}
+
+/* Apply the list once: one paused READ (only with conditions) and one WRITE */
+int _freeze_tick(FREEZE *fz) {
+    GS_ENTER();
+    if (fz->reads) {
+        GS_READ(fz->read_buffer, fz->reads, NULL);
+    }
+    _freeze_plan(fz);
+    if (fz->write_ranges) {
+        GS_WRITE(fz->write_buffer, fz->writes, NULL);
+    }
+    GS_EXIT();
+
+    return 0;
+}
+
+
+/* Public functions */
+
+/*
+ * Parse "[?|!]address=value[:width],..." (width defaults to 4). A condition
+ * gates the entry that follows it, which must be a write.
+ */
+int freeze_parse(char *spec, FREEZE_ENTRY **entries, int *count) {
+    char *p = spec;
+    char *err = NULL;
+    int n = 1;
+
+    for (; *p; p++) {
+        if (*p == ',') n++;
+    }
+    *entries = alloc(n * sizeof(FREEZE_ENTRY));
+    *count = 0;
+
+    p = spec;
+    while (*p) {
+        FREEZE_ENTRY *e = &(*entries)[*count];
+
+        memset(e, 0, sizeof(FREEZE_ENTRY));
+        e->kind = FREEZE_WRITE;
+        e->condition = -1;
+        e->width = 4;
+        if ((*p == '?') || (*p == '!')) {
+            e->kind = ((*p == '?') ? FREEZE_IF_EQUAL : FREEZE_IF_NOT_EQUAL);
+            p++;
+        }
+
+        e->address = strtoul(p, &err, 0);
+        if ((err == p) || (*err != '=')) {
+            fprintf(stderr, "Invalid freeze address\n");
+            parse_error(spec, (err - spec));
+            return 1;
+        }
+        p = err + 1;
+        e->value = strtoul(p, &err, 0);
+        if (err == p) {
+            fprintf(stderr, "Invalid freeze value\n");
+            parse_error(spec, (err - spec));
+            return 1;
+        }
+        if (*err == ':') {
+            p = err + 1;
+            e->width = strtoul(p, &err, 0);
+        }
+        if ((e->width != 1) && (e->width != 2) && (e->width != 4)) {
+            fprintf(stderr, "Invalid freeze width (must be 1, 2 or 4)\n");
+            parse_error(spec, (p - spec));
+            return 1;
+        }
+        if ((e->width < 4) && (e->value >> (e->width * 8))) {
+            fprintf(stderr, "Freeze value does not fit in %u bytes\n", e->width);
+            parse_error(spec, (p - spec));
+            return 1;
+        }
+        if (*err && (*err != ',')) {
+            fprintf(stderr, "Invalid freeze entry\n");
+            parse_error(spec, (err - spec));
+            return 1;
+        }
+
+        if (*count && ((*entries)[*count - 1].kind != FREEZE_WRITE)) {
+            if (e->kind != FREEZE_WRITE) {
+                fprintf(stderr, "A freeze condition must be followed by a write\n");
+                parse_error(spec, (p - spec));
+                return 1;
+            }
+            e->condition = *count - 1;
+        }
+
+        (*count)++;
+        p = *err ? err + 1 : err;
+    }
+
+    if (!*count) {
+        fprintf(stderr, "Empty freeze list\n");
+        return 1;
+    }
+    if ((*entries)[*count - 1].kind != FREEZE_WRITE) {
+        fprintf(stderr, "A freeze condition must be followed by a write\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Re-apply the freeze list every `interval` microseconds until `ticks` have
+ * run (or forever, if zero) or SIGINT arrives.
+ */
+int freeze_run(FREEZE_ENTRY *entries, int count, uint32_t interval, uint32_t ticks) {
+    FREEZE fz;
+    uint32_t total;
+    uint64_t next, prev = 0, t, t_end;
+    uint64_t done = 0;
+    uint64_t overruns = 0;
+    STATS period = { 0 };
+    STATS latency = { 0 };
+    uint8_t check;
+    int conditions = 0;
+    int result = 0;
+    int i;
+
+    memset(&fz, 0, sizeof(FREEZE));
+    fz.entries = entries;
+    fz.count = count;
+    fz.list = alloc(count * sizeof(FREEZE_ENTRY *));
+    fz.enabled = alloc(count);
+    memset(fz.enabled, 0, count);
+    fz.writes = alloc((count + 1) * sizeof(GS_RANGE));
+    fz.write_buffer = alloc(count * 4);
+
+    /* The condition READ never changes, so it is planned once */
+    for (i = 0; i < count; i++) {
+        if (entries[i].kind != FREEZE_WRITE) {
+            fz.list[conditions++] = &entries[i];
+        }
+    }
+    if (conditions) {
+        fz.reads = alloc((conditions + 1) * sizeof(GS_RANGE));
+        _freeze_ranges(fz.list, conditions, fz.reads, &total);
+        fz.read_buffer = alloc(total);
+
+        /* READ refuses some starts; RDRAM's are read through KSEG1 instead */
+        for (i = 0; fz.reads[i].size; i++) {
+            if (memmap_read_blocked(fz.reads[i].address)) {
+                fz.reads[i].address = MEMMAP_KSEG1 | (fz.reads[i].address & MEMMAP_PHYS_MASK);
+            }
+            if (memmap_read_blocked(fz.reads[i].address)) {
+                fprintf(stderr, "Unable to test 0x%08X: READ refuses it in every mirror\n", fz.reads[i].address);
+                result = 1;
+                goto done;
+            }
+        }
+    }
+
+    /* Verify GS is in-game */
+    if (gs_enter() || gs_where(&check)) {
+        result = 1;
+        goto done;
+    }
+    if (check != GS_WHERE_GAME) {
+        fprintf(stderr, "Freeze is only available while in-game\n");
+        result = 1;
+        goto done;
+    }
+
+    /* Settle the initial plan, so it can be reported; WHERE left PC-control */
+    if (fz.reads && (gs_enter() || gs_read(fz.read_buffer, fz.reads, NULL) || gs_exit())) {
+        result = 1;
+        goto done;
+    }
+    _freeze_plan(&fz);
+    fz.skipped = 0;
+    fz.replans = 0;
+
+    for (i = 0; fz.writes[i].size; i++) {
+        DEBUGPRINT("Range %d: 0x%08X, 0x%X bytes\n", i, fz.writes[i].address, fz.writes[i].size);
+    }
+    printf("Freezing %d entries (%d conditions) in %d ranges (%u bytes per tick)\n",
+        count - conditions, conditions, fz.write_ranges, fz.write_total);
+
+    _freeze_stop = 0;
+    signal(SIGINT, _freeze_signal);
+
+    next = now_ns();
+    while (!_freeze_stop && (!ticks || (done < ticks))) {
+        sleep_until_ns(next);
+
+        t = now_ns();
+        if (_freeze_tick(&fz)) {
+            result = 1;
+            break;
+        }
+        t_end = now_ns();
+
+        if (done) {
+            stats_add(&period, (t - prev) / 1e3);
+        }
+        stats_add(&latency, (t_end - t) / 1e3);
+        prev = t;
+        done++;
+
+        /* Keep a fixed cadence; skip ahead if a tick overran its slot */
+        next += (uint64_t)interval * 1000;
+        if (next < t_end) {
+            next = t_end;
+            overruns++;
+        }
+    }
+
+    signal(SIGINT, SIG_DFL);
+
+    printf("\n");
+    printf("Ticks:    %llu (%llu overruns)\n", (unsigned long long)done, (unsigned long long)overruns);
+    if (period.count) {
+        printf("Rate:     %.2f Hz (target %.2f Hz)\n",
+            1e6 / period.mean, (interval ? (1e6 / interval) : 0.0));
+        printf("Period:   mean %.1f us, jitter %.1f us (min %.1f, max %.1f)\n",
+            period.mean, stats_stddev(&period), period.min, period.max);
+    }
+    if (latency.count) {
+        printf("Latency:  mean %.1f us, stddev %.1f us\n", latency.mean, stats_stddev(&latency));
+    }
+    if (conditions) {
+        printf("Skipped:  %llu writes held off by conditions (%llu replans)\n",
+            (unsigned long long)fz.skipped, (unsigned long long)fz.replans);
+    }
+
+done:
+    free(fz.list);
+    free(fz.enabled);
+    free(fz.writes);
+    free(fz.write_buffer);
+    free(fz.reads);
+    free(fz.read_buffer);
+
+    return result;
+}
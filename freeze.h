@@ -0,0 +1,42 @@
+
+#ifndef _FREEZE_H_
+#define _FREEZE_H_
+
+#include <stdint.h>
+
+
+/*
+ * Freeze lists: GameShark-style constant writes, applied from the host.
+ *
+ *   address=value[:width]      Write `value` every tick
+ *   ?address=value[:width]     Only write the next entry while memory holds `value`
+ *   !address=value[:width]     Only write the next entry while it does not
+ *
+ * Entries are separated by commas; width is 1, 2 or 4 bytes (default 4) and
+ * values are stored big-endian, as the console does. Each tick is one enter /
+ * READ / WRITE / exit cycle, and the READ is only made when the list has
+ * conditions. Writes are merged into the fewest contiguous ranges; where
+ * entries overlap, the later one wins.
+ */
+enum _freeze_kinds {
+    FREEZE_WRITE = 0,
+    FREEZE_IF_EQUAL,
+    FREEZE_IF_NOT_EQUAL
+};
+
+struct _freeze_entry {
+    uint32_t    address;
+    uint32_t    value;
+    uint32_t    width;
+    uint8_t     kind;
+    int         condition;  /* Entry gating this write; -1 for none */
+    uint32_t    offset;     /* Offset into the packed read or write buffer */
+};
+typedef struct _freeze_entry FREEZE_ENTRY;
+
+
+/* Function declarations */
+int freeze_parse(char *spec, FREEZE_ENTRY **entries, int *count);
+int freeze_run(FREEZE_ENTRY *entries, int count, uint32_t interval, uint32_t ticks);
+
+#endif /* _FREEZE_H_ */
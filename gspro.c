@@ -3,6 +3,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 
 #if defined(_WIN32)
@@ -27,13 +29,15 @@
 #endif /* defined(_WIN32) */
 
 #include "gspro.h"
+#include "stream.h"
 #include "except.h"
 
 
 /* Exceptions */
 enum _exception_types {
     GS_Unimplemented = 1,
-    GS_TimeoutException
+    GS_TimeoutException,
+    GS_IOException
 };
 
 #define TIMEOUT() \
@@ -46,6 +50,26 @@ enum _exception_types {
         _throw(e); \
     } while (0)
 
+#define UNDERRUN() \
+    do { \
+        Exception e = { \
+            EXCEPTION_INFO, \
+            GS_IOException, \
+            "Data source ended early." \
+        }; \
+        _throw(e); \
+    } while (0)
+
+#define SINK_FAILED() \
+    do { \
+        Exception e = { \
+            EXCEPTION_INFO, \
+            GS_IOException, \
+            "Data sink rejected data." \
+        }; \
+        _throw(e); \
+    } while (0)
+
 #define UNIMPLEMENTED() \
     do { \
         Exception e = { \
@@ -61,6 +85,11 @@ enum _exception_types {
 static int _gs_ready = 0;
 static int _gs_timeout = 100000;
 static GS_CONFIG _gs_config = { 0 };
+static bool _gs_fast = false;
+static uint8_t _gs_fast_phase = 0;
+static void (*_gs_fast_range_callback)(int, uint32_t) = NULL;
+static int _gs_fast_range_index = 0;
+static GS_LINK _gs_link = { GS_WINDOW_START };
 
 
 /* Private defines */
@@ -70,6 +99,29 @@ static GS_CONFIG _gs_config = { 0 };
 
 #define _GS_DEFAULT_PORT_DEV "/dev/parport0"
 
+/* Polls per wait before gs_transfer_step() yields */
+#define _GS_TRANSFER_SPIN 16
+
+/* Resumable transfer phases */
+enum _gs_transfer_phases {
+    _GS_PHASE_SYNC,         /* Entering PC-control, one nybble at a time */
+    _GS_PHASE_HANDSHAKE_G,
+    _GS_PHASE_HANDSHAKE_T,
+    _GS_PHASE_COMMAND,
+    _GS_PHASE_ADDRESS,
+    _GS_PHASE_SIZE,
+    _GS_PHASE_DATA,
+    _GS_PHASE_END,          /* Null range */
+    _GS_PHASE_CHECKSUM
+};
+
+/* Resumable transfer nybble states */
+enum _gs_transfer_nibbles {
+    _GS_NIBBLE_START,
+    _GS_NIBBLE_CLEAR,       /* Waiting for the last nybble's ready flag to drop */
+    _GS_NIBBLE_READY        /* Waiting for the device's nybble */
+};
+
 
 /* Private function declarations */
 uint8_t _gs_in(uint16_t port);
@@ -78,7 +130,37 @@ void _gs_cmd(GS_COMMAND cmd);
 uint8_t _gs_exch_4(uint8_t out);
 uint8_t _gs_exch_8(uint8_t out);
 uint32_t _gs_exch_32(uint32_t out);
-void _gs_mem(uint8_t *data, GS_RANGE *range, void (*callback)(int, uint32_t), bool write);
+void _gs_mem(uint8_t *data, GS_SOURCE *source, GS_RANGE *range, void (*callback)(int, uint32_t), bool write);
+void _gs_upgrade(GS_SOURCE *source);
+void _gs_read_rom(uint8_t *data, GS_SINK *sink, GS_RANGE *range, void (*callback)(uint32_t));
+uint64_t _gs_now(void);
+void _gs_link_adapt(bool passed);
+GS_STATUS _gs_windowed(uint8_t *data, GS_SINK *sink, GS_RANGE *range, bool rom,
+    void (*callback)(int, uint32_t), void (*callback_rom)(uint32_t));
+void _gs_read_mempak(GS_SINK *sink, void (*callback)(uint32_t));
+void _gs_codes_recv(GS_SINK *sink, void (*callback)(uint32_t));
+void _gs_codes_send(GS_SOURCE *source, void (*callback)(uint32_t));
+void _gs_screen_header(GS_FRAME *frame, int mode);
+void _gs_screen_shot(GS_FRAME *frame, GS_SINK *sink, void (*callback)(uint32_t));
+void _gs_sync(void);
+uint8_t _gs_fast_exch_4(uint8_t out);
+uint8_t _gs_fast_exch_8(uint8_t out);
+uint32_t _gs_fast_exch_32(uint32_t out);
+void _gs_fast_cmd(int cmd, int tries);
+void _gs_fast_block(uint8_t *block, uint32_t len, uint32_t at);
+void _gs_fast_read(uint8_t *data, GS_SINK *sink, uint32_t address, uint32_t size, void (*callback)(uint32_t));
+void _gs_fast_hashes(uint64_t *hashes, uint32_t address, uint32_t size);
+void _gs_fast_write(uint8_t *data, GS_SOURCE *source, uint32_t address, uint32_t size, void (*callback)(uint32_t));
+void _gs_fast_range_progress(uint32_t size);
+void _gs_fast_mem(uint8_t *data, GS_SOURCE *source, GS_RANGE *range, void (*callback)(int, uint32_t), bool write);
+void _gs_fast_leave(void);
+void _gs_stock(void);
+uint32_t _gs_get32(const uint8_t *p);
+void _gs_transfer_fail(GS_TRANSFER *t, const char *msg);
+void _gs_transfer_range(GS_TRANSFER *t);
+void _gs_transfer_byte(GS_TRANSFER *t, uint8_t rx);
+void _gs_transfer_nibble(GS_TRANSFER *t, uint8_t nybble);
+void _gs_put32(uint8_t *p, uint32_t value);
 
 
 /* Private functions */
@@ -201,12 +283,23 @@ void _gs_cmd(GS_COMMAND cmd) {
     }
 }
 
-/* Send or receive data using READ or WRITE command */
-void _gs_mem(uint8_t *data, GS_RANGE *range, void (*callback)(int, uint32_t), bool write) {
+/*
+ * Send or receive data using READ or WRITE command
+ *
+ * Ranges are packed back-to-back in `data`. When writing from a source, the
+ * data is pulled in GS_SOURCE_CHUNK pieces instead, so only one chunk is ever
+ * held in memory.
+ */
+void _gs_mem(uint8_t *data, GS_SOURCE *source, GS_RANGE *range, void (*callback)(int, uint32_t), bool write) {
     int i = 0;
     int count = 0;
+    uint32_t pos = 0;
     uint8_t sum = 0;
     uint8_t calc_sum = 0;
+    uint8_t chunk[GS_SOURCE_CHUNK];
+    size_t chunk_size = 0;
+    size_t chunk_pos = 0;
+    uint8_t byte;
     static char error[80] = { 0 };
 
     _gs_cmd(write ? GS_CMD_WRITE : GS_CMD_READ);
@@ -221,20 +314,31 @@ void _gs_mem(uint8_t *data, GS_RANGE *range, void (*callback)(int, uint32_t), bo
         _gs_exch_32(range[count].size);
 
         /* Read data */
-        for (i = 0; i < range[count].size; i++) {
+        for (i = 0; i < range[count].size; i++, pos++) {
             /* Run callback periodically */
             if (callback && i && (!(i & 0x3FFF))) {
                 callback(count, i);
             }
 
             if (write) {
-                _gs_exch_8(data[i]);
+                if (source) {
+                    if (chunk_pos == chunk_size) {
+                        chunk_size = source->read(source, chunk, sizeof(chunk));
+                        chunk_pos = 0;
+                        if (!chunk_size) UNDERRUN();
+                    }
+                    byte = chunk[chunk_pos++];
+                }
+                else {
+                    byte = data[pos];
+                }
+                _gs_exch_8(byte);
             }
             else {
-                data[i] = _gs_exch_8(0);
+                byte = data[pos] = _gs_exch_8(0);
             }
 
-            sum += data[i];
+            sum += byte;
         }
 
         count++;
@@ -269,227 +373,1668 @@ void _gs_mem(uint8_t *data, GS_RANGE *range, void (*callback)(int, uint32_t), bo
     }
 }
 
+/* Read CPU memory 32-bits at a time, into a buffer or a sink */
+void _gs_read_rom(uint8_t *data, GS_SINK *sink, GS_RANGE *range, void (*callback)(uint32_t)) {
+    int i = 0;
+    uint8_t sum = 0;
+    uint8_t calc_sum = 0;
+    uint32_t word = 0;
+    uint8_t chunk[GS_SINK_CHUNK];
+    uint8_t *out;
+    size_t chunk_pos = 0;
+    static char error[80] = { 0 };
 
-/* Public functions */
-
-/* Initialize the library */
-GS_STATUS gs_init(GS_CONFIG *config) {
-    if (_gs_ready) {
-        return GS_SUCCESS;
-    }
-
-    _gs_config.port = _GS_DEFAULT_PORT;
-    _gs_config.port_dev = _GS_DEFAULT_PORT_DEV;
-    _gs_config.in_callback = _gs_in;
-    _gs_config.out_callback = _gs_out;
-
-    if (config) {
-        if (config->port)
-            _gs_config.port = config->port;
-        if (config->port_dev)
-            _gs_config.port_dev = config->port_dev;
-        if (config->in_callback)
-            _gs_config.in_callback = config->in_callback;
-        if (config->out_callback)
-            _gs_config.out_callback = config->out_callback;
-    }
-
-    #if defined(_WIN32)
-        /* Windows, including 64-bit */
-        /* Do not use the UNIMPLEMENTED() macro here; no try/catch sugar */
-        ERRORPRINT("%s\n", "UNIMPLEMENTED");
+    _gs_cmd(GS_CMD_READ_ROM);
 
-        return GS_ERROR;
-    #elif defined (linux)
-        /* Linux */
-        assert(_gs_config.port_dev);
+    /* Send address */
+    range->address &= ~3;
+    DEBUGPRINT("Address: 0x%08X\n", range->address);
+    _gs_exch_32(range->address);
 
-        _gs_port_fd = open(_gs_config.port_dev, O_RDWR);
-        if (_gs_port_fd == -1) {
-            ERRORPRINT("Unable to open '%s' for read/write\n", _gs_config.port_dev);
+    /* Send data size */
+    range->size = (range->size + 3) & ~3;
+    DEBUGPRINT("Size: 0x%08X\n", range->size);
+    _gs_exch_32(range->size);
 
-            return GS_ERROR;
+    /* Read data */
+    for (i = 0; i < range->size; i += 4) {
+        /* Run callback periodically */
+        if (callback && i && (!(i & 0x3FFF))) {
+            callback(i);
         }
 
-        if (ioctl(_gs_port_fd, PPCLAIM, NULL)) {
-            ERRORPRINT("Could not claim '%s'\n", _gs_config.port_dev);
-            close(_gs_port_fd);
-            _gs_port_fd = -1;
+        word = _gs_exch_32(0);
+        sum += word;
 
-            return GS_ERROR;
+        if (sink) {
+            if (chunk_pos == sizeof(chunk)) {
+                if (sink->write(sink, chunk, chunk_pos)) SINK_FAILED();
+                chunk_pos = 0;
+            }
+            out = &chunk[chunk_pos];
+            chunk_pos += 4;
         }
-
-        int _gs_port_mode = IEEE1284_MODE_NIBBLE;
-        if (ioctl(_gs_port_fd, PPSETMODE, &_gs_port_mode)) {
-            ERRORPRINT("Could not set nibble mode for '%s'\n", _gs_config.port_dev);
-            ioctl(_gs_port_fd, PPRELEASE);
-            close(_gs_port_fd);
-            _gs_port_fd = -1;
-
-            return GS_ERROR;
+        else {
+            out = &data[i];
         }
-    #elif defined(HAS_SYSIO_H)
-        /* Other UNIX-like environments with low-level IO */
-        if (ioperm(_GS_LPT_DATA, 2, 1)) {
-            ERRORPRINT("%s\n", "Couldn't get LPT, are you root?");
 
-            return GS_ERROR;
-        }
-    #else /* !defined(_WIN32) */
-        /* Unknown, unsupported */
-        /* Do not use the UNIMPLEMENTED() macro here; no try/catch sugar */
-        ERRORPRINT("%s\n", "UNIMPLEMENTED");
+        out[0] = word >> 24;
+        out[1] = word >> 16;
+        out[2] = word >> 8;
+        out[3] = word >> 0;
+    }
 
-        return GS_ERROR;
-    #endif /* defined(_WIN32) */
+    if (sink && chunk_pos) {
+        if (sink->write(sink, chunk, chunk_pos)) SINK_FAILED();
+    }
 
-    _gs_ready++;
+    /* Final callback */
+    if (callback && (i & 0x3FFF)) {
+        callback(i);
+    }
 
-    return GS_SUCCESS;
+    /* Verify */
+    calc_sum = _gs_exch_8(0);
+    if (calc_sum != sum) {
+        sprintf(error, "Checksum failure during ROM read:\n"
+            "  Received: 0x%02X\n"
+            "  Expected: 0x%02X\n",
+            calc_sum, sum);
+
+        Exception e = {
+            EXCEPTION_INFO,
+            GS_TimeoutException,
+            error
+        };
+        _throw(e);
+    }
 }
 
-/* Finish library calls */
-GS_STATUS gs_quit(void) {
-    assert(_gs_ready);
+uint64_t _gs_now(void) {
+    struct timespec ts;
 
-    if (_gs_ready > 0) {
-        _gs_ready--;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 
-        if (_gs_ready > 0) {
-            return GS_SUCCESS;
-        }
-    }
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
 
-    _try {
-        _gs_config.out_callback(0, _GS_LPT_DATA);
+/* Size the next window after one passed or failed */
+void _gs_link_adapt(bool passed) {
+    if (!passed) {
+        _gs_link.window = MAX(_gs_link.window / 2, (uint32_t)GS_WINDOW_MIN);
+        _gs_link.clean = 0;
     }
-    _catch (e) {
-        // Pass
-    };
-
-    _gs_config.port = 0;
-    _gs_config.port_dev = NULL;
-    _gs_config.in_callback = NULL;
-    _gs_config.out_callback = NULL;
+    else if ((++_gs_link.clean >= GS_WINDOW_GROW) && (_gs_link.window < GS_WINDOW_MAX)) {
+        _gs_link.window *= 2;
+        _gs_link.clean = 0;
+    }
+}
 
-    #if defined(_WIN32)
-        /* Windows, including 64-bit */
-        /* Do not use the UNIMPLEMENTED() macro here; no try/catch sugar */
-        ERRORPRINT("%s\n", "UNIMPLEMENTED");
+/*
+ * READ (or with `rom`, READ_ROM) in adaptive windows, into a buffer or a sink
+ *
+ * READ stays in PC-control between windows; READ_ROM leaves it after each, so
+ * later windows enter again first, as does every retry. A READ cut at or above
+ * GS_READ_HIGH, which the firmware refuses, goes on with READ_ROM windows. A sink only sees
+ * windows whose checksum passed. Each window is its own _try, not nested in
+ * another, so nothing local changes inside one.
+ */
+GS_STATUS _gs_windowed(uint8_t *data, GS_SINK *sink, GS_RANGE *range, bool rom,
+    void (*callback)(int, uint32_t), void (*callback_rom)(uint32_t)) {
+    GS_RANGE window[GS_WINDOW_RANGES + 1];
+    uint8_t *buf = NULL;
+    uint8_t *rom_buf = NULL;
+    uint64_t start = _gs_now();
+    uint32_t pos = 0;
+    uint32_t size;
+    uint32_t len;
+    uint32_t index = 0;     /* First range not yet read, and how far into it */
+    uint32_t offset = 0;
+    uint32_t next;
+    uint32_t next_offset;
+    int count;
+    int failures = 0;
+    uint32_t skip;
+    bool enter = false;
+    bool high;
+    GS_STATUS result = GS_SUCCESS;
+
+    if (rom) {
+        range->address &= ~3;
+        range->size = (range->size + 3) & ~3;
+    }
+    if (sink && !(buf = malloc(GS_WINDOW_MAX))) {
+        ERRORPRINT("%s\n", "Out of memory");
 
         return GS_ERROR;
-    #elif defined (linux)
-        /* Linux */
-        ioctl(_gs_port_fd, PPRELEASE);
-        close(_gs_port_fd);
-        _gs_port_fd = -1;
-    #elif defined(HAS_SYSIO_H)
-        /* Other UNIX-like environments with low-level IO */
-        ioperm(_GS_LPT_DATA, 2, 0);
-    #else /* !defined(_WIN32) */
-        /* Unknown, unsupported */
-        /* Do not use the UNIMPLEMENTED() macro here; no try/catch sugar */
-        ERRORPRINT("%s\n", "UNIMPLEMENTED");
+    }
+    if (!rom && !(rom_buf = malloc(GS_WINDOW_MAX + 8))) {
+        ERRORPRINT("%s\n", "Out of memory");
+        free(buf);
 
         return GS_ERROR;
-    #endif /* defined(_WIN32) */
+    }
 
-    return GS_SUCCESS;
-}
+    while (range[index].address && range[index].size) {
+        /* Gather the next window; READ_ROM only takes one range */
+        size = 0;
+        count = 0;
+        next = index;
+        next_offset = offset;
+        high = false;
+        while (range[next].address && range[next].size && (size < _gs_link.window) &&
+            (count < GS_WINDOW_RANGES) && !(rom && count) && !high) {
+            len = MIN(range[next].size - next_offset, _gs_link.window - size);
+            window[count].address = range[next].address + next_offset;
+            window[count].size = len;
+            if (!rom && next_offset && (window[count].address >= GS_READ_HIGH)) {
+                /* A cut landed in the high block; READ_ROM reads it, alone */
+                if (count) break;
+                high = true;
+            }
+            else if (!rom && next_offset && gs_read_blocked(window[count].address)) {
+                /* A cut landed in the RDRAM window; read it through KSEG1 */
+                window[count].address ^= 0x20000000;
+            }
+            else if (!rom && (window[count].address < GS_READ_HIGH) &&
+                (window[count].address + len > GS_READ_HIGH)) {
+                /* End the READ before the high block */
+                len = GS_READ_HIGH - window[count].address;
+                window[count].size = len;
+            }
+            count++;
+            size += len;
+            next_offset += len;
+            if (next_offset == range[next].size) {
+                next++;
+                next_offset = 0;
+            }
+        }
+        window[count].address = 0;
+        window[count].size = 0;
 
-/* Enter PC-control */
-GS_STATUS gs_enter(void) {
-    int timeout = 1000;
-    uint8_t result = 0;
+        _gs_link.windows++;
+        _try {
+            if (enter) {
+                _gs_sync();
+            }
+            if (rom) {
+                _gs_read_rom(sink ? buf : &data[pos], NULL, window, NULL);
+            }
+            else if (high) {
+                /* READ_ROM reads whole words; keep the bytes asked for */
+                skip = window[0].address & 3;
+                window[0].address -= skip;
+                window[0].size = (skip + size + 3) & ~3;
+                _gs_read_rom(rom_buf, NULL, window, NULL);
+                memcpy(sink ? buf : &data[pos], &rom_buf[skip], size);
+            }
+            else {
+                _gs_mem(sink ? buf : &data[pos], NULL, window, NULL, false);
+            }
+        }
+        _catch (e) {
+            _gs_link.failures++;
+            _gs_link.resent += size;
+            _gs_link_adapt(false);
+            enter = true;
+
+            if (++failures == GS_WINDOW_RETRIES) {
+                ERRORPRINT("%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
+                result = GS_ERROR;
+                break;
+            }
+            DEBUGPRINT("Window at 0x%08X failed; retrying with 0x%X bytes\n", window[0].address, _gs_link.window);
+            continue;
+        }
 
-    assert(_gs_ready);
+        failures = 0;
+        enter = rom || high;
+        _gs_link_adapt(true);
+        _gs_link.bytes += size;
 
-    DEBUGPRINT("%s\n", "Entering...");
+        if (sink && sink->write(sink, buf, size)) {
+            ERRORPRINT("%s\n", "Data sink rejected data.");
+            result = GS_ERROR;
+            break;
+        }
+        pos += size;
 
-    _try {
-        while (--timeout) {
-            /*
-             * Repeatedly send 0x3 until we receive 'g'.
-             *
-             * The 0x03 puts GS into "awaiting command" state.
-             * 'g' is the response to the first byte of the command handshake.
-             *
-             * This function synchronizes nybble-mode communication line,
-             * and puts the GS into its "awaiting command" state.
-             */
-            result = (result << 4) | _gs_exch_4(3);
-            if (result == 'g') break;
+        /* Report each range finished, then how far into the current one */
+        for (; callback && (index < next); index++) {
+            callback(index, range[index].size);
+        }
+        index = next;
+        offset = next_offset;
+        if (callback && offset) {
+            callback(index, offset);
+        }
+        if (callback_rom) {
+            callback_rom(pos);
         }
-        if (!timeout) TIMEOUT();
     }
-    _catch (e) {
-        ERRORPRINT("%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
 
-        return GS_ERROR;
+    /* A READ leaves the GS in PC-control; so must a read whose last window was READ_ROM */
+    if (!rom && enter && (result == GS_SUCCESS)) {
+        _try {
+            _gs_sync();
+        }
+        _catch (e) {
+            ERRORPRINT("%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
+            result = GS_ERROR;
+        }
     }
 
-    return GS_SUCCESS;
+    _gs_link.ns += _gs_now() - start;
+    free(rom_buf);
+    free(buf);
+
+    return result;
 }
 
-/* Exit PC-control */
-GS_STATUS gs_exit(void) {
-    assert(_gs_ready);
+/*
+ * Read the Controller Pak into a sink (see GS_MEMPAK_PAGE)
+ *
+ * Each page is checked against its sum before the sink sees it, so the sink
+ * can check the pak's own structures while the rest is still arriving.
+ */
+void _gs_read_mempak(GS_SINK *sink, void (*callback)(uint32_t)) {
+    uint32_t i;
+    uint32_t j;
+    uint32_t size;
+    uint8_t sum;
+    uint8_t calc_sum;
+    uint8_t page[GS_MEMPAK_PAGE];
+    static char error[80] = { 0 };
 
-    _try {
-        _gs_cmd(GS_CMD_UNPAUSE);
-    }
-    _catch (e) {
-        ERRORPRINT("%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
+    _gs_cmd(GS_CMD_READ_MEMPAK);
 
-        return GS_ERROR;
+    size = _gs_exch_32(0);
+    DEBUGPRINT("Size: 0x%08X\n", size);
+    if ((size > GS_MEMPAK_SIZE) || (size % GS_MEMPAK_PAGE)) {
+        sprintf(error, "Unexpected Controller Pak size: 0x%08X\n", size);
+
+        Exception e = {
+            EXCEPTION_INFO,
+            GS_IOException,
+            error
+        };
+        _throw(e);
     }
 
-    return GS_SUCCESS;
-}
+    for (i = 0; i < size; i += sizeof(page)) {
+        sum = 0;
+        for (j = 0; j < sizeof(page); j++) {
+            page[j] = _gs_exch_8(0);
+            sum += page[j];
+        }
 
-/* Read CPU memory */
-GS_STATUS gs_read(uint8_t *in, GS_RANGE *range, void (*callback)(int, uint32_t)) {
-    assert(_gs_ready);
+        /* Verify */
+        calc_sum = _gs_exch_8(0);
+        if (calc_sum != sum) {
+            sprintf(error, "Checksum failure in pak page 0x%02X:\n"
+                "  Received: 0x%02X\n"
+                "  Expected: 0x%02X\n",
+                i / GS_MEMPAK_PAGE, calc_sum, sum);
+
+            Exception e = {
+                EXCEPTION_INFO,
+                GS_TimeoutException,
+                error
+            };
+            _throw(e);
+        }
 
-    _try {
-        _gs_mem(in, range, callback, false);
-    }
-    _catch (e) {
-        ERRORPRINT("%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
+        if (sink->write(sink, page, sizeof(page))) SINK_FAILED();
 
-        return GS_ERROR;
+        /* Run callback periodically */
+        if (callback && !((i + sizeof(page)) & 0x0FFF)) {
+            callback(i + sizeof(page));
+        }
     }
 
-    return GS_SUCCESS;
+    if (!size) {
+        Exception e = {
+            EXCEPTION_INFO,
+            GS_IOException,
+            "No Controller Pak inserted."
+        };
+        _throw(e);
+    }
 }
 
-/* Write CPU memory */
-GS_STATUS gs_write(uint8_t *out, GS_RANGE *range, void (*callback)(int, uint32_t)) {
-    assert(_gs_ready);
+/* Receive a code list (see GS_CODES_CHUNK), checking each chunk as it arrives */
+void _gs_codes_recv(GS_SINK *sink, void (*callback)(uint32_t)) {
+    uint32_t i;
+    uint32_t j;
+    uint32_t len;
+    uint32_t size;
+    uint8_t sum;
+    uint8_t calc_sum;
+    uint8_t chunk[GS_CODES_CHUNK];
+    static char error[80] = { 0 };
 
-    _try {
-        _gs_mem(out, range, callback, true);
-    }
-    _catch (e) {
-        ERRORPRINT("%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
+    size = _gs_exch_32(0);
+    DEBUGPRINT("Size: 0x%08X\n", size);
+    if (size > GS_CODES_MAX) {
+        sprintf(error, "Unexpected code list size: 0x%08X\n", size);
 
-        return GS_ERROR;
+        Exception e = {
+            EXCEPTION_INFO,
+            GS_IOException,
+            error
+        };
+        _throw(e);
     }
 
-    return GS_SUCCESS;
-}
+    for (i = 0; i < size; i += len) {
+        len = MIN(sizeof(chunk), size - i);
+        sum = 0;
+        for (j = 0; j < len; j++) {
+            chunk[j] = _gs_exch_8(0);
+            sum += chunk[j];
+        }
 
-/* Discover GS run mode (and exit PC-control) */
-GS_STATUS gs_where(uint8_t *out) {
-    assert(_gs_ready);
+        /* Verify */
+        calc_sum = _gs_exch_8(0);
+        if (calc_sum != sum) {
+            sprintf(error, "Checksum failure in code list at 0x%04X:\n"
+                "  Received: 0x%02X\n"
+                "  Expected: 0x%02X\n",
+                i, calc_sum, sum);
+
+            Exception e = {
+                EXCEPTION_INFO,
+                GS_TimeoutException,
+                error
+            };
+            _throw(e);
+        }
 
-    _try {
-        _gs_cmd(GS_CMD_WHERE);
+        if (sink->write(sink, chunk, len)) SINK_FAILED();
 
-        /* Returns GS_WHERE_MENU when in the menu, GS_WHERE_GAME when in game */
-        *out = _gs_exch_8(0);
+        /* Run callback periodically */
+        if (callback && !((i + len) & 0x0FFF)) {
+            callback(i + len);
+        }
     }
-    _catch (e) {
+}
+
+/* Send a code list (see GS_CODES_CHUNK); the GS checks each chunk before the next */
+void _gs_codes_send(GS_SOURCE *source, void (*callback)(uint32_t)) {
+    uint32_t i;
+    uint32_t j;
+    uint32_t len;
+    uint32_t size = source->size;
+    size_t got;
+    uint8_t sum;
+    uint8_t calc_sum;
+    uint8_t chunk[GS_CODES_CHUNK];
+    static char error[80] = { 0 };
+
+    if (size > GS_CODES_MAX) {
+        sprintf(error, "Code list too large: 0x%08X bytes\n", size);
+
+        Exception e = {
+            EXCEPTION_INFO,
+            GS_IOException,
+            error
+        };
+        _throw(e);
+    }
+
+    /* Send data size */
+    DEBUGPRINT("Size: 0x%08X\n", size);
+    _gs_exch_32(size);
+
+    for (i = 0; i < size; i += len) {
+        len = MIN(sizeof(chunk), size - i);
+        for (j = 0; j < len; j += got) {
+            got = source->read(source, &chunk[j], len - j);
+            if (!got) UNDERRUN();
+        }
+
+        sum = 0;
+        for (j = 0; j < len; j++) {
+            _gs_exch_8(chunk[j]);
+            sum += chunk[j];
+        }
+
+        /* Verify; the GS answers our sum with its own */
+        calc_sum = _gs_exch_8(sum);
+        if (calc_sum != sum) {
+            sprintf(error, "Checksum failure in code list at 0x%04X:\n"
+                "  Received: 0x%02X\n"
+                "  Expected: 0x%02X\n",
+                i, calc_sum, sum);
+
+            Exception e = {
+                EXCEPTION_INFO,
+                GS_TimeoutException,
+                error
+            };
+            _throw(e);
+        }
+
+        /* Run callback periodically */
+        if (callback && !((i + len) & 0x0FFF)) {
+            callback(i + len);
+        }
+    }
+}
+
+/* Send SCREEN_SHOT and read the frame buffer description */
+void _gs_screen_header(GS_FRAME *frame, int mode) {
+    static char error[80] = { 0 };
+
+    _gs_cmd(GS_CMD_SCREEN_SHOT);
+    _gs_exch_8(mode);
+
+    frame->address = _gs_exch_32(0);
+    frame->width = _gs_exch_8(0) << 8;
+    frame->width |= _gs_exch_8(0);
+    frame->height = _gs_exch_8(0) << 8;
+    frame->height |= _gs_exch_8(0);
+    frame->depth = _gs_exch_8(0);
+    DEBUGPRINT("Frame: 0x%08X, %ux%u, %u bytes per pixel\n",
+        frame->address, frame->width, frame->height, frame->depth);
+
+    if (!frame->width || !frame->height) {
+        Exception e = {
+            EXCEPTION_INFO,
+            GS_IOException,
+            "No frame is being displayed."
+        };
+        _throw(e);
+    }
+    if ((frame->width > GS_FRAME_MAX_WIDTH) || (frame->height > GS_FRAME_MAX_HEIGHT) ||
+        ((frame->depth != 2) && (frame->depth != 4))) {
+        sprintf(error, "Unexpected frame buffer: %ux%u, %u bytes per pixel\n",
+            frame->width, frame->height, frame->depth);
+
+        Exception e = {
+            EXCEPTION_INFO,
+            GS_IOException,
+            error
+        };
+        _throw(e);
+    }
+}
+
+/* Read a whole frame; the sink is fed one verified line at a time */
+void _gs_screen_shot(GS_FRAME *frame, GS_SINK *sink, void (*callback)(uint32_t)) {
+    uint32_t i;
+    uint32_t y;
+    uint32_t pitch;
+    uint8_t sum;
+    uint8_t calc_sum;
+    uint8_t line[GS_FRAME_MAX_WIDTH * 4];
+    static char error[80] = { 0 };
+
+    _gs_screen_header(frame, GS_SHOT_FULL);
+    pitch = frame->width * frame->depth;
+
+    for (y = 0; y < frame->height; y++) {
+        sum = 0;
+        for (i = 0; i < pitch; i++) {
+            line[i] = _gs_exch_8(0);
+            sum += line[i];
+        }
+
+        /* Verify */
+        calc_sum = _gs_exch_8(0);
+        if (calc_sum != sum) {
+            sprintf(error, "Checksum failure in frame line %u:\n"
+                "  Received: 0x%02X\n"
+                "  Expected: 0x%02X\n",
+                y, calc_sum, sum);
+
+            Exception e = {
+                EXCEPTION_INFO,
+                GS_TimeoutException,
+                error
+            };
+            _throw(e);
+        }
+
+        if (sink->write(sink, line, pitch)) SINK_FAILED();
+
+        /* Run callback periodically */
+        if (callback && !((y + 1) & 0x0F)) {
+            callback((y + 1) * pitch);
+        }
+    }
+}
+
+/* Stream ROM data for the on-board EEPROM from a source */
+void _gs_upgrade(GS_SOURCE *source) {
+    int i;
+    uint32_t size = source->size;
+    uint16_t sum = 0;
+    uint16_t calc_sum = 0;
+    uint8_t chunk[GS_SOURCE_CHUNK];
+    size_t chunk_size = 0;
+    size_t chunk_pos = 0;
+    static char error[80] = { 0 };
+
+    /* Force max size to 256KB */
+    if (size > 0x00040000) {
+        size = 0x00040000;
+    }
+
+    _gs_cmd(GS_CMD_UPGRADE);
+    _gs_cmd(GS_CMD_NULL);
+
+    /* Send data size */
+    _gs_exch_32(size);
+
+    /* Send data */
+    for (i = 0; i < size; i++) {
+        if (chunk_pos == chunk_size) {
+            chunk_size = source->read(source, chunk, MIN(sizeof(chunk), (size_t)(size - i)));
+            chunk_pos = 0;
+            if (!chunk_size) UNDERRUN();
+        }
+        _gs_exch_8(chunk[chunk_pos]);
+        sum += chunk[chunk_pos++];
+    }
+
+    /* Verify */
+    sum &= 0x0FFF;
+    calc_sum = (_gs_exch_8(sum) | (_gs_exch_8(sum >> 8) << 8)) & 0x0FFF;
+    if (calc_sum != sum) {
+        sprintf(error, "Checksum failure during ROM upload:\n"
+            "  Received: 0x%02X\n"
+            "  Expected: 0x%02X\n",
+            calc_sum, sum);
+
+        Exception e = {
+            EXCEPTION_INFO,
+            GS_TimeoutException,
+            error
+        };
+        _throw(e);
+    }
+}
+
+/* Synchronize nybble-mode communication, and enter the "awaiting command" state */
+void _gs_sync(void) {
+    int timeout = 1000;
+    uint8_t result = 0;
+
+    while (--timeout) {
+        /*
+         * Repeatedly send 0x3 until we receive 'g'.
+         *
+         * The 0x03 puts GS into "awaiting command" state.
+         * 'g' is the response to the first byte of the command handshake.
+         *
+         * This function synchronizes nybble-mode communication line,
+         * and puts the GS into its "awaiting command" state.
+         */
+        result = (result << 4) | _gs_exch_4(3);
+        if (result == 'g') break;
+    }
+    if (!timeout) TIMEOUT();
+}
+
+/* Send one nybble to the fast transfer stub, and receive another; one edge each */
+uint8_t _gs_fast_exch_4(uint8_t out) {
+    int timeout = _gs_timeout;
+    uint8_t ack;
+    uint8_t data;
+
+    _gs_fast_phase ^= 0x10;
+    ack = _gs_fast_phase >> 1;
+
+    _gs_config.out_callback((out & 0x0F) | _gs_fast_phase, _GS_LPT_DATA);
+
+    /* The stub copies the strobe level to STAT bit 3 once its nybble is ready */
+    while ((--timeout) && (((data = _gs_config.in_callback(_GS_LPT_STAT)) & 0x08) != ack));
+    if (!timeout) TIMEOUT();
+
+    return (data >> 4) ^ 0x08;
+}
+
+uint8_t _gs_fast_exch_8(uint8_t out) {
+    uint8_t data;
+
+    data  = _gs_fast_exch_4(out >> 4) << 4;
+    data |= _gs_fast_exch_4(out >> 0) << 0;
+
+    return data;
+}
+
+uint32_t _gs_fast_exch_32(uint32_t out) {
+    uint32_t result;
+
+    result  = _gs_fast_exch_8(out >> 24) << 24;
+    result |= _gs_fast_exch_8(out >> 16) << 16;
+    result |= _gs_fast_exch_8(out >> 8)  << 8;
+    result |= _gs_fast_exch_8(out >> 0)  << 0;
+
+    return result;
+}
+
+/* Send command to the fast transfer stub */
+void _gs_fast_cmd(int cmd, int tries) {
+    DEBUGPRINT("Sending fast command: 0x%02X\n", cmd);
+
+    /* Command Handshake */
+    while (--tries) {
+        if (_gs_fast_exch_8('F') != 'f')
+            continue;
+        if (_gs_fast_exch_8('S') == 's')
+            break;
+    }
+    if (!tries) TIMEOUT();
+
+    _gs_fast_exch_8(cmd);
+}
+
+/* Receive one block of a fast READ or HASH payload, retrying on CRC failures; `at` is for errors */
+void _gs_fast_block(uint8_t *block, uint32_t len, uint32_t at) {
+    uint32_t n;
+    uint32_t words;
+    uint16_t crc;
+    uint8_t token;
+    uint8_t word[4];
+    int tries;
+    static char error[80] = { 0 };
+
+    for (tries = 0; ; tries++) {
+        /* Decode runs until the block is full */
+        for (n = 0; n < len; ) {
+            token = _gs_fast_exch_8(0);
+            words = (token & 0x7F) + 1;
+            if ((n + (words * 4)) > len) {
+                sprintf(error, "Fast read framing error at 0x%08X\n", at + n);
+
+                Exception e = {
+                    EXCEPTION_INFO,
+                    GS_IOException,
+                    error
+                };
+                _throw(e);
+            }
+
+            if (token & 0x80) {
+                word[0] = _gs_fast_exch_8(0);
+                word[1] = _gs_fast_exch_8(0);
+                word[2] = _gs_fast_exch_8(0);
+                word[3] = _gs_fast_exch_8(0);
+                for (; words; words--, n += 4) {
+                    memcpy(&block[n], word, 4);
+                }
+            }
+            else {
+                for (words *= 4; words; words--) {
+                    block[n++] = _gs_fast_exch_8(0);
+                }
+            }
+        }
+
+        crc  = _gs_fast_exch_8(0) << 8;
+        crc |= _gs_fast_exch_8(0);
+        if (crc == gs_crc16(block, len)) {
+            _gs_fast_exch_8(GS_FAST_ACK);
+            return;
+        }
+
+        DEBUGPRINT("CRC failure at 0x%08X; retrying\n", at);
+        _gs_fast_exch_8(GS_FAST_NAK);
+        if (tries == GS_FAST_RETRIES) {
+            sprintf(error, "CRC failure during fast read at 0x%08X\n", at);
+
+            Exception e = {
+                EXCEPTION_INFO,
+                GS_TimeoutException,
+                error
+            };
+            _throw(e);
+        }
+    }
+}
+
+/*
+ * Read CPU memory through the fast transfer stub, into a buffer or a sink
+ *
+ * The stub reads whole words, so the request is widened to word boundaries
+ * and only the requested bytes are kept.
+ */
+void _gs_fast_read(uint8_t *data, GS_SINK *sink, uint32_t address, uint32_t size, void (*callback)(uint32_t)) {
+    uint32_t start = address & ~3;
+    uint32_t total = ((address + size + 3) & ~3) - start;
+    uint32_t done;
+    uint32_t len;
+    uint32_t n;
+    uint32_t lo;
+    uint32_t hi;
+    uint32_t copy;
+    uint32_t kept = 0;
+    uint8_t block[GS_FAST_BLOCK];
+    uint8_t chunk[GS_SINK_CHUNK];
+    size_t chunk_pos = 0;
+
+    _gs_fast_cmd(GS_FAST_READ, _gs_timeout);
+    _gs_fast_exch_32(start);
+    _gs_fast_exch_32(total);
+
+    for (done = 0; done < total; done += len) {
+        len = MIN((uint32_t)GS_FAST_BLOCK, total - done);
+        _gs_fast_block(block, len, start + done);
+
+        /* Keep the part of the block inside the requested range */
+        lo = MAX(start + done, address);
+        hi = MIN(start + done + len, address + size);
+        if (sink) {
+            for (n = lo; n < hi; n += copy) {
+                if (chunk_pos == sizeof(chunk)) {
+                    if (sink->write(sink, chunk, chunk_pos)) SINK_FAILED();
+                    chunk_pos = 0;
+                }
+                copy = MIN(hi - n, (uint32_t)(sizeof(chunk) - chunk_pos));
+                memcpy(&chunk[chunk_pos], &block[n - start - done], copy);
+                chunk_pos += copy;
+            }
+        }
+        else {
+            memcpy(&data[lo - address], &block[lo - start - done], hi - lo);
+        }
+
+        /* Run callback periodically */
+        if (callback && ((kept >> 14) != ((hi - address) >> 14))) {
+            callback((hi - address) & ~0x3FFF);
+        }
+        kept = hi - address;
+    }
+
+    if (sink && chunk_pos) {
+        if (sink->write(sink, chunk, chunk_pos)) SINK_FAILED();
+    }
+
+    /* Final callback */
+    if (callback && (kept & 0x3FFF)) {
+        callback(kept);
+    }
+}
+
+/* Hash CPU memory on the console, one GS_FAST_HASH_PAGE page at a time */
+void _gs_fast_hashes(uint64_t *hashes, uint32_t address, uint32_t size) {
+    uint32_t total = ((size + GS_FAST_HASH_PAGE - 1) / GS_FAST_HASH_PAGE) * 8;
+    uint32_t done;
+    uint32_t len;
+    uint32_t n;
+    uint8_t block[GS_FAST_BLOCK];
+
+    _gs_fast_cmd(GS_FAST_HASH, _gs_timeout);
+    _gs_fast_exch_32(address);
+    _gs_fast_exch_32(size);
+
+    for (done = 0; done < total; done += len) {
+        len = MIN((uint32_t)GS_FAST_BLOCK, total - done);
+        _gs_fast_block(block, len, address + ((done / 8) * GS_FAST_HASH_PAGE));
+
+        for (n = 0; n < len; n += 8) {
+            hashes[(done + n) / 8] = ((uint64_t)_gs_get32(&block[n]) << 32) | _gs_get32(&block[n + 4]);
+        }
+    }
+}
+
+/* Write CPU memory through the fast transfer stub, from a buffer or a source */
+void _gs_fast_write(uint8_t *data, GS_SOURCE *source, uint32_t address, uint32_t size, void (*callback)(uint32_t)) {
+    uint32_t done;
+    uint32_t len;
+    uint32_t padded;
+    uint32_t encoded;
+    uint32_t i;
+    uint16_t crc;
+    size_t got;
+    uint8_t block[GS_FAST_BLOCK];
+    uint8_t out[GS_FAST_BLOCK + (GS_FAST_BLOCK / 256) + 2];
+    int tries;
+    static char error[80] = { 0 };
+
+    _gs_fast_cmd(GS_FAST_WRITE, _gs_timeout);
+    _gs_fast_exch_32(address);
+    _gs_fast_exch_32(size);
+
+    for (done = 0; done < size; done += len) {
+        len = MIN((uint32_t)GS_FAST_BLOCK, size - done);
+        padded = (len + 3) & ~3;
+
+        if (source) {
+            for (i = 0; i < len; i += got) {
+                got = source->read(source, &block[i], len - i);
+                if (!got) UNDERRUN();
+            }
+        }
+        else {
+            memcpy(block, &data[done], len);
+        }
+        memset(&block[len], 0, padded - len);
+
+        encoded = gs_fast_encode(block, padded, out);
+        crc = gs_crc16(block, padded);
+        out[encoded++] = crc >> 8;
+        out[encoded++] = crc;
+
+        for (tries = 0; ; tries++) {
+            for (i = 0; i < encoded; i++) {
+                _gs_fast_exch_8(out[i]);
+            }
+
+            /* The stub answers while we send a filler byte */
+            if (_gs_fast_exch_8(0) == GS_FAST_ACK) {
+                break;
+            }
+
+            DEBUGPRINT("CRC failure at 0x%08X; retrying\n", address + done);
+            if (tries == GS_FAST_RETRIES) {
+                sprintf(error, "CRC failure during fast write at 0x%08X\n", address + done);
+
+                Exception e = {
+                    EXCEPTION_INFO,
+                    GS_TimeoutException,
+                    error
+                };
+                _throw(e);
+            }
+        }
+
+        /* Run callback periodically */
+        if (callback && ((done >> 14) != ((done + len) >> 14))) {
+            callback((done + len) & ~0x3FFF);
+        }
+    }
+
+    /* Final callback */
+    if (callback && (size & 0x3FFF)) {
+        callback(size);
+    }
+}
+
+/* Adapts READ / WRITE range callbacks to _gs_fast_read() / _gs_fast_write() */
+void _gs_fast_range_progress(uint32_t size) {
+    _gs_fast_range_callback(_gs_fast_range_index, size);
+}
+
+/* READ or WRITE through the fast transfer stub; same packing as _gs_mem() */
+void _gs_fast_mem(uint8_t *data, GS_SOURCE *source, GS_RANGE *range, void (*callback)(int, uint32_t), bool write) {
+    uint32_t pos = 0;
+    int count;
+
+    _gs_fast_range_callback = callback;
+
+    for (count = 0; range[count].address && range[count].size; count++) {
+        _gs_fast_range_index = count;
+
+        if (write) {
+            _gs_fast_write(source ? NULL : &data[pos], source, range[count].address, range[count].size,
+                callback ? _gs_fast_range_progress : NULL);
+        }
+        else {
+            _gs_fast_read(&data[pos], NULL, range[count].address, range[count].size,
+                callback ? _gs_fast_range_progress : NULL);
+        }
+
+        pos += range[count].size;
+    }
+}
+
+/* Unload the fast transfer stub; the game runs again */
+void _gs_fast_leave(void) {
+    _gs_fast = false;
+    _gs_fast_cmd(GS_FAST_UNLOAD, _gs_timeout);
+}
+
+/* Hand the link back to the GS firmware for commands the stub does not speak */
+void _gs_stock(void) {
+    if (_gs_fast) {
+        _gs_fast_leave();
+        _gs_sync();
+    }
+}
+
+void _gs_transfer_fail(GS_TRANSFER *t, const char *msg) {
+    snprintf(t->error, sizeof(t->error), "%s", msg);
+    t->state = GS_TRANSFER_FAILED;
+}
+
+/* Send the next range, or the null range that ends READ / WRITE */
+void _gs_transfer_range(GS_TRANSFER *t) {
+    GS_RANGE *range = &t->range[t->index];
+
+    t->count = 0;
+    if (range->address && range->size && !((t->command == GS_CMD_READ_ROM) && t->index)) {
+        t->phase = _GS_PHASE_ADDRESS;
+        t->word = range->address;
+        t->tx = t->word >> 24;
+    }
+    else if (t->command == GS_CMD_READ_ROM) {
+        t->phase = _GS_PHASE_CHECKSUM;
+        t->tx = 0;
+    }
+    else {
+        t->phase = _GS_PHASE_END;
+        t->tx = 0;
+    }
+}
+
+/* Handle one complete byte exchange, and choose the next byte to send */
+void _gs_transfer_byte(GS_TRANSFER *t, uint8_t rx) {
+    GS_RANGE *range = &t->range[t->index];
+    uint8_t sent = t->tx;
+
+    switch (t->phase) {
+        case _GS_PHASE_HANDSHAKE_G:
+            if (rx == 'g') {
+                t->phase = _GS_PHASE_HANDSHAKE_T;
+                t->tx = 'T';
+            }
+            else if (++t->tries >= t->timeout) {
+                _gs_transfer_fail(t, "Communications link timed out.");
+            }
+            break;
+
+        case _GS_PHASE_HANDSHAKE_T:
+            t->phase = _GS_PHASE_HANDSHAKE_G;
+            t->tx = 'G';
+            if (rx == 't') {
+                t->phase = _GS_PHASE_COMMAND;
+                t->tx = t->pending;
+            }
+            else if (++t->tries >= t->timeout) {
+                _gs_transfer_fail(t, "Communications link timed out.");
+            }
+            break;
+
+        case _GS_PHASE_COMMAND:
+            if (t->pending == GS_CMD_UNPAUSE) {
+                t->state = GS_TRANSFER_DONE;
+                break;
+            }
+            _gs_transfer_range(t);
+            break;
+
+        case _GS_PHASE_ADDRESS:
+        case _GS_PHASE_SIZE:
+            if (++t->count < 4) {
+                t->tx = t->word >> (24 - (t->count * 8));
+                break;
+            }
+            t->count = 0;
+
+            if (t->phase == _GS_PHASE_ADDRESS) {
+                t->phase = _GS_PHASE_SIZE;
+                t->word = range->size;
+                t->tx = t->word >> 24;
+            }
+            else {
+                t->phase = _GS_PHASE_DATA;
+                t->tx = (t->command == GS_CMD_WRITE) ? t->data[t->pos] : 0;
+            }
+            break;
+
+        case _GS_PHASE_DATA:
+            if (t->command == GS_CMD_WRITE) {
+                t->sum += sent;
+            }
+            else {
+                t->data[t->pos] = rx;
+
+                /* READ_ROM sums the low byte of each word */
+                if ((t->command != GS_CMD_READ_ROM) || ((t->count & 3) == 3)) {
+                    t->sum += rx;
+                }
+            }
+            t->pos++;
+            t->done++;
+
+            if (++t->count < range->size) {
+                t->tx = (t->command == GS_CMD_WRITE) ? t->data[t->pos] : 0;
+                break;
+            }
+
+            t->index++;
+            _gs_transfer_range(t);
+            break;
+
+        case _GS_PHASE_END:
+            if (++t->count == 8) {
+                t->phase = _GS_PHASE_CHECKSUM;
+            }
+            t->tx = 0;
+            break;
+
+        case _GS_PHASE_CHECKSUM:
+            if (rx != t->sum) {
+                snprintf(t->error, sizeof(t->error), "Checksum failure: received 0x%02X, expected 0x%02X",
+                    rx, t->sum);
+                t->state = GS_TRANSFER_FAILED;
+                break;
+            }
+
+            if ((t->flags & GS_TRANSFER_EXIT) && (t->command != GS_CMD_READ_ROM)) {
+                t->pending = GS_CMD_UNPAUSE;
+                t->phase = _GS_PHASE_HANDSHAKE_G;
+                t->tries = 0;
+                t->tx = 'G';
+                break;
+            }
+            t->state = GS_TRANSFER_DONE;
+            break;
+    }
+}
+
+/* Handle one nybble from the device */
+void _gs_transfer_nibble(GS_TRANSFER *t, uint8_t nybble) {
+    if (t->phase == _GS_PHASE_SYNC) {
+        /* Same as gs_enter(): send 0x3 until 'g' comes back */
+        t->sync = (t->sync << 4) | nybble;
+        if (t->sync == 'g') {
+            t->phase = _GS_PHASE_HANDSHAKE_G;
+            t->tries = 0;
+            t->tx = 'G';
+        }
+        else if (++t->tries >= 1000) {
+            _gs_transfer_fail(t, "Communications link timed out.");
+        }
+        return;
+    }
+
+    t->rx = (t->rx << 4) | nybble;
+    t->low = !t->low;
+    if (!t->low) {
+        _gs_transfer_byte(t, t->rx);
+    }
+}
+
+uint32_t _gs_get32(const uint8_t *p) {
+    return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+void _gs_put32(uint8_t *p, uint32_t value) {
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+
+/* Public functions */
+
+/* Raw port access, for transports that wrap the hardware (e.g. a recorder) */
+uint8_t gs_port_in(uint16_t port) {
+    return _gs_in(port);
+}
+
+void gs_port_out(uint8_t data, uint16_t port) {
+    _gs_out(data, port);
+}
+
+/* Initialize the library */
+GS_STATUS gs_init(GS_CONFIG *config) {
+    if (_gs_ready) {
+        return GS_SUCCESS;
+    }
+
+    _gs_config.port = _GS_DEFAULT_PORT;
+    _gs_config.port_dev = _GS_DEFAULT_PORT_DEV;
+    _gs_config.in_callback = _gs_in;
+    _gs_config.out_callback = _gs_out;
+
+    if (config) {
+        if (config->port)
+            _gs_config.port = config->port;
+        if (config->port_dev)
+            _gs_config.port_dev = config->port_dev;
+        if (config->in_callback)
+            _gs_config.in_callback = config->in_callback;
+        if (config->out_callback)
+            _gs_config.out_callback = config->out_callback;
+        _gs_config.virtual_port = config->virtual_port;
+        _gs_config.adaptive = config->adaptive;
+        _gs_config.stock_only = config->stock_only;
+    }
+
+    memset(&_gs_link, 0, sizeof(_gs_link));
+    _gs_link.window = GS_WINDOW_START;
+
+    if (_gs_config.virtual_port) {
+        _gs_ready++;
+
+        return GS_SUCCESS;
+    }
+
+    #if defined(_WIN32)
+        /* Windows, including 64-bit */
+        /* Do not use the UNIMPLEMENTED() macro here; no try/catch sugar */
+        ERRORPRINT("%s\n", "UNIMPLEMENTED");
+
+        return GS_ERROR;
+    #elif defined (linux)
+        /* Linux */
+        assert(_gs_config.port_dev);
+
+        _gs_port_fd = open(_gs_config.port_dev, O_RDWR);
+        if (_gs_port_fd == -1) {
+            ERRORPRINT("Unable to open '%s' for read/write\n", _gs_config.port_dev);
+
+            return GS_ERROR;
+        }
+
+        if (ioctl(_gs_port_fd, PPCLAIM, NULL)) {
+            ERRORPRINT("Could not claim '%s'\n", _gs_config.port_dev);
+            close(_gs_port_fd);
+            _gs_port_fd = -1;
+
+            return GS_ERROR;
+        }
+
+        int _gs_port_mode = IEEE1284_MODE_NIBBLE;
+        if (ioctl(_gs_port_fd, PPSETMODE, &_gs_port_mode)) {
+            ERRORPRINT("Could not set nibble mode for '%s'\n", _gs_config.port_dev);
+            ioctl(_gs_port_fd, PPRELEASE);
+            close(_gs_port_fd);
+            _gs_port_fd = -1;
+
+            return GS_ERROR;
+        }
+    #elif defined(HAS_SYSIO_H)
+        /* Other UNIX-like environments with low-level IO */
+        if (ioperm(_GS_LPT_DATA, 2, 1)) {
+            ERRORPRINT("%s\n", "Couldn't get LPT, are you root?");
+
+            return GS_ERROR;
+        }
+    #else /* !defined(_WIN32) */
+        /* Unknown, unsupported */
+        /* Do not use the UNIMPLEMENTED() macro here; no try/catch sugar */
+        ERRORPRINT("%s\n", "UNIMPLEMENTED");
+
+        return GS_ERROR;
+    #endif /* defined(_WIN32) */
+
+    _gs_ready++;
+
+    return GS_SUCCESS;
+}
+
+/* Finish library calls */
+GS_STATUS gs_quit(void) {
+    assert(_gs_ready);
+
+    if (_gs_ready > 0) {
+        _gs_ready--;
+
+        if (_gs_ready > 0) {
+            return GS_SUCCESS;
+        }
+    }
+
+    _try {
+        if (_gs_fast) {
+            _gs_fast_leave();
+        }
+        _gs_config.out_callback(0, _GS_LPT_DATA);
+    }
+    _catch (e) {
+        // Pass
+    };
+
+    _gs_config.port = 0;
+    _gs_config.port_dev = NULL;
+    _gs_config.in_callback = NULL;
+    _gs_config.out_callback = NULL;
+    _gs_config.adaptive = false;
+
+    if (_gs_config.virtual_port) {
+        _gs_config.virtual_port = false;
+
+        return GS_SUCCESS;
+    }
+
+    #if defined(_WIN32)
+        /* Windows, including 64-bit */
+        /* Do not use the UNIMPLEMENTED() macro here; no try/catch sugar */
+        ERRORPRINT("%s\n", "UNIMPLEMENTED");
+
+        return GS_ERROR;
+    #elif defined (linux)
+        /* Linux */
+        ioctl(_gs_port_fd, PPRELEASE);
+        close(_gs_port_fd);
+        _gs_port_fd = -1;
+    #elif defined(HAS_SYSIO_H)
+        /* Other UNIX-like environments with low-level IO */
+        ioperm(_GS_LPT_DATA, 2, 0);
+    #else /* !defined(_WIN32) */
+        /* Unknown, unsupported */
+        /* Do not use the UNIMPLEMENTED() macro here; no try/catch sugar */
+        ERRORPRINT("%s\n", "UNIMPLEMENTED");
+
+        return GS_ERROR;
+    #endif /* defined(_WIN32) */
+
+    return GS_SUCCESS;
+}
+
+/* Enter PC-control */
+GS_STATUS gs_enter(void) {
+    assert(_gs_ready);
+
+    DEBUGPRINT("%s\n", "Entering...");
+
+    /* The fast transfer stub takes the CPU with each command handshake */
+    if (_gs_fast) {
+        return GS_SUCCESS;
+    }
+
+    _try {
+        _gs_sync();
+    }
+    _catch (e) {
+        ERRORPRINT("%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
+
+        return GS_ERROR;
+    }
+
+    return GS_SUCCESS;
+}
+
+/* Exit PC-control */
+GS_STATUS gs_exit(void) {
+    assert(_gs_ready);
+
+    _try {
+        if (_gs_fast) {
+            _gs_fast_cmd(GS_FAST_RESUME, _gs_timeout);
+        }
+        else {
+            _gs_cmd(GS_CMD_UNPAUSE);
+        }
+    }
+    _catch (e) {
+        ERRORPRINT("%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
+
+        return GS_ERROR;
+    }
+
+    return GS_SUCCESS;
+}
+
+/* Read CPU memory */
+GS_STATUS gs_read(uint8_t *in, GS_RANGE *range, void (*callback)(int, uint32_t)) {
+    assert(_gs_ready);
+
+    if (_gs_config.adaptive && !_gs_fast) {
+        return _gs_windowed(in, NULL, range, false, callback, NULL);
+    }
+
+    _try {
+        if (_gs_fast) {
+            _gs_fast_mem(in, NULL, range, callback, false);
+        }
+        else {
+            _gs_mem(in, NULL, range, callback, false);
+        }
+    }
+    _catch (e) {
+        ERRORPRINT("%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
+
+        return GS_ERROR;
+    }
+
+    return GS_SUCCESS;
+}
+
+/* True when the firmware refuses a READ range starting at `address` */
+bool gs_read_blocked(uint32_t address) {
+    return ((address >= 0x80780000) && (address <= 0x807FFFFF)) || (address >= GS_READ_HIGH);
+}
+
+/* Write CPU memory */
+GS_STATUS gs_write(uint8_t *out, GS_RANGE *range, void (*callback)(int, uint32_t)) {
+    assert(_gs_ready);
+
+    _try {
+        if (_gs_fast) {
+            _gs_fast_mem(out, NULL, range, callback, true);
+        }
+        else {
+            _gs_mem(out, NULL, range, callback, true);
+        }
+    }
+    _catch (e) {
+        ERRORPRINT("%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
+
+        return GS_ERROR;
+    }
+
+    return GS_SUCCESS;
+}
+
+/* Write CPU memory, pulling the data from a source as it is sent */
+GS_STATUS gs_write_source(GS_SOURCE *source, GS_RANGE *range, void (*callback)(int, uint32_t)) {
+    assert(_gs_ready);
+    assert(source && source->read);
+
+    _try {
+        if (_gs_fast) {
+            _gs_fast_mem(NULL, source, range, callback, true);
+        }
+        else {
+            _gs_mem(NULL, source, range, callback, true);
+        }
+    }
+    _catch (e) {
+        ERRORPRINT("%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
+
+        return GS_ERROR;
+    }
+
+    return GS_SUCCESS;
+}
+
+/* Discover GS run mode (and exit PC-control) */
+GS_STATUS gs_where(uint8_t *out) {
+    assert(_gs_ready);
+
+    _try {
+        if (_gs_fast) {
+            /* The stub only ever runs in game */
+            _gs_fast_cmd(GS_FAST_RESUME, _gs_timeout);
+            *out = GS_WHERE_GAME;
+        }
+        else {
+            _gs_cmd(GS_CMD_WHERE);
+
+            /* Returns GS_WHERE_MENU when in the menu, GS_WHERE_GAME when in game */
+            *out = _gs_exch_8(0);
+        }
+    }
+    _catch (e) {
+        ERRORPRINT("%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
+
+        return GS_ERROR;
+    }
+
+    return GS_SUCCESS;
+}
+
+/* Get GS firmware version (and exit PC-control) */
+GS_STATUS gs_version(uint8_t *size, char *version, int buf_size) {
+    int i;
+    uint8_t buf = 0;
+
+    assert(_gs_ready);
+    assert(buf_size > 1); /* We need a buffer with valid size */
+
+    buf_size--; /* Allocate one byte for the null-terminator */
+
+    _try {
+        _gs_stock();
+        _gs_cmd(GS_CMD_VERSION);
+
+        /* FIXME: Verify this... */
+        while (buf != 0x2E) {
+            buf = _gs_exch_8(0);
+            if (buf == 'g') {
+                /* Exit GS "awaiting command" state" */
+                gs_exit();
+
+                ERRORPRINT("%s\n", "Cannot detect firmware version while in-game");
+
+                return GS_ERROR;
+            }
+        }
+
+        /* Get size of version string */
+        *size = _gs_exch_8(0);
+
+        /* Get version string */
+        for (i = 0; i < *size; i++) {
+            buf = _gs_exch_8(0);
+            if (i < buf_size) {
+                version[i] = buf;
+            }
+        }
+
+        /* Append null-terminator to version string */
+        version[MIN(buf_size, i)] = '\0';
+    }
+    _catch (e) {
+        ERRORPRINT("%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
+
+        return GS_ERROR;
+    }
+
+    return GS_SUCCESS;
+}
+
+/* Upload ROM data to be written to the on-board EEPROM */
+GS_STATUS gs_upgrade(uint8_t *buffer, uint32_t buf_size) {
+    GS_SOURCE source;
+
+    assert(buf_size > 0); /* We need a buffer with valid size */
+
+    gs_source_memory(&source, buffer, buf_size);
+
+    return gs_upgrade_source(&source);
+}
+
+/* Upload ROM data from a source, streaming it as it is sent */
+GS_STATUS gs_upgrade_source(GS_SOURCE *source) {
+    assert(_gs_ready);
+    assert(source && source->read);
+    assert(source->size > 0); /* We need a source with valid size */
+
+    _try {
+        _gs_stock();
+        _gs_upgrade(source);
+
+        /* GS sends 0x01 to indicate the checksum is valid */
+        if (_gs_exch_8(0) != 1) {
+            ERRORPRINT("%s\n", "Updater could not verify checksum");
+
+            return GS_ERROR;
+        }
+
+        DEBUGPRINT("%s\n", "Upload complete. Waiting for final response...");
+
+        sleep(5);
+
+        /* GS sends 0x01 to indicate the ROM upgrade was successful */
+        if (_gs_exch_8(0) != 1) {
+            ERRORPRINT("%s\n", "Could not validate ROM after write");
+
+            return GS_ERROR;
+        }
+
+        return GS_SUCCESS;
+    }
+    _catch (e) {
+        ERRORPRINT("%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
+
+        return GS_ERROR;
+    }
+
+    ERRORPRINT("%s\n", "Undefined error (Should never happen).");
+
+    return GS_ERROR;
+}
+
+/* Read CPU memory 32-bits at a time (and exit PC-control) */
+GS_STATUS gs_read_rom(uint8_t *data, GS_RANGE *range, void (*callback)(uint32_t)) {
+    if (_gs_config.adaptive && !_gs_fast) {
+        return _gs_windowed(data, NULL, range, true, NULL, callback);
+    }
+
+    _try {
+        if (_gs_fast) {
+            range->address &= ~3;
+            range->size = (range->size + 3) & ~3;
+            _gs_fast_read(data, NULL, range->address, range->size, callback);
+            _gs_fast_cmd(GS_FAST_RESUME, _gs_timeout);
+        }
+        else {
+            _gs_read_rom(data, NULL, range, callback);
+        }
+    }
+    _catch (e) {
+        ERRORPRINT("%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
+
+        return GS_ERROR;
+    }
+
+    return GS_SUCCESS;
+}
+
+/*
+ * Read CPU memory 32-bits at a time into a sink (and exit PC-control)
+ *
+ * Data is handed to the sink in GS_SINK_CHUNK pieces as it arrives. The
+ * checksum covers the whole transfer, so sinks must not treat data as final
+ * until this function returns GS_SUCCESS.
+ */
+GS_STATUS gs_read_rom_sink(GS_SINK *sink, GS_RANGE *range, void (*callback)(uint32_t)) {
+    assert(sink && sink->write);
+
+    if (_gs_config.adaptive && !_gs_fast) {
+        return _gs_windowed(NULL, sink, range, true, NULL, callback);
+    }
+
+    _try {
+        if (_gs_fast) {
+            range->address &= ~3;
+            range->size = (range->size + 3) & ~3;
+            _gs_fast_read(NULL, sink, range->address, range->size, callback);
+            _gs_fast_cmd(GS_FAST_RESUME, _gs_timeout);
+        }
+        else {
+            _gs_read_rom(NULL, sink, range, callback);
+        }
+    }
+    _catch (e) {
+        ERRORPRINT("%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
+
+        return GS_ERROR;
+    }
+
+    return GS_SUCCESS;
+}
+
+/*
+ * Upload a fast transfer stub and hand the link over to it (see gspro.h)
+ *
+ * Must be called in PC-control. The image is uploaded to the address in its
+ * header, and the hook instructions are replaced with a jump to its entry
+ * point; the stub takes the CPU the next time the game passes the hook. If
+ * it does not answer, the hook is restored and the stock protocol is left in
+ * PC-control, so callers can carry on either way.
+ */
+GS_STATUS gs_fast_start(uint8_t *image, uint32_t size) {
+    uint32_t load;
+    uint32_t hook;
+    uint32_t entry;
+    uint8_t saved[8];
+    uint8_t jump[8] = { 0 };
+    GS_RANGE range[2] = { { 0, 0 }, { 0, 0 } };
+
+    assert(_gs_ready);
+
+    if (_gs_fast) {
+        return GS_SUCCESS;
+    }
+    if (_gs_config.stock_only) {
+        ERRORPRINT("%s\n", "The fast transfer stub cannot run over this transport");
+
+        return GS_ERROR;
+    }
+
+    if ((size < GS_FAST_HDR_ENTRY + 4) || (_gs_get32(image) != GS_FAST_MAGIC)) {
+        ERRORPRINT("%s\n", "Not a fast transfer stub image");
+
+        return GS_ERROR;
+    }
+    load = _gs_get32(&image[GS_FAST_HDR_LOAD]);
+    hook = _gs_get32(&image[GS_FAST_HDR_HOOK]);
+    entry = load + GS_FAST_HDR_ENTRY;
+    if ((load & 3) || (hook & 3) || ((entry & 0xF0000000) != ((hook + 4) & 0xF0000000))) {
+        ERRORPRINT("Stub at 0x%08X cannot be reached from hook 0x%08X\n", load, hook);
+
+        return GS_ERROR;
+    }
+
+    /* J entry; NOP */
+    _gs_put32(jump, 0x08000000 | ((entry >> 2) & 0x03FFFFFF));
+
+    _try {
+        /* The stub restores the hooked instructions when it is unloaded */
+        range[0].address = hook;
+        range[0].size = sizeof(saved);
+        _gs_mem(saved, NULL, range, NULL, false);
+        memcpy(&image[GS_FAST_HDR_SAVED], saved, sizeof(saved));
+
+        range[0].address = load;
+        range[0].size = size;
+        _gs_mem(image, NULL, range, NULL, true);
+
+        range[0].address = hook;
+        range[0].size = sizeof(jump);
+        _gs_mem(jump, NULL, range, NULL, true);
+
+        _gs_cmd(GS_CMD_UNPAUSE);
+    }
+    _catch (e) {
+        ERRORPRINT("%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
+
+        return GS_ERROR;
+    }
+
+    _gs_fast_phase = 0;
+    _try {
+        _gs_fast_cmd(GS_FAST_NOP, 64);
+        _gs_fast = true;
+    }
+    _catch (probe) {
+        DEBUGPRINT("%s\n", probe->msg);
+    };
+
+    if (_gs_fast) {
+        DEBUGPRINT("Fast transfer stub running at 0x%08X\n", load);
+
+        return GS_SUCCESS;
+    }
+
+    /* Fall back: retake the CPU with the stock protocol, and remove the hook */
+    _gs_config.out_callback(0, _GS_LPT_DATA);
+    _try {
+        _gs_sync();
+        range[0].address = hook;
+        range[0].size = sizeof(saved);
+        _gs_mem(saved, NULL, range, NULL, true);
+    }
+    _catch (retake) {
+        ERRORPRINT("%s:%d, %s(): %s\n", retake->file, retake->line, retake->function, retake->msg);
+    }
+
+    return GS_ERROR;
+}
+
+/* Unload the fast transfer stub (and exit PC-control) */
+GS_STATUS gs_fast_stop(void) {
+    assert(_gs_ready);
+
+    if (!_gs_fast) {
+        return GS_SUCCESS;
+    }
+
+    _try {
+        _gs_fast_leave();
+    }
+    _catch (e) {
         ERRORPRINT("%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
 
         return GS_ERROR;
@@ -498,45 +2043,143 @@ GS_STATUS gs_where(uint8_t *out) {
     return GS_SUCCESS;
 }
 
-/* Get GS firmware version (and exit PC-control) */
-GS_STATUS gs_version(uint8_t *size, char *version, int buf_size) {
-    int i;
-    uint8_t buf = 0;
+/* Link quality so far; adaptive windows only */
+void gs_link_stats(GS_LINK *link) {
+    *link = _gs_link;
+}
+
+bool gs_fast_active(void) {
+    return _gs_fast;
+}
+
+/*
+ * Run-length encode whole words for the fast transfer protocol
+ *
+ * Each run starts with a token byte: 0x00-0x7F is followed by 1-128 literal
+ * words, 0x80-0xFF by one word repeated 1-128 times. `size` must be a
+ * multiple of 4. `out` needs room for size + (size / 512) + 1 bytes.
+ */
+uint32_t gs_fast_encode(const uint8_t *data, uint32_t size, uint8_t *out) {
+    const uint32_t words = size / 4;
+    uint32_t len = 0;
+    uint32_t i = 0;
+    uint32_t run;
+    uint32_t start;
+
+    while (i < words) {
+        for (run = 1; (i + run < words) && (run < 128); run++) {
+            if (memcmp(&data[i * 4], &data[(i + run) * 4], 4)) break;
+        }
+
+        if (run > 1) {
+            out[len++] = 0x80 | (run - 1);
+            memcpy(&out[len], &data[i * 4], 4);
+            len += 4;
+            i += run;
+            continue;
+        }
+
+        /* Literals, up to the start of the next repeat */
+        for (start = i++; (i < words) && ((i - start) < 128); i++) {
+            if ((i + 1 < words) && !memcmp(&data[i * 4], &data[(i + 1) * 4], 4)) break;
+        }
+        out[len++] = (i - start) - 1;
+        memcpy(&out[len], &data[start * 4], (i - start) * 4);
+        len += (i - start) * 4;
+    }
+
+    return len;
+}
+
+/*
+ * The page hash the stub computes for GS_FAST_HASH: two 32-bit lanes over
+ * big-endian words, each a multiply and two ALU ops per word on the R4300.
+ * Changing any one word always changes both lanes. `size` must be a multiple
+ * of 4.
+ */
+uint64_t gs_fast_hash(const uint8_t *data, uint32_t size) {
+    uint32_t a = 0x811C9DC5;
+    uint32_t b = size;
+    uint32_t w;
+    uint32_t i;
+
+    for (i = 0; i < size; i += 4) {
+        w = _gs_get32(&data[i]);
+        a = (a ^ w) * 0x01000193;
+        b = (b + w) * 0x9E3779B1;
+        b = (b << 13) | (b >> 19);
+    }
+
+    return ((uint64_t)a << 32) | b;
+}
 
+/*
+ * Hash memory on the console through the fast transfer stub, one hash per
+ * GS_FAST_HASH_PAGE bytes (the last page may be shorter). `hashes` needs room
+ * for one per page. Only the hashes cross the link, so comparing them with
+ * gs_fast_hash() of an earlier copy finds the changed pages cheaply.
+ */
+GS_STATUS gs_fast_hash_pages(uint64_t *hashes, uint32_t address, uint32_t size) {
     assert(_gs_ready);
-    assert(buf_size > 1); /* We need a buffer with valid size */
 
-    buf_size--; /* Allocate one byte for the null-terminator */
+    if (!_gs_fast) {
+        ERRORPRINT("%s\n", "Page hashing needs the fast transfer stub");
+
+        return GS_ERROR;
+    }
+    if (!size || (address & 3) || (size & 3)) {
+        ERRORPRINT("Page hashes need whole words: 0x%08X, 0x%08X bytes\n", address, size);
+
+        return GS_ERROR;
+    }
 
     _try {
-        _gs_cmd(GS_CMD_VERSION);
+        _gs_fast_hashes(hashes, address, size);
+    }
+    _catch (e) {
+        ERRORPRINT("%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
 
-        /* FIXME: Verify this... */
-        while (buf != 0x2E) {
-            buf = _gs_exch_8(0);
-            if (buf == 'g') {
-                /* Exit GS "awaiting command" state" */
-                gs_exit();
+        return GS_ERROR;
+    }
 
-                ERRORPRINT("%s\n", "Cannot detect firmware version while in-game");
+    return GS_SUCCESS;
+}
 
-                return GS_ERROR;
+/* CRC-16/CCITT-FALSE, as used by fast transfer blocks */
+uint16_t gs_crc16(const uint8_t *data, size_t size) {
+    static uint16_t table[256];
+    static bool ready = false;
+    uint16_t crc = 0xFFFF;
+    size_t i;
+    int j;
+
+    if (!ready) {
+        for (i = 0; i < 256; i++) {
+            crc = i << 8;
+            for (j = 0; j < 8; j++) {
+                crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
             }
+            table[i] = crc;
         }
+        ready = true;
+        crc = 0xFFFF;
+    }
 
-        /* Get size of version string */
-        *size = _gs_exch_8(0);
+    for (i = 0; i < size; i++) {
+        crc = (crc << 8) ^ table[(crc >> 8) ^ data[i]];
+    }
 
-        /* Get version string */
-        for (i = 0; i < *size; i++) {
-            buf = _gs_exch_8(0);
-            if (i < buf_size) {
-                version[i] = buf;
-            }
-        }
+    return crc;
+}
 
-        /* Append null-terminator to version string */
-        version[MIN(buf_size, i)] = '\0';
+/* Read the Controller Pak into a sink, a page at a time */
+GS_STATUS gs_read_mempak(GS_SINK *sink, void (*callback)(uint32_t)) {
+    assert(_gs_ready);
+    assert(sink && sink->write);
+
+    _try {
+        _gs_stock();
+        _gs_read_mempak(sink, callback);
     }
     _catch (e) {
         ERRORPRINT("%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
@@ -547,63 +2190,120 @@ GS_STATUS gs_version(uint8_t *size, char *version, int buf_size) {
     return GS_SUCCESS;
 }
 
-/* Upload ROM data to be written to the on-board EEPROM */
-GS_STATUS gs_upgrade(uint8_t *buffer, uint32_t buf_size) {
-    int i;
-    uint16_t sum = 0;
-    uint16_t calc_sum = 0;
+/* Read the number of games in the code list, and the list's size in bytes */
+GS_STATUS gs_count_codes(uint32_t *games, uint32_t *size) {
+    assert(_gs_ready);
 
+    _try {
+        _gs_stock();
+        _gs_cmd(GS_CMD_COUNT_CODES);
+        *games = _gs_exch_32(0);
+        *size = _gs_exch_32(0);
+    }
+    _catch (e) {
+        ERRORPRINT("%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
+
+        return GS_ERROR;
+    }
+
+    return GS_SUCCESS;
+}
+
+/* Read the whole code list into a sink */
+GS_STATUS gs_get_codes(GS_SINK *sink, void (*callback)(uint32_t)) {
     assert(_gs_ready);
-    assert(buf_size > 0); /* We need a buffer with valid size */
+    assert(sink && sink->write);
 
-    /* Force max size to 256KB */
-    if (buf_size > 0x00040000) {
-        buf_size = 0x00040000;
+    _try {
+        _gs_stock();
+        _gs_cmd(GS_CMD_GET_CODES);
+        _gs_codes_recv(sink, callback);
+    }
+    _catch (e) {
+        ERRORPRINT("%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
+
+        return GS_ERROR;
     }
 
+    return GS_SUCCESS;
+}
+
+/* Read one game record of the code list; an index past the end reads nothing */
+GS_STATUS gs_read_codes(uint32_t game, GS_SINK *sink) {
+    assert(_gs_ready);
+    assert(sink && sink->write);
+
     _try {
-        _gs_cmd(GS_CMD_UPGRADE);
-        _gs_cmd(GS_CMD_NULL);
+        _gs_stock();
+        _gs_cmd(GS_CMD_READ_CODES);
+        _gs_exch_32(game);
+        _gs_codes_recv(sink, NULL);
+    }
+    _catch (e) {
+        ERRORPRINT("%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
 
-        /* Send data size */
-        _gs_exch_32(buf_size);
+        return GS_ERROR;
+    }
 
-        /* Send data */
-        for (i = 0; i < buf_size; i++) {
-            _gs_exch_8(buffer[i]);
-            sum += buffer[i];
-        }
+    return GS_SUCCESS;
+}
 
-        /* Verify */
-        sum &= 0x0FFF;
-        calc_sum = (_gs_exch_8(sum) | (_gs_exch_8(sum >> 8) << 8)) & 0x0FFF;
-        if (calc_sum != sum) {
-            ERRORPRINT("Checksum failure during ROM upload:\n"
-                "  Received: 0x%02X\n"
-                "  Expected: 0x%02X\n",
-                calc_sum, sum);
+/* Replace the whole code list */
+GS_STATUS gs_write_codes(GS_SOURCE *source, void (*callback)(uint32_t)) {
+    assert(_gs_ready);
+    assert(source && source->read);
 
-            return GS_ERROR;
-        }
-        /* GS sends 0x01 to indicate the checksum is valid */
+    /* The list is stored for good; don't risk it on a framing only gssim speaks */
+    if (!_gs_config.virtual_port) {
+        ERRORPRINT("%s\n", "Storing code lists is not verified on real firmware; refused");
+
+        return GS_ERROR;
+    }
+
+    _try {
+        _gs_stock();
+        _gs_cmd(GS_CMD_WRITE_CODES);
+        _gs_codes_send(source, callback);
+
+        /* GS sends 0x01 once the list is stored */
         if (_gs_exch_8(0) != 1) {
-            ERRORPRINT("%s\n", "Updater could not verify checksum");
+            ERRORPRINT("%s\n", "GS could not store the code list");
 
             return GS_ERROR;
         }
+    }
+    _catch (e) {
+        ERRORPRINT("%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
 
-        DEBUGPRINT("%s\n", "Upload complete. Waiting for final response...");
+        return GS_ERROR;
+    }
 
-        sleep(5);
+    return GS_SUCCESS;
+}
 
-        /* GS sends 0x01 to indicate the ROM upgrade was successful */
+/* Add game records to the code list, replacing any games with the same names */
+GS_STATUS gs_add_codes(GS_SOURCE *source, void (*callback)(uint32_t)) {
+    assert(_gs_ready);
+    assert(source && source->read);
+
+    /* The list is stored for good; don't risk it on a framing only gssim speaks */
+    if (!_gs_config.virtual_port) {
+        ERRORPRINT("%s\n", "Storing code lists is not verified on real firmware; refused");
+
+        return GS_ERROR;
+    }
+
+    _try {
+        _gs_stock();
+        _gs_cmd(GS_CMD_ADD_CODE);
+        _gs_codes_send(source, callback);
+
+        /* GS sends 0x01 once the games are stored */
         if (_gs_exch_8(0) != 1) {
-            ERRORPRINT("%s\n", "Could not validate ROM after write");
+            ERRORPRINT("%s\n", "GS could not store the games");
 
             return GS_ERROR;
         }
-
-        return GS_SUCCESS;
     }
     _catch (e) {
         ERRORPRINT("%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
@@ -611,68 +2311,213 @@ GS_STATUS gs_upgrade(uint8_t *buffer, uint32_t buf_size) {
         return GS_ERROR;
     }
 
-    ERRORPRINT("%s\n", "Undefined error (Should never happen).");
+    return GS_SUCCESS;
+}
 
-    return GS_ERROR;
+/* Size of the game record at the start of `data`; 0 if it is malformed */
+uint32_t gs_codes_game_size(const uint8_t *data, uint32_t size) {
+    uint32_t pos;
+    uint32_t len;
+    int cheats;
+    int codes;
+
+    len = strnlen((const char *)data, MIN(size, GS_CODES_NAME + 1));
+    if (!len || (len > GS_CODES_NAME) || ((len + 2) > size)) {
+        return 0;
+    }
+    pos = len + 1;
+    cheats = data[pos++];
+
+    while (cheats--) {
+        len = strnlen((const char *)&data[pos], MIN(size - pos, GS_CODES_NAME + 1));
+        if (!len || (len > GS_CODES_NAME) || ((pos + len + 3) > size)) {
+            return 0;
+        }
+        pos += len + 2;
+        codes = data[pos++];
+        if ((pos + (codes * 6)) > size) {
+            return 0;
+        }
+        pos += codes * 6;
+    }
+
+    return pos;
 }
 
-/* Read CPU memory 32-bits at a time (and exit PC-control) */
-GS_STATUS gs_read_rom(uint8_t *data, GS_RANGE *range, void (*callback)(uint32_t)) {
-    int i = 0;
-    uint8_t sum = 0;
-    uint8_t calc_sum = 0;
-    uint32_t word = 0;
+/* Read the displayed frame into a sink, one line per write (see GS_SHOT_FULL) */
+GS_STATUS gs_screen_shot(GS_FRAME *frame, GS_SINK *sink, void (*callback)(uint32_t)) {
+    assert(_gs_ready);
+    assert(sink && sink->write);
 
     _try {
-        _gs_cmd(GS_CMD_READ_ROM);
+        _gs_stock();
+        _gs_screen_shot(frame, sink, callback);
+    }
+    _catch (e) {
+        ERRORPRINT("%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
 
-        /* Send address */
-        range->address &= ~3;
-        DEBUGPRINT("Address: 0x%08X\n", range->address);
-        _gs_exch_32(range->address);
+        return GS_ERROR;
+    }
 
-        /* Send data size */
-        range->size = (range->size + 3) & ~3;
-        DEBUGPRINT("Size: 0x%08X\n", range->size);
-        _gs_exch_32(range->size);
+    return GS_SUCCESS;
+}
 
-        /* Read data */
-        for (i = 0; i < range->size; i += 4) {
-            /* Run callback periodically */
-            if (callback && i && (!(i & 0x3FFF))) {
-                callback(i);
-            }
+/*
+ * Begin a resumable READ, WRITE or READ_ROM (see gs_transfer_step())
+ *
+ * `data` and `range` are used as gs_read() and friends use them, and must
+ * stay valid until gs_transfer_end(). With a NULL `config`, the transfer uses
+ * the library's port; otherwise `config` supplies the port and callbacks.
+ * Transfers always speak the stock protocol.
+ */
+GS_STATUS gs_transfer_begin(GS_TRANSFER *transfer, GS_CONFIG *config, GS_COMMAND command,
+    uint8_t *data, GS_RANGE *range, uint32_t flags) {
+    int i;
 
-            word = _gs_exch_32(0);
-            sum += word;
+    memset(transfer, 0, sizeof(GS_TRANSFER));
 
-            data[i + 0] = word >> 24;
-            data[i + 1] = word >> 16;
-            data[i + 2] = word >> 8;
-            data[i + 3] = word >> 0;
-        }
+    if ((command != GS_CMD_READ) && (command != GS_CMD_WRITE) && (command != GS_CMD_READ_ROM)) {
+        ERRORPRINT("Command 0x%02X cannot be run as a transfer\n", command);
 
-        /* Final callback */
-        if (callback && (i & 0x3FFF)) {
-            callback(i);
-        }
+        return GS_ERROR;
+    }
 
-        /* Verify */
-        calc_sum = _gs_exch_8(0);
-        if (calc_sum != sum) {
-            ERRORPRINT("Checksum failure during ROM read:\n"
-                "  Received: 0x%02X\n"
-                "  Expected: 0x%02X\n",
-                calc_sum, sum);
+    if (config && config->in_callback && config->out_callback) {
+        transfer->port = config->port ? config->port : _GS_DEFAULT_PORT;
+        transfer->in_callback = config->in_callback;
+        transfer->out_callback = config->out_callback;
+    }
+    else {
+        assert(_gs_ready);
+        if (_gs_fast) {
+            ERRORPRINT("%s\n", "Transfers are not available through the fast transfer stub");
 
             return GS_ERROR;
         }
+        transfer->port = _gs_config.port;
+        transfer->in_callback = _gs_config.in_callback;
+        transfer->out_callback = _gs_config.out_callback;
     }
-    _catch (e) {
-        ERRORPRINT("%s:%d, %s(): %s\n", e->file, e->line, e->function, e->msg);
 
-        return GS_ERROR;
+    if (command == GS_CMD_READ_ROM) {
+        range->address &= ~3;
+        range->size = (range->size + 3) & ~3;
+        transfer->total = range->size;
+    }
+    else {
+        for (i = 0; range[i].address && range[i].size; i++) {
+            transfer->total += range[i].size;
+        }
+    }
+
+    transfer->command = command;
+    transfer->data = data;
+    transfer->range = range;
+    transfer->flags = flags;
+    transfer->timeout = _gs_timeout;
+    transfer->state = GS_TRANSFER_RUNNING;
+    transfer->pending = command;
+    transfer->nibble = _GS_NIBBLE_START;
+
+    if (flags & GS_TRANSFER_ENTER) {
+        transfer->phase = _GS_PHASE_SYNC;
+    }
+    else {
+        transfer->phase = _GS_PHASE_HANDSHAKE_G;
+        transfer->tx = 'G';
     }
 
     return GS_SUCCESS;
 }
+
+/*
+ * Advance a transfer by up to `budget` nybble exchanges
+ *
+ * Returns early, with `blocked` set, when the device has not answered after a
+ * few polls. Returns the transfer state; call again while it is
+ * GS_TRANSFER_RUNNING.
+ */
+int gs_transfer_step(GS_TRANSFER *t, uint32_t budget) {
+    const uint16_t data_port = t->port;
+    const uint16_t stat_port = t->port + 1;
+    uint8_t status;
+    uint8_t out;
+    int spin;
+
+    t->blocked = false;
+
+    while ((t->state == GS_TRANSFER_RUNNING) && budget) {
+        out = (t->phase == _GS_PHASE_SYNC) ? 3 : (t->low ? (t->tx & 0x0F) : (t->tx >> 4));
+
+        switch (t->nibble) {
+            case _GS_NIBBLE_START:
+                t->waits = 0;
+                if (t->in_callback(stat_port) & 0x08) {
+                    t->out_callback(0, data_port);
+                    t->nibble = _GS_NIBBLE_CLEAR;
+                    break;
+                }
+                t->out_callback(out | 0x10, data_port);
+                t->nibble = _GS_NIBBLE_READY;
+                break;
+
+            case _GS_NIBBLE_CLEAR:
+                for (spin = 0; (spin < _GS_TRANSFER_SPIN) && (t->in_callback(stat_port) & 0x08); spin++);
+                if (spin == _GS_TRANSFER_SPIN) {
+                    t->waits += spin;
+                    t->blocked = true;
+                    break;
+                }
+                t->waits = 0;
+                t->out_callback(out | 0x10, data_port);
+                t->nibble = _GS_NIBBLE_READY;
+                break;
+
+            case _GS_NIBBLE_READY:
+                for (spin = 0; spin < _GS_TRANSFER_SPIN; spin++) {
+                    status = t->in_callback(stat_port);
+                    if (status & 0x08) break;
+                }
+                if (spin == _GS_TRANSFER_SPIN) {
+                    t->waits += spin;
+                    t->blocked = true;
+                    break;
+                }
+                t->out_callback(0, data_port);
+                t->nibble = _GS_NIBBLE_START;
+                budget--;
+
+                _gs_transfer_nibble(t, (status >> 4) ^ 0x08);
+                break;
+        }
+
+        if (t->blocked) {
+            if (t->waits >= t->timeout) {
+                _gs_transfer_fail(t, "Communications link timed out.");
+            }
+            break;
+        }
+    }
+
+    return t->state;
+}
+
+/* Finish a transfer; one still running is abandoned */
+GS_STATUS gs_transfer_end(GS_TRANSFER *transfer) {
+    switch (transfer->state) {
+        case GS_TRANSFER_DONE:
+            return GS_SUCCESS;
+
+        case GS_TRANSFER_RUNNING:
+            transfer->out_callback(0, transfer->port);
+            transfer->state = GS_TRANSFER_FAILED;
+            ERRORPRINT("%s\n", "Transfer abandoned");
+            break;
+
+        default:
+            ERRORPRINT("%s\n", transfer->error);
+            break;
+    }
+
+    return GS_ERROR;
+}
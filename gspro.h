@@ -6,6 +6,8 @@
 extern "C" {
 #endif /* __cplusplus */
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -16,6 +18,9 @@ struct _gs_config {
     char *      port_dev;
     uint8_t     (*in_callback)(uint16_t);
     void        (*out_callback)(uint8_t, uint16_t);
+    bool        virtual_port;   /* Callbacks are the whole transport; no port is opened */
+    bool        adaptive;       /* Read in adaptive windows (see GS_WINDOW_START) */
+    bool        stock_only;     /* Transport only carries the stock protocol (a recording) */
 };
 typedef struct _gs_config GS_CONFIG;
 
@@ -26,6 +31,86 @@ struct _gs_range {
 };
 typedef struct _gs_range GS_RANGE;
 
+/* Data source for WRITE & UPGRADE commands (see stream.h) */
+typedef struct _gs_source GS_SOURCE;
+struct _gs_source {
+    size_t      (*read)(GS_SOURCE *source, uint8_t *buf, size_t size);
+    void        (*close)(GS_SOURCE *source);
+    uint32_t    size;
+    uint32_t    offset;
+    int         fd;
+    uint8_t *   data;
+    size_t      map_size;
+};
+
+/* Data sink for READ_ROM command (see stream.h) */
+typedef struct _gs_sink GS_SINK;
+struct _gs_sink {
+    int         (*write)(GS_SINK *sink, const uint8_t *buf, size_t size);
+    void        (*close)(GS_SINK *sink);
+    uint32_t    size;
+    uint32_t    offset;
+    int         fd;
+    uint8_t *   data;
+    void *      context;
+};
+
+
+/*
+ * Resumable transfer (see gs_transfer_begin())
+ *
+ * Holds every bit of protocol state, so a transfer can be advanced a few
+ * nybbles at a time from an event loop, and many can run side by side. Each
+ * one talks through its own port callbacks; they are told the port number,
+ * which is enough to tell devices apart.
+ */
+struct _gs_transfer {
+    /* Request */
+    int         command;
+    uint8_t *   data;
+    GS_RANGE *  range;
+    uint32_t    flags;
+    uint16_t    port;
+    uint8_t     (*in_callback)(uint16_t);
+    void        (*out_callback)(uint8_t, uint16_t);
+    uint32_t    timeout;    /* Unanswered polls before a nybble fails */
+
+    /* Progress */
+    int         state;      /* GS_TRANSFER_RUNNING, _DONE or _FAILED */
+    uint32_t    done;       /* Payload bytes moved */
+    uint32_t    total;
+    bool        blocked;    /* Last step stopped to wait for the device */
+    char        error[80];
+
+    /* Protocol state */
+    int         phase;
+    int         nibble;
+    int         pending;    /* Command being sent */
+    uint8_t     tx;
+    uint8_t     rx;
+    bool        low;
+    uint8_t     sync;
+    uint8_t     sum;
+    uint32_t    waits;
+    uint32_t    tries;
+    int         index;      /* Current range */
+    uint32_t    count;      /* Bytes into the current field or range */
+    uint32_t    pos;        /* Offset into data */
+    uint32_t    word;
+};
+typedef struct _gs_transfer GS_TRANSFER;
+
+/* Transfer options */
+#define GS_TRANSFER_ENTER   0x01    /* Enter PC-control first */
+#define GS_TRANSFER_EXIT    0x02    /* Exit PC-control afterwards (READ_ROM always does) */
+
+/* Transfer states */
+enum _gs_transfer_states {
+    GS_TRANSFER_RUNNING,
+    GS_TRANSFER_DONE,
+    GS_TRANSFER_FAILED
+};
+
 
 /* GameShark commands */
 enum _gs_commands {
@@ -37,18 +122,151 @@ enum _gs_commands {
     GS_CMD_WHERE        = 0x65,
     GS_CMD_VERSION      = 0x66,
     GS_CMD_UPGRADE_SWAP = 0x67, /* Unimplemented */
-    GS_CMD_ADD_CODE     = 0x69, /* Unimplemented */
-    GS_CMD_COUNT_CODES  = 0x6A, /* Unimplemented */
+    GS_CMD_ADD_CODE     = 0x69,
+    GS_CMD_COUNT_CODES  = 0x6A,
     GS_CMD_UPGRADE      = 0x6E,
-    GS_CMD_GET_CODES    = 0x70, /* Unimplemented */
-    GS_CMD_SCREEN_SHOT  = 0x72, /* Unimplemented */
-    GS_CMD_WRITE_CODES  = 0x7C, /* Unimplemented */
-    GS_CMD_READ_CODES   = 0x7D, /* Unimplemented */
-    GS_CMD_READ_MEMPAK  = 0x7E, /* Unimplemented */
+    GS_CMD_GET_CODES    = 0x70,
+    GS_CMD_SCREEN_SHOT  = 0x72,
+    GS_CMD_WRITE_CODES  = 0x7C,
+    GS_CMD_READ_CODES   = 0x7D,
+    GS_CMD_READ_MEMPAK  = 0x7E,
     GS_CMD_READ_ROM     = 0x7F
 };
 typedef enum _gs_commands GS_COMMAND;
 
+/*
+ * Commands spoken by an uploaded fast transfer stub (see gs_fast_start())
+ *
+ * The stub speaks a leaner protocol than the GS firmware. Every edge of the
+ * strobe (DATA bit 4) carries a nybble, and the stub acknowledges by copying
+ * the strobe level to STAT bit 3, so no return-to-zero write is needed.
+ * Commands follow an 'F'/'S' handshake. READ and WRITE take an address and
+ * size, then move the payload in GS_FAST_BLOCK blocks; each block is
+ * run-length encoded by 32-bit word (see gs_fast_encode()) and followed by a
+ * CRC-16 of the decoded data, which the receiver answers with ACK or NAK.
+ *
+ * HASH takes an address and size too, and answers with one big-endian 64-bit
+ * gs_fast_hash() per GS_FAST_HASH_PAGE bytes (the last page may be shorter),
+ * sent in blocks like READ's payload.
+ */
+enum _gs_fast_commands {
+    GS_FAST_NOP     = 0x00,
+    GS_FAST_READ    = 0x01, /* Whole words; the address must be aligned */
+    GS_FAST_WRITE   = 0x02,
+    GS_FAST_HASH    = 0x03, /* Whole words; the address must be aligned */
+    GS_FAST_RESUME  = 0x64, /* Return to the game, staying resident */
+    GS_FAST_UNLOAD  = 0x6F  /* Restore the hook and return to the game */
+};
+
+/* Fast transfer stub image header; big-endian, uploaded with the code */
+#define GS_FAST_MAGIC       0x47534653  /* "GSFS" */
+#define GS_FAST_HDR_LOAD    0x04        /* RDRAM address the image is uploaded to */
+#define GS_FAST_HDR_HOOK    0x08        /* Instruction pair replaced with a jump to the stub */
+#define GS_FAST_HDR_SAVED   0x0C        /* Original hook instructions; filled in by the host */
+#define GS_FAST_HDR_ENTRY   0x14        /* Code starts here */
+
+#define GS_FAST_BLOCK   0x0400
+#define GS_FAST_RETRIES 3
+#define GS_FAST_ACK     0x06
+#define GS_FAST_NAK     0x15
+#define GS_FAST_HASH_PAGE   0x1000
+
+/*
+ * Adaptive windows (GS_CONFIG.adaptive)
+ *
+ * Long stock-protocol reads are split into windows. Each window is its own
+ * READ or READ_ROM with its own checksum, so a failure costs one window rather
+ * than the whole transfer. The window doubles after GS_WINDOW_GROW clean
+ * windows in a row, spreading the per-command handshakes over more data, and
+ * halves after each checksum failure or timeout, limiting what is sent again.
+ */
+#define GS_WINDOW_MIN       0x00000400
+#define GS_WINDOW_START     0x00004000
+#define GS_WINDOW_MAX       0x00100000
+#define GS_WINDOW_GROW      4
+#define GS_WINDOW_RETRIES   8       /* Failures in a row before giving up */
+#define GS_WINDOW_RANGES    16      /* READ ranges per window */
+
+/* READ refuses ranges starting here and above; windows cut there use READ_ROM */
+#define GS_READ_HIGH        0xBDFFFFFF
+
+/* Link quality, as seen by adaptive windows */
+struct _gs_link {
+    uint32_t    window;     /* Size of the next window */
+    uint32_t    clean;      /* Windows passed since the size last changed */
+    uint64_t    windows;    /* Windows sent, including failed ones */
+    uint64_t    failures;   /* Checksum failures and timeouts */
+    uint64_t    bytes;      /* Bytes delivered */
+    uint64_t    resent;     /* Bytes of failed windows */
+    uint64_t    ns;         /* Time spent in windowed reads */
+};
+typedef struct _gs_link GS_LINK;
+
+/*
+ * READ_MEMPAK
+ *
+ * The GS answers with the pak size (u32; zero when no pak is inserted), then
+ * the pak in GS_MEMPAK_PAGE pieces, each followed by an 8-bit sum of its
+ * bytes. A bad page is caught before it reaches the sink.
+ *
+ * This framing has not been checked against real firmware; only gssim speaks
+ * it. Firmware sending one sum at the end would fail the first page's check,
+ * so a mismatch shows up as an error rather than a bad backup.
+ */
+#define GS_MEMPAK_SIZE  0x8000
+#define GS_MEMPAK_PAGE  0x0100
+
+/*
+ * Code lists (GET_CODES, READ_CODES, WRITE_CODES and ADD_CODE)
+ *
+ * A code list is a sequence of game records, big-endian:
+ *
+ *   Game:  name (NUL-terminated), cheat count (u8), cheats
+ *   Cheat: name (NUL-terminated), flags (u8), code count (u8), codes
+ *   Code:  address (u32), value (u16)
+ *
+ * The list size (u32) goes first, then the list moves in GS_CODES_CHUNK
+ * pieces. Each piece is followed by an 8-bit sum of its bytes, which the
+ * receiver checks before the next piece is sent. After WRITE_CODES or
+ * ADD_CODE, the GS answers 0x01 once the list is stored.
+ *
+ * This framing has not been checked against real firmware; only gssim speaks
+ * it. A mismatch could corrupt the stored list, so WRITE_CODES and ADD_CODE
+ * are refused unless the port is virtual (the simulator, a bridge or a replay).
+ */
+#define GS_CODES_MAX    0x00010000
+#define GS_CODES_CHUNK  0x0100
+#define GS_CODES_NAME   30
+#define GS_CODES_ACTIVE 0x01    /* Cheat flag: enabled by default */
+
+/*
+ * SCREEN_SHOT takes a mode byte. The GS answers with the frame buffer's
+ * KSEG0 address (u32), width (u16), height (u16) and bytes per pixel (u8; 2
+ * for RGBA5551, 4 for RGBA8888), then:
+ *
+ *   GS_SHOT_FULL   Each line, followed by an 8-bit sum of its bytes.
+ *
+ * The GS stays in PC-control, so lines can be read again with gs_read().
+ * A width or height of zero means no frame is being displayed; nothing else
+ * follows.
+ */
+enum _gs_shot_modes {
+    GS_SHOT_FULL    = 0x00
+};
+
+#define GS_FRAME_MAX_WIDTH  1024
+#define GS_FRAME_MAX_HEIGHT 1024
+#define GS_VI_ORIGIN        0xA4400004  /* Physical address of the displayed frame buffer */
+
+/* Frame buffer described by SCREEN_SHOT */
+struct _gs_frame {
+    uint32_t    address;
+    uint16_t    width;
+    uint16_t    height;
+    uint8_t     depth;      /* Bytes per pixel */
+};
+typedef struct _gs_frame GS_FRAME;
+
 /* Responses to WHERE command */
 enum _gs_where {
     GS_WHERE_MENU   = 1,
@@ -66,14 +284,40 @@ typedef enum _gs_return_codes GS_STATUS;
 /* Function declarations */
 GS_STATUS gs_init(GS_CONFIG *config);
 GS_STATUS gs_quit(void);
+uint8_t gs_port_in(uint16_t port);
+void gs_port_out(uint8_t data, uint16_t port);
 GS_STATUS gs_enter(void);
 GS_STATUS gs_exit(void);
 GS_STATUS gs_read(uint8_t *in, GS_RANGE *range, void (*callback)(int, uint32_t));
+bool gs_read_blocked(uint32_t address);
 GS_STATUS gs_write(uint8_t *out, GS_RANGE *range, void (*callback)(int, uint32_t));
+GS_STATUS gs_write_source(GS_SOURCE *source, GS_RANGE *range, void (*callback)(int, uint32_t));
 GS_STATUS gs_where(uint8_t *out);
 GS_STATUS gs_version(uint8_t *size, char *version, int buf_size);
 GS_STATUS gs_upgrade(uint8_t *buffer, uint32_t buf_size);
+GS_STATUS gs_upgrade_source(GS_SOURCE *source);
 GS_STATUS gs_read_rom(uint8_t *data, GS_RANGE *range, void (*callback)(uint32_t));
+GS_STATUS gs_read_rom_sink(GS_SINK *sink, GS_RANGE *range, void (*callback)(uint32_t));
+GS_STATUS gs_read_mempak(GS_SINK *sink, void (*callback)(uint32_t));
+GS_STATUS gs_count_codes(uint32_t *games, uint32_t *size);
+GS_STATUS gs_get_codes(GS_SINK *sink, void (*callback)(uint32_t));
+GS_STATUS gs_read_codes(uint32_t game, GS_SINK *sink);
+GS_STATUS gs_write_codes(GS_SOURCE *source, void (*callback)(uint32_t));
+GS_STATUS gs_add_codes(GS_SOURCE *source, void (*callback)(uint32_t));
+uint32_t gs_codes_game_size(const uint8_t *data, uint32_t size);
+GS_STATUS gs_screen_shot(GS_FRAME *frame, GS_SINK *sink, void (*callback)(uint32_t));
+GS_STATUS gs_transfer_begin(GS_TRANSFER *transfer, GS_CONFIG *config, GS_COMMAND command,
+    uint8_t *data, GS_RANGE *range, uint32_t flags);
+int gs_transfer_step(GS_TRANSFER *transfer, uint32_t budget);
+GS_STATUS gs_transfer_end(GS_TRANSFER *transfer);
+void gs_link_stats(GS_LINK *link);
+GS_STATUS gs_fast_start(uint8_t *image, uint32_t size);
+GS_STATUS gs_fast_stop(void);
+bool gs_fast_active(void);
+uint32_t gs_fast_encode(const uint8_t *data, uint32_t size, uint8_t *out);
+uint64_t gs_fast_hash(const uint8_t *data, uint32_t size);
+GS_STATUS gs_fast_hash_pages(uint64_t *hashes, uint32_t address, uint32_t size);
+uint16_t gs_crc16(const uint8_t *data, size_t size);
 
 
 /* Handy macros */
@@ -0,0 +1,210 @@
+/*
+    gsserve - GameShark bridge server
+
+    Answers n64rd over a shared-memory bridge (n64rd -p bridge:<name>) with the
+    GameShark simulator. RDRAM can be an emulator's, mapped from a file it
+    shares, so the same tooling runs on hosts without a parallel port.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gspro.h"
+#include "gssim.h"
+#include "n64rd.h"
+#include "bridge.h"
+
+
+/* Server options (from command line arguments) */
+struct _serve_options {
+    char *      name;
+    char *      ram_file;
+    char *      rom_file;
+    uint32_t    ram_size;
+    bool        swapped;
+};
+typedef struct _serve_options SERVE_OPTIONS;
+
+
+void serve_usage(void);
+int serve_map_ram(GS_SIM *sim, const char *filename, size_t *size);
+int serve_load_rom(GS_SIM *sim, const char *filename);
+
+
+int main(int argc, char **argv) {
+    SERVE_OPTIONS options;
+    BRIDGE_STATS stats;
+    GS_CONFIG device;
+    GS_SIM sim;
+    size_t mapped = 0;
+    char *err = 0;
+    int result;
+    int c;
+
+    memset(&options, 0, sizeof(options));
+    options.name = "n64rd";
+    options.ram_size = 0x00800000;
+
+    while ((c = getopt(argc, argv, "hn:r:sm:c:")) != -1) {
+        switch (c) {
+            case 'h':
+                serve_usage();
+                return 0;
+
+            case 'n':
+                options.name = optarg;
+                break;
+
+            case 'r':
+                options.ram_file = optarg;
+                break;
+
+            case 's':
+                options.swapped = true;
+                break;
+
+            case 'm':
+                options.ram_size = strtoul(optarg, &err, 0);
+                if (err[0] || (options.ram_size & 3) || !options.ram_size ||
+                    (options.ram_size > 0x00800000)) {
+                    fprintf(stderr, "Invalid RDRAM size\n");
+                    return 1;
+                }
+                break;
+
+            case 'c':
+                options.rom_file = optarg;
+                break;
+
+            default:
+                serve_usage();
+                return 1;
+        }
+    }
+
+    gs_sim_init(&sim, options.ram_size);
+    if (options.ram_file && serve_map_ram(&sim, options.ram_file, &mapped)) {
+        gs_sim_free(&sim);
+        return 1;
+    }
+    if (options.swapped) {
+        sim.ram_swap = 3;
+    }
+    if (options.rom_file && serve_load_rom(&sim, options.rom_file)) {
+        if (mapped) {
+            munmap(sim.ram, mapped);
+            sim.ram = NULL;
+        }
+        free(sim.rom);
+        gs_sim_free(&sim);
+        return 1;
+    }
+
+    memset(&device, 0, sizeof(device));
+    gs_sim_attach(&sim, &device);
+
+    result = bridge_listen(options.name);
+    if (!result) {
+        printf("Serving %u MB of %s RDRAM on `%s`; interrupt to stop\n", sim.ram_size >> 20,
+            (options.ram_file ? options.ram_file : "simulated"), options.name);
+        fflush(stdout);
+        result = bridge_serve(&device, &stats);
+    }
+    if (!result) {
+        printf("%llu sessions, %llu port writes in %llu batches\n",
+            (unsigned long long)stats.sessions, (unsigned long long)stats.writes,
+            (unsigned long long)stats.batches);
+    }
+
+    if (mapped) {
+        munmap(sim.ram, mapped);
+        sim.ram = NULL;
+    }
+    free(sim.rom);
+    gs_sim_free(&sim);
+
+    return result;
+}
+
+void serve_usage(void) {
+    printf("Usage: gsserve [options]\n");
+    printf("Options:\n");
+    printf("  -h            Print usage and quit.\n");
+    printf("  -n <name>     Bridge name (default n64rd); clients use -p bridge:<name>.\n");
+    printf("  -r <file>     Serve RDRAM from <file>, mapped shared (an emulator's\n");
+    printf("                RDRAM); its size is the RDRAM size.\n");
+    printf("  -s            The -r file holds host-endian 32-bit words, as most\n");
+    printf("                emulators keep RDRAM.\n");
+    printf("  -m <size>     Simulated RDRAM size without -r (default 0x00800000).\n");
+    printf("  -c <file>     Cartridge ROM image (.z64) to serve at 0xB0000000.\n");
+}
+
+/* Use a file as RDRAM; writes go straight to it */
+int serve_map_ram(GS_SIM *sim, const char *filename, size_t *size) {
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(filename, O_RDWR);
+    if ((fd == -1) || fstat(fd, &st)) {
+        fprintf(stderr, "Unable to open `%s`: %s\n", filename, strerror(errno));
+        if (fd != -1) close(fd);
+        return 1;
+    }
+    if (!st.st_size || (st.st_size & 3) || (st.st_size > 0x00800000)) {
+        fprintf(stderr, "`%s` is not an RDRAM image (%lld bytes)\n", filename, (long long)st.st_size);
+        close(fd);
+        return 1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Unable to map `%s`: %s\n", filename, strerror(errno));
+        return 1;
+    }
+
+    free(sim->ram);
+    sim->ram = map;
+    sim->ram_size = st.st_size;
+    *size = st.st_size;
+
+    return 0;
+}
+
+int serve_load_rom(GS_SIM *sim, const char *filename) {
+    FILE *fp;
+    long size;
+
+    fp = fopen(filename, "rb");
+    if (!fp) {
+        fprintf(stderr, "Unable to open `%s`\n", filename);
+        return 1;
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if ((size <= 0) || (size > 0x0FC00000)) {
+        fprintf(stderr, "`%s` is not a cartridge ROM image\n", filename);
+        fclose(fp);
+        return 1;
+    }
+
+    sim->rom = alloc(size);
+    sim->rom_size = size;
+    if (fread(sim->rom, size, 1, fp) != 1) {
+        fprintf(stderr, "Unable to read `%s`\n", filename);
+        fclose(fp);
+        return 1;
+    }
+    fclose(fp);
+
+    return 0;
+}
@@ -0,0 +1,878 @@
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gspro.h"
+#include "n64rd.h"
+#include "gssim.h"
+
+
+/* Private variables */
+static GS_SIM *_gs_sim_attached = NULL;
+
+
+/* Private function declarations */
+uint8_t _gs_sim_in_callback(uint16_t port);
+void _gs_sim_out_callback(uint8_t data, uint16_t port);
+void _gs_sim_queue(GS_SIM *sim, const uint8_t *data, uint32_t len, int next_state);
+uint8_t _gs_sim_next_out(GS_SIM *sim);
+void _gs_sim_byte(GS_SIM *sim, uint8_t rx);
+uint32_t _gs_sim_codes_count(const uint8_t *data, uint32_t size);
+void _gs_sim_codes_send(GS_SIM *sim, uint32_t offset, uint32_t size);
+uint8_t _gs_sim_codes_commit(GS_SIM *sim);
+uint8_t _gs_sim_shot_next(GS_SIM *sim);
+uint32_t _gs_sim_read32(GS_SIM *sim, uint32_t address);
+void _gs_sim_resume(GS_SIM *sim);
+void _gs_sim_fast_block(GS_SIM *sim);
+uint64_t _gs_sim_fast_hash(GS_SIM *sim, uint32_t page);
+void _gs_sim_fast_recv(GS_SIM *sim, uint8_t rx);
+void _gs_sim_fast_byte(GS_SIM *sim, uint8_t rx);
+
+
+/* Private functions */
+
+uint8_t _gs_sim_in_callback(uint16_t port) {
+    return gs_sim_in(_gs_sim_attached);
+}
+
+void _gs_sim_out_callback(uint8_t data, uint16_t port) {
+    gs_sim_out(_gs_sim_attached, data);
+}
+
+/* Send a fixed response, then move to `next_state` */
+void _gs_sim_queue(GS_SIM *sim, const uint8_t *data, uint32_t len, int next_state) {
+    memcpy(sim->queue, data, len);
+    sim->queue_len = len;
+    sim->queue_pos = 0;
+    sim->next_state = next_state;
+    sim->state = GS_SIM_QUEUE;
+    sim->tx = sim->queue[0];
+}
+
+/* Fetch the next data byte for READ / READ_ROM, folding it into the checksum */
+uint8_t _gs_sim_next_out(GS_SIM *sim) {
+    uint8_t data = sim->refused ? 0 : gs_sim_read8(sim, sim->address + sim->count);
+
+    /* READ_ROM sums the low byte of each word; READ sums every byte */
+    if ((sim->command != GS_CMD_READ_ROM) || ((sim->count & 3) == 3)) {
+        sim->sum += data;
+    }
+
+    return data;
+}
+
+/* Handle one complete byte from the host, and choose the next byte to send */
+void _gs_sim_byte(GS_SIM *sim, uint8_t rx) {
+    uint8_t buf[64];
+    uint32_t len;
+
+    switch (sim->state) {
+        case GS_SIM_RUNNING:
+        case GS_SIM_IDLE:
+            sim->state = GS_SIM_IDLE;
+            sim->tx = 'g';
+            if (rx == 'G') {
+                sim->state = GS_SIM_HANDSHAKE;
+                sim->tx = 't';
+            }
+            break;
+
+        case GS_SIM_HANDSHAKE:
+            sim->tx = 0;
+            if (rx != 'T') {
+                sim->state = GS_SIM_IDLE;
+                sim->tx = 'g';
+            }
+            else if (sim->command == GS_CMD_UPGRADE) {
+                /* Second handshake of UPGRADE; the size follows directly */
+                sim->state = GS_SIM_SIZE;
+                sim->size = 0;
+                sim->count = 0;
+            }
+            else {
+                sim->state = GS_SIM_COMMAND;
+            }
+            break;
+
+        case GS_SIM_COMMAND:
+            sim->command = rx;
+            sim->commands++;
+            sim->address = 0;
+            sim->size = 0;
+            sim->count = 0;
+            sim->sum = 0;
+            sim->refused = false;
+            sim->tx = 0;
+
+            switch (rx) {
+                case GS_CMD_READ:
+                case GS_CMD_WRITE:
+                case GS_CMD_READ_ROM:
+                    sim->state = GS_SIM_ADDRESS;
+                    break;
+
+                case GS_CMD_UNPAUSE:
+                    sim->command = GS_CMD_NULL;
+                    _gs_sim_resume(sim);
+                    break;
+
+                case GS_CMD_WHERE:
+                    _gs_sim_queue(sim, &sim->where, 1, GS_SIM_RUNNING);
+                    break;
+
+                case GS_CMD_VERSION:
+                    if (sim->where == GS_WHERE_GAME) {
+                        _gs_sim_queue(sim, (uint8_t *)"g", 1, GS_SIM_IDLE);
+                        break;
+                    }
+                    len = strlen(sim->version);
+                    buf[0] = 0x2E;
+                    buf[1] = len;
+                    memcpy(&buf[2], sim->version, len);
+                    _gs_sim_queue(sim, buf, len + 2, GS_SIM_RUNNING);
+                    break;
+
+                case GS_CMD_READ_MEMPAK:
+                    sim->size = sim->mempak_present ? GS_MEMPAK_SIZE : 0;
+                    sim->state = GS_SIM_MEMPAK;
+                    sim->tx = sim->size >> 24;
+                    break;
+
+                case GS_CMD_COUNT_CODES:
+                    put_be32(&buf[0], _gs_sim_codes_count(sim->codes, sim->codes_size));
+                    put_be32(&buf[4], sim->codes_size);
+                    _gs_sim_queue(sim, buf, 8, GS_SIM_IDLE);
+                    break;
+
+                case GS_CMD_GET_CODES:
+                    _gs_sim_codes_send(sim, 0, sim->codes_size);
+                    break;
+
+                case GS_CMD_READ_CODES:
+                    sim->state = GS_SIM_CODES_INDEX;
+                    break;
+
+                case GS_CMD_SCREEN_SHOT:
+                    sim->state = GS_SIM_SHOT_MODE;
+                    break;
+
+                case GS_CMD_WRITE_CODES:
+                case GS_CMD_ADD_CODE:
+                    sim->state = GS_SIM_SIZE;
+                    break;
+
+                case GS_CMD_UPGRADE:
+                    /* Expect another handshake without a command byte */
+                    sim->state = GS_SIM_IDLE;
+                    sim->tx = 'g';
+                    break;
+
+                default:
+                    sim->command = GS_CMD_NULL;
+                    sim->state = GS_SIM_IDLE;
+                    sim->tx = 'g';
+                    break;
+            }
+            break;
+
+        case GS_SIM_ADDRESS:
+            sim->address = (sim->address << 8) | rx;
+            sim->tx = 0;
+            if (++sim->count == 4) {
+                sim->state = GS_SIM_SIZE;
+                sim->size = 0;
+                sim->count = 0;
+            }
+            break;
+
+        case GS_SIM_SIZE:
+            sim->size = (sim->size << 8) | rx;
+            sim->tx = 0;
+            if (++sim->count < 4) {
+                break;
+            }
+            sim->count = 0;
+
+            if ((sim->command == GS_CMD_WRITE_CODES) || (sim->command == GS_CMD_ADD_CODE)) {
+                sim->offset = 0;
+                sim->state = GS_SIM_CODES_RECV;
+                if (!sim->size || (sim->size > GS_CODES_MAX)) {
+                    buf[0] = sim->size ? 0 : _gs_sim_codes_commit(sim);
+                    _gs_sim_queue(sim, buf, 1, GS_SIM_IDLE);
+                }
+                break;
+            }
+
+            if (!sim->size) {
+                /* Null range ends READ / WRITE; READ_ROM ends after its range */
+                buf[0] = sim->sum ^ (sim->refused ? 0xFF : 0);
+                _gs_sim_queue(sim, buf, 1,
+                    (sim->command == GS_CMD_READ_ROM) ? GS_SIM_RUNNING : GS_SIM_IDLE);
+                break;
+            }
+
+            sim->state = GS_SIM_DATA;
+            if ((sim->command == GS_CMD_READ) && gs_read_blocked(sim->address)) {
+                sim->refused = true;
+            }
+            if ((sim->command == GS_CMD_READ) || (sim->command == GS_CMD_READ_ROM)) {
+                sim->tx = _gs_sim_next_out(sim);
+            }
+            break;
+
+        case GS_SIM_DATA:
+            if (sim->command == GS_CMD_WRITE) {
+                gs_sim_write8(sim, sim->address + sim->count, rx);
+                sim->sum += rx;
+            }
+            else if (sim->command == GS_CMD_UPGRADE) {
+                if (sim->count < sizeof(sim->gs_rom)) {
+                    sim->gs_rom[sim->count] = rx;
+                }
+                sim->sum += rx;
+            }
+            sim->tx = 0;
+
+            if (++sim->count < sim->size) {
+                if ((sim->command == GS_CMD_READ) || (sim->command == GS_CMD_READ_ROM)) {
+                    sim->tx = _gs_sim_next_out(sim);
+                }
+                break;
+            }
+
+            switch (sim->command) {
+                case GS_CMD_READ_ROM:
+                    buf[0] = sim->sum;
+                    _gs_sim_queue(sim, buf, 1, GS_SIM_RUNNING);
+                    break;
+
+                case GS_CMD_UPGRADE:
+                    buf[0] = sim->sum;
+                    buf[1] = sim->sum >> 8;
+                    buf[2] = 1; /* Checksum valid */
+                    buf[3] = 1; /* ROM verified */
+                    _gs_sim_queue(sim, buf, 4, GS_SIM_RUNNING);
+                    break;
+
+                default:
+                    /* Next range */
+                    sim->state = GS_SIM_ADDRESS;
+                    sim->address = 0;
+                    sim->count = 0;
+                    break;
+            }
+            break;
+
+        case GS_SIM_MEMPAK:
+            /* Size, then each page followed by its sum */
+            len = sim->count - 3;
+            if (++sim->count < 4) {
+                sim->tx = sim->size >> (24 - (sim->count * 8));
+            }
+            else if (len < (sim->size / GS_MEMPAK_PAGE) * (GS_MEMPAK_PAGE + 1)) {
+                if ((len % (GS_MEMPAK_PAGE + 1)) < GS_MEMPAK_PAGE) {
+                    sim->tx = sim->mempak[(len / (GS_MEMPAK_PAGE + 1)) * GS_MEMPAK_PAGE +
+                        (len % (GS_MEMPAK_PAGE + 1))];
+                    sim->sum += sim->tx;
+                }
+                else {
+                    sim->tx = sim->sum;
+                    sim->sum = 0;
+                }
+            }
+            else {
+                sim->command = GS_CMD_NULL;
+                sim->state = GS_SIM_IDLE;
+                sim->tx = 'g';
+            }
+            break;
+
+        case GS_SIM_CODES_INDEX:
+            sim->address = (sim->address << 8) | rx;
+            sim->tx = 0;
+            if (++sim->count < 4) {
+                break;
+            }
+
+            /* Find the game; past the end, send an empty record */
+            sim->offset = 0;
+            sim->size = 0;
+            while (sim->offset < sim->codes_size) {
+                sim->size = gs_codes_game_size(&sim->codes[sim->offset], sim->codes_size - sim->offset);
+                if (!sim->address-- || !sim->size) {
+                    break;
+                }
+                sim->offset += sim->size;
+                sim->size = 0;
+            }
+            _gs_sim_codes_send(sim, sim->offset, sim->size);
+            break;
+
+        case GS_SIM_SHOT_MODE:
+            /* The reply is generated as it is sent; `size` is its length */
+            sim->address = rx;
+            sim->size = 9;
+            if (sim->fb_address) {
+                sim->size += sim->fb_height * ((sim->fb_width * sim->fb_depth) + 1);
+            }
+            sim->state = GS_SIM_SHOT_SEND;
+            sim->tx = _gs_sim_shot_next(sim);
+            break;
+
+        case GS_SIM_SHOT_SEND:
+            if (++sim->count < sim->size) {
+                sim->tx = _gs_sim_shot_next(sim);
+                break;
+            }
+            sim->command = GS_CMD_NULL;
+            sim->state = GS_SIM_IDLE;
+            sim->tx = 'g';
+            break;
+
+        case GS_SIM_CODES_SEND:
+            if (++sim->queue_pos < sim->queue_len) {
+                sim->tx = sim->codes_io[sim->queue_pos];
+                break;
+            }
+            sim->command = GS_CMD_NULL;
+            sim->state = GS_SIM_IDLE;
+            sim->tx = 'g';
+            break;
+
+        case GS_SIM_CODES_RECV:
+            /* Chunk data, then the host's sum, answered with ours */
+            len = MIN((uint32_t)GS_CODES_CHUNK, sim->size - (sim->count - sim->offset));
+            if (sim->offset < len) {
+                sim->codes_io[sim->count++] = rx;
+                sim->sum += rx;
+                sim->tx = (++sim->offset == len) ? (uint8_t)sim->sum : 0;
+                break;
+            }
+            if (rx != (uint8_t)sim->sum) {
+                /* Discard the upload */
+                sim->command = GS_CMD_NULL;
+                sim->state = GS_SIM_IDLE;
+                sim->tx = 'g';
+                break;
+            }
+            sim->offset = 0;
+            sim->sum = 0;
+            sim->tx = 0;
+            if (sim->count == sim->size) {
+                buf[0] = _gs_sim_codes_commit(sim);
+                _gs_sim_queue(sim, buf, 1, GS_SIM_IDLE);
+            }
+            break;
+
+        case GS_SIM_QUEUE:
+            if (++sim->queue_pos < sim->queue_len) {
+                sim->tx = sim->queue[sim->queue_pos];
+                break;
+            }
+            sim->command = GS_CMD_NULL;
+            if (sim->next_state == GS_SIM_RUNNING) {
+                _gs_sim_resume(sim);
+                break;
+            }
+            sim->state = sim->next_state;
+            sim->tx = 'g';
+            break;
+    }
+}
+
+/* Count the games in a code list; returns ~0 if it is malformed */
+uint32_t _gs_sim_codes_count(const uint8_t *data, uint32_t size) {
+    uint32_t pos = 0;
+    uint32_t len;
+    uint32_t count = 0;
+
+    while (pos < size) {
+        len = gs_codes_game_size(&data[pos], size - pos);
+        if (!len) {
+            return ~0;
+        }
+        pos += len;
+        count++;
+    }
+
+    return count;
+}
+
+/* Start sending part of the code list: its size, then chunks each followed by their sum */
+void _gs_sim_codes_send(GS_SIM *sim, uint32_t offset, uint32_t size) {
+    uint32_t len = 0;
+    uint32_t i;
+    uint8_t sum = 0;
+
+    put_be32(sim->codes_io, size);
+    sim->queue_len = 4;
+    for (i = 0; i < size; i++) {
+        sim->codes_io[sim->queue_len++] = sim->codes[offset + i];
+        sum += sim->codes[offset + i];
+        if ((++len == GS_CODES_CHUNK) || ((i + 1) == size)) {
+            sim->codes_io[sim->queue_len++] = sum;
+            len = 0;
+            sum = 0;
+        }
+    }
+
+    sim->queue_pos = 0;
+    sim->state = GS_SIM_CODES_SEND;
+    sim->tx = sim->codes_io[0];
+}
+
+/* Store a received code list; returns the status byte for the host */
+uint8_t _gs_sim_codes_commit(GS_SIM *sim) {
+    uint8_t *in = sim->codes_io;
+    uint32_t pos;
+    uint32_t at;
+    uint32_t len;
+    uint32_t old;
+
+    if (_gs_sim_codes_count(in, sim->size) == ~0) {
+        return 0;
+    }
+
+    if (sim->command == GS_CMD_WRITE_CODES) {
+        memcpy(sim->codes, in, sim->size);
+        sim->codes_size = sim->size;
+
+        return 1;
+    }
+
+    /* ADD_CODE: drop any game with the same name, then append */
+    for (pos = 0; pos < sim->size; pos += len) {
+        len = gs_codes_game_size(&in[pos], sim->size - pos);
+        for (at = 0; at < sim->codes_size; at += old) {
+            old = gs_codes_game_size(&sim->codes[at], sim->codes_size - at);
+            if (!strcmp((char *)&sim->codes[at], (char *)&in[pos])) {
+                memmove(&sim->codes[at], &sim->codes[at + old], sim->codes_size - at - old);
+                sim->codes_size -= old;
+                break;
+            }
+        }
+        if ((sim->codes_size + len) > sizeof(sim->codes)) {
+            return 0;
+        }
+        memcpy(&sim->codes[sim->codes_size], &in[pos], len);
+        sim->codes_size += len;
+    }
+
+    return 1;
+}
+
+/* Byte `count` of a SCREEN_SHOT reply: the header, then each line and its sum */
+uint8_t _gs_sim_shot_next(GS_SIM *sim) {
+    uint8_t header[9];
+    uint32_t pitch = sim->fb_width * sim->fb_depth;
+    uint32_t pos;
+    uint32_t y;
+    uint8_t data;
+
+    if (sim->count < sizeof(header)) {
+        put_be32(&header[0], sim->fb_address);
+        put_be16(&header[4], sim->fb_address ? sim->fb_width : 0);
+        put_be16(&header[6], sim->fb_address ? sim->fb_height : 0);
+        header[8] = sim->fb_depth;
+
+        return header[sim->count];
+    }
+    pos = sim->count - sizeof(header);
+
+    y = pos / (pitch + 1);
+    if ((pos % (pitch + 1)) == pitch) {
+        data = sim->sum;
+        sim->sum = 0;
+
+        return data;
+    }
+    data = gs_sim_read8(sim, sim->fb_address + (y * pitch) + (pos % (pitch + 1)));
+    sim->sum += data;
+
+    return data;
+}
+
+uint32_t _gs_sim_read32(GS_SIM *sim, uint32_t address) {
+    return (gs_sim_read8(sim, address + 0) << 24) |
+           (gs_sim_read8(sim, address + 1) << 16) |
+           (gs_sim_read8(sim, address + 2) << 8) |
+           (gs_sim_read8(sim, address + 3) << 0);
+}
+
+/* Let the game run; if it hits a jump to a stub image at the hook, the stub takes over */
+void _gs_sim_resume(GS_SIM *sim) {
+    uint32_t word;
+    uint32_t image;
+
+    sim->state = GS_SIM_RUNNING;
+    sim->tx = 'g';
+
+    if (!sim->hook) {
+        return;
+    }
+    word = _gs_sim_read32(sim, sim->hook);
+    if ((word >> 26) != 0x02) {
+        return;
+    }
+
+    /* J target; the image header sits just before the entry point */
+    image = (((sim->hook + 4) & 0xF0000000) | ((word & 0x03FFFFFF) << 2)) - GS_FAST_HDR_ENTRY;
+    if ((_gs_sim_read32(sim, image) != GS_FAST_MAGIC) ||
+        (_gs_sim_read32(sim, image + GS_FAST_HDR_LOAD) != image)) {
+        return;
+    }
+
+    sim->stub = image;
+    sim->phase = false;
+    sim->state = GS_SIM_FAST_IDLE;
+    sim->tx = 'f';
+}
+
+/* Encode the next block of a fast READ or HASH, and start sending it */
+void _gs_sim_fast_block(GS_SIM *sim) {
+    uint32_t i;
+    uint32_t n;
+    uint16_t crc;
+
+    sim->block_size = MIN((uint32_t)GS_FAST_BLOCK, sim->size - sim->count);
+    for (i = 0; i < sim->block_size; i++) {
+        if (sim->command == GS_FAST_HASH) {
+            n = sim->count + i;
+            sim->payload[i] = _gs_sim_fast_hash(sim, n / 8) >> (56 - ((n % 8) * 8));
+        }
+        else {
+            sim->payload[i] = gs_sim_read8(sim, sim->address + sim->count + i);
+        }
+    }
+
+    sim->block_len = gs_fast_encode(sim->payload, sim->block_size, sim->block);
+    crc = gs_crc16(sim->payload, sim->block_size);
+    sim->block[sim->block_len++] = crc >> 8;
+    sim->block[sim->block_len++] = crc;
+
+    sim->block_pos = 0;
+    sim->state = GS_SIM_FAST_SEND;
+    sim->tx = sim->block[0];
+}
+
+/* Hash one page for a fast HASH, as the stub would */
+uint64_t _gs_sim_fast_hash(GS_SIM *sim, uint32_t page) {
+    uint8_t data[GS_FAST_HASH_PAGE];
+    uint32_t address = sim->hash_base + (page * GS_FAST_HASH_PAGE);
+    uint32_t len = MIN((uint32_t)GS_FAST_HASH_PAGE, sim->hash_size - (page * GS_FAST_HASH_PAGE));
+    uint32_t i;
+
+    if (page != sim->hash_page) {
+        for (i = 0; i < len; i++) {
+            data[i] = gs_sim_read8(sim, address + i);
+        }
+        sim->hash = gs_fast_hash(data, len);
+        sim->hash_page = page;
+    }
+
+    return sim->hash;
+}
+
+/* Decode one byte of a fast WRITE block */
+void _gs_sim_fast_recv(GS_SIM *sim, uint8_t rx) {
+    if (!sim->run) {
+        sim->repeat = (rx & 0x80);
+        sim->run = (rx & 0x7F) + 1;
+        sim->word_pos = 0;
+        return;
+    }
+
+    sim->word[sim->word_pos++] = rx;
+    if (sim->word_pos < 4) {
+        return;
+    }
+    sim->word_pos = 0;
+
+    do {
+        if ((sim->count + 4) <= sizeof(sim->payload)) {
+            memcpy(&sim->payload[sim->count], sim->word, 4);
+        }
+        sim->count += 4;
+        sim->run--;
+    } while (sim->repeat && sim->run);
+
+    if (!sim->run && (sim->count >= sim->block_size)) {
+        sim->state = GS_SIM_FAST_CRC;
+        sim->sum = 0;
+        sim->word_pos = 0;
+    }
+}
+
+/* Handle one complete byte from the host while the stub has the CPU */
+void _gs_sim_fast_byte(GS_SIM *sim, uint8_t rx) {
+    uint32_t i;
+
+    switch (sim->state) {
+        case GS_SIM_FAST_IDLE:
+            sim->tx = 'f';
+            if (rx == 'F') {
+                sim->state = GS_SIM_FAST_HANDSHAKE;
+                sim->tx = 's';
+            }
+            break;
+
+        case GS_SIM_FAST_HANDSHAKE:
+            sim->state = (rx == 'S') ? GS_SIM_FAST_COMMAND : GS_SIM_FAST_IDLE;
+            sim->tx = (rx == 'S') ? 0 : 'f';
+            break;
+
+        case GS_SIM_FAST_COMMAND:
+            sim->command = rx;
+            sim->commands++;
+            sim->address = 0;
+            sim->size = 0;
+            sim->count = 0;
+            sim->state = GS_SIM_FAST_IDLE;
+            sim->tx = 'f';
+
+            switch (rx) {
+                case GS_FAST_READ:
+                case GS_FAST_WRITE:
+                case GS_FAST_HASH:
+                    sim->state = GS_SIM_FAST_ADDRESS;
+                    sim->tx = 0;
+                    break;
+
+                case GS_FAST_UNLOAD:
+                    /* Put the hooked instructions back, and leave the game running */
+                    for (i = 0; i < 8; i++) {
+                        gs_sim_write8(sim, sim->hook + i,
+                            gs_sim_read8(sim, sim->stub + GS_FAST_HDR_SAVED + i));
+                    }
+                    sim->stub = 0;
+                    sim->command = GS_CMD_NULL;
+                    sim->state = GS_SIM_RUNNING;
+                    sim->tx = 'g';
+                    break;
+
+                default:
+                    /* NOP and RESUME; the stub answers again at the next hook */
+                    break;
+            }
+            break;
+
+        case GS_SIM_FAST_ADDRESS:
+            sim->address = (sim->address << 8) | rx;
+            if (++sim->count == 4) {
+                sim->state = GS_SIM_FAST_SIZE;
+                sim->count = 0;
+            }
+            break;
+
+        case GS_SIM_FAST_SIZE:
+            sim->size = (sim->size << 8) | rx;
+            if (++sim->count < 4) {
+                break;
+            }
+            sim->count = 0;
+            sim->offset = 0;
+
+            if (!sim->size) {
+                sim->state = GS_SIM_FAST_IDLE;
+                sim->tx = 'f';
+            }
+            else if (sim->command == GS_FAST_READ) {
+                sim->address &= ~3;
+                sim->size = (sim->size + 3) & ~3;
+                _gs_sim_fast_block(sim);
+            }
+            else if (sim->command == GS_FAST_HASH) {
+                /* The payload is one 64-bit hash per page */
+                sim->hash_base = sim->address & ~3;
+                sim->hash_size = (sim->size + 3) & ~3;
+                sim->hash_page = (uint32_t)-1;
+                sim->size = ((sim->hash_size + GS_FAST_HASH_PAGE - 1) / GS_FAST_HASH_PAGE) * 8;
+                _gs_sim_fast_block(sim);
+            }
+            else {
+                sim->state = GS_SIM_FAST_RECV;
+                sim->block_size = MIN((uint32_t)GS_FAST_BLOCK, (sim->size + 3) & ~3);
+                sim->run = 0;
+            }
+            break;
+
+        case GS_SIM_FAST_SEND:
+            if (++sim->block_pos < sim->block_len) {
+                sim->tx = sim->block[sim->block_pos];
+                break;
+            }
+            sim->state = GS_SIM_FAST_REPLY;
+            sim->tx = 0;
+            break;
+
+        case GS_SIM_FAST_RECV:
+            _gs_sim_fast_recv(sim, rx);
+            break;
+
+        case GS_SIM_FAST_CRC:
+            sim->sum = (sim->sum << 8) | rx;
+            if (++sim->word_pos < 2) {
+                break;
+            }
+
+            sim->ack = (sim->count == sim->block_size) &&
+                (sim->sum == gs_crc16(sim->payload, sim->block_size));
+            if (sim->ack) {
+                for (i = 0; (i < sim->block_size) && ((sim->offset + i) < sim->size); i++) {
+                    gs_sim_write8(sim, sim->address + sim->offset + i, sim->payload[i]);
+                }
+                sim->offset += sim->block_size;
+            }
+            sim->state = GS_SIM_FAST_REPLY;
+            sim->tx = sim->ack ? GS_FAST_ACK : GS_FAST_NAK;
+            break;
+
+        case GS_SIM_FAST_REPLY:
+            if (sim->command != GS_FAST_WRITE) {
+                sim->ack = (rx == GS_FAST_ACK);
+                if (sim->ack) {
+                    sim->count += sim->block_size;
+                }
+            }
+            if (!sim->ack) {
+                sim->retries++;
+            }
+
+            if (sim->command != GS_FAST_WRITE) {
+                if (sim->count < sim->size) {
+                    _gs_sim_fast_block(sim);
+                    break;
+                }
+            }
+            else if (sim->offset < sim->size) {
+                sim->state = GS_SIM_FAST_RECV;
+                sim->block_size = MIN((uint32_t)GS_FAST_BLOCK, ((sim->size - sim->offset) + 3) & ~3);
+                sim->count = 0;
+                sim->run = 0;
+                sim->tx = 0;
+                break;
+            }
+
+            sim->state = GS_SIM_FAST_IDLE;
+            sim->tx = 'f';
+            break;
+    }
+}
+
+
+/* Public functions */
+
+/* Create a console in-game, with `ram_size` bytes of RDRAM, zeroed but for osMemSize */
+void gs_sim_init(GS_SIM *sim, uint32_t ram_size) {
+    memset(sim, 0, sizeof(GS_SIM));
+    sim->ram_size = ram_size;
+    sim->ram = alloc(ram_size);
+    put_be32(&sim->ram[0x318], ram_size);   /* Set by the boot code */
+    sim->where = GS_WHERE_GAME;
+    sim->hook = 0x80000180; /* General exception vector; games pass it on every interrupt */
+    strcpy(sim->version, "GameShark Pro 3.30 (sim)");
+    sim->state = GS_SIM_RUNNING;
+    sim->command = GS_CMD_NULL;
+    sim->tx = 'g';
+}
+
+void gs_sim_free(GS_SIM *sim) {
+    free(sim->ram);
+    sim->ram = NULL;
+    if (_gs_sim_attached == sim) {
+        _gs_sim_attached = NULL;
+    }
+}
+
+/* Route a GS_CONFIG's port callbacks to the simulator */
+void gs_sim_attach(GS_SIM *sim, GS_CONFIG *config) {
+    _gs_sim_attached = sim;
+    config->in_callback = _gs_sim_in_callback;
+    config->out_callback = _gs_sim_out_callback;
+    config->virtual_port = true;
+}
+
+/* Status register read */
+uint8_t gs_sim_in(GS_SIM *sim) {
+    return sim->status;
+}
+
+/* Data register write; a rising strobe (bit 4) exchanges one nybble */
+void gs_sim_out(GS_SIM *sim, uint8_t data) {
+    uint8_t nybble;
+    bool level = (data & 0x10);
+
+    /* The stub exchanges a nybble on either edge, and acks with the strobe level */
+    if (sim->stub) {
+        sim->strobe = level;
+        if (level == sim->phase) {
+            /* Return-to-zero from the stock exchange that handed over */
+            if (!level) sim->status &= ~0x08;
+            return;
+        }
+        sim->phase = level;
+        sim->nibbles++;
+
+        nybble = sim->low ? (sim->tx & 0x0F) : (sim->tx >> 4);
+        sim->status = (((nybble ^ 0x08) & 0x0F) << 4) | (level ? 0x08 : 0);
+        sim->rx = (sim->rx << 4) | (data & 0x0F);
+
+        sim->low = !sim->low;
+        if (!sim->low) {
+            _gs_sim_fast_byte(sim, sim->rx);
+        }
+        return;
+    }
+
+    if (!(data & 0x10)) {
+        sim->strobe = false;
+        sim->status &= ~0x08;
+        return;
+    }
+    if (sim->strobe) {
+        return;
+    }
+    sim->strobe = true;
+    sim->nibbles++;
+
+    /* High nybble first; bit 7 of the status register reads inverted */
+    nybble = sim->low ? (sim->tx & 0x0F) : (sim->tx >> 4);
+    sim->status = (((nybble ^ 0x08) & 0x0F) << 4) | 0x08;
+    sim->rx = (sim->rx << 4) | (data & 0x0F);
+
+    sim->low = !sim->low;
+    if (!sim->low) {
+        _gs_sim_byte(sim, sim->rx);
+    }
+}
+
+/* CPU-visible memory map: KSEG0/KSEG1 RDRAM (mirrored past its size) and cart ROM */
+uint8_t gs_sim_read8(GS_SIM *sim, uint32_t address) {
+    uint32_t phys = address & 0x1FFFFFFF;
+
+    if (phys < 0x00800000) {
+        return sim->ram[(phys % sim->ram_size) ^ sim->ram_swap];
+    }
+    if ((phys >= 0x10000000) && ((phys - 0x10000000) < sim->rom_size)) {
+        return sim->rom[phys - 0x10000000];
+    }
+    if ((phys >= 0x1EC00000) && ((phys - 0x1EC00000) < sizeof(sim->gs_rom))) {
+        return sim->gs_rom[phys - 0x1EC00000];
+    }
+    if ((phys & ~3) == (GS_VI_ORIGIN & 0x1FFFFFFF)) {
+        /* The displayed frame buffer, as a physical address */
+        return ((sim->fb_address & 0x00FFFFFF) >> ((3 - (phys & 3)) * 8)) & 0xFF;
+    }
+
+    return 0;
+}
+
+void gs_sim_write8(GS_SIM *sim, uint32_t address, uint8_t data) {
+    uint32_t phys = address & 0x1FFFFFFF;
+
+    if (phys < 0x00800000) {
+        sim->ram[(phys % sim->ram_size) ^ sim->ram_swap] = data;
+    }
+}
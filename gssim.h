@@ -0,0 +1,135 @@
+
+#ifndef _GSSIM_H_
+#define _GSSIM_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gspro.h"
+
+
+/*
+ * Software model of the GameShark side of the link.
+ *
+ * The simulator answers the same parallel-port status reads and data writes
+ * the hardware would, so it can be plugged into GS_CONFIG in place of a port.
+ * It implements the commands gspro.c speaks (READ, WRITE, UNPAUSE, WHERE,
+ * VERSION, UPGRADE, READ_ROM, READ_MEMPAK, SCREEN_SHOT and the code list
+ * commands) against in-memory RDRAM, cartridge ROM, GS ROM, Controller Pak and
+ * code list images.
+ *
+ * Like the firmware, it refuses a READ with a range starting in a window
+ * gs_read_blocked() names: the range reads as zeros and the checksum fails.
+ *
+ * It also models a fast transfer stub (see gs_fast_start()). MIPS code is not
+ * executed; when the game resumes with a jump to a stub image at `hook`, the
+ * simulator speaks the stub's protocol until the stub is unloaded.
+ */
+
+/* Device states, advanced one received byte at a time */
+enum _gs_sim_states {
+    GS_SIM_RUNNING,     /* Game running; any traffic pauses it */
+    GS_SIM_IDLE,        /* Awaiting command handshake ('G') */
+    GS_SIM_HANDSHAKE,   /* Got 'G', awaiting 'T' */
+    GS_SIM_COMMAND,     /* Awaiting command byte */
+    GS_SIM_ADDRESS,     /* Receiving 32-bit address */
+    GS_SIM_SIZE,        /* Receiving 32-bit size */
+    GS_SIM_DATA,        /* Transferring data */
+    GS_SIM_QUEUE,       /* Sending queued bytes */
+    GS_SIM_MEMPAK,      /* Sending the Controller Pak */
+    GS_SIM_CODES_INDEX, /* Receiving the READ_CODES game index */
+    GS_SIM_CODES_SEND,  /* Sending a code list */
+    GS_SIM_CODES_RECV,  /* Receiving a code list */
+    GS_SIM_SHOT_MODE,   /* Awaiting the SCREEN_SHOT mode */
+    GS_SIM_SHOT_SEND,   /* Sending a frame */
+
+    /* Fast transfer stub */
+    GS_SIM_FAST_IDLE,       /* Awaiting command handshake ('F') */
+    GS_SIM_FAST_HANDSHAKE,  /* Got 'F', awaiting 'S' */
+    GS_SIM_FAST_COMMAND,    /* Awaiting command byte */
+    GS_SIM_FAST_ADDRESS,    /* Receiving 32-bit address */
+    GS_SIM_FAST_SIZE,       /* Receiving 32-bit size */
+    GS_SIM_FAST_SEND,       /* Sending an encoded block */
+    GS_SIM_FAST_RECV,       /* Receiving an encoded block */
+    GS_SIM_FAST_CRC,        /* Receiving a block's CRC */
+    GS_SIM_FAST_REPLY       /* Exchanging ACK / NAK */
+};
+
+struct _gs_sim {
+    /* Memory images */
+    uint8_t *   ram;
+    uint32_t    ram_size;
+    uint8_t     ram_swap;   /* XORed into RDRAM offsets; 3 for host-endian words */
+    uint8_t *   rom;
+    uint32_t    rom_size;
+    uint8_t     gs_rom[0x00040000];
+    uint8_t     mempak[GS_MEMPAK_SIZE];
+    bool        mempak_present;
+    uint8_t     codes[GS_CODES_MAX];
+    uint32_t    codes_size;
+    uint8_t     codes_io[GS_CODES_MAX + (GS_CODES_MAX / GS_CODES_CHUNK) + 4];
+    uint32_t    fb_address; /* Displayed frame buffer (KSEG0); 0 for none */
+    uint16_t    fb_width;
+    uint16_t    fb_height;
+    uint8_t     fb_depth;
+    uint8_t     where;
+    char        version[32];
+
+    /* Byte-level state */
+    int         state;
+    int         next_state;
+    int         command;
+    uint32_t    address;
+    uint32_t    size;
+    uint32_t    count;
+    uint32_t    offset;
+    uint32_t    sum;
+    bool        refused;    /* READ started a range in a blocked window */
+    uint8_t     tx;
+    uint8_t     rx;
+    uint8_t     queue[64];
+    uint32_t    queue_len;
+    uint32_t    queue_pos;
+
+    /* Fast transfer stub */
+    uint32_t    hook;       /* Address the game passes through; 0 for none */
+    uint32_t    stub;       /* Image address while the stub is resident */
+    bool        phase;      /* Strobe level of the last stub exchange */
+    uint8_t     block[GS_FAST_BLOCK + 16];
+    uint32_t    block_len;
+    uint32_t    block_pos;
+    uint32_t    block_size;
+    uint32_t    run;
+    uint32_t    word_pos;
+    bool        repeat;
+    bool        ack;
+    uint8_t     word[4];
+    uint8_t     payload[GS_FAST_BLOCK];
+    uint32_t    hash_base;  /* HASH: the memory being hashed */
+    uint32_t    hash_size;
+    uint32_t    hash_page;  /* Page whose hash is in `hash`; -1 for none */
+    uint64_t    hash;
+
+    /* Nibble-level state */
+    uint8_t     status;
+    bool        strobe;
+    bool        low;        /* Next nybble is the low half */
+
+    /* Statistics */
+    uint64_t    nibbles;
+    uint64_t    commands;
+    uint64_t    retries;
+};
+typedef struct _gs_sim GS_SIM;
+
+
+/* Function declarations */
+void gs_sim_init(GS_SIM *sim, uint32_t ram_size);
+void gs_sim_free(GS_SIM *sim);
+void gs_sim_attach(GS_SIM *sim, GS_CONFIG *config);
+uint8_t gs_sim_in(GS_SIM *sim);
+void gs_sim_out(GS_SIM *sim, uint8_t data);
+uint8_t gs_sim_read8(GS_SIM *sim, uint32_t address);
+void gs_sim_write8(GS_SIM *sim, uint32_t address, uint8_t data);
+
+#endif /* _GSSIM_H_ */
@@ -0,0 +1,396 @@
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#if defined(HAS_USERFAULTFD_H)
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <linux/userfaultfd.h>
+#endif /* defined(HAS_USERFAULTFD_H) */
+
+#include "gspro.h"
+#include "memmap.h"
+#include "n64rd.h"
+#include "lazy.h"
+
+
+/* lazy->present values */
+#define _LAZY_MISSING   0
+#define _LAZY_PRESENT   1
+#define _LAZY_FAILED    2   /* Installed as zeros; reported by lazy_check() */
+
+
+/* Private function declarations */
+int _lazy_fetch(LAZY *lazy, uint32_t first, uint32_t count, uint8_t *buf);
+bool _lazy_pages(LAZY *lazy, uint32_t address, uint32_t size, uint32_t *first, uint32_t *count);
+#if defined(HAS_USERFAULTFD_H)
+int _lazy_register(LAZY *lazy);
+void *_lazy_handler(void *arg);
+#endif /* defined(HAS_USERFAULTFD_H) */
+
+
+/* Private functions */
+
+/* Read `count` pages from page `first` into `buf`; the caller holds the lock */
+int _lazy_fetch(LAZY *lazy, uint32_t first, uint32_t count, uint8_t *buf) {
+    MEMMAP_PLAN plan;
+    uint32_t address = lazy->start + (first * lazy->page_size);
+    int result;
+
+    result = memmap_plan(lazy->map, address, count * lazy->page_size, lazy->paused, &plan);
+    if (!result) {
+        result = memmap_read(&plan, buf, NULL, NULL);
+        memmap_plan_free(&plan);
+    }
+
+    if (result) {
+        memset(buf, 0, count * lazy->page_size);
+        lazy->failed += count;
+    }
+    lazy->fetched += count;
+
+    return result;
+}
+
+/* The pages overlapping [address, address + size) within the view */
+bool _lazy_pages(LAZY *lazy, uint32_t address, uint32_t size, uint32_t *first, uint32_t *count) {
+    uint64_t lo = MAX(address, lazy->start);
+    uint64_t hi = MIN((uint64_t)address + size,
+        (uint64_t)lazy->start + ((uint64_t)lazy->page_count * lazy->page_size));
+
+    if (lo >= hi) {
+        return false;
+    }
+
+    *first = (lo - lazy->start) / lazy->page_size;
+    *count = ((hi - lazy->start + lazy->page_size - 1) / lazy->page_size) - *first;
+
+    return true;
+}
+
+#if defined(HAS_USERFAULTFD_H)
+/* Hand missing-page faults on the mapping to a new userfaultfd */
+int _lazy_register(LAZY *lazy) {
+    struct uffdio_api api;
+    struct uffdio_register reg;
+
+    /* Only user-mode faults are needed, which unprivileged processes may ask for */
+    #if defined(UFFD_USER_MODE_ONLY)
+        lazy->uffd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+    #endif /* defined(UFFD_USER_MODE_ONLY) */
+    if (lazy->uffd == -1) {
+        lazy->uffd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+    }
+    if (lazy->uffd == -1) {
+        DEBUGPRINT("userfaultfd: %s\n", strerror(errno));
+        return 1;
+    }
+
+    memset(&api, 0, sizeof(api));
+    api.api = UFFD_API;
+    memset(&reg, 0, sizeof(reg));
+    reg.range.start = (uintptr_t)lazy->base;
+    reg.range.len = (uint64_t)lazy->page_count * lazy->page_size;
+    reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+
+    if (ioctl(lazy->uffd, UFFDIO_API, &api) || ioctl(lazy->uffd, UFFDIO_REGISTER, &reg) ||
+        !(reg.ioctls & ((uint64_t)1 << _UFFDIO_COPY)) || pipe(lazy->wake)) {
+        DEBUGPRINT("userfaultfd setup: %s\n", strerror(errno));
+        close(lazy->uffd);
+        lazy->uffd = -1;
+        return 1;
+    }
+
+    lazy->page = alloc(lazy->page_size);
+    if (pthread_create(&lazy->thread, NULL, _lazy_handler, lazy)) {
+        close(lazy->wake[0]);
+        close(lazy->wake[1]);
+        close(lazy->uffd);
+        lazy->uffd = -1;
+        free(lazy->page);
+        lazy->page = NULL;
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Serve faults until woken through lazy->wake */
+void *_lazy_handler(void *arg) {
+    LAZY *lazy = arg;
+    struct uffd_msg msg;
+    struct uffdio_copy copy;
+    struct pollfd fds[2];
+    uint32_t n;
+
+    fds[0].fd = lazy->uffd;
+    fds[0].events = POLLIN;
+    fds[1].fd = lazy->wake[0];
+    fds[1].events = POLLIN;
+
+    while (true) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[1].revents) {
+            break;
+        }
+        if (read(lazy->uffd, &msg, sizeof(msg)) != sizeof(msg)) {
+            continue;
+        }
+        if (msg.event != UFFD_EVENT_PAGEFAULT) {
+            continue;
+        }
+
+        n = (msg.arg.pagefault.address - (uintptr_t)lazy->base) / lazy->page_size;
+
+        pthread_mutex_lock(&lazy->lock);
+
+        /* The touching thread waits for a page, so a failed read still installs one */
+        if (_lazy_fetch(lazy, n, 1, lazy->page)) {
+            lazy->present[n] = _LAZY_FAILED;
+        }
+        else {
+            /* Marked first: installing the page wakes the touching thread */
+            lazy->present[n] = _LAZY_PRESENT;
+        }
+        memset(&copy, 0, sizeof(copy));
+        copy.dst = (uintptr_t)&lazy->base[(size_t)n * lazy->page_size];
+        copy.src = (uintptr_t)lazy->page;
+        copy.len = lazy->page_size;
+
+        /* EEXIST: another thread faulted on the same page, which is now installed */
+        if (ioctl(lazy->uffd, UFFDIO_COPY, &copy) && (errno != EEXIST)) {
+            fprintf(stderr, "Unable to install page 0x%08X: %s\n",
+                lazy->start + (n * lazy->page_size), strerror(errno));
+        }
+        pthread_mutex_unlock(&lazy->lock);
+    }
+
+    return NULL;
+}
+#endif /* defined(HAS_USERFAULTFD_H) */
+
+
+/* Public functions */
+
+/* Map [address, address + size); read lazily when userfaultfd is available */
+int lazy_open(LAZY *lazy, MEMMAP *map, uint32_t address, uint32_t size, bool paused) {
+    uint64_t end = (uint64_t)address + size;
+
+    memset(lazy, 0, sizeof(LAZY));
+    lazy->uffd = -1;
+
+    if (!size || (end > 0x100000000ULL)) {
+        fprintf(stderr, "Invalid view: 0x%08X, 0x%08X bytes\n", address, size);
+        return 1;
+    }
+
+    lazy->address = address;
+    lazy->size = size;
+    lazy->map = map;
+    lazy->paused = paused;
+    lazy->page_size = sysconf(_SC_PAGESIZE);
+    lazy->start = address & ~(lazy->page_size - 1);
+    lazy->page_count = (end - lazy->start + lazy->page_size - 1) / lazy->page_size;
+
+    lazy->base = mmap(NULL, (size_t)lazy->page_count * lazy->page_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (lazy->base == MAP_FAILED) {
+        fprintf(stderr, "Unable to map a 0x%08X byte view: %s\n", size, strerror(errno));
+        lazy->base = NULL;
+        return 1;
+    }
+    lazy->data = &lazy->base[address - lazy->start];
+    lazy->present = alloc(lazy->page_count);
+    memset(lazy->present, 0, lazy->page_count);
+    pthread_mutex_init(&lazy->lock, NULL);
+
+    #if defined(HAS_USERFAULTFD_H)
+        if (!_lazy_register(lazy)) {
+            return 0;
+        }
+    #endif /* defined(HAS_USERFAULTFD_H) */
+
+    /* No demand paging; read everything now */
+    DEBUGPRINT("No userfaultfd; reading the view up front\n");
+    pthread_mutex_lock(&lazy->lock);
+    _lazy_fetch(lazy, 0, lazy->page_count, lazy->base);
+    memset(lazy->present, _LAZY_PRESENT, lazy->page_count);
+    pthread_mutex_unlock(&lazy->lock);
+    if (lazy->failed) {
+        lazy_close(lazy);
+        return 1;
+    }
+
+    return 0;
+}
+
+void lazy_close(LAZY *lazy) {
+    if (!lazy->base) {
+        return;
+    }
+
+    if (lazy->uffd != -1) {
+        if (write(lazy->wake[1], "", 1) == 1) {
+            pthread_join(lazy->thread, NULL);
+        }
+        close(lazy->wake[0]);
+        close(lazy->wake[1]);
+        close(lazy->uffd);
+        free(lazy->page);
+    }
+
+    munmap(lazy->base, (size_t)lazy->page_count * lazy->page_size);
+    free(lazy->present);
+    pthread_mutex_destroy(&lazy->lock);
+    memset(lazy, 0, sizeof(LAZY));
+    lazy->uffd = -1;
+}
+
+/* Has the page holding `address` been read? */
+bool lazy_present(LAZY *lazy, uint32_t address) {
+    uint32_t first;
+    uint32_t count;
+    bool present = false;
+
+    if (_lazy_pages(lazy, address, 1, &first, &count)) {
+        pthread_mutex_lock(&lazy->lock);
+        present = (lazy->present[first] == _LAZY_PRESENT);
+        pthread_mutex_unlock(&lazy->lock);
+    }
+
+    return present;
+}
+
+/*
+ * Drop the pages overlapping [address, address + size), so that the next
+ * touch reads them again. Without userfaultfd they are refreshed instead.
+ */
+int lazy_invalidate(LAZY *lazy, uint32_t address, uint32_t size) {
+    uint32_t first;
+    uint32_t count;
+
+    if (lazy->uffd == -1) {
+        return lazy_refresh(lazy, address, size);
+    }
+    if (!_lazy_pages(lazy, address, size, &first, &count)) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&lazy->lock);
+    if (madvise(&lazy->base[(size_t)first * lazy->page_size], (size_t)count * lazy->page_size,
+        MADV_DONTNEED)) {
+        fprintf(stderr, "Unable to invalidate the view: %s\n", strerror(errno));
+        pthread_mutex_unlock(&lazy->lock);
+        return 1;
+    }
+    memset(&lazy->present[first], _LAZY_MISSING, count);
+    pthread_mutex_unlock(&lazy->lock);
+
+    return 0;
+}
+
+/*
+ * Were the pages overlapping [address, address + size) that have been touched
+ * read? Pages that failed are reported and dropped, so the next touch tries
+ * them again; until then they read as zeros.
+ */
+int lazy_check(LAZY *lazy, uint32_t address, uint32_t size) {
+    uint32_t first;
+    uint32_t count;
+    uint32_t i;
+    int result = 0;
+
+    if (!_lazy_pages(lazy, address, size, &first, &count)) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&lazy->lock);
+    for (i = first; i < (first + count); i++) {
+        if (lazy->present[i] != _LAZY_FAILED) {
+            continue;
+        }
+        fprintf(stderr, "Unable to read page 0x%08X of the view\n", lazy->start + (i * lazy->page_size));
+        if (!madvise(&lazy->base[(size_t)i * lazy->page_size], lazy->page_size, MADV_DONTNEED)) {
+            lazy->present[i] = _LAZY_MISSING;
+        }
+        result = 1;
+    }
+    pthread_mutex_unlock(&lazy->lock);
+
+    return result;
+}
+
+/*
+ * Read the pages overlapping [address, address + size) that have already been
+ * read again, now; each run of them is one read. Pages not yet read stay lazy.
+ */
+int lazy_refresh(LAZY *lazy, uint32_t address, uint32_t size) {
+    uint32_t first;
+    uint32_t count;
+    uint32_t end;
+    uint32_t run;
+    uint8_t *buf;
+    int result = 0;
+
+    if (!_lazy_pages(lazy, address, size, &first, &count)) {
+        return 0;
+    }
+    end = first + count;
+
+    pthread_mutex_lock(&lazy->lock);
+    while (first < end) {
+        if (lazy->present[first] != _LAZY_PRESENT) {
+            first++;
+            continue;
+        }
+        for (run = 1; ((first + run) < end) && (lazy->present[first + run] == _LAZY_PRESENT); run++);
+
+        /* Read aside, so a failed read leaves the old contents */
+        buf = alloc((size_t)run * lazy->page_size);
+        if (_lazy_fetch(lazy, first, run, buf)) {
+            result = 1;
+        }
+        else {
+            memcpy(&lazy->base[(size_t)first * lazy->page_size], buf, (size_t)run * lazy->page_size);
+        }
+        free(buf);
+        first += run;
+    }
+    pthread_mutex_unlock(&lazy->lock);
+
+    return result;
+}
+
+void lazy_print(LAZY *lazy) {
+    uint32_t present = 0;
+    uint32_t fetched;
+    uint32_t failed;
+    uint32_t i;
+
+    pthread_mutex_lock(&lazy->lock);
+    for (i = 0; i < lazy->page_count; i++) {
+        present += (lazy->present[i] == _LAZY_PRESENT);
+    }
+    fetched = lazy->fetched;
+    failed = lazy->failed;
+    pthread_mutex_unlock(&lazy->lock);
+
+    printf("View 0x%08X - 0x%08X: %u of %u pages present, %u read (%u KB), %u failed%s\n",
+        lazy->address, lazy->address + lazy->size - 1, present, lazy->page_count, fetched,
+        (uint32_t)(((uint64_t)fetched * lazy->page_size) >> 10), failed,
+        ((lazy->uffd == -1) ? " (read up front)" : ""));
+}
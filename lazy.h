@@ -0,0 +1,64 @@
+
+#ifndef _LAZY_H_
+#define _LAZY_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "memmap.h"
+
+
+/*
+ * Lazy views: a window of the console's address space mapped into the host as
+ * a plain array. Nothing is read up front; the first touch of each page reads
+ * just that page (planned with memmap_plan(), so any region can be viewed) and
+ * installs it, through Linux's userfaultfd. Pages stay as they were read until
+ * they are invalidated or refreshed.
+ *
+ * Pages are fetched by a handler thread while the touching thread waits, so
+ * only one thread may use the link while a view is open. Each page is its own
+ * read: with `paused`, the game is paused for each page, not for the view.
+ * The touching thread cannot be handed an error, so a page that fails to read
+ * is installed as zeros; check lazy_check() before trusting what was touched.
+ *
+ * Without userfaultfd (other systems, or when the kernel refuses it), the
+ * whole window is read when the view is opened.
+ */
+
+struct _lazy {
+    uint8_t *       data;       /* The byte at `address` */
+    uint32_t        address;
+    uint32_t        size;
+
+    uint8_t *       base;       /* Host mapping of the window, rounded out to pages */
+    uint32_t        start;      /* Target address of base */
+    uint32_t        page_size;
+    uint32_t        page_count;
+    uint8_t *       present;    /* One state per page (see lazy.c) */
+    MEMMAP *        map;
+    bool            paused;
+
+    /* Fault handling; uffd is -1 when the window was read up front */
+    int             uffd;
+    int             wake[2];
+    pthread_t       thread;
+    pthread_mutex_t lock;       /* Held while the link is in use */
+    uint8_t *       page;       /* Handler's read buffer */
+
+    uint32_t        fetched;    /* Pages read so far */
+    uint32_t        failed;     /* Page reads that failed */
+};
+typedef struct _lazy LAZY;
+
+
+/* Function declarations */
+int lazy_open(LAZY *lazy, MEMMAP *map, uint32_t address, uint32_t size, bool paused);
+void lazy_close(LAZY *lazy);
+bool lazy_present(LAZY *lazy, uint32_t address);
+int lazy_invalidate(LAZY *lazy, uint32_t address, uint32_t size);
+int lazy_refresh(LAZY *lazy, uint32_t address, uint32_t size);
+int lazy_check(LAZY *lazy, uint32_t address, uint32_t size);
+void lazy_print(LAZY *lazy);
+
+#endif /* _LAZY_H_ */
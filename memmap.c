@@ -0,0 +1,543 @@
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gspro.h"
+#include "stream.h"
+#include "n64rd.h"
+#include "memmap.h"
+
+
+/* Physical regions, in address order, covering 0x00000000 - 0x1FFFFFFF */
+static const MEMMAP_REGION _memmap_regions[] = {
+    { 0x00000000, 0x003FFFFF, MEMMAP_RDRAM,     "RDRAM" },
+    { 0x00400000, 0x007FFFFF, MEMMAP_RDRAM,     "RDRAM (Expansion Pak)" },
+    { 0x00800000, 0x03EFFFFF, MEMMAP_UNMAPPED,  "Unused" },
+    { 0x03F00000, 0x03FFFFFF, MEMMAP_IO,        "RDRAM registers" },
+    { 0x04000000, 0x04000FFF, MEMMAP_IO,        "SP DMEM" },
+    { 0x04001000, 0x04001FFF, MEMMAP_IO,        "SP IMEM" },
+    { 0x04002000, 0x0403FFFF, MEMMAP_UNMAPPED,  "Unused" },
+    { 0x04040000, 0x040FFFFF, MEMMAP_IO,        "SP registers" },
+    { 0x04100000, 0x041FFFFF, MEMMAP_IO,        "DP command registers" },
+    { 0x04200000, 0x042FFFFF, MEMMAP_IO,        "DP span registers" },
+    { 0x04300000, 0x043FFFFF, MEMMAP_IO,        "MI registers" },
+    { 0x04400000, 0x044FFFFF, MEMMAP_IO,        "VI registers" },
+    { 0x04500000, 0x045FFFFF, MEMMAP_IO,        "AI registers" },
+    { 0x04600000, 0x046FFFFF, MEMMAP_IO,        "PI registers" },
+    { 0x04700000, 0x047FFFFF, MEMMAP_IO,        "RI registers" },
+    { 0x04800000, 0x048FFFFF, MEMMAP_IO,        "SI registers" },
+    { 0x04900000, 0x04FFFFFF, MEMMAP_UNMAPPED,  "Unused" },
+    { 0x05000000, 0x05FFFFFF, MEMMAP_CART,      "Cart domain 2 (64DD registers)" },
+    { 0x06000000, 0x07FFFFFF, MEMMAP_CART,      "Cart domain 1 (64DD IPL ROM)" },
+    { 0x08000000, 0x0FFFFFFF, MEMMAP_CART,      "Cart domain 2 (SRAM / FlashRAM)" },
+    { 0x10000000, 0x1FBFFFFF, MEMMAP_CART,      "Cart domain 1 (cartridge ROM)" },
+    { 0x1FC00000, 0x1FC007BF, MEMMAP_IO,        "PIF ROM" },
+    { 0x1FC007C0, 0x1FC007FF, MEMMAP_IO,        "PIF RAM" },
+    { 0x1FC00800, 0x1FCFFFFF, MEMMAP_UNMAPPED,  "Unused" },
+    { 0x1FD00000, 0x1FFFFFFF, MEMMAP_CART,      "Cart domain 1 (address 3)" }
+};
+
+/* Virtual segments outside KSEG0 / KSEG1; bounds are virtual */
+static const MEMMAP_REGION _memmap_kuseg = { 0x00000000, 0x7FFFFFFF, MEMMAP_TLB, "KUSEG (TLB-mapped)" };
+static const MEMMAP_REGION _memmap_kseg2 = { 0xC0000000, 0xFFFFFFFF, MEMMAP_TLB, "KSEG2 (TLB-mapped)" };
+
+/* Passes on `left` bytes after dropping `skip`; trims READ_ROM's whole words to a segment */
+struct _memmap_trim {
+    GS_SINK *       sink;
+    uint32_t        skip;
+    uint32_t        left;
+};
+typedef struct _memmap_trim MEMMAP_TRIM;
+
+
+/* Private function declarations */
+void _memmap_add(MEMMAP_PLAN *plan, uint32_t address, uint32_t size, uint32_t offset,
+    const MEMMAP_REGION *region, bool paused);
+void _memmap_source(MEMMAP_SEGMENT *segment);
+int _memmap_read_rom(MEMMAP_SEGMENT *segment, uint8_t *data, void (*callback)(uint32_t));
+int _memmap_read_batch(MEMMAP_PLAN *plan, uint8_t *buf, void (*callback)(int, uint32_t));
+int _memmap_trim_write(GS_SINK *sink, const uint8_t *buf, size_t size);
+
+
+/* Private functions */
+
+/* Append a segment, or grow the last one when it continues with the same method */
+void _memmap_add(MEMMAP_PLAN *plan, uint32_t address, uint32_t size, uint32_t offset,
+    const MEMMAP_REGION *region, bool paused) {
+    MEMMAP_SEGMENT *segment;
+    uint8_t method;
+
+    switch (region->kind) {
+        case MEMMAP_UNMAPPED:
+            method = MEMMAP_SKIP;
+            break;
+
+        case MEMMAP_RDRAM:
+            method = paused ? MEMMAP_READ : MEMMAP_READ_ROM;
+            break;
+
+        default:
+            method = MEMMAP_READ_ROM;
+            break;
+    }
+
+    if (plan->count) {
+        segment = &plan->segments[plan->count - 1];
+        if ((segment->method == method) && (segment->region->kind == region->kind) &&
+            ((segment->address + segment->size) == address)) {
+            segment->size += size;
+            _memmap_source(segment);
+            return;
+        }
+    }
+
+    if (plan->count == plan->capacity) {
+        plan->capacity *= 2;
+        plan->segments = realloc(plan->segments, plan->capacity * sizeof(MEMMAP_SEGMENT));
+        if (!plan->segments) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+
+    segment = &plan->segments[plan->count++];
+    segment->address = address;
+    segment->size = size;
+    segment->offset = offset;
+    segment->method = method;
+    segment->region = region;
+    _memmap_source(segment);
+}
+
+/* Pick the address to read: the requested mirror for READ, KSEG1 words for READ_ROM I/O */
+void _memmap_source(MEMMAP_SEGMENT *segment) {
+    uint32_t address = segment->address;
+
+    switch (segment->method) {
+        case MEMMAP_SKIP:
+            segment->source = address;
+            segment->source_size = 0;
+            break;
+
+        case MEMMAP_READ:
+            /* Only the start of a range is checked; the other mirror is always allowed */
+            if (memmap_read_blocked(address)) {
+                address ^= (MEMMAP_KSEG0 ^ MEMMAP_KSEG1);
+            }
+            segment->source = address;
+            segment->source_size = segment->size;
+            break;
+
+        case MEMMAP_READ_ROM:
+            /* I/O must not be read through the cache; RDRAM is read through the mirror asked for */
+            if ((segment->region->kind == MEMMAP_IO) || (segment->region->kind == MEMMAP_CART)) {
+                address = (address & MEMMAP_PHYS_MASK) | MEMMAP_KSEG1;
+            }
+            segment->source = address & ~3;
+            segment->source_size = ((uint32_t)((uint64_t)address + segment->size + 3) & ~3) - segment->source;
+            break;
+    }
+}
+
+/* Read one segment 32 bits at a time; leaves PC-control */
+int _memmap_read_rom(MEMMAP_SEGMENT *segment, uint8_t *data, void (*callback)(uint32_t)) {
+    uint8_t *buf = &data[segment->offset];
+    uint32_t lead = segment->address & 3;
+    GS_RANGE range[2] = {
+        {
+            segment->source,
+            segment->source_size
+        },
+        {
+            0, 0
+        }
+    };
+
+    if (lead || (segment->source_size != segment->size)) {
+        buf = alloc(segment->source_size);
+    }
+
+    if (gs_enter() || gs_read_rom(buf, range, callback)) {
+        fprintf(stderr, "%s(): reading 0x%08X failed\n", __FUNCTION__, segment->source);
+        if (buf != &data[segment->offset]) {
+            free(buf);
+        }
+        return 1;
+    }
+
+    if (buf != &data[segment->offset]) {
+        memcpy(&data[segment->offset], &buf[lead], segment->size);
+        free(buf);
+    }
+
+    return 0;
+}
+
+/* Read the plan's READ segments back to back into `buf`, in one paused session */
+int _memmap_read_batch(MEMMAP_PLAN *plan, uint8_t *buf, void (*callback)(int, uint32_t)) {
+    MEMMAP_SEGMENT *segment;
+    GS_RANGE *ranges = alloc((plan->reads + 1) * sizeof(GS_RANGE));
+    uint32_t i;
+    int count = 0;
+    int result = 0;
+
+    for (i = 0; i < plan->count; i++) {
+        segment = &plan->segments[i];
+        if (segment->method == MEMMAP_READ) {
+            ranges[count].address = segment->source;
+            ranges[count].size = segment->source_size;
+            count++;
+        }
+    }
+    ranges[count].address = 0;
+    ranges[count].size = 0;
+
+    if (gs_enter() || gs_read(buf, ranges, callback) || gs_exit()) {
+        fprintf(stderr, "%s(): gs_read() failed\n", __FUNCTION__);
+        result = 1;
+    }
+    free(ranges);
+
+    return result;
+}
+
+int _memmap_trim_write(GS_SINK *sink, const uint8_t *buf, size_t size) {
+    MEMMAP_TRIM *trim = sink->context;
+    size_t len = MIN(size, (size_t)trim->skip);
+
+    buf += len;
+    size -= len;
+    trim->skip -= len;
+
+    len = MIN(size, (size_t)trim->left);
+    trim->left -= len;
+
+    return len ? trim->sink->write(trim->sink, buf, len) : 0;
+}
+
+
+/* Public functions */
+
+/* `ram_size` is the installed RDRAM; MEMMAP_RAM_MAX when it is not known */
+void memmap_init(MEMMAP *map, uint32_t ram_size) {
+    uint32_t i;
+
+    map->count = sizeof(_memmap_regions) / sizeof(_memmap_regions[0]);
+    map->regions = alloc(sizeof(_memmap_regions));
+    memcpy(map->regions, _memmap_regions, sizeof(_memmap_regions));
+    map->ram_size = ram_size;
+
+    /* RDRAM that is not installed only mirrors what is */
+    for (i = 0; i < map->count; i++) {
+        if ((map->regions[i].kind == MEMMAP_RDRAM) && (map->regions[i].start >= ram_size)) {
+            map->regions[i].kind = MEMMAP_UNMAPPED;
+            map->regions[i].name = "RDRAM (not installed)";
+        }
+    }
+}
+
+void memmap_free(MEMMAP *map) {
+    free(map->regions);
+    memset(map, 0, sizeof(MEMMAP));
+}
+
+/* The region holding a virtual address */
+const MEMMAP_REGION *memmap_region(MEMMAP *map, uint32_t address) {
+    uint32_t phys = address & MEMMAP_PHYS_MASK;
+    uint32_t lo = 0;
+    uint32_t hi = map->count;
+    uint32_t mid;
+
+    if (address < MEMMAP_KSEG0) {
+        return &_memmap_kuseg;
+    }
+    if (address >= 0xC0000000) {
+        return &_memmap_kseg2;
+    }
+
+    while ((hi - lo) > 1) {
+        mid = (lo + hi) / 2;
+        if (map->regions[mid].start <= phys) {
+            lo = mid;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    return &map->regions[lo];
+}
+
+/* True when the firmware refuses a READ starting at `address` */
+bool memmap_read_blocked(uint32_t address) {
+    return gs_read_blocked(address);
+}
+
+/* True when a read reaches the Expansion Pak's RDRAM, through either mirror */
+bool memmap_expansion(uint32_t address, uint32_t size) {
+    uint64_t end = (uint64_t)address + size;
+    uint32_t start;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        start = (i ? MEMMAP_KSEG1 : MEMMAP_KSEG0) + MEMMAP_RAM_SIZE;
+        if ((end > start) && (address < (start + MEMMAP_RAM_SIZE))) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Find the installed RDRAM size: osMemSize when the boot code has set it,
+ * otherwise by comparing samples 4 MB apart. Without an Expansion Pak the
+ * upper 4 MB mirrors the lower, or reads as a single repeated byte.
+ */
+int memmap_probe(uint32_t *ram_size) {
+    uint8_t word[4];
+    uint8_t lo[MEMMAP_PROBE_SIZE];
+    uint8_t hi[MEMMAP_PROBE_SIZE];
+    uint32_t size;
+    uint32_t i;
+    GS_RANGE range[2] = {
+        {
+            MEMMAP_OS_MEM_SIZE,
+            4
+        },
+        {
+            0, 0
+        }
+    };
+
+    if (gs_enter() || gs_read_rom(word, range, NULL)) {
+        fprintf(stderr, "%s(): reading osMemSize failed\n", __FUNCTION__);
+        return 1;
+    }
+    size = get_be32(word);
+    if ((size == MEMMAP_RAM_SIZE) || (size == MEMMAP_RAM_MAX)) {
+        *ram_size = size;
+        return 0;
+    }
+    DEBUGPRINT("osMemSize is 0x%08X; comparing samples\n", size);
+
+    range[0].address = MEMMAP_PROBE;
+    range[0].size = MEMMAP_PROBE_SIZE;
+    if (gs_enter() || gs_read_rom(lo, range, NULL)) {
+        fprintf(stderr, "%s(): reading RDRAM failed\n", __FUNCTION__);
+        return 1;
+    }
+    range[0].address = MEMMAP_PROBE + MEMMAP_RAM_SIZE;
+    range[0].size = MEMMAP_PROBE_SIZE;
+    if (gs_enter() || gs_read_rom(hi, range, NULL)) {
+        fprintf(stderr, "%s(): reading RDRAM failed\n", __FUNCTION__);
+        return 1;
+    }
+
+    for (i = 1; (i < MEMMAP_PROBE_SIZE) && (hi[i] == hi[0]); i++);
+    *ram_size = ((i == MEMMAP_PROBE_SIZE) || !memcmp(lo, hi, MEMMAP_PROBE_SIZE)) ?
+        MEMMAP_RAM_SIZE : MEMMAP_RAM_MAX;
+
+    return 0;
+}
+
+/*
+ * Split a read into segments by region and choose how to read each one.
+ * With `paused`, RDRAM is read with one batched READ that leaves the game
+ * paused; otherwise everything is read with READ_ROM, which also works from
+ * the GS menu.
+ */
+int memmap_plan(MEMMAP *map, uint32_t address, uint32_t size, bool paused, MEMMAP_PLAN *plan) {
+    const MEMMAP_REGION *region;
+    uint32_t offset = 0;
+    uint32_t pos;
+    uint32_t end;
+    uint32_t len;
+    uint32_t i;
+
+    memset(plan, 0, sizeof(MEMMAP_PLAN));
+
+    if (!size || (((uint64_t)address + size) > 0x100000000ULL)) {
+        fprintf(stderr, "Invalid read range: 0x%08X, 0x%08X bytes\n", address, size);
+        return 1;
+    }
+
+    plan->capacity = 8;
+    plan->segments = alloc(plan->capacity * sizeof(MEMMAP_SEGMENT));
+    plan->size = size;
+
+    while (offset < size) {
+        pos = address + offset;
+        region = memmap_region(map, pos);
+        end = region->end;
+        if (region->kind != MEMMAP_TLB) {
+            end |= pos & ~MEMMAP_PHYS_MASK;
+        }
+
+        len = size - offset;
+        if ((end - pos) < len) {
+            len = end - pos + 1;
+        }
+
+        _memmap_add(plan, pos, len, offset, region, paused);
+        offset += len;
+    }
+
+    for (i = 0; i < plan->count; i++) {
+        if (plan->segments[i].method == MEMMAP_READ) {
+            plan->reads++;
+        }
+        else if (plan->segments[i].method == MEMMAP_READ_ROM) {
+            plan->read_roms++;
+        }
+    }
+
+    return 0;
+}
+
+void memmap_plan_free(MEMMAP_PLAN *plan) {
+    free(plan->segments);
+    memset(plan, 0, sizeof(MEMMAP_PLAN));
+}
+
+void memmap_print(MEMMAP_PLAN *plan) {
+    static const char *methods[] = { "skip", "READ", "READ_ROM" };
+    MEMMAP_SEGMENT *segment;
+    uint32_t i;
+
+    for (i = 0; i < plan->count; i++) {
+        segment = &plan->segments[i];
+        printf("  0x%08X - 0x%08X  %-8s", segment->address, segment->address + segment->size - 1,
+            methods[segment->method]);
+        if ((segment->method != MEMMAP_SKIP) &&
+            ((segment->source != segment->address) || (segment->source_size != segment->size))) {
+            printf(" from 0x%08X (0x%X bytes)", segment->source, segment->source_size);
+        }
+        printf("  %s\n", segment->region->name);
+    }
+}
+
+/*
+ * Run a plan into `data` (plan->size bytes). The READ_ROM segments go first,
+ * as each one unpauses the game; the RDRAM batch is read last, in one paused
+ * session, so it is coherent.
+ */
+int memmap_read(MEMMAP_PLAN *plan, uint8_t *data, void (*callback)(int, uint32_t),
+    void (*callback_rom)(uint32_t)) {
+    MEMMAP_SEGMENT *segment;
+    uint8_t *buf;
+    uint32_t size = 0;
+    uint32_t pos;
+    uint32_t i;
+
+    for (i = 0; i < plan->count; i++) {
+        segment = &plan->segments[i];
+        if (segment->method == MEMMAP_SKIP) {
+            memset(&data[segment->offset], 0, segment->size);
+        }
+        else if (segment->method == MEMMAP_READ_ROM) {
+            if (_memmap_read_rom(segment, data, callback_rom)) {
+                return 1;
+            }
+        }
+        else {
+            size += segment->size;
+        }
+    }
+
+    if (!plan->reads) {
+        return 0;
+    }
+
+    /* One range is read straight into place */
+    if (plan->reads == 1) {
+        for (i = 0; plan->segments[i].method != MEMMAP_READ; i++);
+        return _memmap_read_batch(plan, &data[plan->segments[i].offset], callback);
+    }
+
+    buf = alloc(size);
+    if (_memmap_read_batch(plan, buf, callback)) {
+        free(buf);
+        return 1;
+    }
+    for (i = 0, pos = 0; i < plan->count; i++) {
+        segment = &plan->segments[i];
+        if (segment->method == MEMMAP_READ) {
+            memcpy(&data[segment->offset], &buf[pos], segment->size);
+            pos += segment->size;
+        }
+    }
+    free(buf);
+
+    return 0;
+}
+
+/*
+ * Run a plan into a sink, in address order, without holding the whole request:
+ * READ_ROM segments stream straight from the link, and only the RDRAM batch
+ * (read first, in one paused session) is buffered.
+ */
+int memmap_read_sink(MEMMAP_PLAN *plan, GS_SINK *sink, void (*callback)(int, uint32_t),
+    void (*callback_rom)(uint32_t)) {
+    static const uint8_t zero[0x1000] = { 0 };
+    MEMMAP_SEGMENT *segment;
+    MEMMAP_TRIM trim;
+    GS_SINK trimmed;
+    GS_RANGE range[2] = { { 0, 0 }, { 0, 0 } };
+    uint8_t *batch = NULL;
+    uint32_t size = 0;
+    uint32_t pos = 0;
+    uint32_t len;
+    uint32_t i;
+    uint32_t j;
+    int result = 0;
+
+    for (i = 0; i < plan->count; i++) {
+        if (plan->segments[i].method == MEMMAP_READ) {
+            size += plan->segments[i].size;
+        }
+    }
+    if (size) {
+        batch = alloc(size);
+        if (_memmap_read_batch(plan, batch, callback)) {
+            free(batch);
+            return 1;
+        }
+    }
+
+    for (i = 0; !result && (i < plan->count); i++) {
+        segment = &plan->segments[i];
+        switch (segment->method) {
+            case MEMMAP_SKIP:
+                for (j = 0; !result && (j < segment->size); j += len) {
+                    len = MIN(segment->size - j, (uint32_t)sizeof(zero));
+                    result = sink->write(sink, zero, len);
+                }
+                break;
+
+            case MEMMAP_READ:
+                result = sink->write(sink, &batch[pos], segment->size);
+                pos += segment->size;
+                break;
+
+            case MEMMAP_READ_ROM:
+                trim.sink = sink;
+                trim.skip = segment->address & 3;
+                trim.left = segment->size;
+                gs_sink_callback(&trimmed, _memmap_trim_write, &trim);
+                range[0].address = segment->source;
+                range[0].size = segment->source_size;
+                if (gs_enter() || gs_read_rom_sink(&trimmed, range, callback_rom)) {
+                    fprintf(stderr, "%s(): reading 0x%08X failed\n", __FUNCTION__, segment->source);
+                    result = 1;
+                }
+                break;
+        }
+    }
+    free(batch);
+
+    return result;
+}
@@ -0,0 +1,102 @@
+
+#ifndef _MEMMAP_H_
+#define _MEMMAP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gspro.h"
+
+
+/*
+ * The N64's physical address space, as the GS reaches it through the KSEG0
+ * (0x80000000, cached) and KSEG1 (0xA0000000, uncached) mirrors.
+ *
+ * Only RDRAM can be read a byte at a time (GS_CMD_READ); everything else is
+ * read 32 bits at a time (GS_CMD_READ_ROM) through KSEG1. The firmware also
+ * refuses READs that *start* in one of these windows, whatever their length:
+ *
+ *   0x80780000 - 0x807FFFFF
+ *   0xBDFFFFFF - 0xFFFFFFFF
+ */
+#define MEMMAP_RAM_SIZE     0x00400000  /* Without an Expansion Pak */
+#define MEMMAP_RAM_MAX      0x00800000  /* With one */
+
+#define MEMMAP_OS_MEM_SIZE  0x80000318  /* libultra's osMemSize, set by the boot code */
+#define MEMMAP_PROBE        0x80000400  /* Boot code and libultra text; never changes */
+#define MEMMAP_PROBE_SIZE   0x100
+
+#define MEMMAP_KSEG0        0x80000000
+#define MEMMAP_KSEG1        0xA0000000
+#define MEMMAP_PHYS_MASK    0x1FFFFFFF
+
+enum _memmap_kinds {
+    MEMMAP_UNMAPPED = 0,    /* Reads as nothing; skipped */
+    MEMMAP_RDRAM,
+    MEMMAP_IO,              /* RCP, RDRAM and PIF registers and memories */
+    MEMMAP_CART,            /* PI domains: cartridge, 64DD, SRAM / FlashRAM */
+    MEMMAP_TLB              /* KUSEG / KSEG2 / KSEG3; read as given */
+};
+
+/* How each part of a read is done */
+enum _memmap_methods {
+    MEMMAP_SKIP = 0,        /* Filled with zeros */
+    MEMMAP_READ,            /* GS_CMD_READ, batched; in-game only, game stays paused */
+    MEMMAP_READ_ROM         /* GS_CMD_READ_ROM; anywhere, game unpauses after each */
+};
+
+/* A physical region (inclusive bounds) */
+struct _memmap_region {
+    uint32_t        start;
+    uint32_t        end;
+    uint8_t         kind;
+    const char *    name;
+};
+typedef struct _memmap_region MEMMAP_REGION;
+
+struct _memmap {
+    MEMMAP_REGION * regions;
+    uint32_t        count;
+    uint32_t        ram_size;
+};
+typedef struct _memmap MEMMAP;
+
+/* One part of a read request */
+struct _memmap_segment {
+    uint32_t        address;    /* As requested */
+    uint32_t        size;
+    uint32_t        offset;     /* Into the request's data */
+    uint32_t        source;     /* Address actually read: mirrored and aligned */
+    uint32_t        source_size;
+    uint8_t         method;
+    const MEMMAP_REGION *region;
+};
+typedef struct _memmap_segment MEMMAP_SEGMENT;
+
+struct _memmap_plan {
+    MEMMAP_SEGMENT *segments;
+    uint32_t        count;
+    uint32_t        capacity;
+    uint32_t        size;       /* Requested bytes */
+    uint32_t        reads;      /* Segments per method */
+    uint32_t        read_roms;
+};
+typedef struct _memmap_plan MEMMAP_PLAN;
+
+
+/* Function declarations */
+void memmap_init(MEMMAP *map, uint32_t ram_size);
+void memmap_free(MEMMAP *map);
+const MEMMAP_REGION *memmap_region(MEMMAP *map, uint32_t address);
+bool memmap_read_blocked(uint32_t address);
+bool memmap_expansion(uint32_t address, uint32_t size);
+int memmap_probe(uint32_t *ram_size);
+int memmap_plan(MEMMAP *map, uint32_t address, uint32_t size, bool paused, MEMMAP_PLAN *plan);
+void memmap_plan_free(MEMMAP_PLAN *plan);
+void memmap_print(MEMMAP_PLAN *plan);
+int memmap_read(MEMMAP_PLAN *plan, uint8_t *data, void (*callback)(int, uint32_t),
+    void (*callback_rom)(uint32_t));
+int memmap_read_sink(MEMMAP_PLAN *plan, GS_SINK *sink, void (*callback)(int, uint32_t),
+    void (*callback_rom)(uint32_t));
+
+#endif /* _MEMMAP_H_ */
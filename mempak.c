@@ -0,0 +1,478 @@
+
+#include <ctype.h>
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gspro.h"
+#include "stream.h"
+#include "n64rd.h"
+#include "store.h"
+#include "mempak.h"
+
+
+/* Offsets of the four ID blocks in page 0 */
+static const uint8_t _mempak_id_blocks[] = { 0x20, 0x60, 0x80, 0xC0 };
+
+/* N64 font, starting at 0x0F */
+static const char _mempak_font[] =
+    " 0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ!\"#'*+,-./:=?@";
+
+
+/* Private function declarations */
+bool _mempak_id_valid(const uint8_t *block);
+bool _mempak_inodes_valid(const uint8_t *table);
+char _mempak_char(uint8_t c);
+void _mempak_name(const uint8_t *entry, char *name);
+void _mempak_check_id(MEMPAK *pak);
+void _mempak_check_inodes(MEMPAK *pak);
+void _mempak_check_notes(MEMPAK *pak);
+int _mempak_chain(const uint8_t *inodes, uint16_t start, uint8_t *chain);
+int _mempak_sink_write(GS_SINK *sink, const uint8_t *buf, size_t size);
+uint8_t *_mempak_load(const char *path, const char *name, size_t *size);
+
+
+/* Private functions */
+
+bool _mempak_id_valid(const uint8_t *block) {
+    uint16_t sum = 0;
+    int i;
+
+    for (i = 0; i < 0x1C; i += 2) {
+        sum += get_be16(&block[i]);
+    }
+
+    return (get_be16(&block[0x1C]) == sum) && (get_be16(&block[0x1E]) == (uint16_t)(0xFFF2 - sum));
+}
+
+bool _mempak_inodes_valid(const uint8_t *table) {
+    uint8_t sum = 0;
+    int i;
+
+    for (i = MEMPAK_FIRST_PAGE * 2; i < GS_MEMPAK_PAGE; i++) {
+        sum += table[i];
+    }
+
+    return (table[1] == sum);
+}
+
+char _mempak_char(uint8_t c) {
+    if ((c >= 0x0F) && (c < (0x0F + sizeof(_mempak_font) - 1))) {
+        return _mempak_font[c - 0x0F];
+    }
+
+    return c ? '?' : '\0';
+}
+
+/* Decode a note's name and extension, e.g. "MARIOKART64.A" */
+void _mempak_name(const uint8_t *entry, char *name) {
+    int len = 0;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        name[len] = _mempak_char(entry[0x10 + i]);
+        if (!name[len]) {
+            break;
+        }
+        len++;
+    }
+    while (len && (name[len - 1] == ' ')) {
+        len--;
+    }
+    if (entry[0x0C]) {
+        name[len++] = '.';
+        name[len++] = _mempak_char(entry[0x0C]);
+    }
+    name[len] = '\0';
+}
+
+/* Page 0: at least one ID block must check out */
+void _mempak_check_id(MEMPAK *pak) {
+    int i;
+
+    for (i = 0; i < sizeof(_mempak_id_blocks); i++) {
+        if (_mempak_id_valid(&pak->image[_mempak_id_blocks[i]])) {
+            break;
+        }
+    }
+
+    if (i == sizeof(_mempak_id_blocks)) {
+        fprintf(stderr, "%s\n", "Controller Pak ID area is damaged (unformatted pak?)");
+        pak->errors++;
+    }
+    else if (i) {
+        fprintf(stderr, "%s\n", "Controller Pak primary ID block is damaged; a backup is intact");
+        pak->errors++;
+    }
+}
+
+/* Pages 1-2: pick an intact inode table */
+void _mempak_check_inodes(MEMPAK *pak) {
+    const uint8_t *table = &pak->image[GS_MEMPAK_PAGE * 1];
+    const uint8_t *backup = &pak->image[GS_MEMPAK_PAGE * 2];
+
+    pak->inodes = table;
+    if (!_mempak_inodes_valid(table)) {
+        fprintf(stderr, "%s\n", "Controller Pak inode table is damaged");
+        pak->errors++;
+        if (_mempak_inodes_valid(backup)) {
+            pak->inodes = backup;
+        }
+    }
+    else if (memcmp(table, backup, GS_MEMPAK_PAGE)) {
+        fprintf(stderr, "%s\n", "Controller Pak inode table differs from its backup");
+        pak->errors++;
+    }
+}
+
+/*
+ * Follow a note's pages through the inode table; returns the page count, or
+ * -1 if the chain leaves the note area, loops or hits a free page
+ */
+int _mempak_chain(const uint8_t *inodes, uint16_t start, uint8_t *chain) {
+    bool seen[MEMPAK_PAGES] = { false };
+    uint16_t page = start;
+    int count = 0;
+
+    for (;;) {
+        if ((page < MEMPAK_FIRST_PAGE) || (page >= MEMPAK_PAGES) || seen[page]) {
+            return -1;
+        }
+        seen[page] = true;
+        chain[count++] = page;
+
+        page = get_be16(&inodes[page * 2]);
+        if (page == MEMPAK_INODE_LAST) {
+            return count;
+        }
+    }
+}
+
+/* Pages 3-4: list the notes */
+void _mempak_check_notes(MEMPAK *pak) {
+    MEMPAK_NOTE *note;
+    const uint8_t *entry;
+    char code[8];
+    int pages;
+    int i;
+    int j;
+
+    for (i = 0; i < MEMPAK_NOTES; i++) {
+        entry = &pak->image[(GS_MEMPAK_PAGE * 3) + (i * MEMPAK_NOTE_SIZE)];
+        if (!get_be32(&entry[0x00]) || !get_be16(&entry[0x06])) {
+            continue;
+        }
+
+        note = &pak->notes[pak->count];
+        memset(note, 0, sizeof(MEMPAK_NOTE));
+        memcpy(note->entry, entry, MEMPAK_NOTE_SIZE);
+        _mempak_name(entry, note->name);
+
+        pages = _mempak_chain(pak->inodes, get_be16(&entry[0x06]), note->chain);
+        if (pages < 0) {
+            fprintf(stderr, "Note `%s` has a broken page chain; skipped\n", note->name);
+            pak->errors++;
+            continue;
+        }
+        note->pages = pages;
+        pak->count++;
+
+        for (j = 0; j < 4; j++) {
+            code[j] = isprint(entry[j]) ? entry[j] : '.';
+        }
+        code[4] = '\0';
+        printf("  %-20s  %s-%04X  %3u pages\n", note->name, code, get_be16(&entry[0x04]), note->pages);
+    }
+}
+
+int _mempak_sink_write(GS_SINK *sink, const uint8_t *buf, size_t size) {
+    return mempak_write(sink->context, buf, size);
+}
+
+/* Read a whole manifest */
+uint8_t *_mempak_load(const char *path, const char *name, size_t *size) {
+    struct stat st;
+    uint8_t *data = NULL;
+    char *rel;
+    char *p;
+    FILE *fp;
+
+    if (!store_valid_name(name)) {
+        fprintf(stderr, "Invalid pak backup name `%s`\n", name);
+        return NULL;
+    }
+
+    rel = alloc(strlen(name) + 8);
+    sprintf(rel, "paks/%s", name);
+    p = store_path(path, rel);
+    free(rel);
+
+    fp = fopen(p, "rb");
+    if (fp && !fstat(fileno(fp), &st) && (st.st_size >= (MEMPAK_HEADER_SIZE + STORE_RECORD_SIZE))) {
+        data = alloc(st.st_size);
+        if (fread(data, st.st_size, 1, fp) != 1) {
+            free(data);
+            data = NULL;
+        }
+        *size = st.st_size;
+    }
+    if (fp) {
+        fclose(fp);
+    }
+    free(p);
+
+    if (data && (memcmp(data, MEMPAK_MAGIC, 4) || (get_le16(&data[4]) != MEMPAK_VERSION) ||
+        (*size < (MEMPAK_HEADER_SIZE + STORE_RECORD_SIZE + (get_le16(&data[6]) * MEMPAK_ENTRY_SIZE))))) {
+        free(data);
+        data = NULL;
+    }
+    if (!data) {
+        fprintf(stderr, "Unable to read pak backup `%s`\n", name);
+    }
+
+    return data;
+}
+
+
+/* Public functions */
+
+void mempak_init(MEMPAK *pak) {
+    memset(pak, 0, sizeof(MEMPAK));
+}
+
+/* Accept pak data in order; structures are checked as soon as their pages arrive */
+int mempak_write(MEMPAK *pak, const uint8_t *data, size_t size) {
+    uint32_t before = pak->size;
+
+    if (size > (size_t)(GS_MEMPAK_SIZE - pak->size)) {
+        ERRORPRINT("%s\n", "Controller Pak data exceeds the pak size");
+        return 1;
+    }
+
+    memcpy(&pak->image[pak->size], data, size);
+    pak->size += size;
+
+    if ((before < (GS_MEMPAK_PAGE * 1)) && (pak->size >= (GS_MEMPAK_PAGE * 1))) {
+        _mempak_check_id(pak);
+    }
+    if ((before < (GS_MEMPAK_PAGE * 3)) && (pak->size >= (GS_MEMPAK_PAGE * 3))) {
+        _mempak_check_inodes(pak);
+    }
+    if ((before < MEMPAK_SYSTEM_SIZE) && (pak->size >= MEMPAK_SYSTEM_SIZE)) {
+        _mempak_check_notes(pak);
+    }
+
+    return 0;
+}
+
+/* Feed a pak from gs_read_mempak() */
+void mempak_sink(MEMPAK *pak, GS_SINK *sink) {
+    gs_sink_callback(sink, _mempak_sink_write, pak);
+}
+
+/* Store each note and the system area, then write the manifest */
+int mempak_save(MEMPAK *pak, STORE *store, const char *name) {
+    STORE_RECORD system;
+    MEMPAK_NOTE *note;
+    uint8_t header[MEMPAK_HEADER_SIZE];
+    uint8_t buf[STORE_RECORD_SIZE];
+    uint8_t *data;
+    char *tmp;
+    char *path;
+    char *rel;
+    FILE *fp;
+    uint32_t i;
+    int n;
+    int result = 0;
+
+    if (!store_valid_name(name)) {
+        fprintf(stderr, "Invalid pak backup name `%s`\n", name);
+        return 1;
+    }
+    if (pak->size != GS_MEMPAK_SIZE) {
+        ERRORPRINT("Controller Pak incomplete (0x%X of 0x%X bytes)\n", pak->size, GS_MEMPAK_SIZE);
+        return 1;
+    }
+
+    /* Notes are stored in chain order, so moving a note on the pak keeps its object */
+    data = alloc(GS_MEMPAK_SIZE);
+    result = store_put(store, pak->image, MEMPAK_SYSTEM_SIZE, &system);
+    for (n = 0; !result && (n < pak->count); n++) {
+        note = &pak->notes[n];
+        for (i = 0; i < note->pages; i++) {
+            memcpy(&data[i * GS_MEMPAK_PAGE], &pak->image[note->chain[i] * GS_MEMPAK_PAGE], GS_MEMPAK_PAGE);
+        }
+        result = store_put(store, data, note->pages * GS_MEMPAK_PAGE, &note->record);
+    }
+    free(data);
+    if (result) {
+        return 1;
+    }
+
+    fdatasync(store->pack_fd);
+    fdatasync(store->idx_fd);
+
+    rel = alloc(strlen(name) + 8);
+    sprintf(rel, "paks/%s", name);
+    path = store_path(store->path, rel);
+    sprintf(rel, "paks/.%s", name);
+    tmp = store_path(store->path, rel);
+    free(rel);
+
+    memset(header, 0, sizeof(header));
+    memcpy(header, MEMPAK_MAGIC, 4);
+    put_le16(&header[4], MEMPAK_VERSION);
+    put_le16(&header[6], pak->count);
+    put_le64(&header[8], time(NULL));
+
+    fp = fopen(tmp, "wb");
+    if (!fp) {
+        fprintf(stderr, "Unable to create `%s`\n", tmp);
+        result = 1;
+    }
+    else {
+        fwrite(header, sizeof(header), 1, fp);
+        store_pack_record(buf, &system);
+        fwrite(buf, sizeof(buf), 1, fp);
+        for (n = 0; n < pak->count; n++) {
+            note = &pak->notes[n];
+            fwrite(note->entry, MEMPAK_NOTE_SIZE, 1, fp);
+            store_pack_record(buf, &note->record);
+            fwrite(buf, sizeof(buf), 1, fp);
+            put_le32(buf, note->pages);
+            fwrite(buf, 4, 1, fp);
+        }
+        fflush(fp);
+        fdatasync(fileno(fp));
+        result = ferror(fp);
+        result |= fclose(fp);
+        if (result || rename(tmp, path)) {
+            fprintf(stderr, "Unable to write `%s`\n", path);
+            unlink(tmp);
+            result = 1;
+        }
+    }
+
+    free(tmp);
+    free(path);
+
+    return result;
+}
+
+/* Print the pak backups held in a repository */
+int mempak_list(const char *path) {
+    DIR *dir;
+    struct dirent *ent;
+    uint8_t *data;
+    size_t size;
+    char *p;
+    char date[32];
+    time_t t;
+
+    p = store_path(path, "paks");
+    dir = opendir(p);
+    free(p);
+    if (!dir) {
+        fprintf(stderr, "Unable to list pak backups in `%s`\n", path);
+        return 1;
+    }
+
+    while ((ent = readdir(dir))) {
+        if (!store_valid_name(ent->d_name) || !(data = _mempak_load(path, ent->d_name, &size))) {
+            continue;
+        }
+        t = get_le64(&data[8]);
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&t));
+        printf("%-24s  %2u notes  %s\n", ent->d_name, get_le16(&data[6]), date);
+        free(data);
+    }
+    closedir(dir);
+
+    return 0;
+}
+
+/*
+ * Rebuild a pak image from a backup; notes are laid back along the page
+ * chains recorded in the stored inode table. Without a filename, list the
+ * backup's notes instead.
+ */
+int mempak_export(const char *path, const char *name, const char *filename) {
+    MEMPAK pak;
+    STORE store;
+    STORE_RECORD record;
+    const uint8_t *entry;
+    uint8_t *data;
+    uint8_t *note;
+    uint8_t chain[MEMPAK_PAGES];
+    size_t size;
+    uint32_t pages;
+    FILE *fp;
+    int count;
+    int i;
+    int n;
+    int result = 0;
+
+    data = _mempak_load(path, name, &size);
+    if (!data) {
+        return 1;
+    }
+    if (store_open(&store, path, false)) {
+        free(data);
+        return 1;
+    }
+
+    mempak_init(&pak);
+    store_unpack_record(&data[MEMPAK_HEADER_SIZE], &record);
+    result = store_get(&store, &record, pak.image, MEMPAK_SYSTEM_SIZE);
+    if (!result) {
+        _mempak_check_inodes(&pak);
+    }
+
+    note = alloc(GS_MEMPAK_SIZE);
+    count = get_le16(&data[6]);
+    for (n = 0; !result && (n < count); n++) {
+        entry = &data[MEMPAK_HEADER_SIZE + STORE_RECORD_SIZE + (n * MEMPAK_ENTRY_SIZE)];
+        store_unpack_record(&entry[MEMPAK_NOTE_SIZE], &record);
+        pages = get_le32(&entry[MEMPAK_NOTE_SIZE + STORE_RECORD_SIZE]);
+
+        i = _mempak_chain(pak.inodes, get_be16(&entry[0x06]), chain);
+        if ((i < 0) || (i != pages) || store_get(&store, &record, note, pages * GS_MEMPAK_PAGE)) {
+            fprintf(stderr, "Note %d of pak backup `%s` does not match its page chain\n", n, name);
+            result = 1;
+            break;
+        }
+        for (i = 0; i < pages; i++) {
+            memcpy(&pak.image[chain[i] * GS_MEMPAK_PAGE], &note[i * GS_MEMPAK_PAGE], GS_MEMPAK_PAGE);
+        }
+    }
+    free(note);
+    store_close(&store);
+    free(data);
+
+    if (result) {
+        return 1;
+    }
+
+    if (!filename) {
+        pak.size = MEMPAK_SYSTEM_SIZE;
+        _mempak_check_notes(&pak);
+
+        return 0;
+    }
+
+    fp = fopen(filename, "wb");
+    if (!fp) {
+        fprintf(stderr, "Unable to open `%s` for writing\n", filename);
+        return 1;
+    }
+    result = (fwrite(pak.image, GS_MEMPAK_SIZE, 1, fp) != 1);
+    result |= fclose(fp);
+
+    return result;
+}
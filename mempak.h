@@ -0,0 +1,78 @@
+
+#ifndef _MEMPAK_H_
+#define _MEMPAK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gspro.h"
+#include "store.h"
+
+
+/*
+ * Controller Pak layout (big-endian, 256-byte pages):
+ *
+ *   Page 0     ID area; ID blocks at 0x20, 0x60, 0x80 and 0xC0, each with two
+ *              16-bit checksums at 0x1C.
+ *   Page 1     Inode table; one 16-bit entry per page, holding the next page
+ *              of a note, MEMPAK_INODE_LAST or MEMPAK_INODE_FREE. Byte 1 sums
+ *              the entries for the note pages.
+ *   Page 2     Backup copy of the inode table.
+ *   Page 3-4   Note table; MEMPAK_NOTES entries of 32 bytes.
+ *   Page 5-127 Note data.
+ *
+ * Backup manifest (<repo>/paks/<name>, little-endian):
+ *
+ *   Header:    "N64P", version (u16), note count (u16), time (u64), then
+ *              reserved bytes up to MEMPAK_HEADER_SIZE.
+ *   System:    STORE_RECORD for pages 0-4.
+ *   Notes:     per note, the 32-byte note table entry, its STORE_RECORD and
+ *              its page count (u32). Note data is stored in chain order.
+ *
+ * Notes are store objects keyed by content hash, so a note that has not
+ * changed since the last backup costs one manifest entry.
+ */
+#define MEMPAK_PAGES        (GS_MEMPAK_SIZE / GS_MEMPAK_PAGE)
+#define MEMPAK_NOTES        16
+#define MEMPAK_NOTE_SIZE    32
+#define MEMPAK_FIRST_PAGE   5
+#define MEMPAK_SYSTEM_SIZE  (MEMPAK_FIRST_PAGE * GS_MEMPAK_PAGE)
+#define MEMPAK_INODE_LAST   0x0001
+#define MEMPAK_INODE_FREE   0x0003
+
+#define MEMPAK_MAGIC        "N64P"
+#define MEMPAK_VERSION      1
+#define MEMPAK_HEADER_SIZE  32
+#define MEMPAK_ENTRY_SIZE   (MEMPAK_NOTE_SIZE + STORE_RECORD_SIZE + 4)
+
+/* One note (save file) */
+struct _mempak_note {
+    uint8_t         entry[MEMPAK_NOTE_SIZE];
+    char            name[24];
+    uint32_t        pages;
+    uint8_t         chain[MEMPAK_PAGES];
+    STORE_RECORD    record;
+};
+typedef struct _mempak_note MEMPAK_NOTE;
+
+/* A pak image, checked as it arrives */
+struct _mempak {
+    uint8_t         image[GS_MEMPAK_SIZE];
+    uint32_t        size;       /* Bytes received */
+    const uint8_t * inodes;     /* The inode table in use */
+    MEMPAK_NOTE     notes[MEMPAK_NOTES];
+    int             count;
+    int             errors;
+};
+typedef struct _mempak MEMPAK;
+
+
+/* Function declarations */
+void mempak_init(MEMPAK *pak);
+int mempak_write(MEMPAK *pak, const uint8_t *data, size_t size);
+void mempak_sink(MEMPAK *pak, GS_SINK *sink);
+int mempak_save(MEMPAK *pak, STORE *store, const char *name);
+int mempak_list(const char *path);
+int mempak_export(const char *path, const char *name, const char *filename);
+
+#endif /* _MEMPAK_H_ */
@@ -21,44 +21,30 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "gspro.h"
-
-
-/* Handy macros */
-#define GS_MACRO_0(_FUNC) \
-    if (_FUNC()) { \
-        fprintf(stderr, "%s(): " #_FUNC "() failed\n", __FUNCTION__); \
-        return 1; \
-    }
-
-#define GS_MACRO_1(_FUNC, _ARG) \
-    if (_FUNC((_ARG))) { \
-        fprintf(stderr, "%s(): " #_FUNC "() failed\n", __FUNCTION__); \
-        return 1; \
-    }
-
-#define GS_MACRO_2(_FUNC, _ARG1, _ARG2) \
-    if (_FUNC((_ARG1), (_ARG2))) { \
-        fprintf(stderr, "%s(): " #_FUNC "() failed\n", __FUNCTION__); \
-        return 1; \
-    }
-
-#define GS_MACRO_3(_FUNC, _ARG1, _ARG2, _ARG3) \
-    if (_FUNC((_ARG1), (_ARG2), (_ARG3))) { \
-        fprintf(stderr, "%s(): " #_FUNC "() failed\n", __FUNCTION__); \
-        return 1; \
-    }
-
-#define GS_ENTER()              GS_MACRO_0(gs_enter)
-#define GS_EXIT()               GS_MACRO_0(gs_exit)
-#define GS_READ(_a, _b, _c)     GS_MACRO_3(gs_read, _a, _b, _c)
-#define GS_WRITE(_a, _b, _c)    GS_MACRO_3(gs_write, _a, _b, _c)
-#define GS_WHERE(_a)            GS_MACRO_1(gs_where, _a)
-#define GS_VERSION(_a, _b, _c)  GS_MACRO_3(gs_version, _a, _b, _c)
-#define GS_UPGRADE(_a, _b)      GS_MACRO_2(gs_upgrade, _a, _b)
-#define GS_READ_ROM(_a, _b, _c) GS_MACRO_3(gs_read_rom, _a, _b, _c)
+#include "stream.h"
+#include "n64rd.h"
+#include "watch.h"
+#include "freeze.h"
+#include "store.h"
+#include "mempak.h"
+#include "state.h"
+#include "triage.h"
+#include "codes.h"
+#include "shot.h"
+#include "plan.h"
+#include "diff.h"
+#include "record.h"
+#include "bridge.h"
+#include "memmap.h"
+#include "analysis.h"
+#include "ptrscan.h"
+#include "sparse.h"
+#include "archive.h"
 
 
 /* Application information */
@@ -73,30 +59,90 @@ struct _options {
     bool        read;
     char *      read_file;
     bool        read_word;
+    bool        read_archive;
     bool        write;
     char *      write_file;
     char *      upgrade_file;
     uint32_t    address;
     uint32_t    length;
+    char *      watch_list;
+    char *      freeze_list;
+    uint32_t    interval;
+    uint32_t    count;
+    char *      output_file;
+    char *      store_capture;
+    char *      store_base;
+    char *      state_save;
+    char *      state_restore;
+    char *      triage_file;
+    char *      triage_list;
+    char *      coherent_list;
+    char *      store_export;
+    char *      archive_export;
+    char *      diff_list;
+    uint32_t    gap;
+    char *      plan_write;
+    char *      plan_read;
+    char *      record_file;
+    char *      replay_file;
+    bool        replay_realtime;
+    char *      fast_stub;
+    bool        adaptive;
+    char *      mempak_backup;
+    char *      mempak_export;
+    char *      codes_get;
+    char *      codes_put;
+    char *      codes_sync;
+    char *      shot_file;
+    char *      video_file;
+    char *      analyze_file;
+    char *      analysis_query;
+    char *      ptrscan_list;
+    uint32_t    ptrscan_depth;
+    uint32_t    ptrscan_offset;
+    char *      ptrscan_live;
 };
 typedef struct _options OPTIONS;
 
 
 void usage(void);
-void parse_error(char *string, int location);
 void cleanup(void);
-void *alloc(size_t size);
-size_t fsizeof(FILE *fp);
+void link_report(void);
 int detect(void);
 int upgrade(char *filename);
+int upgrade_source(GS_SOURCE *source);
+uint32_t installed_ram(void);
+int ram_length(uint32_t address, uint32_t *size);
 int read_data(char *filename, uint32_t address, uint32_t size, bool word);
+int analyze_data(char *filename, uint32_t address, uint32_t size, char *index);
+int archive_data(char *filename, uint32_t address, uint32_t size);
 int write_data(char *filename, uint32_t address);
-void hex_dump(uint8_t *data, uint32_t address, uint32_t size);
+int write_source(GS_SOURCE *source, uint32_t address);
+int capture_snapshot(char *spec, uint32_t address, uint32_t size, char *base);
+int capture_changes(STORE_WRITER *writer, char *repo, char *base);
+int export_snapshot(char *spec, char *filename);
+int export_archive(char *spec, uint32_t size, char *filename);
+int save_state(char *spec, char *base);
+int restore_state(char *spec);
+int triage_dump(char *filename, char *list);
+int backup_mempak(char *spec);
+int export_mempak(char *spec, char *filename);
+int get_codes(char *filename);
+int put_codes(char *filename);
+int sync_codes(char *filename);
+int run_plan(char *filename, bool write, char *output);
+int coherent_read(char *list, uint32_t gap, char *output);
+int follow_chains(char *filename, char *output);
+int fast_start(char *filename);
 
 
 int main(int argc, char **argv) {
     OPTIONS options;
     GS_CONFIG config;
+    WATCH_ENTRY *watch_entries = NULL;
+    int watch_count = 0;
+    FREEZE_ENTRY *freeze_entries = NULL;
+    int freeze_count = 0;
     char *err = 0;
     int c;
 
@@ -109,9 +155,12 @@ int main(int argc, char **argv) {
     /* Default option */
     memset(&options, 0, sizeof(options));
     options.address = 0x80000000;
-    options.length = 0x00400000;
+    options.interval = 16667;
+    options.gap = DIFF_DEFAULT_GAP;
+    options.ptrscan_depth = PTRSCAN_DEPTH;
+    options.ptrscan_offset = PTRSCAN_OFFSET;
 
-    while ((c = getopt(argc, argv, "hp:va:l:d::r::w:u:")) != -1) {
+    while ((c = getopt(argc, argv, "hp:va:l:d::r::w:u:W:i:n:o:S:X:D:g:P:E:R:Y:y:F:m:M:c:C:k:s:V:A:Q:T:L:O:J:I:KZ:B:U:G:t:x:ze:")) != -1) {
         switch (c) {
             case 'h':
                 usage();
@@ -166,11 +215,217 @@ int main(int argc, char **argv) {
                 options.upgrade_file = optarg;
                 break;
 
+            case 'W':
+                options.watch_list = optarg;
+                break;
+
+            case 'Z':
+                options.freeze_list = optarg;
+                break;
+
+            case 'i':
+                options.interval = strtoul(optarg, &err, 0);
+                if (err[0]) {
+                    fprintf(stderr, "Invalid interval\n");
+                    parse_error(optarg, (err - optarg));
+                    return 1;
+                }
+                break;
+
+            case 'n':
+                options.count = strtoul(optarg, &err, 0);
+                if (err[0]) {
+                    fprintf(stderr, "Invalid count\n");
+                    parse_error(optarg, (err - optarg));
+                    return 1;
+                }
+                break;
+
+            case 'o':
+                options.output_file = optarg;
+                break;
+
+            case 'S':
+                options.store_capture = optarg;
+                break;
+
+            case 'I':
+                options.store_base = optarg;
+                break;
+
+            case 'X':
+                options.store_export = optarg;
+                break;
+
+            case 'B':
+                options.state_save = optarg;
+                break;
+
+            case 'U':
+                options.state_restore = optarg;
+                break;
+
+            case 'G':
+                options.triage_file = optarg;
+                break;
+
+            case 't':
+                options.triage_list = optarg;
+                break;
+
+            case 'D':
+                options.diff_list = optarg;
+                break;
+
+            case 'g':
+                options.gap = strtoul(optarg, &err, 0);
+                if (err[0]) {
+                    fprintf(stderr, "Invalid gap\n");
+                    parse_error(optarg, (err - optarg));
+                    return 1;
+                }
+                break;
+
+            case 'P':
+                options.plan_write = optarg;
+                break;
+
+            case 'E':
+                options.plan_read = optarg;
+                break;
+
+            case 'x':
+                options.coherent_list = optarg;
+                break;
+
+            case 'z':
+                options.read_archive = true;
+                break;
+
+            case 'e':
+                options.archive_export = optarg;
+                break;
+
+            case 'R':
+                options.record_file = optarg;
+                break;
+
+            case 'Y':
+            case 'y':
+                options.replay_file = optarg;
+                options.replay_realtime = (c == 'y');
+                break;
+
+            case 'K':
+                options.adaptive = true;
+                break;
+
+            case 'F':
+                options.fast_stub = optarg;
+                break;
+
+            case 'm':
+                options.mempak_backup = optarg;
+                break;
+
+            case 'M':
+                options.mempak_export = optarg;
+                break;
+
+            case 'c':
+                options.codes_get = optarg;
+                break;
+
+            case 'C':
+                options.codes_put = optarg;
+                break;
+
+            case 'k':
+                options.codes_sync = optarg;
+                break;
+
+            case 's':
+                options.shot_file = optarg;
+                break;
+
+            case 'V':
+                options.video_file = optarg;
+                break;
+
+            case 'A':
+                options.analyze_file = optarg;
+                break;
+
+            case 'Q':
+                options.analysis_query = optarg;
+                break;
+
+            case 'T':
+                options.ptrscan_list = optarg;
+                break;
+
+            case 'L':
+                options.ptrscan_depth = strtoul(optarg, &err, 0);
+                if (err[0] || !options.ptrscan_depth || (options.ptrscan_depth > PTRSCAN_DEPTH_MAX)) {
+                    fprintf(stderr, "Invalid depth\n");
+                    parse_error(optarg, (err - optarg));
+                    return 1;
+                }
+                break;
+
+            case 'O':
+                options.ptrscan_offset = strtoul(optarg, &err, 0);
+                if (err[0]) {
+                    fprintf(stderr, "Invalid offset\n");
+                    parse_error(optarg, (err - optarg));
+                    return 1;
+                }
+                break;
+
+            case 'J':
+                options.ptrscan_live = optarg;
+                break;
+
             case '?':
                 if ((optopt == 'p') ||
                     (optopt == 'a') ||
                     (optopt == 'l') ||
-                    (optopt == 'w')) {
+                    (optopt == 'w') ||
+                    (optopt == 'W') ||
+                    (optopt == 'i') ||
+                    (optopt == 'n') ||
+                    (optopt == 'o') ||
+                    (optopt == 'S') ||
+                    (optopt == 'X') ||
+                    (optopt == 'D') ||
+                    (optopt == 'g') ||
+                    (optopt == 'P') ||
+                    (optopt == 'E') ||
+                    (optopt == 'R') ||
+                    (optopt == 'Y') ||
+                    (optopt == 'y') ||
+                    (optopt == 'F') ||
+                    (optopt == 'm') ||
+                    (optopt == 'M') ||
+                    (optopt == 'c') ||
+                    (optopt == 'C') ||
+                    (optopt == 'k') ||
+                    (optopt == 's') ||
+                    (optopt == 'V') ||
+                    (optopt == 'A') ||
+                    (optopt == 'Q') ||
+                    (optopt == 'T') ||
+                    (optopt == 'L') ||
+                    (optopt == 'O') ||
+                    (optopt == 'J') ||
+                    (optopt == 'I') ||
+                    (optopt == 'Z') ||
+                    (optopt == 'B') ||
+                    (optopt == 'U') ||
+                    (optopt == 'G') ||
+                    (optopt == 't') ||
+                    (optopt == 'x') ||
+                    (optopt == 'e')) {
                     fprintf(stderr, "Option -%c requires an argument.\n", optopt);
                 }
                 else if (isprint(optopt)) {
@@ -186,6 +441,47 @@ int main(int argc, char **argv) {
         }
     }
 
+    /* Offline modes; these do not touch the port */
+    if (options.store_export) {
+        return export_snapshot(options.store_export, options.output_file);
+    }
+
+    if (options.archive_export) {
+        return export_archive(options.archive_export, options.length, options.output_file);
+    }
+
+    if (options.read_archive && !(options.read && options.read_word && options.read_file)) {
+        fprintf(stderr, "%s\n", "-z needs a dump to a file (-d<file>)");
+        return 1;
+    }
+
+    if (options.diff_list) {
+        return diff_run(options.diff_list, options.address, options.gap, options.output_file);
+    }
+
+    if (options.mempak_export) {
+        return export_mempak(options.mempak_export, options.output_file);
+    }
+
+    if (options.state_restore && !strrchr(options.state_restore, ':')) {
+        return state_list(options.state_restore);
+    }
+
+    /* Analyzing a dump being read happens once the port is up */
+    if (options.analyze_file && !(options.read && options.read_file &&
+        !strcmp(options.read_file, options.analyze_file))) {
+        return analysis_run(options.analyze_file, options.address, options.output_file);
+    }
+
+    if (options.analysis_query) {
+        return analysis_query(options.analysis_query);
+    }
+
+    if (options.ptrscan_list) {
+        return ptrscan_run(options.ptrscan_list, options.address, options.length,
+            options.ptrscan_depth, options.ptrscan_offset, options.output_file);
+    }
+
     if (options.port) {
         printf("Using port 0x%04X...\n", options.port);
     }
@@ -196,6 +492,31 @@ int main(int argc, char **argv) {
     memset(&config, 0, sizeof(GS_CONFIG));
     config.port = options.port;
     config.port_dev = options.port_dev;
+    config.adaptive = options.adaptive;
+
+    /* A bridge server stands in for the port */
+    if (options.port_dev && !strncmp(options.port_dev, "bridge:", 7)) {
+        config.port_dev = NULL;
+        if (bridge_open(&options.port_dev[7], &config)) {
+            return 1;
+        }
+    }
+
+    /* Recordings only understand the stock protocol */
+    if (options.fast_stub && (options.record_file || options.replay_file)) {
+        fprintf(stderr, "%s\n", "Fast transfer sessions cannot be recorded or replayed");
+        return 1;
+    }
+
+    if (options.replay_file) {
+        if (replay_open(options.replay_file, options.replay_realtime, &config)) {
+            return 1;
+        }
+        printf("Replaying %s...\n", options.replay_file);
+    }
+    if (options.record_file && record_open(options.record_file, &config)) {
+        return 1;
+    }
 
     if (gs_init(&config)) {
         ERRORPRINT("%s\n", "gs_init() failed");
@@ -204,10 +525,22 @@ int main(int argc, char **argv) {
 
     atexit(cleanup);
 
+    if (options.fast_stub) {
+        fast_start(options.fast_stub);
+    }
     if (options.detect) {
         detect();
     }
-    if (options.read) {
+    if (options.triage_file) {
+        triage_dump(options.triage_file, options.triage_list);
+    }
+    if (options.read && options.analyze_file) {
+        analyze_data(options.read_file, options.address, options.length, options.output_file);
+    }
+    else if (options.read && options.read_archive) {
+        archive_data(options.read_file, options.address, options.length);
+    }
+    else if (options.read) {
         read_data(options.read_file, options.address, options.length, options.read_word);
     }
     if (options.write) {
@@ -217,6 +550,66 @@ int main(int argc, char **argv) {
         upgrade(options.upgrade_file);
     }
 
+    if (options.watch_list) {
+        if (watch_parse(options.watch_list, &watch_entries, &watch_count)) {
+            return 1;
+        }
+        watch_run(watch_entries, watch_count, options.output_file, options.interval, options.count);
+        free(watch_entries);
+    }
+    if (options.freeze_list) {
+        if (freeze_parse(options.freeze_list, &freeze_entries, &freeze_count)) {
+            return 1;
+        }
+        freeze_run(freeze_entries, freeze_count, options.interval, options.count);
+        free(freeze_entries);
+    }
+
+    if (options.shot_file) {
+        shot_run(options.shot_file, options.interval, 1, NULL, NULL);
+    }
+    if (options.video_file) {
+        shot_run(options.video_file, options.interval, options.count, fast_start, options.fast_stub);
+    }
+
+    if (options.store_capture) {
+        capture_snapshot(options.store_capture, options.address, options.length, options.store_base);
+    }
+    if (options.state_save) {
+        save_state(options.state_save, options.store_base);
+    }
+    if (options.state_restore) {
+        restore_state(options.state_restore);
+    }
+
+    if (options.mempak_backup) {
+        backup_mempak(options.mempak_backup);
+    }
+
+    if (options.codes_get) {
+        get_codes(options.codes_get);
+    }
+    if (options.codes_put) {
+        put_codes(options.codes_put);
+    }
+    if (options.codes_sync) {
+        sync_codes(options.codes_sync);
+    }
+
+    if (options.plan_read) {
+        run_plan(options.plan_read, false, options.output_file);
+    }
+    if (options.plan_write) {
+        run_plan(options.plan_write, true, NULL);
+    }
+    if (options.coherent_list) {
+        coherent_read(options.coherent_list, options.gap, options.output_file);
+    }
+
+    if (options.ptrscan_live) {
+        follow_chains(options.ptrscan_live, options.output_file);
+    }
+
     return 0;
 }
 
@@ -227,16 +620,99 @@ void usage(void) {
     printf("  -p <port>     Specify port number (default 0x378).\n");
     printf("                Linux systems with PPDev can use a path.\n");
     printf("                e.g. \"/dev/parport0\"\n");
+    printf("                \"bridge:<name>\" talks to a gsserve bridge server.\n");
     printf("  -v            Detect GS firmware version.\n");
     printf("  -a <address>  Specify address (default 0x80000000).\n");
-    printf("  -l <length>   Specify length (default 0x00400000).\n");
+    printf("  -l <length>   Specify length (default: the rest of the installed RDRAM,\n");
+    printf("                or 0x00400000 elsewhere).\n");
     printf("  -d[file]      Dump memory 32-bits at a time;\n");
     printf("                Copy <length> bytes from memory <address> (to [file]).\n");
     printf("  -r[file]      Read memory;\n");
     printf("                Copy <length> bytes from memory <address> (to [file]).\n");
+    printf("  -z            With -d, write [file] as a seekable compressed archive,\n");
+    printf("                compressed while it is read.\n");
     printf("  -w <file>     Write memory;\n");
     printf("                Copy from <file> to memory <address>.\n");
     printf("  -u <file>     Upgrade ROM with given file.\n");
+    printf("  -W <list>     Watch memory; sample each <address>[:<width>] in the\n");
+    printf("                comma-separated <list> every <interval> (to <output>).\n");
+    printf("  -Z <list>     Freeze memory; write each <address>=<value>[:<width>] in\n");
+    printf("                the comma-separated <list> every <interval>. Entries\n");
+    printf("                prefixed ? (equal) or ! (not equal) only let the next\n");
+    printf("                entry be written while their condition holds.\n");
+    printf("  -i <usec>     Specify sampling interval (default 16667).\n");
+    printf("  -n <count>    Specify sample count (default 0, until Ctrl-C).\n");
+    printf("  -o <output>   Specify output file.\n");
+    printf("  -G <file>     Triage dump; read RDRAM to <file> most useful regions\n");
+    printf("                first, each written as soon as it is read.\n");
+    printf("  -t <list>     With -G, read each [name=]<address>:<size> in the\n");
+    printf("                comma-separated <list> after the built-in regions.\n");
+    printf("  -S <repo>[:name]\n");
+    printf("                Capture snapshot; dump <length> bytes from memory\n");
+    printf("                <address> into snapshot repository <repo>.\n");
+    printf("  -I <name>     With -S or -B and -F, capture only the pages that differ\n");
+    printf("                from snapshot <name> in the same repository.\n");
+    printf("  -B <repo>[:name]\n");
+    printf("                Save state; capture all of the installed RDRAM into\n");
+    printf("                snapshot repository <repo>, noting what it was taken from.\n");
+    printf("  -U <repo>[:name]\n");
+    printf("                List states in <repo>, or restore state [name], writing\n");
+    printf("                only the pages that differ from the console.\n");
+    printf("  -X <repo>[:name]\n");
+    printf("                List snapshots in <repo>, or export snapshot [name]\n");
+    printf("                (to <output>).\n");
+    printf("  -e <archive>[:address]\n");
+    printf("                Export an archive written with -z, or <length> bytes of\n");
+    printf("                it from [address] (to <output>).\n");
+    printf("  -D <a>,<b>[,...]\n");
+    printf("                Compare captures (files based at <address>, or\n");
+    printf("                <repo>:<name> snapshots) and list changed ranges\n");
+    printf("                (saving a write plan to <output>).\n");
+    printf("  -g <gap>      Merge changes (-D) or ranges (-x) separated by up to <gap>\n");
+    printf("                bytes (default 8).\n");
+    printf("  -P <plan>     Run a write plan.\n");
+    printf("  -E <plan>     Re-read the ranges of a plan (to <output>, as a write plan).\n");
+    printf("  -x <list>     Read each RDRAM <address>:<size> in the comma-separated\n");
+    printf("                <list> from the same frame, in one paused READ (to\n");
+    printf("                <output>, as a write plan); ranges within <gap> merge.\n");
+    printf("  -R <file>     Record the session's port traffic to <file>.\n");
+    printf("  -Y <file>     Replay a recorded session instead of using the port.\n");
+    printf("  -y <file>     Replay a recorded session with its original timing.\n");
+    printf("  -F <stub>     Upload a fast transfer stub image and use its protocol\n");
+    printf("                for the rest of the session, when it answers.\n");
+    printf("  -K            Read in adaptive windows, each checked on its own, and\n");
+    printf("                report the link's error rate and goodput on exit.\n");
+    printf("  -m <repo>[:name]\n");
+    printf("                Back up the Controller Pak into snapshot repository\n");
+    printf("                <repo>, storing each note once.\n");
+    printf("  -M <repo>[:name]\n");
+    printf("                List Controller Pak backups in <repo>, or list the\n");
+    printf("                notes of backup [name] (exporting a .mpk to <output>).\n");
+    printf("  -c <file>     Read the GS code list (to <file>).\n");
+    printf("  -C <file>     Replace the GS code list with <file>.\n");
+    printf("  -k <file>     Sync the GS code list with <file>; only games that\n");
+    printf("                differ are sent. -C and -k only run against a\n");
+    printf("                bridge until the format is checked on hardware.\n");
+    printf("  -s <file>     Capture the displayed frame to <file> (PNG if it ends\n");
+    printf("                in .png, otherwise raw RGBA).\n");
+    printf("  -V <file>     Capture video every <interval> for <count> frames\n");
+    printf("                (numbered PNGs, or raw RGBA); with -F, only the parts\n");
+    printf("                of the frame that changed are read.\n");
+    printf("  -A <dump>     Analyze a dump (file based at <address>, or <repo>:<name>\n");
+    printf("                snapshot) into an index of code references, strings and\n");
+    printf("                pointers (<output>, or <dump>.idx). Given the same file\n");
+    printf("                as -d or -r, the dump is analyzed while it is read.\n");
+    printf("  -Q <index>[:address]\n");
+    printf("                Summarize an analysis index, or list what references\n");
+    printf("                [address].\n");
+    printf("  -T <capture>=<target>[,...]\n");
+    printf("                Find pointer chains that lead to each capture's <target>\n");
+    printf("                (RDRAM files, or <repo>:<name> snapshots), starting in\n");
+    printf("                <length> bytes at <address> (saving them to <output>).\n");
+    printf("  -L <depth>    Specify the longest pointer chain (default 4).\n");
+    printf("  -O <offset>   Specify the largest offset in a chain (default 0x1000).\n");
+    printf("  -J <chains>   Follow pointer chains through the running game (saving\n");
+    printf("                those that agree to <output>).\n");
 }
 
 void parse_error(char *string, int location) {
@@ -251,26 +727,33 @@ void parse_error(char *string, int location) {
 }
 
 void cleanup(void) {
+    REPLAY_STATS replay;
+
     DEBUGPRINT("%s\n", "Good night! ZZzzz...");
+    link_report();
     gs_quit();
-}
 
-void *alloc(size_t size) {
-    void *p = calloc(size, 1);
-    if (!p) {
-        abort();
+    record_close();
+    bridge_close();
+    if (replay_close(&replay)) {
+        fprintf(stderr, "Session diverged from the recording in %llu of %llu exchanges\n",
+            (unsigned long long)replay.mismatches, (unsigned long long)replay.played);
     }
-
-    return p;
 }
 
-size_t fsizeof(FILE *fp) {
-    size_t cur = ftell(fp);
-    fseek(fp, 0, SEEK_END);
-    size_t size = ftell(fp);
-    fseek(fp, cur, SEEK_SET);
+/* Summarize adaptive windows, if any were used */
+void link_report(void) {
+    GS_LINK link;
 
-    return size;
+    gs_link_stats(&link);
+    if (!link.windows) {
+        return;
+    }
+
+    printf("Link: %llu windows, %llu failed (%.2f%%), %llu KB resent; %.2f KB/s goodput; window now 0x%X\n",
+        (unsigned long long)link.windows, (unsigned long long)link.failures,
+        (link.failures * 100.0) / link.windows, (unsigned long long)(link.resent >> 10),
+        (link.ns ? ((link.bytes / 1024.0) / (link.ns / 1e9)) : 0.0), link.window);
 }
 
 int detect(void) {
@@ -290,160 +773,1013 @@ int detect(void) {
 }
 
 int upgrade(char *filename) {
-    FILE *fp;
-    size_t size;
-    uint8_t *data;
-    uint32_t buf_size;
+    GS_SOURCE source;
+    int result = 0;
 
-    /* Read file data */
-    /* FIXME: Add error handling */
-    fp = fopen(filename, "rb");
-    buf_size = size = fsizeof(fp);
-    data = alloc(size);
-    fread(data, 1, size, fp);
-    fclose(fp);
+    /* Data is streamed from the file as it is sent */
+    if (gs_source_file(&source, filename)) {
+        return 1;
+    }
+    if (!source.size) {
+        fprintf(stderr, "Cannot determine size of `%s`\n", filename);
+        gs_source_close(&source);
+        return 1;
+    }
 
     printf("Uploading `%s`...\n", filename);
 
-    GS_ENTER();
-    GS_UPGRADE(data, buf_size);
+    result = upgrade_source(&source);
+    gs_source_close(&source);
+
+    if (!result) {
+        printf("Upgrade complete\n");
+    }
 
-    printf("Upgrade complete\n");
+    return result;
+}
 
-    free(data);
+int upgrade_source(GS_SOURCE *source) {
+    GS_ENTER();
+    GS_UPGRADE_SOURCE(source);
 
     return 0;
 }
 
-uint8_t *callback_data = NULL;
-uint32_t callback_address = 0;
-uint32_t callback_size = 0;
 void callback(int range, uint32_t size) {
     printf(".");
     fflush(stdout);
 }
 
-void callback2(uint32_t size) {
-    hex_dump(&callback_data[callback_size], (callback_address + callback_size), (size - callback_size));
-    callback_size = size;
+void callback_rom(uint32_t size) {
+    printf(".");
+    fflush(stdout);
 }
 
-int read_data(char *filename, uint32_t address, uint32_t size, bool word) {
-    FILE *fp;
-    uint8_t *data = alloc(size);
-    uint8_t check;
-    GS_RANGE range[2] = {
-        {
-            address,
-            size
-        },
-        {
-            0, 0
+/* Installed RDRAM, probed once; 0 if the probe fails */
+uint32_t installed_ram(void) {
+    static uint32_t size = 0;
+
+    if (!size) {
+        if (memmap_probe(&size)) {
+            return 0;
         }
-    };
+        printf("RDRAM: %u MB%s\n", size >> 20, (size == MEMMAP_RAM_MAX) ? " (Expansion Pak)" : "");
+    }
 
-    GS_ENTER();
+    return size;
+}
 
-    if (word) {
-        callback_data = data;
-        callback_address = address;
-        callback_size = 0;
-        GS_READ_ROM(data, range, callback2);
+/*
+ * Fit a length to the installed RDRAM: 0 covers the rest of it, and longer
+ * lengths are trimmed. Outside of RDRAM, 0 becomes MEMMAP_RAM_SIZE.
+ */
+int ram_length(uint32_t address, uint32_t *size) {
+    uint32_t phys = address & MEMMAP_PHYS_MASK;
+    uint32_t ram;
+
+    if ((address < MEMMAP_KSEG0) || (address >= 0xC0000000) || (phys >= MEMMAP_RAM_MAX)) {
+        if (!*size) {
+            *size = MEMMAP_RAM_SIZE;
+        }
+        return 0;
     }
-    else {
-        /* Verify GS is in-game */
+    if (*size && !memmap_expansion(address, *size)) {
+        return 0;
+    }
+
+    ram = installed_ram();
+    if (!ram) {
+        return 1;
+    }
+    if (phys >= ram) {
+        fprintf(stderr, "0x%08X is past the end of the installed RDRAM\n", address);
+        return 1;
+    }
+    if (!*size || ((phys + *size) > ram)) {
+        *size = ram - phys;
+    }
+
+    return 0;
+}
+
+/*
+ * Read memory, splitting the request by region (see memmap.h). `word` asks for
+ * READ_ROM throughout, which leaves the game running; otherwise RDRAM is read
+ * with READ, keeping the game paused, when the GS is in-game.
+ */
+int read_data(char *filename, uint32_t address, uint32_t size, bool word) {
+    MEMMAP map;
+    MEMMAP_PLAN plan;
+    MEMMAP_SEGMENT *segment;
+    SPARSE sparse;
+    GS_SINK sink;
+    uint8_t *data;
+    uint8_t check;
+    uint32_t ram;
+    bool paused = !word;
+    int result;
+
+    /* READ is only available in-game; in the menu there is no game to keep paused */
+    if (paused) {
+        GS_ENTER();
         GS_WHERE(&check);
         if (check != GS_WHERE_GAME) {
-            fprintf(stderr, "Read is only available while in-game\n");
-            return 1;
+            printf("Not in-game; reading 32 bits at a time\n");
+            paused = false;
         }
+    }
 
-        /* The actual read happens here */
-        GS_ENTER();
-        GS_READ(data, range, callback);
-        GS_EXIT();
+    if (!size && ram_length(address, &size)) {
+        return 1;
     }
 
-    printf("\n");
+    /* Only probe for an Expansion Pak when the read reaches its memory */
+    ram = MEMMAP_RAM_MAX;
+    if (memmap_expansion(address, size) && !(ram = installed_ram())) {
+        return 1;
+    }
+
+    memmap_init(&map, ram);
+    if (memmap_plan(&map, address, size, paused, &plan)) {
+        memmap_free(&map);
+        return 1;
+    }
+
+    /* Explain any rewriting of the request */
+    segment = &plan.segments[0];
+    if ((plan.count > 1) || (segment->source != address) || (segment->source_size != size) ||
+        (segment->method != (paused ? MEMMAP_READ : MEMMAP_READ_ROM))) {
+        printf("Read plan:\n");
+        memmap_print(&plan);
+    }
 
     if (filename) {
-        /* Write data to file */
-        /* FIXME: Add error handling */
-        fp = fopen(filename, "wb");
-        fwrite(data, 1, size, fp);
-        fclose(fp);
+        /* Stream into the file, leaving holes for empty pages as they arrive */
+        if (!(result = sparse_open(&sparse, filename))) {
+            sparse_sink(&sparse, &sink);
+            result = memmap_read_sink(&plan, &sink, callback, callback_rom);
+            printf("\n");
+            result |= sparse_close(&sparse);
+            if (result) {
+                fprintf(stderr, "Unable to write `%s`\n", filename);
+                unlink(filename);
+            }
+            else {
+                sparse_print(&sparse, address);
+            }
+            sparse_free(&sparse);
+        }
     }
     else {
         /* Or display it all pretty */
-        hex_dump(data, address, size);
+        data = alloc(size);
+        result = memmap_read(&plan, data, callback, callback_rom);
+        printf("\n");
+        if (!result) {
+            hex_dump(data, address, size);
+        }
+        free(data);
     }
 
-    free(data);
+    memmap_plan_free(&plan);
+    memmap_free(&map);
 
-    return 0;
+    return result;
 }
 
-int write_data(char *filename, uint32_t address) {
-    FILE *fp;
-    uint8_t *data;
-    uint8_t check;
-    GS_RANGE range[2] = { { 0 } };
+/*
+ * Dump memory to `filename` while analyzing it into `index` (or `filename`.idx);
+ * worker threads scan each part of the image as soon as it has arrived.
+ */
+int analyze_data(char *filename, uint32_t address, uint32_t size, char *index) {
+    ANALYSIS a;
+    GS_SINK sink;
+    char *path = index;
+    uint64_t t;
+    int result;
+    GS_RANGE range[2] = {
+        {
+            address,
+            size
+        },
+        {
+            0, 0
+        }
+    };
 
-    /* Verify GS is in-game */
-    GS_ENTER();
-    GS_WHERE(&check);
-    if (check != GS_WHERE_GAME) {
-        fprintf(stderr, "Write is only available while in-game\n");
+    if (ram_length(address, &size)) {
         return 1;
     }
 
-    /* Read file data */
-    /* FIXME: Add error handling */
-    fp = fopen(filename, "rb");
-    range[0].size = fsizeof(fp);
-    data = alloc(range[0].size);
-    fread(data, 1, range[0].size, fp);
-    fclose(fp);
+    /* READ_ROM rounds to whole words; size the image to match */
+    range[0].address &= ~3;
+    range[0].size = (size + (address & 3) + 3) & ~3;
+    if (analysis_begin(&a, NULL, range[0].address, range[0].size)) {
+        return 1;
+    }
+    analysis_sink(&a, &sink);
 
-    /* The actual write happens here */
-    GS_ENTER();
-    GS_WRITE(data, range, callback);
-    GS_EXIT();
+    printf("Dumping and analyzing with %d threads...\n", a.thread_count);
 
+    t = now_ns();
+    result = (gs_enter() || gs_read_rom_sink(&sink, range, callback_rom));
     printf("\n");
+    if (result) {
+        fprintf(stderr, "%s(): read failed\n", __FUNCTION__);
+    }
+    result = analysis_end(&a, !result);
 
-    free(data);
+    if (!result) {
+        result = sparse_dump(filename, a.buf, a.address, a.size);
+    }
+    if (!path) {
+        path = analysis_path(filename);
+    }
+    if (!result) {
+        result = analysis_save(&a, path);
+    }
+    if (!result) {
+        printf("Wrote `%s` in %.2f s\n", path, (now_ns() - t) / 1e9);
+        result = analysis_summary(path);
+    }
+
+    analysis_free(&a);
+    if (path != index) {
+        free(path);
+    }
+
+    return result;
+}
+
+/* Dump memory to a seekable compressed archive; frames are compressed while the rest is read */
+int archive_data(char *filename, uint32_t address, uint32_t size) {
+    ARCHIVE a;
+    GS_SINK sink;
+    struct stat st;
+    uint64_t t;
+    int result;
+    GS_RANGE range[2] = {
+        {
+            address,
+            size
+        },
+        {
+            0, 0
+        }
+    };
+
+    if (ram_length(address, &size)) {
+        return 1;
+    }
+
+    /* READ_ROM rounds to whole words; size the image to match */
+    range[0].address &= ~3;
+    range[0].size = (size + (address & 3) + 3) & ~3;
+    if (archive_begin(&a, filename, range[0].address, range[0].size)) {
+        return 1;
+    }
+    archive_sink(&a, &sink);
+
+    printf("Dumping to `%s` with %d compression threads...\n", filename, a.thread_count);
+
+    t = now_ns();
+    result = (gs_enter() || gs_read_rom_sink(&sink, range, callback_rom));
+    printf("\n");
+    if (result) {
+        fprintf(stderr, "%s(): read failed\n", __FUNCTION__);
+    }
+    result = archive_end(&a, !result);
+    if (result) {
+        unlink(filename);
+        return 1;
+    }
+
+    if (!stat(filename, &st)) {
+        printf("%u frames (%u empty, %u repeated): %u KB stored in %llu KB (%.1f%%), %.2f s\n",
+            a.count, a.zero_frames, a.duplicate_frames, a.size >> 10,
+            (unsigned long long)(st.st_size >> 10), (100.0 * st.st_size) / a.size,
+            (now_ns() - t) / 1e9);
+    }
 
     return 0;
 }
 
-void hex_dump(uint8_t *data, uint32_t address, uint32_t size) {
-    char ascii[16 + 1] = { 0 };
-    int i;
+int write_data(char *filename, uint32_t address) {
+    GS_SOURCE source;
+    int result = 0;
+
+    /* Data is streamed from the file as it is sent */
+    if (gs_source_file(&source, filename)) {
+        return 1;
+    }
+    if (!source.size) {
+        fprintf(stderr, "Cannot determine size of `%s`\n", filename);
+        gs_source_close(&source);
+        return 1;
+    }
+
+    result = write_source(&source, address);
+    gs_source_close(&source);
+
+    return result;
+}
+
+int write_source(GS_SOURCE *source, uint32_t address) {
+    uint8_t check;
+    GS_RANGE range[2] = {
+        {
+            address,
+            source->size
+        },
+        {
+            0, 0
+        }
+    };
+
+    /* Verify GS is in-game */
+    GS_ENTER();
+    GS_WHERE(&check);
+    if (check != GS_WHERE_GAME) {
+        fprintf(stderr, "Write is only available while in-game\n");
+        return 1;
+    }
+
+    /* The actual write happens here */
+    GS_ENTER();
+    GS_WRITE_SOURCE(source, range, callback);
+    GS_EXIT();
+
+    printf("\n");
+
+    return 0;
+}
+
+/* Split "path:name" in place; returns the name (or NULL) */
+char *split_spec(char *spec) {
+    char *colon = strrchr(spec, ':');
+
+    if (!colon) {
+        return NULL;
+    }
+    *colon = '\0';
+
+    return colon + 1;
+}
 
-    for (i = 0; i < size; i++) {
-        /* Address */
-        if (!(i % 16)) {
-            printf("%08X  ", address + i);
+int capture_snapshot(char *spec, uint32_t address, uint32_t size, char *base) {
+    STORE store;
+    STORE_WRITER writer;
+    GS_SINK sink;
+    char *name = split_spec(spec);
+    char stamp[32];
+    time_t t;
+    int result;
+    GS_RANGE range[2] = {
+        {
+            address,
+            size
+        },
+        {
+            0, 0
         }
+    };
+
+    if (!name) {
+        t = time(NULL);
+        strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&t));
+        name = stamp;
+    }
+
+    /* Only capture the installed RDRAM */
+    if (ram_length(address, &size)) {
+        return 1;
+    }
+    range[0].size = size;
+
+    if (store_open(&store, spec, true)) {
+        return 1;
+    }
+
+    /* READ_ROM rounds to whole words; size the snapshot to match */
+    range[0].address &= ~3;
+    range[0].size = (range[0].size + 3) & ~3;
+    if (store_begin(&writer, &store, name, range[0].address, range[0].size)) {
+        store_close(&store);
+        return 1;
+    }
+
+    /* Hashing happens on the console, so it needs the stub */
+    if (base && !gs_fast_active()) {
+        printf("%s\n", "Incremental capture needs a fast transfer stub (-F); capturing everything");
+        base = NULL;
+    }
 
-        /* Hex */
-        printf("%02X ", data[i]);
+    printf("Capturing `%s`...\n", name);
 
-        /* ASCII */
-        sprintf(&ascii[i % 16], "%c", isprint(data[i]) ? data[i] : '.');
-        if ((i % 16) == 15) {
-            printf(" %s\n", ascii);
+    if (base) {
+        result = capture_changes(&writer, spec, base);
+    }
+    else {
+        store_sink(&writer, &sink);
+        result = (gs_enter() || gs_read_rom_sink(&sink, range, callback_rom));
+        if (result) {
+            fprintf(stderr, "%s(): capture failed\n", __FUNCTION__);
         }
+        printf("\n");
+    }
+    if (result) {
+        store_abort(&writer);
+        store_close(&store);
+        return 1;
+    }
+
+    if (store_commit(&writer)) {
+        store_close(&store);
+        return 1;
     }
+    store_close(&store);
 
-    /* Pad the output, if necessary */
-    if (size & 15) {
-        for (i = 0; i < (16 - (size & 15)); i++) {
-            printf("   ");
+    printf("%u pages, %u new (%llu bytes stored)\n",
+        writer.pages, writer.new_pages, (unsigned long long)writer.new_bytes);
+
+    return 0;
+}
+
+/*
+ * Fill `writer` from the console, reading only the pages whose hashes (taken
+ * on the console) differ from snapshot `base`; the rest are copied from it.
+ * The changed pages are read with one multi-range READ, while the stub still
+ * holds the CPU, so they come from the same frame as the hashes.
+ */
+int capture_changes(STORE_WRITER *writer, char *repo, char *base) {
+    SNAPSHOT snap;
+    GS_RANGE *ranges;
+    uint64_t *hashes;
+    uint8_t *changed;
+    uint8_t *data;
+    uint8_t page[STORE_PAGE_SIZE];
+    uint32_t pages;
+    uint32_t len;
+    uint32_t pos = 0;
+    uint32_t size = 0;
+    uint32_t dirty = 0;
+    uint32_t i;
+    int count = 0;
+    int result = 0;
+
+    if (snapshot_open(&snap, repo, base)) {
+        return 1;
+    }
+    if ((snap.address != writer->address) || (snap.size != writer->size) ||
+        (snap.page_size != GS_FAST_HASH_PAGE)) {
+        fprintf(stderr, "Snapshot `%s` covers 0x%08X - 0x%08X; cannot capture 0x%08X - 0x%08X against it\n",
+            base, snap.address, snap.address + snap.size - 1, writer->address, writer->address + writer->size - 1);
+        snapshot_close(&snap);
+        return 1;
+    }
+    pages = snap.pages;
+
+    hashes = alloc(pages * sizeof(uint64_t));
+    if (gs_enter() || gs_fast_hash_pages(hashes, writer->address, writer->size)) {
+        fprintf(stderr, "%s(): hashing failed\n", __FUNCTION__);
+        free(hashes);
+        snapshot_close(&snap);
+        return 1;
+    }
+
+    /* Compare with the base, merging runs of changed pages into ranges */
+    changed = alloc(pages);
+    ranges = alloc((pages + 1) * sizeof(GS_RANGE));
+    for (i = 0; i < pages; i++) {
+        len = MIN(snap.page_size, snap.size - (i * snap.page_size));
+        if (snapshot_read_page(&snap, i, page)) {
+            result = 1;
+            break;
         }
-        printf(" %s\n", ascii);
+        changed[i] = (gs_fast_hash(page, len) != hashes[i]);
+        if (!changed[i]) {
+            continue;
+        }
+
+        if (i && changed[i - 1]) {
+            ranges[count - 1].size += len;
+        }
+        else {
+            ranges[count].address = writer->address + (i * snap.page_size);
+            ranges[count].size = len;
+            count++;
+        }
+        size += len;
+        dirty++;
+    }
+    ranges[count].address = 0;
+    ranges[count].size = 0;
+    free(hashes);
+
+    data = alloc(MAX(size, 1));
+    if (!result && size && gs_read(data, ranges, callback)) {
+        fprintf(stderr, "%s(): capture failed\n", __FUNCTION__);
+        result = 1;
+    }
+    result |= gs_exit();
+    if (size) {
+        printf("\n");
     }
 
-    printf("\n");
+    /* Store every page in order; unchanged pages come from the base */
+    for (i = 0; !result && (i < pages); i++) {
+        len = MIN(snap.page_size, snap.size - (i * snap.page_size));
+        if (changed[i]) {
+            result = store_write(writer, &data[pos], len);
+            pos += len;
+        }
+        else {
+            result = snapshot_read_page(&snap, i, page) || store_write(writer, page, len);
+        }
+    }
+
+    if (!result) {
+        printf("%u of %u pages changed since `%s` (%u KB read)\n", dirty, pages, base, size >> 10);
+    }
+
+    free(data);
+    free(ranges);
+    free(changed);
+    snapshot_close(&snap);
+
+    return result;
+}
+
+int export_snapshot(char *spec, char *filename) {
+    SNAPSHOT snap;
+    SPARSE sparse;
+    uint8_t *page;
+    uint32_t i;
+    uint32_t len;
+    int result;
+    char *name = split_spec(spec);
+
+    if (!name) {
+        return store_list(spec);
+    }
+
+    if (snapshot_open(&snap, spec, name)) {
+        return 1;
+    }
+
+    if (filename && sparse_open(&sparse, filename)) {
+        snapshot_close(&snap);
+        return 1;
+    }
+    page = alloc(snap.page_size);
+
+    /* Pages are decompressed one at a time */
+    for (i = 0; i < snap.pages; i++) {
+        len = MIN(snap.page_size, snap.size - (i * snap.page_size));
+        if (snapshot_read_page(&snap, i, page)) {
+            break;
+        }
+        if (filename) {
+            if (sparse_write(&sparse, page, len)) {
+                break;
+            }
+        }
+        else {
+            hex_dump(page, snap.address + (i * snap.page_size), len);
+        }
+    }
+
+    result = (i != snap.pages);
+
+    if (filename) {
+        result |= sparse_close(&sparse);
+        if (!result) {
+            sparse_print(&sparse, snap.address);
+        }
+        sparse_free(&sparse);
+    }
+    free(page);
+    snapshot_close(&snap);
+
+    return result;
+}
+
+/* Export an archive, or `size` bytes of it (default: the rest) from the address in `spec` */
+int export_archive(char *spec, uint32_t size, char *filename) {
+    ARCHIVE_READER r;
+    SPARSE sparse;
+    uint8_t *buf;
+    uint32_t address;
+    uint32_t end;
+    uint32_t len;
+    char *err = NULL;
+    char *at = split_spec(spec);
+    int result = 0;
+
+    if (archive_open(&r, spec)) {
+        return 1;
+    }
+
+    address = r.address;
+    if (at) {
+        address = strtoul(at, &err, 0);
+        if ((err == at) || *err) {
+            fprintf(stderr, "Invalid address\n");
+            archive_close(&r);
+            return 1;
+        }
+    }
+    if ((address < r.address) || ((address - r.address) >= r.size)) {
+        fprintf(stderr, "0x%08X is not in `%s`\n", address, spec);
+        archive_close(&r);
+        return 1;
+    }
+    if (!at || !size || (size > (r.size - (address - r.address)))) {
+        size = r.size - (address - r.address);
+    }
+
+    printf("`%s`: 0x%08X - 0x%08X, %u frames, %llu KB stored\n", spec, r.address,
+        r.address + r.size - 1, r.count, (unsigned long long)(r.stored >> 10));
+
+    if (filename && sparse_open(&sparse, filename)) {
+        archive_close(&r);
+        return 1;
+    }
+    buf = alloc(r.frame_size);
+
+    /* A frame at a time */
+    for (end = address + size; !result && (address != end); address += len) {
+        len = MIN(end - address, r.frame_size - ((address - r.address) % r.frame_size));
+        result = archive_read(&r, address, buf, len);
+        if (result) {
+            break;
+        }
+        if (filename) {
+            result = sparse_write(&sparse, buf, len);
+        }
+        else {
+            hex_dump(buf, address, len);
+        }
+    }
+
+    if (filename) {
+        result |= sparse_close(&sparse);
+        if (!result) {
+            sparse_print(&sparse, end - size);
+        }
+        sparse_free(&sparse);
+    }
+    free(buf);
+    archive_close(&r);
+
+    return result;
+}
+
+/* Capture a savestate: a snapshot of all of the installed RDRAM and a manifest */
+int save_state(char *spec, char *base) {
+    STATE state;
+    char *name = split_spec(spec);
+    char *snap;
+    char stamp[32];
+    time_t t;
+    int result;
+
+    if (!name) {
+        t = time(NULL);
+        strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&t));
+        name = stamp;
+    }
+
+    memset(&state, 0, sizeof(STATE));
+    state.ram = installed_ram();
+    if (!state.ram || gs_enter() || gs_where(&state.where)) {
+        return 1;
+    }
+    if (state.where != GS_WHERE_GAME) {
+        fprintf(stderr, "%s\n", "States can only be saved in-game");
+        return 1;
+    }
+
+    snap = alloc(strlen(spec) + strlen(name) + 2);
+    sprintf(snap, "%s:%s", spec, name);
+    result = capture_snapshot(snap, MEMMAP_KSEG0, state.ram, base);
+    free(snap);
+
+    if (!result) {
+        state.time = time(NULL);
+        result = state_save(spec, name, &state);
+    }
+    if (!result) {
+        printf("Saved state `%s`\n", name);
+    }
+
+    return result;
+}
+
+int restore_state(char *spec) {
+    char *name = split_spec(spec);
+    uint32_t ram = installed_ram();
+
+    if (!ram) {
+        return 1;
+    }
+
+    return state_restore(spec, name, ram, callback);
+}
+
+int triage_dump(char *filename, char *list) {
+    TRIAGE_REGION *regions = NULL;
+    uint32_t ram;
+    int count = 0;
+    int result;
+
+    if (list && triage_parse(list, &regions, &count)) {
+        free(regions);
+        return 1;
+    }
+
+    ram = installed_ram();
+    if (!ram) {
+        /* The probe can fail on a crashed game; assume no Expansion Pak */
+        ram = MEMMAP_RAM_SIZE;
+    }
+    result = triage_run(filename, regions, count, ram);
+    free(regions);
+
+    return result;
+}
+
+int backup_mempak(char *spec) {
+    MEMPAK *pak;
+    STORE store;
+    GS_SINK sink;
+    uint32_t objects;
+    uint64_t bytes;
+    char *name = split_spec(spec);
+    char stamp[32];
+    time_t t;
+    int result = 0;
+
+    if (!name) {
+        t = time(NULL);
+        strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&t));
+        name = stamp;
+    }
+
+    if (store_open(&store, spec, true)) {
+        return 1;
+    }
+    objects = store.count;
+    bytes = store.pack_size;
+
+    pak = alloc(sizeof(MEMPAK));
+    mempak_init(pak);
+    mempak_sink(pak, &sink);
+
+    printf("Backing up Controller Pak to `%s`...\n", name);
+
+    if (gs_enter() || gs_read_mempak(&sink, callback_rom) || gs_exit()) {
+        fprintf(stderr, "%s(): backup failed\n", __FUNCTION__);
+        result = 1;
+    }
+    else if (mempak_save(pak, &store, name)) {
+        result = 1;
+    }
+    else {
+        printf("%d notes, %u new objects (%llu bytes stored)\n", pak->count,
+            store.count - objects, (unsigned long long)(store.pack_size - bytes));
+        if (pak->errors) {
+            printf("%d problems found on the pak; the image was saved as read\n", pak->errors);
+        }
+    }
+
+    store_close(&store);
+    free(pak);
+
+    return result;
+}
+
+int export_mempak(char *spec, char *filename) {
+    char *name = split_spec(spec);
+
+    if (!name) {
+        return mempak_list(spec);
+    }
+
+    return mempak_export(spec, name, filename);
+}
+
+int get_codes(char *filename) {
+    CODE_LIST list;
+    GS_SINK sink;
+    int result = 0;
+
+    codes_init(&list);
+    codes_sink(&list, &sink);
+
+    printf("Reading code list...\n");
+
+    if (gs_enter() || gs_get_codes(&sink, callback_rom) || gs_exit() || codes_index(&list)) {
+        fprintf(stderr, "%s(): reading the code list failed\n", __FUNCTION__);
+        result = 1;
+    }
+    else {
+        printf("%u games, %u bytes\n", list.count, list.size);
+        result = codes_save(&list, filename);
+    }
+    codes_free(&list);
+
+    return result;
+}
+
+int put_codes(char *filename) {
+    CODE_LIST list;
+    GS_SOURCE source;
+    int result = 0;
+
+    if (codes_load(&list, filename)) {
+        return 1;
+    }
+    gs_source_memory(&source, list.data, list.size);
+
+    printf("Writing %u games (%u bytes)...\n", list.count, list.size);
+
+    if (gs_enter() || gs_write_codes(&source, callback_rom) || gs_exit()) {
+        fprintf(stderr, "%s(): writing the code list failed\n", __FUNCTION__);
+        result = 1;
+    }
+    codes_free(&list);
+
+    return result;
+}
+
+/* Send only the games that differ from the GS's list, in one session */
+int sync_codes(char *filename) {
+    CODE_LIST list;
+    CODE_LIST unit;
+    CODE_LIST changes;
+    GS_SINK sink;
+    GS_SOURCE source;
+    uint32_t games;
+    uint32_t size;
+    uint32_t kept_games;
+    uint32_t kept_size;
+    uint32_t i;
+    int result = 0;
+
+    if (codes_load(&list, filename)) {
+        return 1;
+    }
+    codes_init(&unit);
+    codes_sink(&unit, &sink);
+    codes_init(&changes);
+
+    if (gs_enter() || gs_get_codes(&sink, NULL) || codes_index(&unit)) {
+        fprintf(stderr, "%s(): reading the code list failed\n", __FUNCTION__);
+        result = 1;
+        goto done;
+    }
+
+    if (!codes_diff(&list, &unit, &changes)) {
+        printf("Code list is up to date (%u games)\n", unit.count);
+        result = gs_exit();
+        goto done;
+    }
+
+    printf("Sending %u of %u games (%u of %u bytes)...\n",
+        changes.count, list.count, changes.size, list.size);
+    gs_source_memory(&source, changes.data, changes.size);
+    if (gs_add_codes(&source, callback_rom) || gs_count_codes(&games, &size) || gs_exit()) {
+        fprintf(stderr, "%s(): writing the code list failed\n", __FUNCTION__);
+        result = 1;
+        goto done;
+    }
+
+    /* Games only on the GS are kept */
+    kept_games = 0;
+    kept_size = 0;
+    for (i = 0; i < unit.count; i++) {
+        if (!codes_find(&list, unit.games[i].name)) {
+            printf("  = %s (not in `%s`; kept)\n", unit.games[i].name, filename);
+            kept_games++;
+            kept_size += unit.games[i].size;
+        }
+    }
+
+    if ((games != (list.count + kept_games)) || (size != (list.size + kept_size))) {
+        fprintf(stderr, "GS reports %u games (%u bytes) after sync; expected %u (%u bytes)\n",
+            games, size, list.count + kept_games, list.size + kept_size);
+        result = 1;
+    }
+
+done:
+    codes_free(&changes);
+    codes_free(&unit);
+    codes_free(&list);
+
+    return result;
+}
+
+int run_plan(char *filename, bool write, char *output) {
+    PLAN plan;
+    int result;
+
+    if (plan_load(&plan, filename)) {
+        return 1;
+    }
+
+    result = write ? plan_write(&plan) : plan_read(&plan, output);
+    plan_free(&plan);
+
+    return result;
+}
+
+/*
+ * Read RDRAM regions coherently: one paused READ, with the ranges sorted and
+ * merged first so the game is paused for as short a time as possible
+ */
+int coherent_read(char *list, uint32_t gap, char *output) {
+    PLAN plan;
+    GS_RANGE *range;
+    uint32_t ram;
+    uint32_t phys;
+    uint32_t i;
+    int result;
+
+    if (plan_parse(&plan, list)) {
+        return 1;
+    }
+    ram = installed_ram();
+    if (!ram) {
+        plan_free(&plan);
+        return 1;
+    }
+
+    /* Only RDRAM can be read without unpausing; both mirrors merge as one */
+    for (i = 0; i < plan.count; i++) {
+        range = &plan.ranges[i];
+        phys = range->address & MEMMAP_PHYS_MASK;
+        if ((range->address < MEMMAP_KSEG0) || (range->address >= 0xC0000000) ||
+            (((uint64_t)phys + range->size) > ram)) {
+            fprintf(stderr, "0x%08X - 0x%08X is not in the installed RDRAM; only RDRAM can be read "
+                "while the game is paused\n", range->address, range->address + range->size - 1);
+            plan_free(&plan);
+            return 1;
+        }
+        range->address = MEMMAP_KSEG0 | phys;
+    }
+    plan_coalesce(&plan, gap);
+
+    /* Ranges the firmware would refuse are read through the other mirror */
+    for (i = 0; i < plan.count; i++) {
+        range = &plan.ranges[i];
+        if (memmap_read_blocked(range->address)) {
+            range->address = MEMMAP_KSEG1 | (range->address & MEMMAP_PHYS_MASK);
+        }
+    }
+
+    plan_print(&plan);
+    result = plan_read(&plan, output);
+    plan_free(&plan);
+
+    return result;
+}
+
+/* Chains that lead past the installed RDRAM are invalid */
+int follow_chains(char *filename, char *output) {
+    uint32_t ram = installed_ram();
+
+    if (!ram) {
+        return 1;
+    }
+
+    return ptrscan_live(filename, ram, output);
+}
+
+/* Load a fast transfer stub; the stock protocol carries on if it does not answer */
+int fast_start(char *filename) {
+    GS_SOURCE source;
+    uint8_t *image;
+    uint32_t pos;
+    size_t got = 1;
+
+    if (gs_source_file(&source, filename)) {
+        return 1;
+    }
+    image = alloc(source.size + 1);
+    for (pos = 0; got && (pos < source.size); pos += got) {
+        got = source.read(&source, &image[pos], source.size - pos);
+    }
+    gs_source_close(&source);
+
+    if (gs_enter() || gs_fast_start(image, pos)) {
+        fprintf(stderr, "%s\n", "Fast transfer stub unavailable; using the stock protocol");
+        gs_exit();
+        free(image);
+        return 1;
+    }
+    printf("Fast transfer stub running at 0x%08X\n", get_be32(&image[GS_FAST_HDR_LOAD]));
+    free(image);
+
+    return 0;
 }
@@ -0,0 +1,84 @@
+
+#ifndef _N64RD_H_
+#define _N64RD_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "gspro.h"
+
+
+/* Handy macros */
+#define GS_MACRO_0(_FUNC) \
+    if (_FUNC()) { \
+        fprintf(stderr, "%s(): " #_FUNC "() failed\n", __FUNCTION__); \
+        return 1; \
+    }
+
+#define GS_MACRO_1(_FUNC, _ARG) \
+    if (_FUNC((_ARG))) { \
+        fprintf(stderr, "%s(): " #_FUNC "() failed\n", __FUNCTION__); \
+        return 1; \
+    }
+
+#define GS_MACRO_2(_FUNC, _ARG1, _ARG2) \
+    if (_FUNC((_ARG1), (_ARG2))) { \
+        fprintf(stderr, "%s(): " #_FUNC "() failed\n", __FUNCTION__); \
+        return 1; \
+    }
+
+#define GS_MACRO_3(_FUNC, _ARG1, _ARG2, _ARG3) \
+    if (_FUNC((_ARG1), (_ARG2), (_ARG3))) { \
+        fprintf(stderr, "%s(): " #_FUNC "() failed\n", __FUNCTION__); \
+        return 1; \
+    }
+
+#define GS_ENTER()              GS_MACRO_0(gs_enter)
+#define GS_EXIT()               GS_MACRO_0(gs_exit)
+#define GS_READ(_a, _b, _c)     GS_MACRO_3(gs_read, _a, _b, _c)
+#define GS_WRITE(_a, _b, _c)    GS_MACRO_3(gs_write, _a, _b, _c)
+#define GS_WRITE_SOURCE(_a, _b, _c) \
+                        GS_MACRO_3(gs_write_source, _a, _b, _c)
+#define GS_WHERE(_a)            GS_MACRO_1(gs_where, _a)
+#define GS_VERSION(_a, _b, _c)  GS_MACRO_3(gs_version, _a, _b, _c)
+#define GS_UPGRADE(_a, _b)      GS_MACRO_2(gs_upgrade, _a, _b)
+#define GS_UPGRADE_SOURCE(_a)   GS_MACRO_1(gs_upgrade_source, _a)
+#define GS_READ_ROM(_a, _b, _c) GS_MACRO_3(gs_read_rom, _a, _b, _c)
+
+
+/* Running statistics (Welford) */
+struct _stats {
+    uint64_t    count;
+    double      mean;
+    double      m2;
+    double      min;
+    double      max;
+};
+typedef struct _stats STATS;
+
+
+/* Shared helpers (n64rd.c) */
+void parse_error(char *string, int location);
+char *split_spec(char *spec);
+
+/* Shared helpers (util.c) */
+void *alloc(size_t size);
+uint64_t now_ns(void);
+uint64_t cpu_ns(void);
+void sleep_until_ns(uint64_t deadline);
+uint64_t hash64(const void *data, size_t size, uint64_t seed);
+void stats_add(STATS *stats, double value);
+double stats_stddev(STATS *stats);
+void hex_dump(uint8_t *data, uint32_t address, uint32_t size);
+void put_le16(uint8_t *p, uint16_t value);
+void put_le32(uint8_t *p, uint32_t value);
+void put_le64(uint8_t *p, uint64_t value);
+uint16_t get_le16(const uint8_t *p);
+uint32_t get_le32(const uint8_t *p);
+uint64_t get_le64(const uint8_t *p);
+void put_be16(uint8_t *p, uint16_t value);
+void put_be32(uint8_t *p, uint32_t value);
+uint16_t get_be16(const uint8_t *p);
+uint32_t get_be32(const uint8_t *p);
+
+#endif /* _N64RD_H_ */
@@ -0,0 +1,384 @@
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gspro.h"
+#include "n64rd.h"
+#include "memmap.h"
+#include "plan.h"
+
+
+/* Private function declarations */
+int _plan_hex(char c);
+int _plan_check_game(void);
+int _plan_compare(const void *a, const void *b);
+
+
+/* Private functions */
+
+int _plan_hex(char c) {
+    if ((c >= '0') && (c <= '9')) return c - '0';
+    if ((c >= 'a') && (c <= 'f')) return c - 'a' + 10;
+    if ((c >= 'A') && (c <= 'F')) return c - 'A' + 10;
+
+    return -1;
+}
+
+/* READ and WRITE are only available in-game */
+int _plan_check_game(void) {
+    uint8_t check;
+
+    GS_ENTER();
+    GS_WHERE(&check);
+    if (check != GS_WHERE_GAME) {
+        fprintf(stderr, "Plans can only be run while in-game\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int _plan_compare(const void *a, const void *b) {
+    const GS_RANGE *ra = a;
+    const GS_RANGE *rb = b;
+
+    return (ra->address > rb->address) - (ra->address < rb->address);
+}
+
+
+/* Public functions */
+
+void plan_init(PLAN *plan) {
+    memset(plan, 0, sizeof(PLAN));
+    plan->capacity = 16;
+    plan->ranges = alloc(plan->capacity * sizeof(GS_RANGE));
+}
+
+void plan_free(PLAN *plan) {
+    free(plan->ranges);
+    free(plan->data);
+    memset(plan, 0, sizeof(PLAN));
+}
+
+/* Append a range; `data` (when given) holds `size` bytes to write */
+void plan_add(PLAN *plan, uint32_t address, uint32_t size, const uint8_t *data) {
+    GS_RANGE *ranges;
+    uint8_t *buf;
+
+    /* Keep room for the terminator */
+    if ((plan->count + 2) > plan->capacity) {
+        plan->capacity *= 2;
+        ranges = alloc(plan->capacity * sizeof(GS_RANGE));
+        memcpy(ranges, plan->ranges, plan->count * sizeof(GS_RANGE));
+        free(plan->ranges);
+        plan->ranges = ranges;
+    }
+
+    if (data) {
+        if ((plan->size + size) > plan->data_capacity) {
+            plan->data_capacity = MAX(plan->data_capacity * 2, plan->size + size);
+            buf = alloc(plan->data_capacity);
+            if (plan->data) {
+                memcpy(buf, plan->data, plan->size);
+            }
+            free(plan->data);
+            plan->data = buf;
+        }
+        memcpy(&plan->data[plan->size], data, size);
+    }
+
+    plan->ranges[plan->count].address = address;
+    plan->ranges[plan->count].size = size;
+    plan->count++;
+    plan->ranges[plan->count].address = 0;
+    plan->ranges[plan->count].size = 0;
+    plan->size += size;
+}
+
+/* Parse "address:size,address:size,..." into a read plan */
+int plan_parse(PLAN *plan, char *spec) {
+    char *p = spec;
+    char *err;
+    uint32_t address;
+    uint32_t size;
+
+    plan_init(plan);
+
+    while (*p) {
+        address = strtoul(p, &err, 0);
+        if ((err == p) || !address || (*err != ':')) {
+            fprintf(stderr, "Invalid range address\n");
+            parse_error(spec, (err - spec));
+            plan_free(plan);
+            return 1;
+        }
+        p = err + 1;
+        size = strtoul(p, &err, 0);
+        if ((err == p) || !size || (*err && (*err != ','))) {
+            fprintf(stderr, "Invalid range size\n");
+            parse_error(spec, (err - spec));
+            plan_free(plan);
+            return 1;
+        }
+        plan_add(plan, address, size, NULL);
+        p = *err ? err + 1 : err;
+    }
+
+    if (!plan->count) {
+        fprintf(stderr, "Empty range list\n");
+        plan_free(plan);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Sort a read plan and merge ranges that overlap or are separated by up to
+ * `gap` bytes. Each range costs an address and a size on the wire, so reading
+ * a small gap is cheaper than starting another range.
+ */
+void plan_coalesce(PLAN *plan, uint32_t gap) {
+    GS_RANGE *last;
+    uint64_t end;
+    uint32_t i;
+
+    if (plan->data || (plan->count < 2)) {
+        return;
+    }
+
+    qsort(plan->ranges, plan->count, sizeof(GS_RANGE), _plan_compare);
+
+    last = plan->ranges;
+    plan->size = last->size;
+    for (i = 1; i < plan->count; i++) {
+        end = (uint64_t)last->address + last->size;
+        if (plan->ranges[i].address <= (end + gap)) {
+            end = MAX(end, (uint64_t)plan->ranges[i].address + plan->ranges[i].size);
+            plan->size += (end - last->address) - last->size;
+            last->size = end - last->address;
+        }
+        else {
+            last++;
+            *last = plan->ranges[i];
+            plan->size += last->size;
+        }
+    }
+    plan->count = (last - plan->ranges) + 1;
+    plan->ranges[plan->count].address = 0;
+    plan->ranges[plan->count].size = 0;
+}
+
+int plan_load(PLAN *plan, const char *filename) {
+    FILE *fp;
+    char *line = NULL;
+    size_t line_size = 0;
+    char *p;
+    char *err;
+    uint32_t address;
+    uint32_t size;
+    uint8_t *data = NULL;
+    uint32_t i;
+    int lineno = 0;
+    int writes = 0;
+    int hi, lo;
+
+    plan_init(plan);
+
+    fp = fopen(filename, "r");
+    if (!fp) {
+        fprintf(stderr, "Unable to open `%s` for reading\n", filename);
+        return 1;
+    }
+
+    while (getline(&line, &line_size, fp) != -1) {
+        lineno++;
+        p = line;
+        while (isspace(*p)) p++;
+        if (!*p || (*p == '#')) {
+            continue;
+        }
+
+        address = strtoul(p, &err, 0);
+        if ((err == p) || !address) {
+            fprintf(stderr, "%s:%d: invalid address\n", filename, lineno);
+            goto fail;
+        }
+        p = err;
+        size = strtoul(p, &err, 0);
+        if ((err == p) || !size) {
+            fprintf(stderr, "%s:%d: invalid size\n", filename, lineno);
+            goto fail;
+        }
+        p = err;
+        while (isspace(*p)) p++;
+
+        if (*p && (*p != '#')) {
+            /* Write entry */
+            data = realloc(data, size);
+            for (i = 0; i < size; i++) {
+                hi = _plan_hex(p[i * 2]);
+                lo = (hi < 0) ? -1 : _plan_hex(p[(i * 2) + 1]);
+                if (lo < 0) {
+                    fprintf(stderr, "%s:%d: expected %u bytes of hex data\n", filename, lineno, size);
+                    goto fail;
+                }
+                data[i] = (hi << 4) | lo;
+            }
+            plan_add(plan, address, size, data);
+            writes++;
+        }
+        else {
+            plan_add(plan, address, size, NULL);
+        }
+
+        if (writes && (writes != plan->count)) {
+            fprintf(stderr, "%s:%d: cannot mix read and write entries\n", filename, lineno);
+            goto fail;
+        }
+    }
+
+    free(data);
+    free(line);
+    fclose(fp);
+
+    return 0;
+
+fail:
+    free(data);
+    free(line);
+    fclose(fp);
+    plan_free(plan);
+
+    return 1;
+}
+
+int plan_save(PLAN *plan, const char *filename) {
+    FILE *fp;
+    uint32_t offset = 0;
+    uint32_t i, j;
+
+    fp = fopen(filename, "w");
+    if (!fp) {
+        fprintf(stderr, "Unable to open `%s` for writing\n", filename);
+        return 1;
+    }
+
+    fprintf(fp, "# n64rd %s plan: %u ranges, 0x%X bytes\n",
+        (plan->data ? "write" : "read"), plan->count, plan->size);
+    for (i = 0; i < plan->count; i++) {
+        fprintf(fp, "0x%08X 0x%X", plan->ranges[i].address, plan->ranges[i].size);
+        if (plan->data) {
+            fprintf(fp, " ");
+            for (j = 0; j < plan->ranges[i].size; j++) {
+                fprintf(fp, "%02X", plan->data[offset + j]);
+            }
+        }
+        fprintf(fp, "\n");
+        offset += plan->ranges[i].size;
+    }
+
+    if (fclose(fp)) {
+        fprintf(stderr, "Unable to write `%s`\n", filename);
+        return 1;
+    }
+
+    return 0;
+}
+
+void plan_print(PLAN *plan) {
+    uint32_t i;
+
+    for (i = 0; i < plan->count; i++) {
+        printf("0x%08X - 0x%08X  (0x%X bytes)\n",
+            plan->ranges[i].address,
+            plan->ranges[i].address + plan->ranges[i].size - 1,
+            plan->ranges[i].size);
+    }
+    printf("%u ranges, 0x%X bytes\n", plan->count, plan->size);
+}
+
+/* Run a write plan as one multi-range WRITE */
+int plan_write(PLAN *plan) {
+    if (!plan->data) {
+        fprintf(stderr, "%s\n", "Plan has no data to write");
+        return 1;
+    }
+    if (!plan->count) {
+        return 0;
+    }
+    if (_plan_check_game()) {
+        return 1;
+    }
+
+    GS_ENTER();
+    GS_WRITE(plan->data, plan->ranges, NULL);
+    GS_EXIT();
+
+    printf("Wrote %u ranges, 0x%X bytes\n", plan->count, plan->size);
+
+    return 0;
+}
+
+/*
+ * Re-read every range of a plan in one multi-range READ, so every range comes
+ * from the same paused frame. The game runs again after the in-game check (WHERE
+ * leaves PC-control), so it is paused only from the ENTER before the READ to the
+ * EXIT after it; how long is reported. The result is saved as
+ * a write plan (so it can be restored later) or displayed.
+ */
+int plan_read(PLAN *plan, const char *filename) {
+    GS_RANGE *reads;
+    uint64_t start;
+    uint32_t offset = 0;
+    uint32_t i;
+
+    if (!plan->count) {
+        return 0;
+    }
+
+    if (plan->data_capacity < plan->size) {
+        free(plan->data);
+        plan->data = alloc(plan->size);
+        plan->data_capacity = plan->size;
+    }
+
+    if (_plan_check_game()) {
+        return 1;
+    }
+
+    /* READ refuses some starts; RDRAM's are read through KSEG1, keeping the plan's addresses */
+    reads = alloc((plan->count + 1) * sizeof(GS_RANGE));
+    memcpy(reads, plan->ranges, (plan->count + 1) * sizeof(GS_RANGE));
+    for (i = 0; i < plan->count; i++) {
+        if (memmap_read_blocked(reads[i].address)) {
+            reads[i].address = MEMMAP_KSEG1 | (reads[i].address & MEMMAP_PHYS_MASK);
+        }
+    }
+
+    /* WHERE left PC-control; the pause is from this ENTER to the EXIT */
+    start = now_ns();
+    if (gs_enter() || gs_read(plan->data, reads, NULL) || gs_exit()) {
+        free(reads);
+        return 1;
+    }
+    free(reads);
+
+    printf("Game paused for %.3f ms: %u ranges, 0x%X bytes in one READ\n",
+        (now_ns() - start) / 1e6, plan->count, plan->size);
+
+    if (filename) {
+        return plan_save(plan, filename);
+    }
+
+    for (i = 0; i < plan->count; i++) {
+        hex_dump(&plan->data[offset], plan->ranges[i].address, plan->ranges[i].size);
+        offset += plan->ranges[i].size;
+    }
+
+    return 0;
+}
@@ -0,0 +1,45 @@
+
+#ifndef _PLAN_H_
+#define _PLAN_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gspro.h"
+
+
+/*
+ * A plan is a list of GS_RANGEs, optionally with data, that can be handed
+ * straight to a multi-range gs_read() or gs_write(). Data for each range is
+ * packed back-to-back, in range order, exactly as those functions expect.
+ *
+ * Plan files are text, one range per line:
+ *
+ *   # comment
+ *   <address> <size>              Read plan entry
+ *   <address> <size> <hex data>   Write plan entry
+ */
+struct _plan {
+    GS_RANGE *  ranges;     /* Always terminated by a { 0, 0 } entry */
+    uint8_t *   data;       /* NULL for a read plan */
+    uint32_t    count;
+    uint32_t    size;       /* Total bytes across all ranges */
+    uint32_t    capacity;
+    uint32_t    data_capacity;
+};
+typedef struct _plan PLAN;
+
+
+/* Function declarations */
+void plan_init(PLAN *plan);
+void plan_free(PLAN *plan);
+void plan_add(PLAN *plan, uint32_t address, uint32_t size, const uint8_t *data);
+int plan_parse(PLAN *plan, char *spec);
+void plan_coalesce(PLAN *plan, uint32_t gap);
+int plan_load(PLAN *plan, const char *filename);
+int plan_save(PLAN *plan, const char *filename);
+void plan_print(PLAN *plan);
+int plan_write(PLAN *plan);
+int plan_read(PLAN *plan, const char *filename);
+
+#endif /* _PLAN_H_ */
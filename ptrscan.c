@@ -0,0 +1,756 @@
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gspro.h"
+#include "n64rd.h"
+#include "diff.h"
+#include "memmap.h"
+#include "ptrscan.h"
+
+
+/* Private function declarations */
+int _ptrscan_compare_entry(const void *x, const void *y);
+int _ptrscan_compare_chain(const void *x, const void *y);
+int _ptrscan_compare_u32(const void *x, const void *y);
+bool _ptrscan_pointer(CAPTURE *capture, uint32_t address);
+bool _ptrscan_ancestor(PTRSCAN *scan, uint32_t level, uint32_t i, uint32_t location);
+void _ptrscan_chain(PTRSCAN *scan, PTRSCAN_NODE *node, PTRSCAN_CHAIN *chain);
+void _ptrscan_expand(PTRSCAN *scan, PTRSCAN_WORK *work, uint32_t start, uint32_t end);
+void *_ptrscan_worker(void *arg);
+
+
+/* Private functions */
+
+int _ptrscan_compare_entry(const void *x, const void *y) {
+    const PTRSCAN_ENTRY *p = x;
+    const PTRSCAN_ENTRY *q = y;
+
+    if (p->value != q->value) {
+        return (p->value < q->value) ? -1 : 1;
+    }
+    if (p->location != q->location) {
+        return (p->location < q->location) ? -1 : 1;
+    }
+
+    return 0;
+}
+
+/* Shortest chains first, then by base and offsets */
+int _ptrscan_compare_chain(const void *x, const void *y) {
+    const PTRSCAN_CHAIN *p = x;
+    const PTRSCAN_CHAIN *q = y;
+    uint32_t i;
+
+    if (p->depth != q->depth) {
+        return (p->depth < q->depth) ? -1 : 1;
+    }
+    if (p->base != q->base) {
+        return (p->base < q->base) ? -1 : 1;
+    }
+    for (i = 0; i < p->depth; i++) {
+        if (p->offsets[i] != q->offsets[i]) {
+            return (p->offsets[i] < q->offsets[i]) ? -1 : 1;
+        }
+    }
+
+    return 0;
+}
+
+int _ptrscan_compare_u32(const void *x, const void *y) {
+    uint32_t p = *(const uint32_t *)x;
+    uint32_t q = *(const uint32_t *)y;
+
+    return (p < q) ? -1 : (p > q);
+}
+
+/* Can a word at `address` be read from the capture? */
+bool _ptrscan_pointer(CAPTURE *capture, uint32_t address) {
+    return (!(address & 3) && (address >= capture->address) &&
+        ((address - capture->address) <= (capture->size - 4)) && (capture->size >= 4));
+}
+
+/* Is `location` already on the path from node `i` of `level` to the target? */
+bool _ptrscan_ancestor(PTRSCAN *scan, uint32_t level, uint32_t i, uint32_t location) {
+    PTRSCAN_NODE *node;
+
+    for (;;) {
+        node = &scan->levels[level][i];
+        if (node->location == location) {
+            return true;
+        }
+        if (!level) {
+            return false;
+        }
+        i = node->parent;
+        level--;
+    }
+}
+
+/* The chain from a new node (one level below scan->level) to the target */
+void _ptrscan_chain(PTRSCAN *scan, PTRSCAN_NODE *node, PTRSCAN_CHAIN *chain) {
+    uint32_t level = scan->level;
+    uint32_t i = node->parent;
+
+    memset(chain, 0, sizeof(PTRSCAN_CHAIN));
+    chain->base = node->location;
+    chain->offsets[chain->depth++] = node->offset;
+    for (; level; level--) {
+        chain->offsets[chain->depth++] = scan->levels[level][i].offset;
+        i = scan->levels[level][i].parent;
+    }
+}
+
+/* Find what points at nodes [start, end) of the current level */
+void _ptrscan_expand(PTRSCAN *scan, PTRSCAN_WORK *work, uint32_t start, uint32_t end) {
+    PTRSCAN_NODE *frontier = scan->levels[scan->level];
+    PTRSCAN_NODE *node;
+    PTRSCAN_ENTRY *entry;
+    PTRSCAN_CHAIN chain;
+    uint32_t address;
+    uint32_t resolved;
+    uint32_t lo;
+    uint32_t hi;
+    uint32_t mid;
+    uint32_t taken;
+    uint32_t i;
+    int c;
+
+    for (i = start; i < end; i++) {
+        address = frontier[i].location;
+
+        /* First entry pointing past the node */
+        lo = 0;
+        hi = scan->index_count;
+        while (lo < hi) {
+            mid = lo + ((hi - lo) / 2);
+            if (scan->index[mid].value <= address) {
+                lo = mid + 1;
+            }
+            else {
+                hi = mid;
+            }
+        }
+
+        /* Walk down to the nearest pointers */
+        for (taken = 0; lo-- && (taken < PTRSCAN_FANOUT); ) {
+            entry = &scan->index[lo];
+            if ((address - entry->value) > scan->max_offset) {
+                break;
+            }
+            if (_ptrscan_ancestor(scan, scan->level, i, entry->location)) {
+                continue;
+            }
+            taken++;
+
+            if (work->node_count == work->node_capacity) {
+                work->node_capacity = work->node_capacity ? (work->node_capacity * 2) : 0x400;
+                work->nodes = realloc(work->nodes, work->node_capacity * sizeof(PTRSCAN_NODE));
+                if (!work->nodes) {
+                    fprintf(stderr, "Out of memory\n");
+                    exit(1);
+                }
+            }
+            node = &work->nodes[work->node_count++];
+            node->location = entry->location;
+            node->parent = i;
+            node->offset = address - entry->value;
+
+            if ((node->location < scan->base_start) || (node->location >= scan->base_end)) {
+                continue;
+            }
+
+            /* A base: keep it if every other capture agrees */
+            _ptrscan_chain(scan, node, &chain);
+            for (c = 1; c < scan->count; c++) {
+                if (!ptrscan_resolve(&scan->captures[c], &chain, &resolved) || (resolved != scan->targets[c])) {
+                    break;
+                }
+            }
+            if (c < scan->count) {
+                continue;
+            }
+
+            if (work->chain_count == work->chain_capacity) {
+                work->chain_capacity = work->chain_capacity ? (work->chain_capacity * 2) : 0x40;
+                work->chains = realloc(work->chains, work->chain_capacity * sizeof(PTRSCAN_CHAIN));
+                if (!work->chains) {
+                    fprintf(stderr, "Out of memory\n");
+                    exit(1);
+                }
+            }
+            work->chains[work->chain_count++] = chain;
+        }
+    }
+}
+
+void *_ptrscan_worker(void *arg) {
+    PTRSCAN_WORK *work = arg;
+    PTRSCAN *scan = work->scan;
+    uint32_t pass = 0;
+    uint32_t count;
+
+    pthread_mutex_lock(&scan->lock);
+    for (;;) {
+        while ((scan->pass == pass) && !scan->quit) {
+            pthread_cond_wait(&scan->cond, &scan->lock);
+        }
+        if (scan->quit) {
+            break;
+        }
+        pass = scan->pass;
+        pthread_mutex_unlock(&scan->lock);
+
+        /* Each worker takes an even share of the level */
+        count = scan->level_counts[scan->level];
+        _ptrscan_expand(scan, work,
+            (uint32_t)(((uint64_t)count * work->id) / scan->thread_count),
+            (uint32_t)(((uint64_t)count * (work->id + 1)) / scan->thread_count));
+
+        pthread_mutex_lock(&scan->lock);
+        if (!--scan->pending) {
+            pthread_cond_signal(&scan->done);
+        }
+    }
+    pthread_mutex_unlock(&scan->lock);
+
+    return NULL;
+}
+
+
+/* Public functions */
+
+/*
+ * Index the pointers of the first capture and start the workers. `targets`
+ * holds the target's address in each capture.
+ */
+int ptrscan_init(PTRSCAN *scan, CAPTURE *captures, uint32_t *targets, int count) {
+    CAPTURE *capture = &captures[0];
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t value;
+    uint32_t pos;
+    uint32_t n = 0;
+    int i;
+
+    memset(scan, 0, sizeof(PTRSCAN));
+    scan->captures = captures;
+    scan->targets = targets;
+    scan->count = count;
+    scan->depth = PTRSCAN_DEPTH;
+    scan->max_offset = PTRSCAN_OFFSET;
+    scan->base_start = capture->address;
+    scan->base_end = capture->address + capture->size;
+
+    for (i = 0; i < count; i++) {
+        if (!_ptrscan_pointer(&captures[i], targets[i] & ~3)) {
+            fprintf(stderr, "0x%08X is outside of capture %d\n", targets[i], i + 1);
+            return 1;
+        }
+    }
+
+    /* Reverse index: every aligned word that points into the capture */
+    for (pos = 0; (pos + 4) <= capture->size; pos += 4) {
+        value = get_be32(&capture->data[pos]);
+        if ((value >= capture->address) && ((value - capture->address) < capture->size)) {
+            n++;
+        }
+    }
+    scan->index = alloc((n + 1) * sizeof(PTRSCAN_ENTRY));
+    for (pos = 0; (pos + 4) <= capture->size; pos += 4) {
+        value = get_be32(&capture->data[pos]);
+        if ((value >= capture->address) && ((value - capture->address) < capture->size)) {
+            scan->index[scan->index_count].value = value;
+            scan->index[scan->index_count].location = capture->address + pos;
+            scan->index_count++;
+        }
+    }
+    qsort(scan->index, scan->index_count, sizeof(PTRSCAN_ENTRY), _ptrscan_compare_entry);
+
+    pthread_mutex_init(&scan->lock, NULL);
+    pthread_cond_init(&scan->cond, NULL);
+    pthread_cond_init(&scan->done, NULL);
+
+    scan->thread_count = MAX(1, MIN(cpus, PTRSCAN_THREADS_MAX));
+    scan->threads = alloc(scan->thread_count * sizeof(pthread_t));
+    scan->work = alloc(scan->thread_count * sizeof(PTRSCAN_WORK));
+    memset(scan->work, 0, scan->thread_count * sizeof(PTRSCAN_WORK));
+    for (i = 0; i < scan->thread_count; i++) {
+        scan->work[i].scan = scan;
+        scan->work[i].id = i;
+        if (pthread_create(&scan->threads[i], NULL, _ptrscan_worker, &scan->work[i])) {
+            fprintf(stderr, "Unable to start pointer scan threads\n");
+            scan->thread_count = i;
+            ptrscan_free(scan);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Breadth-first search back from the target, one level per pass of the workers */
+int ptrscan_search(PTRSCAN *scan) {
+    PTRSCAN_WORK *work;
+    uint32_t total;
+    uint32_t n;
+    uint32_t level;
+    int i;
+
+    scan->depth = MAX(1, MIN(scan->depth, PTRSCAN_DEPTH_MAX));
+
+    scan->levels[0] = alloc(sizeof(PTRSCAN_NODE));
+    scan->levels[0]->location = scan->targets[0];
+    scan->levels[0]->parent = 0;
+    scan->levels[0]->offset = 0;
+    scan->level_counts[0] = 1;
+
+    for (level = 0; (level < scan->depth) && scan->level_counts[level]; level++) {
+        pthread_mutex_lock(&scan->lock);
+        scan->level = level;
+        scan->pending = scan->thread_count;
+        scan->pass++;
+        pthread_cond_broadcast(&scan->cond);
+        while (scan->pending) {
+            pthread_cond_wait(&scan->done, &scan->lock);
+        }
+        pthread_mutex_unlock(&scan->lock);
+
+        /* Gather the workers' results in order, so they do not depend on scheduling */
+        total = 0;
+        for (i = 0; i < scan->thread_count; i++) {
+            total += scan->work[i].node_count;
+        }
+        if (total > PTRSCAN_BREADTH) {
+            total = PTRSCAN_BREADTH;
+            scan->truncated = true;
+        }
+        scan->levels[level + 1] = alloc((total + 1) * sizeof(PTRSCAN_NODE));
+        scan->level_counts[level + 1] = 0;
+
+        for (i = 0; i < scan->thread_count; i++) {
+            work = &scan->work[i];
+
+            n = MIN(work->node_count, total - scan->level_counts[level + 1]);
+            memcpy(&scan->levels[level + 1][scan->level_counts[level + 1]], work->nodes, n * sizeof(PTRSCAN_NODE));
+            scan->level_counts[level + 1] += n;
+
+            n = MIN(work->chain_count, PTRSCAN_CHAINS_MAX - scan->chain_count);
+            if (n < work->chain_count) {
+                scan->truncated = true;
+            }
+            scan->chains = realloc(scan->chains, (scan->chain_count + n + 1) * sizeof(PTRSCAN_CHAIN));
+            memcpy(&scan->chains[scan->chain_count], work->chains, n * sizeof(PTRSCAN_CHAIN));
+            scan->chain_count += n;
+
+            work->node_count = 0;
+            work->chain_count = 0;
+        }
+
+        printf("Level %u: %u pointers, %u chains\n", level + 1, scan->level_counts[level + 1], scan->chain_count);
+    }
+
+    qsort(scan->chains, scan->chain_count, sizeof(PTRSCAN_CHAIN), _ptrscan_compare_chain);
+
+    return 0;
+}
+
+void ptrscan_free(PTRSCAN *scan) {
+    int i;
+
+    if (scan->threads) {
+        pthread_mutex_lock(&scan->lock);
+        scan->quit = true;
+        pthread_cond_broadcast(&scan->cond);
+        pthread_mutex_unlock(&scan->lock);
+        for (i = 0; i < scan->thread_count; i++) {
+            pthread_join(scan->threads[i], NULL);
+        }
+        for (i = 0; i < scan->thread_count; i++) {
+            free(scan->work[i].nodes);
+            free(scan->work[i].chains);
+        }
+        pthread_mutex_destroy(&scan->lock);
+        pthread_cond_destroy(&scan->cond);
+        pthread_cond_destroy(&scan->done);
+    }
+
+    for (i = 0; i <= PTRSCAN_DEPTH_MAX; i++) {
+        free(scan->levels[i]);
+    }
+    free(scan->index);
+    free(scan->chains);
+    free(scan->threads);
+    free(scan->work);
+    memset(scan, 0, sizeof(PTRSCAN));
+}
+
+/* Follow a chain through a capture; false when it leaves the capture */
+bool ptrscan_resolve(CAPTURE *capture, PTRSCAN_CHAIN *chain, uint32_t *address) {
+    uint32_t a = chain->base;
+    uint32_t i;
+
+    for (i = 0; i < chain->depth; i++) {
+        if (!_ptrscan_pointer(capture, a)) {
+            return false;
+        }
+        a = get_be32(&capture->data[a - capture->address]) + chain->offsets[i];
+    }
+    *address = a;
+
+    return true;
+}
+
+void ptrscan_print(PTRSCAN_CHAIN *chain) {
+    uint32_t i;
+
+    printf("0x%08X", chain->base);
+    for (i = 0; i < chain->depth; i++) {
+        printf(" +0x%X", chain->offsets[i]);
+    }
+}
+
+int ptrscan_save(PTRSCAN_CHAIN *chains, uint32_t count, const char *filename) {
+    FILE *fp;
+    uint32_t i, j;
+
+    fp = fopen(filename, "w");
+    if (!fp) {
+        fprintf(stderr, "Unable to open `%s` for writing\n", filename);
+        return 1;
+    }
+
+    fprintf(fp, "# n64rd pointer chains: %u\n", count);
+    for (i = 0; i < count; i++) {
+        fprintf(fp, "0x%08X", chains[i].base);
+        for (j = 0; j < chains[i].depth; j++) {
+            fprintf(fp, " +0x%X", chains[i].offsets[j]);
+        }
+        fprintf(fp, "\n");
+    }
+
+    if (fclose(fp)) {
+        fprintf(stderr, "Unable to write `%s`\n", filename);
+        return 1;
+    }
+
+    return 0;
+}
+
+int ptrscan_load(const char *filename, PTRSCAN_CHAIN **chains, uint32_t *count) {
+    FILE *fp;
+    PTRSCAN_CHAIN chain;
+    char *line = NULL;
+    size_t line_size = 0;
+    char *p;
+    char *err;
+    uint32_t capacity = 0;
+    int lineno = 0;
+
+    *chains = NULL;
+    *count = 0;
+
+    fp = fopen(filename, "r");
+    if (!fp) {
+        fprintf(stderr, "Unable to open `%s` for reading\n", filename);
+        return 1;
+    }
+
+    while (getline(&line, &line_size, fp) != -1) {
+        lineno++;
+        p = line;
+        while (isspace(*p)) p++;
+        if (!*p || (*p == '#')) {
+            continue;
+        }
+
+        memset(&chain, 0, sizeof(chain));
+        chain.base = strtoul(p, &err, 0);
+        if ((err == p) || !chain.base) {
+            fprintf(stderr, "%s:%d: invalid base\n", filename, lineno);
+            goto fail;
+        }
+        for (p = err; ; p = err) {
+            while (isspace(*p)) p++;
+            if (!*p || (*p == '#')) {
+                break;
+            }
+            if ((*p != '+') || (chain.depth == PTRSCAN_DEPTH_MAX)) {
+                fprintf(stderr, "%s:%d: invalid offset\n", filename, lineno);
+                goto fail;
+            }
+            p++;
+            chain.offsets[chain.depth++] = strtoul(p, &err, 0);
+            if (err == p) {
+                fprintf(stderr, "%s:%d: invalid offset\n", filename, lineno);
+                goto fail;
+            }
+        }
+        if (!chain.depth) {
+            fprintf(stderr, "%s:%d: expected at least one offset\n", filename, lineno);
+            goto fail;
+        }
+
+        if (*count == capacity) {
+            capacity = capacity ? (capacity * 2) : 0x40;
+            *chains = realloc(*chains, capacity * sizeof(PTRSCAN_CHAIN));
+        }
+        (*chains)[(*count)++] = chain;
+    }
+
+    free(line);
+    fclose(fp);
+
+    return 0;
+
+fail:
+    free(line);
+    fclose(fp);
+    free(*chains);
+    *chains = NULL;
+    *count = 0;
+
+    return 1;
+}
+
+/*
+ * Follow chains through the running game: one multi-range READ per level,
+ * each distinct pointer read once, with the game paused throughout.
+ * `resolved` receives where each chain leads, or 0 when it leaves the `ram`
+ * bytes of installed RDRAM; `target` receives the address most chains agree on.
+ */
+int ptrscan_validate(PTRSCAN_CHAIN *chains, uint32_t count, uint32_t ram, uint32_t *resolved,
+    uint32_t *target) {
+    uint32_t *addresses;
+    uint32_t *found;
+    uint8_t *data;
+    GS_RANGE *ranges;
+    uint32_t level;
+    uint32_t depth = 0;
+    uint32_t unique;
+    uint32_t n;
+    uint32_t i;
+    uint32_t best = 0;
+    uint32_t run;
+    uint8_t check;
+    int result = 0;
+
+    *target = 0;
+
+    GS_ENTER();
+    GS_WHERE(&check);
+    if (check != GS_WHERE_GAME) {
+        fprintf(stderr, "Chains can only be followed while in-game\n");
+        return 1;
+    }
+
+    addresses = alloc((count + 1) * sizeof(uint32_t));
+    ranges = alloc((count + 1) * sizeof(GS_RANGE));
+    data = alloc((count + 1) * 4);
+    for (i = 0; i < count; i++) {
+        resolved[i] = chains[i].base;
+        depth = MAX(depth, chains[i].depth);
+    }
+
+    result = gs_enter();
+    for (level = 0; !result && (level < depth); level++) {
+        /* The distinct pointers this level reads */
+        for (i = 0, n = 0; i < count; i++) {
+            if (chains[i].depth <= level) {
+                continue;
+            }
+            if ((resolved[i] & 3) || (resolved[i] < MEMMAP_KSEG0) || (resolved[i] >= (MEMMAP_KSEG0 + ram))) {
+                resolved[i] = 0;
+                continue;
+            }
+            addresses[n++] = resolved[i];
+        }
+        if (!n) {
+            break;
+        }
+        qsort(addresses, n, sizeof(uint32_t), _ptrscan_compare_u32);
+        for (i = 1, unique = 1; i < n; i++) {
+            if (addresses[i] != addresses[unique - 1]) {
+                addresses[unique++] = addresses[i];
+            }
+        }
+        for (i = 0; i < unique; i++) {
+            /* Ranges the firmware would refuse are read through the other mirror */
+            ranges[i].address = addresses[i];
+            if (memmap_read_blocked(addresses[i])) {
+                ranges[i].address = MEMMAP_KSEG1 | (addresses[i] & MEMMAP_PHYS_MASK);
+            }
+            ranges[i].size = 4;
+        }
+        ranges[unique].address = 0;
+        ranges[unique].size = 0;
+
+        result = gs_read(data, ranges, NULL);
+        for (i = 0; !result && (i < count); i++) {
+            if ((chains[i].depth > level) && resolved[i]) {
+                found = bsearch(&resolved[i], addresses, unique, sizeof(uint32_t), _ptrscan_compare_u32);
+                resolved[i] = get_be32(&data[(found - addresses) * 4]) + chains[i].offsets[level];
+            }
+        }
+    }
+    result |= gs_exit();
+
+    if (!result) {
+        /* Most common result; chains that end past the installed RDRAM are invalid */
+        for (i = 0, n = 0; i < count; i++) {
+            if ((resolved[i] < MEMMAP_KSEG0) || (resolved[i] >= (MEMMAP_KSEG0 + ram))) {
+                resolved[i] = 0;
+            }
+            if (resolved[i]) {
+                addresses[n++] = resolved[i];
+            }
+        }
+        qsort(addresses, n, sizeof(uint32_t), _ptrscan_compare_u32);
+        for (i = 0, run = 0; i < n; i++) {
+            run = (i && (addresses[i] == addresses[i - 1])) ? (run + 1) : 1;
+            if (run > best) {
+                best = run;
+                *target = addresses[i];
+            }
+        }
+    }
+
+    free(addresses);
+    free(ranges);
+    free(data);
+
+    return result;
+}
+
+/* Scan the comma-separated "capture=target" list; chains start in [base, base + size) */
+int ptrscan_run(char *list, uint32_t base, uint32_t size, uint32_t depth, uint32_t max_offset, char *filename) {
+    PTRSCAN scan;
+    CAPTURE *captures;
+    uint32_t *targets;
+    char *spec;
+    char *save = NULL;
+    char *equals;
+    char *err;
+    uint64_t t;
+    uint32_t i;
+    int count = 1;
+    int opened = 0;
+    int result = 1;
+
+    for (spec = list; *spec; spec++) {
+        if (*spec == ',') count++;
+    }
+    captures = alloc(count * sizeof(CAPTURE));
+    targets = alloc(count * sizeof(uint32_t));
+
+    for (spec = strtok_r(list, ",", &save); spec; spec = strtok_r(NULL, ",", &save)) {
+        equals = strrchr(spec, '=');
+        if (!equals) {
+            fprintf(stderr, "Expected <capture>=<target>\n");
+            parse_error(spec, strlen(spec));
+            goto done;
+        }
+        *equals++ = '\0';
+        targets[opened] = strtoul(equals, &err, 0);
+        if (!*equals || *err) {
+            fprintf(stderr, "Invalid target address\n");
+            parse_error(equals, (err - equals));
+            goto done;
+        }
+
+        /* Raw captures are RDRAM images */
+        if (capture_open(&captures[opened], spec, 0x80000000)) {
+            goto done;
+        }
+        opened++;
+    }
+
+    t = now_ns();
+    if (ptrscan_init(&scan, captures, targets, opened)) {
+        goto done;
+    }
+    scan.depth = depth;
+    scan.max_offset = max_offset;
+    scan.base_start = MAX(scan.base_start, base);
+    if (size) {
+        scan.base_end = MIN(scan.base_end, base + size);
+    }
+    printf("Indexed %u pointers; searching with %d threads...\n", scan.index_count, scan.thread_count);
+
+    ptrscan_search(&scan);
+    t = now_ns() - t;
+
+    for (i = 0; i < MIN(scan.chain_count, PTRSCAN_PRINT); i++) {
+        printf("  ");
+        ptrscan_print(&scan.chains[i]);
+        printf("\n");
+    }
+    if (scan.chain_count > PTRSCAN_PRINT) {
+        printf("  ... %u more\n", scan.chain_count - PTRSCAN_PRINT);
+    }
+    printf("%u chains valid in %d captures (%.3f s)%s\n", scan.chain_count, opened, t / 1e9,
+        scan.truncated ? "; the search was truncated" : "");
+
+    result = (filename && scan.chain_count) ? ptrscan_save(scan.chains, scan.chain_count, filename) : 0;
+    ptrscan_free(&scan);
+
+done:
+    for (i = 0; i < opened; i++) {
+        capture_close(&captures[i]);
+    }
+    free(captures);
+    free(targets);
+
+    return result;
+}
+
+/* Follow the chains in a file through the running game (saving those that agree to `output`) */
+int ptrscan_live(char *filename, uint32_t ram, char *output) {
+    PTRSCAN_CHAIN *chains;
+    uint32_t *resolved;
+    uint32_t count;
+    uint32_t target;
+    uint32_t agree = 0;
+    uint32_t i;
+    int result;
+
+    if (ptrscan_load(filename, &chains, &count)) {
+        return 1;
+    }
+
+    resolved = alloc((count + 1) * sizeof(uint32_t));
+    result = ptrscan_validate(chains, count, ram, resolved, &target);
+
+    if (!result) {
+        for (i = 0; i < count; i++) {
+            printf("  ");
+            ptrscan_print(&chains[i]);
+            if (resolved[i]) {
+                printf(" -> 0x%08X\n", resolved[i]);
+            }
+            else {
+                printf(" -> (invalid pointer)\n");
+            }
+
+            /* Keep the chains that reach the consensus */
+            if (resolved[i] && (resolved[i] == target)) {
+                chains[agree++] = chains[i];
+            }
+        }
+        printf("%u of %u chains lead to 0x%08X\n", agree, count, target);
+
+        if (output && agree) {
+            result = ptrscan_save(chains, agree, output);
+        }
+    }
+
+    free(resolved);
+    free(chains);
+
+    return result;
+}
@@ -0,0 +1,118 @@
+
+#ifndef _PTRSCAN_H_
+#define _PTRSCAN_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "diff.h"
+
+
+/*
+ * Pointer scanning: find chains of pointers that lead from a fixed base
+ * address to a value that moves between sessions. A chain of depth n is
+ * followed as:
+ *
+ *   address = base
+ *   for each offset: address = read32(address) + offset
+ *
+ * The search works backwards from the target in the first capture, through a
+ * reverse index of every word that points into it. A chain is kept only when
+ * it resolves to the matching target in every other capture.
+ *
+ * Chain files are text, one chain per line:
+ *
+ *   # comment
+ *   <base> +<offset> [+<offset> ...]
+ */
+#define PTRSCAN_DEPTH           4       /* Default chain length */
+#define PTRSCAN_DEPTH_MAX       8
+#define PTRSCAN_OFFSET          0x1000  /* Default largest offset */
+#define PTRSCAN_FANOUT          64      /* Pointers followed per node, nearest first */
+#define PTRSCAN_BREADTH         0x40000 /* Nodes kept per level */
+#define PTRSCAN_CHAINS_MAX      0x10000
+#define PTRSCAN_PRINT           32      /* Chains listed after a scan */
+#define PTRSCAN_THREADS_MAX     32
+
+/* One word of the first capture that points into it */
+struct _ptrscan_entry {
+    uint32_t        value;
+    uint32_t        location;
+};
+typedef struct _ptrscan_entry PTRSCAN_ENTRY;
+
+/* A location that leads to the target: read32(location) + offset = parent's location */
+struct _ptrscan_node {
+    uint32_t        location;
+    uint32_t        parent;     /* Index into the previous level */
+    uint32_t        offset;
+};
+typedef struct _ptrscan_node PTRSCAN_NODE;
+
+struct _ptrscan_chain {
+    uint32_t        base;
+    uint32_t        depth;
+    uint32_t        offsets[PTRSCAN_DEPTH_MAX];
+};
+typedef struct _ptrscan_chain PTRSCAN_CHAIN;
+
+/* Results of one worker for one level */
+struct _ptrscan_work {
+    struct _ptrscan *scan;
+    int             id;
+    PTRSCAN_NODE *  nodes;
+    uint32_t        node_count;
+    uint32_t        node_capacity;
+    PTRSCAN_CHAIN * chains;
+    uint32_t        chain_count;
+    uint32_t        chain_capacity;
+};
+typedef struct _ptrscan_work PTRSCAN_WORK;
+
+struct _ptrscan {
+    CAPTURE *       captures;
+    uint32_t *      targets;    /* One per capture */
+    int             count;
+    uint32_t        depth;
+    uint32_t        max_offset;
+    uint32_t        base_start; /* Chains must start in [base_start, base_end) */
+    uint32_t        base_end;
+
+    PTRSCAN_ENTRY * index;      /* Sorted by value, then location */
+    uint32_t        index_count;
+    PTRSCAN_NODE *  levels[PTRSCAN_DEPTH_MAX + 1];
+    uint32_t        level_counts[PTRSCAN_DEPTH_MAX + 1];
+    uint32_t        level;      /* Level being expanded */
+    PTRSCAN_CHAIN * chains;
+    uint32_t        chain_count;
+    bool            truncated;
+
+    /* Worker pool; each pass expands one level */
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    pthread_cond_t  done;
+    pthread_t *     threads;
+    PTRSCAN_WORK *  work;
+    int             thread_count;
+    uint32_t        pass;
+    int             pending;
+    bool            quit;
+};
+typedef struct _ptrscan PTRSCAN;
+
+
+/* Function declarations */
+int ptrscan_init(PTRSCAN *scan, CAPTURE *captures, uint32_t *targets, int count);
+int ptrscan_search(PTRSCAN *scan);
+void ptrscan_free(PTRSCAN *scan);
+bool ptrscan_resolve(CAPTURE *capture, PTRSCAN_CHAIN *chain, uint32_t *address);
+void ptrscan_print(PTRSCAN_CHAIN *chain);
+int ptrscan_save(PTRSCAN_CHAIN *chains, uint32_t count, const char *filename);
+int ptrscan_load(const char *filename, PTRSCAN_CHAIN **chains, uint32_t *count);
+int ptrscan_validate(PTRSCAN_CHAIN *chains, uint32_t count, uint32_t ram, uint32_t *resolved,
+    uint32_t *target);
+int ptrscan_run(char *list, uint32_t base, uint32_t size, uint32_t depth, uint32_t max_offset, char *filename);
+int ptrscan_live(char *filename, uint32_t ram, char *output);
+
+#endif /* _PTRSCAN_H_ */
@@ -0,0 +1,413 @@
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "r4300.h"
+
+
+/* Primary opcodes with a sub-table */
+#define _R4300_SPECIAL  0x00
+#define _R4300_REGIMM   0x01
+#define _R4300_COP0     0x10
+#define _R4300_COP1     0x11
+
+#define _R4300_OP(_name, _format, _flags)   { _name, R4300_F_##_format, _flags }
+
+
+/* Private variables */
+static const R4300_OP _r4300_primary[64] = {
+    [0x02] = _R4300_OP("j",         TARGET,     R4300_JUMP | R4300_END),
+    [0x03] = _R4300_OP("jal",       TARGET,     R4300_JUMP | R4300_LINK),
+    [0x04] = _R4300_OP("beq",       RS_RT_OFF,  R4300_BRANCH),
+    [0x05] = _R4300_OP("bne",       RS_RT_OFF,  R4300_BRANCH),
+    [0x06] = _R4300_OP("blez",      RS_OFF,     R4300_BRANCH),
+    [0x07] = _R4300_OP("bgtz",      RS_OFF,     R4300_BRANCH),
+    [0x08] = _R4300_OP("addi",      RT_RS_IMM,  R4300_WRT | R4300_LO),
+    [0x09] = _R4300_OP("addiu",     RT_RS_IMM,  R4300_WRT | R4300_LO),
+    [0x0A] = _R4300_OP("slti",      RT_RS_IMM,  R4300_WRT),
+    [0x0B] = _R4300_OP("sltiu",     RT_RS_IMM,  R4300_WRT),
+    [0x0C] = _R4300_OP("andi",      RT_RS_IMM,  R4300_WRT),
+    [0x0D] = _R4300_OP("ori",       RT_RS_IMM,  R4300_WRT | R4300_LO),
+    [0x0E] = _R4300_OP("xori",      RT_RS_IMM,  R4300_WRT),
+    [0x0F] = _R4300_OP("lui",       RT_IMM,     R4300_WRT),
+    [0x14] = _R4300_OP("beql",      RS_RT_OFF,  R4300_BRANCH),
+    [0x15] = _R4300_OP("bnel",      RS_RT_OFF,  R4300_BRANCH),
+    [0x16] = _R4300_OP("blezl",     RS_OFF,     R4300_BRANCH),
+    [0x17] = _R4300_OP("bgtzl",     RS_OFF,     R4300_BRANCH),
+    [0x18] = _R4300_OP("daddi",     RT_RS_IMM,  R4300_WRT),
+    [0x19] = _R4300_OP("daddiu",    RT_RS_IMM,  R4300_WRT),
+    [0x1A] = _R4300_OP("ldl",       MEM,        R4300_WRT | R4300_MEM),
+    [0x1B] = _R4300_OP("ldr",       MEM,        R4300_WRT | R4300_MEM),
+    [0x20] = _R4300_OP("lb",        MEM,        R4300_WRT | R4300_MEM),
+    [0x21] = _R4300_OP("lh",        MEM,        R4300_WRT | R4300_MEM),
+    [0x22] = _R4300_OP("lwl",       MEM,        R4300_WRT | R4300_MEM),
+    [0x23] = _R4300_OP("lw",        MEM,        R4300_WRT | R4300_MEM),
+    [0x24] = _R4300_OP("lbu",       MEM,        R4300_WRT | R4300_MEM),
+    [0x25] = _R4300_OP("lhu",       MEM,        R4300_WRT | R4300_MEM),
+    [0x26] = _R4300_OP("lwr",       MEM,        R4300_WRT | R4300_MEM),
+    [0x27] = _R4300_OP("lwu",       MEM,        R4300_WRT | R4300_MEM),
+    [0x28] = _R4300_OP("sb",        MEM,        R4300_MEM),
+    [0x29] = _R4300_OP("sh",        MEM,        R4300_MEM),
+    [0x2A] = _R4300_OP("swl",       MEM,        R4300_MEM),
+    [0x2B] = _R4300_OP("sw",        MEM,        R4300_MEM),
+    [0x2C] = _R4300_OP("sdl",       MEM,        R4300_MEM),
+    [0x2D] = _R4300_OP("sdr",       MEM,        R4300_MEM),
+    [0x2E] = _R4300_OP("swr",       MEM,        R4300_MEM),
+    [0x2F] = _R4300_OP("cache",     MEM,        0),
+    [0x30] = _R4300_OP("ll",        MEM,        R4300_WRT | R4300_MEM),
+    [0x31] = _R4300_OP("lwc1",      FMEM,       R4300_MEM),
+    [0x34] = _R4300_OP("lld",       MEM,        R4300_WRT | R4300_MEM),
+    [0x35] = _R4300_OP("ldc1",      FMEM,       R4300_MEM),
+    [0x37] = _R4300_OP("ld",        MEM,        R4300_WRT | R4300_MEM),
+    [0x38] = _R4300_OP("sc",        MEM,        R4300_WRT | R4300_MEM),
+    [0x39] = _R4300_OP("swc1",      FMEM,       R4300_MEM),
+    [0x3C] = _R4300_OP("scd",       MEM,        R4300_WRT | R4300_MEM),
+    [0x3D] = _R4300_OP("sdc1",      FMEM,       R4300_MEM),
+    [0x3F] = _R4300_OP("sd",        MEM,        R4300_MEM)
+};
+
+/* By funct */
+static const R4300_OP _r4300_special[64] = {
+    [0x00] = _R4300_OP("sll",       RD_RT_SA,   R4300_WRD),
+    [0x02] = _R4300_OP("srl",       RD_RT_SA,   R4300_WRD),
+    [0x03] = _R4300_OP("sra",       RD_RT_SA,   R4300_WRD),
+    [0x04] = _R4300_OP("sllv",      RD_RT_RS,   R4300_WRD),
+    [0x06] = _R4300_OP("srlv",      RD_RT_RS,   R4300_WRD),
+    [0x07] = _R4300_OP("srav",      RD_RT_RS,   R4300_WRD),
+    [0x08] = _R4300_OP("jr",        RS,         R4300_JUMP | R4300_END),
+    [0x09] = _R4300_OP("jalr",      RD_RS,      R4300_JUMP | R4300_LINK | R4300_WRD),
+    [0x0C] = _R4300_OP("syscall",   CODE,       0),
+    [0x0D] = _R4300_OP("break",     CODE,       0),
+    [0x0F] = _R4300_OP("sync",      NONE,       0),
+    [0x10] = _R4300_OP("mfhi",      RD,         R4300_WRD),
+    [0x11] = _R4300_OP("mthi",      RS,         0),
+    [0x12] = _R4300_OP("mflo",      RD,         R4300_WRD),
+    [0x13] = _R4300_OP("mtlo",      RS,         0),
+    [0x14] = _R4300_OP("dsllv",     RD_RT_RS,   R4300_WRD),
+    [0x16] = _R4300_OP("dsrlv",     RD_RT_RS,   R4300_WRD),
+    [0x17] = _R4300_OP("dsrav",     RD_RT_RS,   R4300_WRD),
+    [0x18] = _R4300_OP("mult",      RS_RT,      0),
+    [0x19] = _R4300_OP("multu",     RS_RT,      0),
+    [0x1A] = _R4300_OP("div",       RS_RT,      0),
+    [0x1B] = _R4300_OP("divu",      RS_RT,      0),
+    [0x1C] = _R4300_OP("dmult",     RS_RT,      0),
+    [0x1D] = _R4300_OP("dmultu",    RS_RT,      0),
+    [0x1E] = _R4300_OP("ddiv",      RS_RT,      0),
+    [0x1F] = _R4300_OP("ddivu",     RS_RT,      0),
+    [0x20] = _R4300_OP("add",       RD_RS_RT,   R4300_WRD),
+    [0x21] = _R4300_OP("addu",      RD_RS_RT,   R4300_WRD),
+    [0x22] = _R4300_OP("sub",       RD_RS_RT,   R4300_WRD),
+    [0x23] = _R4300_OP("subu",      RD_RS_RT,   R4300_WRD),
+    [0x24] = _R4300_OP("and",       RD_RS_RT,   R4300_WRD),
+    [0x25] = _R4300_OP("or",        RD_RS_RT,   R4300_WRD),
+    [0x26] = _R4300_OP("xor",       RD_RS_RT,   R4300_WRD),
+    [0x27] = _R4300_OP("nor",       RD_RS_RT,   R4300_WRD),
+    [0x2A] = _R4300_OP("slt",       RD_RS_RT,   R4300_WRD),
+    [0x2B] = _R4300_OP("sltu",      RD_RS_RT,   R4300_WRD),
+    [0x2C] = _R4300_OP("dadd",      RD_RS_RT,   R4300_WRD),
+    [0x2D] = _R4300_OP("daddu",     RD_RS_RT,   R4300_WRD),
+    [0x2E] = _R4300_OP("dsub",      RD_RS_RT,   R4300_WRD),
+    [0x2F] = _R4300_OP("dsubu",     RD_RS_RT,   R4300_WRD),
+    [0x30] = _R4300_OP("tge",       RS_RT,      0),
+    [0x31] = _R4300_OP("tgeu",      RS_RT,      0),
+    [0x32] = _R4300_OP("tlt",       RS_RT,      0),
+    [0x33] = _R4300_OP("tltu",      RS_RT,      0),
+    [0x34] = _R4300_OP("teq",       RS_RT,      0),
+    [0x36] = _R4300_OP("tne",       RS_RT,      0),
+    [0x38] = _R4300_OP("dsll",      RD_RT_SA,   R4300_WRD),
+    [0x3A] = _R4300_OP("dsrl",      RD_RT_SA,   R4300_WRD),
+    [0x3B] = _R4300_OP("dsra",      RD_RT_SA,   R4300_WRD),
+    [0x3C] = _R4300_OP("dsll32",    RD_RT_SA,   R4300_WRD),
+    [0x3E] = _R4300_OP("dsrl32",    RD_RT_SA,   R4300_WRD),
+    [0x3F] = _R4300_OP("dsra32",    RD_RT_SA,   R4300_WRD)
+};
+
+/* By rt */
+static const R4300_OP _r4300_regimm[32] = {
+    [0x00] = _R4300_OP("bltz",      RS_OFF,     R4300_BRANCH),
+    [0x01] = _R4300_OP("bgez",      RS_OFF,     R4300_BRANCH),
+    [0x02] = _R4300_OP("bltzl",     RS_OFF,     R4300_BRANCH),
+    [0x03] = _R4300_OP("bgezl",     RS_OFF,     R4300_BRANCH),
+    [0x08] = _R4300_OP("tgei",      RS_IMM,     0),
+    [0x09] = _R4300_OP("tgeiu",     RS_IMM,     0),
+    [0x0A] = _R4300_OP("tlti",      RS_IMM,     0),
+    [0x0B] = _R4300_OP("tltiu",     RS_IMM,     0),
+    [0x0C] = _R4300_OP("teqi",      RS_IMM,     0),
+    [0x0E] = _R4300_OP("tnei",      RS_IMM,     0),
+    [0x10] = _R4300_OP("bltzal",    RS_OFF,     R4300_BRANCH | R4300_LINK),
+    [0x11] = _R4300_OP("bgezal",    RS_OFF,     R4300_BRANCH | R4300_LINK),
+    [0x12] = _R4300_OP("bltzall",   RS_OFF,     R4300_BRANCH | R4300_LINK),
+    [0x13] = _R4300_OP("bgezall",   RS_OFF,     R4300_BRANCH | R4300_LINK)
+};
+
+/* COP0 by rs, then CO operations by funct */
+static const R4300_OP _r4300_cop0[32] = {
+    [0x00] = _R4300_OP("mfc0",      RT_CS,      R4300_WRT),
+    [0x01] = _R4300_OP("dmfc0",     RT_CS,      R4300_WRT),
+    [0x04] = _R4300_OP("mtc0",      RT_CS,      0),
+    [0x05] = _R4300_OP("dmtc0",     RT_CS,      0)
+};
+
+static const R4300_OP _r4300_cop0_co[64] = {
+    [0x01] = _R4300_OP("tlbr",      NONE,       0),
+    [0x02] = _R4300_OP("tlbwi",     NONE,       0),
+    [0x06] = _R4300_OP("tlbwr",     NONE,       0),
+    [0x08] = _R4300_OP("tlbp",      NONE,       0),
+    [0x18] = _R4300_OP("eret",      NONE,       R4300_END)
+};
+
+/* COP1 by rs, BC1 by rt, then arithmetic by funct (suffixed with the format) */
+static const R4300_OP _r4300_cop1[32] = {
+    [0x00] = _R4300_OP("mfc1",      RT_FS,      R4300_WRT),
+    [0x01] = _R4300_OP("dmfc1",     RT_FS,      R4300_WRT),
+    [0x02] = _R4300_OP("cfc1",      RT_FS,      R4300_WRT),
+    [0x04] = _R4300_OP("mtc1",      RT_FS,      0),
+    [0x05] = _R4300_OP("dmtc1",     RT_FS,      0),
+    [0x06] = _R4300_OP("ctc1",      RT_FS,      0)
+};
+
+static const R4300_OP _r4300_bc1[4] = {
+    _R4300_OP("bc1f",   OFF,    R4300_BRANCH),
+    _R4300_OP("bc1t",   OFF,    R4300_BRANCH),
+    _R4300_OP("bc1fl",  OFF,    R4300_BRANCH),
+    _R4300_OP("bc1tl",  OFF,    R4300_BRANCH)
+};
+
+static const R4300_OP _r4300_fpu[64] = {
+    [0x00] = _R4300_OP("add",       FD_FS_FT,   0),
+    [0x01] = _R4300_OP("sub",       FD_FS_FT,   0),
+    [0x02] = _R4300_OP("mul",       FD_FS_FT,   0),
+    [0x03] = _R4300_OP("div",       FD_FS_FT,   0),
+    [0x04] = _R4300_OP("sqrt",      FD_FS,      0),
+    [0x05] = _R4300_OP("abs",       FD_FS,      0),
+    [0x06] = _R4300_OP("mov",       FD_FS,      0),
+    [0x07] = _R4300_OP("neg",       FD_FS,      0),
+    [0x08] = _R4300_OP("round.l",   FD_FS,      0),
+    [0x09] = _R4300_OP("trunc.l",   FD_FS,      0),
+    [0x0A] = _R4300_OP("ceil.l",    FD_FS,      0),
+    [0x0B] = _R4300_OP("floor.l",   FD_FS,      0),
+    [0x0C] = _R4300_OP("round.w",   FD_FS,      0),
+    [0x0D] = _R4300_OP("trunc.w",   FD_FS,      0),
+    [0x0E] = _R4300_OP("ceil.w",    FD_FS,      0),
+    [0x0F] = _R4300_OP("floor.w",   FD_FS,      0),
+    [0x20] = _R4300_OP("cvt.s",     FD_FS,      0),
+    [0x21] = _R4300_OP("cvt.d",     FD_FS,      0),
+    [0x24] = _R4300_OP("cvt.w",     FD_FS,      0),
+    [0x25] = _R4300_OP("cvt.l",     FD_FS,      0),
+    [0x30] = _R4300_OP("c.f",       FS_FT,      0),
+    [0x31] = _R4300_OP("c.un",      FS_FT,      0),
+    [0x32] = _R4300_OP("c.eq",      FS_FT,      0),
+    [0x33] = _R4300_OP("c.ueq",     FS_FT,      0),
+    [0x34] = _R4300_OP("c.olt",     FS_FT,      0),
+    [0x35] = _R4300_OP("c.ult",     FS_FT,      0),
+    [0x36] = _R4300_OP("c.ole",     FS_FT,      0),
+    [0x37] = _R4300_OP("c.ule",     FS_FT,      0),
+    [0x38] = _R4300_OP("c.sf",      FS_FT,      0),
+    [0x39] = _R4300_OP("c.ngle",    FS_FT,      0),
+    [0x3A] = _R4300_OP("c.seq",     FS_FT,      0),
+    [0x3B] = _R4300_OP("c.ngl",     FS_FT,      0),
+    [0x3C] = _R4300_OP("c.lt",      FS_FT,      0),
+    [0x3D] = _R4300_OP("c.nge",     FS_FT,      0),
+    [0x3E] = _R4300_OP("c.le",      FS_FT,      0),
+    [0x3F] = _R4300_OP("c.ngt",     FS_FT,      0)
+};
+
+/* FPU formats by rs: S, D, W, L */
+static const char _r4300_fmt[32] = {
+    [0x10] = 's',
+    [0x11] = 'd',
+    [0x14] = 'w',
+    [0x15] = 'l'
+};
+
+static const char *_r4300_gpr[32] = {
+    "zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+    "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+    "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+    "t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra"
+};
+
+
+/* Public functions */
+
+/* Look up an instruction; NULL when the word is not a valid R4300 instruction */
+const R4300_OP *r4300_decode(uint32_t word) {
+    const R4300_OP *op;
+    uint32_t rs = R4300_RS(word);
+
+    switch (R4300_OPCODE(word)) {
+        case _R4300_SPECIAL:
+            op = &_r4300_special[R4300_FUNCT(word)];
+            break;
+
+        case _R4300_REGIMM:
+            op = &_r4300_regimm[R4300_RT(word)];
+            break;
+
+        case _R4300_COP0:
+            op = (rs == 0x10) ? &_r4300_cop0_co[R4300_FUNCT(word)] : &_r4300_cop0[rs];
+            break;
+
+        case _R4300_COP1:
+            if (rs == 0x08) {
+                op = &_r4300_bc1[R4300_RT(word) & 3];
+            }
+            else if (_r4300_fmt[rs]) {
+                op = &_r4300_fpu[R4300_FUNCT(word)];
+            }
+            else {
+                op = &_r4300_cop1[rs];
+            }
+            break;
+
+        default:
+            op = &_r4300_primary[R4300_OPCODE(word)];
+            break;
+    }
+
+    return op->name ? op : NULL;
+}
+
+/* Branch or j / jal destination of the instruction at `pc`; 0 for others */
+uint32_t r4300_target(uint32_t word, const R4300_OP *op, uint32_t pc) {
+    if (op->flags & R4300_BRANCH) {
+        return pc + 4 + (R4300_IMM(word) * 4);
+    }
+    if (op->format == R4300_F_TARGET) {
+        return ((pc + 4) & 0xF0000000) | ((word & 0x03FFFFFF) << 2);
+    }
+
+    return 0;
+}
+
+/* Disassemble one instruction, e.g. "lw      t0, -0x4E54(at)" */
+void r4300_disasm(uint32_t word, uint32_t pc, char *out, size_t size) {
+    const R4300_OP *op = r4300_decode(word);
+    const char *rs;
+    const char *rt;
+    const char *rd;
+    char name[16];
+    int16_t imm = R4300_IMM(word);
+    uint32_t opcode = R4300_OPCODE(word);
+
+    if (!op) {
+        snprintf(out, size, ".word   0x%08X", word);
+        return;
+    }
+    if (!word) {
+        snprintf(out, size, "nop");
+        return;
+    }
+
+    rs = _r4300_gpr[R4300_RS(word)];
+    rt = _r4300_gpr[R4300_RT(word)];
+    rd = _r4300_gpr[R4300_RD(word)];
+
+    if ((opcode == _R4300_COP1) && _r4300_fmt[R4300_RS(word)]) {
+        snprintf(name, sizeof(name), "%s.%c", op->name, _r4300_fmt[R4300_RS(word)]);
+    }
+    else {
+        snprintf(name, sizeof(name), "%s", op->name);
+    }
+
+    switch (op->format) {
+        case R4300_F_RD_RS_RT:
+            snprintf(out, size, "%-7s %s, %s, %s", name, rd, rs, rt);
+            break;
+
+        case R4300_F_RD_RT_SA:
+            snprintf(out, size, "%-7s %s, %s, %u", name, rd, rt, R4300_SA(word));
+            break;
+
+        case R4300_F_RD_RT_RS:
+            snprintf(out, size, "%-7s %s, %s, %s", name, rd, rt, rs);
+            break;
+
+        case R4300_F_RS:
+            snprintf(out, size, "%-7s %s", name, rs);
+            break;
+
+        case R4300_F_RD:
+            snprintf(out, size, "%-7s %s", name, rd);
+            break;
+
+        case R4300_F_RD_RS:
+            snprintf(out, size, "%-7s %s, %s", name, rd, rs);
+            break;
+
+        case R4300_F_RS_RT:
+            snprintf(out, size, "%-7s %s, %s", name, rs, rt);
+            break;
+
+        case R4300_F_RT_RS_IMM:
+            /* Logical operations take an unsigned immediate */
+            if ((opcode >= 0x0C) && (opcode <= 0x0E)) {
+                snprintf(out, size, "%-7s %s, %s, 0x%X", name, rt, rs, R4300_UIMM(word));
+            }
+            else {
+                snprintf(out, size, "%-7s %s, %s, %s0x%X", name, rt, rs,
+                    (imm < 0) ? "-" : "", abs(imm));
+            }
+            break;
+
+        case R4300_F_RT_IMM:
+            snprintf(out, size, "%-7s %s, 0x%X", name, rt, R4300_UIMM(word));
+            break;
+
+        case R4300_F_MEM:
+            snprintf(out, size, "%-7s %s, %s0x%X(%s)", name, rt, (imm < 0) ? "-" : "", abs(imm), rs);
+            break;
+
+        case R4300_F_FMEM:
+            snprintf(out, size, "%-7s f%u, %s0x%X(%s)", name, R4300_RT(word), (imm < 0) ? "-" : "",
+                abs(imm), rs);
+            break;
+
+        case R4300_F_RS_RT_OFF:
+            snprintf(out, size, "%-7s %s, %s, 0x%08X", name, rs, rt, r4300_target(word, op, pc));
+            break;
+
+        case R4300_F_RS_OFF:
+            snprintf(out, size, "%-7s %s, 0x%08X", name, rs, r4300_target(word, op, pc));
+            break;
+
+        case R4300_F_OFF:
+        case R4300_F_TARGET:
+            snprintf(out, size, "%-7s 0x%08X", name, r4300_target(word, op, pc));
+            break;
+
+        case R4300_F_RS_IMM:
+            snprintf(out, size, "%-7s %s, %s0x%X", name, rs, (imm < 0) ? "-" : "", abs(imm));
+            break;
+
+        case R4300_F_RT_FS:
+            snprintf(out, size, "%-7s %s, f%u", name, rt, R4300_RD(word));
+            break;
+
+        case R4300_F_RT_CS:
+            snprintf(out, size, "%-7s %s, $%u", name, rt, R4300_RD(word));
+            break;
+
+        case R4300_F_FD_FS_FT:
+            snprintf(out, size, "%-7s f%u, f%u, f%u", name, R4300_SA(word), R4300_RD(word), R4300_RT(word));
+            break;
+
+        case R4300_F_FD_FS:
+            snprintf(out, size, "%-7s f%u, f%u", name, R4300_SA(word), R4300_RD(word));
+            break;
+
+        case R4300_F_FS_FT:
+            snprintf(out, size, "%-7s f%u, f%u", name, R4300_RD(word), R4300_RT(word));
+            break;
+
+        case R4300_F_CODE:
+            snprintf(out, size, "%-7s 0x%X", name, (word >> 6) & 0xFFFFF);
+            break;
+
+        default:
+            snprintf(out, size, "%s", name);
+            break;
+    }
+}
@@ -0,0 +1,71 @@
+
+#ifndef _R4300_H_
+#define _R4300_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* Instruction fields */
+#define R4300_OPCODE(_w)    (((_w) >> 26) & 0x3F)
+#define R4300_RS(_w)        (((_w) >> 21) & 0x1F)
+#define R4300_RT(_w)        (((_w) >> 16) & 0x1F)
+#define R4300_RD(_w)        (((_w) >> 11) & 0x1F)
+#define R4300_SA(_w)        (((_w) >> 6) & 0x1F)
+#define R4300_FUNCT(_w)     ((_w) & 0x3F)
+#define R4300_IMM(_w)       ((int16_t)((_w) & 0xFFFF))
+#define R4300_UIMM(_w)      ((_w) & 0xFFFF)
+
+/* What an instruction does, for analysis */
+enum _r4300_flags {
+    R4300_WRT       = 0x01, /* Writes rt */
+    R4300_WRD       = 0x02, /* Writes rd */
+    R4300_MEM       = 0x04, /* Loads or stores at imm(rs) */
+    R4300_LO        = 0x08, /* rt = rs + imm, or rs | imm: the low half of an address */
+    R4300_BRANCH    = 0x10, /* PC-relative */
+    R4300_JUMP      = 0x20, /* j / jal target, or jr / jalr */
+    R4300_LINK      = 0x40, /* Saves a return address */
+    R4300_END       = 0x80  /* Ends a block after its delay slot (j, jr, eret) */
+};
+
+/* Operand layouts, for disassembly */
+enum _r4300_formats {
+    R4300_F_NONE = 0,
+    R4300_F_RD_RS_RT,
+    R4300_F_RD_RT_SA,
+    R4300_F_RD_RT_RS,
+    R4300_F_RS,
+    R4300_F_RD,
+    R4300_F_RD_RS,
+    R4300_F_RS_RT,
+    R4300_F_RT_RS_IMM,
+    R4300_F_RT_IMM,
+    R4300_F_MEM,
+    R4300_F_FMEM,
+    R4300_F_RS_RT_OFF,
+    R4300_F_RS_OFF,
+    R4300_F_OFF,
+    R4300_F_TARGET,
+    R4300_F_RS_IMM,
+    R4300_F_RT_FS,
+    R4300_F_RT_CS,
+    R4300_F_FD_FS_FT,
+    R4300_F_FD_FS,
+    R4300_F_FS_FT,
+    R4300_F_CODE
+};
+
+struct _r4300_op {
+    const char *    name;
+    uint8_t         format;
+    uint8_t         flags;
+};
+typedef struct _r4300_op R4300_OP;
+
+
+/* Function declarations */
+const R4300_OP *r4300_decode(uint32_t word);
+uint32_t r4300_target(uint32_t word, const R4300_OP *op, uint32_t pc);
+void r4300_disasm(uint32_t word, uint32_t pc, char *out, size_t size);
+
+#endif /* _R4300_H_ */
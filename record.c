@@ -0,0 +1,255 @@
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gspro.h"
+#include "n64rd.h"
+#include "record.h"
+
+
+/* Recorder state; wraps whatever transport the config already had */
+struct _recorder {
+    FILE *      fp;
+    uint8_t     (*in)(uint16_t);
+    void        (*out)(uint8_t, uint16_t);
+    bool        strobe;
+    bool        got;
+    uint8_t     sent;
+    uint64_t    strobe_time;
+    uint64_t    events;
+};
+
+/* Replay state; stands in for the port */
+struct _replayer {
+    uint8_t *   map;
+    size_t      map_size;
+    size_t      pos;
+    bool        realtime;
+    bool        strobe;
+    bool        ready;
+    uint8_t     status;
+    uint64_t    ready_time;
+    REPLAY_STATS stats;
+};
+
+
+/* Private variables */
+static struct _recorder _rec = { 0 };
+static struct _replayer _rep = { 0 };
+
+
+/* Private function declarations */
+uint8_t _record_in(uint16_t port);
+void _record_out(uint8_t data, uint16_t port);
+uint8_t _replay_in(uint16_t port);
+void _replay_out(uint8_t data, uint16_t port);
+
+
+/* Private functions */
+
+uint8_t _record_in(uint16_t port) {
+    uint8_t data = _rec.in(port);
+    uint64_t latency;
+
+    /* First ready status after a strobe carries the device's nybble */
+    if (_rec.strobe && !_rec.got && (data & 0x08)) {
+        _rec.got = true;
+        latency = (now_ns() - _rec.strobe_time) / 100;
+
+        fputc((_rec.sent << 4) | ((data >> 4) ^ 0x08), _rec.fp);
+        do {
+            fputc((latency & 0x7F) | ((latency > 0x7F) ? 0x80 : 0), _rec.fp);
+            latency >>= 7;
+        } while (latency);
+        _rec.events++;
+    }
+
+    return data;
+}
+
+void _record_out(uint8_t data, uint16_t port) {
+    if ((data & 0x10) && !_rec.strobe) {
+        _rec.strobe = true;
+        _rec.got = false;
+        _rec.sent = data & 0x0F;
+        _rec.strobe_time = now_ns();
+    }
+    else if (!(data & 0x10)) {
+        _rec.strobe = false;
+    }
+
+    _rec.out(data, port);
+}
+
+uint8_t _replay_in(uint16_t port) {
+    if (!_rep.ready) {
+        return 0;
+    }
+    if (_rep.realtime && (now_ns() < _rep.ready_time)) {
+        return 0;
+    }
+
+    return _rep.status;
+}
+
+void _replay_out(uint8_t data, uint16_t port) {
+    uint64_t latency = 0;
+    uint8_t event;
+    int shift = 0;
+
+    if (!(data & 0x10)) {
+        _rep.strobe = false;
+        _rep.ready = false;
+        return;
+    }
+    if (_rep.strobe) {
+        return;
+    }
+    _rep.strobe = true;
+
+    /* Past the end of the recording the device never answers */
+    if (_rep.pos >= _rep.map_size) {
+        return;
+    }
+
+    event = _rep.map[_rep.pos++];
+    while (_rep.pos < _rep.map_size) {
+        uint8_t b = _rep.map[_rep.pos++];
+
+        latency |= (uint64_t)(b & 0x7F) << shift;
+        shift += 7;
+        if (!(b & 0x80)) {
+            break;
+        }
+    }
+
+    if ((event >> 4) != (data & 0x0F)) {
+        _rep.stats.mismatches++;
+    }
+    _rep.stats.played++;
+    _rep.stats.recorded_ns += latency * 100;
+
+    _rep.status = (((event & 0x0F) ^ 0x08) << 4) | 0x08;
+    _rep.ready = true;
+    if (_rep.realtime) {
+        _rep.ready_time = now_ns() + (latency * 100);
+    }
+}
+
+
+/* Public functions */
+
+/* Record every nybble exchanged through `config` (the port, if it has no callbacks) */
+int record_open(const char *filename, GS_CONFIG *config) {
+    uint8_t header[8] = { 0 };
+
+    memset(&_rec, 0, sizeof(_rec));
+    _rec.fp = fopen(filename, "wb");
+    if (!_rec.fp) {
+        fprintf(stderr, "Unable to open `%s` for writing\n", filename);
+        return 1;
+    }
+    setvbuf(_rec.fp, NULL, _IOFBF, 0x10000);
+
+    memcpy(header, RECORD_MAGIC, 4);
+    put_le16(&header[4], RECORD_VERSION);
+    fwrite(header, sizeof(header), 1, _rec.fp);
+
+    _rec.in = config->in_callback ? config->in_callback : gs_port_in;
+    _rec.out = config->out_callback ? config->out_callback : gs_port_out;
+    config->in_callback = _record_in;
+    config->out_callback = _record_out;
+    config->stock_only = true;
+
+    return 0;
+}
+
+int record_close(void) {
+    int result = 0;
+
+    if (_rec.fp) {
+        result = ferror(_rec.fp);
+        result |= fclose(_rec.fp);
+        if (result) {
+            fprintf(stderr, "%s\n", "Error writing session recording");
+        }
+        DEBUGPRINT("Recorded %llu exchanges\n", (unsigned long long)_rec.events);
+    }
+    _rec.fp = NULL;
+
+    return result;
+}
+
+/* Replace the port with a recording; `realtime` reproduces device latency */
+int replay_open(const char *filename, bool realtime, GS_CONFIG *config) {
+    struct stat st;
+    int fd;
+
+    memset(&_rep, 0, sizeof(_rep));
+
+    fd = open(filename, O_RDONLY);
+    if ((fd == -1) || fstat(fd, &st) || (st.st_size < 8)) {
+        fprintf(stderr, "Unable to open recording `%s`\n", filename);
+        if (fd != -1) close(fd);
+        return 1;
+    }
+    _rep.map_size = st.st_size;
+    _rep.map = mmap(NULL, _rep.map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (_rep.map == MAP_FAILED) {
+        _rep.map = NULL;
+        return 1;
+    }
+    if (memcmp(_rep.map, RECORD_MAGIC, 4) || (get_le16(&_rep.map[4]) != RECORD_VERSION)) {
+        fprintf(stderr, "`%s` is not a session recording\n", filename);
+        munmap(_rep.map, _rep.map_size);
+        _rep.map = NULL;
+        return 1;
+    }
+
+    _rep.realtime = realtime;
+    replay_rewind();
+
+    config->in_callback = _replay_in;
+    config->out_callback = _replay_out;
+    config->virtual_port = true;
+    config->stock_only = true;
+
+    return 0;
+}
+
+/* Start again from the first exchange */
+void replay_rewind(void) {
+    size_t pos;
+
+    _rep.pos = 8;
+    _rep.strobe = false;
+    _rep.ready = false;
+    memset(&_rep.stats, 0, sizeof(_rep.stats));
+
+    /* Count events: one nybble byte, then a varint */
+    for (pos = 8; pos < _rep.map_size; ) {
+        pos++;
+        while ((pos < _rep.map_size) && (_rep.map[pos++] & 0x80));
+        _rep.stats.events++;
+    }
+}
+
+/* Unmap the recording; returns non-zero if the host diverged from it */
+int replay_close(REPLAY_STATS *stats) {
+    if (stats) {
+        *stats = _rep.stats;
+    }
+    if (_rep.map) {
+        munmap(_rep.map, _rep.map_size);
+    }
+    _rep.map = NULL;
+
+    return (_rep.stats.mismatches != 0);
+}
@@ -0,0 +1,49 @@
+
+#ifndef _RECORD_H_
+#define _RECORD_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gspro.h"
+
+
+/*
+ * Session recording format:
+ *
+ *   Header:  "N64R", version (u16, little-endian), reserved (u16).
+ *   Events:  one per nybble exchange:
+ *              (host nybble << 4) | device nybble   (one byte)
+ *              strobe-to-ready latency in 100ns units (LEB128 varint)
+ *
+ * Only the exchanged nybbles and the device latency are kept, not each status
+ * poll. A replay therefore stays in step with host code that polls more or
+ * less often than the recorded build did. A divergence shows up as host
+ * nybbles that differ from the recording.
+ *
+ * Only the stock protocol's exchanges (rising strobe, ready on STAT bit 3
+ * set) are understood. The fast stub exchanges on both edges and would be
+ * half lost, so recording and replay mark the config stock_only, and
+ * gs_fast_start() refuses to run over it.
+ */
+#define RECORD_MAGIC "N64R"
+#define RECORD_VERSION 1
+
+/* Replay counters */
+struct _replay_stats {
+    uint64_t    events;
+    uint64_t    played;
+    uint64_t    mismatches;
+    uint64_t    recorded_ns;    /* Sum of recorded device latency */
+};
+typedef struct _replay_stats REPLAY_STATS;
+
+
+/* Function declarations */
+int record_open(const char *filename, GS_CONFIG *config);
+int record_close(void);
+int replay_open(const char *filename, bool realtime, GS_CONFIG *config);
+int replay_close(REPLAY_STATS *stats);
+void replay_rewind(void);
+
+#endif /* _RECORD_H_ */
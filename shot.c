@@ -0,0 +1,638 @@
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define _SHOT_X86
+    #include <immintrin.h>
+#endif /* defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) */
+
+#include "gspro.h"
+#include "stream.h"
+#include "n64rd.h"
+#include "memmap.h"
+#include "shot.h"
+
+
+/* Kernel: convert one line of big-endian pixels to RGBA */
+typedef void (*SHOT_KERNEL)(uint8_t *rgba, const uint8_t *line, uint32_t width, uint8_t depth);
+
+
+/* Private variables */
+static SHOT_KERNEL _shot_kernel = NULL;
+static volatile sig_atomic_t _shot_stop = 0;
+
+
+/* Private function declarations */
+void _shot_signal(int sig);
+void _shot_convert_scalar(uint8_t *rgba, const uint8_t *line, uint32_t width, uint8_t depth);
+#if defined(_SHOT_X86)
+void _shot_convert_sse2(uint8_t *rgba, const uint8_t *line, uint32_t width, uint8_t depth);
+void _shot_convert_avx2(uint8_t *rgba, const uint8_t *line, uint32_t width, uint8_t depth);
+#endif /* defined(_SHOT_X86) */
+SHOT_KERNEL _shot_select(const char **name);
+int _shot_open(SHOT *shot);
+int _shot_row(SHOT *shot, const uint8_t *line);
+int _shot_close(SHOT *shot);
+#if defined(HAS_ZLIB_H)
+void _shot_png_chunk(FILE *fp, const char *type, const uint8_t *data, uint32_t size);
+int _shot_png_deflate(SHOT_OUTPUT *out, int flush);
+#endif /* defined(HAS_ZLIB_H) */
+int _shot_sink_write(GS_SINK *sink, const uint8_t *buf, size_t size);
+int _shot_origin(uint32_t *address);
+uint32_t _shot_changed(SHOT *shot, GS_RANGE *ranges);
+
+
+/* Private functions */
+
+void _shot_signal(int sig) {
+    _shot_stop = 1;
+}
+
+/* Portable fallback: one pixel at a time; the coverage bit is not alpha, so A is opaque */
+void _shot_convert_scalar(uint8_t *rgba, const uint8_t *line, uint32_t width, uint8_t depth) {
+    uint32_t i;
+    uint16_t p;
+    uint8_t r, g, b;
+
+    if (depth == 4) {
+        for (i = 0; i < width; i++) {
+            rgba[(i * 4) + 0] = line[(i * 4) + 0];
+            rgba[(i * 4) + 1] = line[(i * 4) + 1];
+            rgba[(i * 4) + 2] = line[(i * 4) + 2];
+            rgba[(i * 4) + 3] = 0xFF;
+        }
+        return;
+    }
+
+    for (i = 0; i < width; i++) {
+        p = (line[i * 2] << 8) | line[(i * 2) + 1];
+        r = (p >> 11) & 0x1F;
+        g = (p >> 6) & 0x1F;
+        b = (p >> 1) & 0x1F;
+        rgba[(i * 4) + 0] = (r << 3) | (r >> 2);
+        rgba[(i * 4) + 1] = (g << 3) | (g >> 2);
+        rgba[(i * 4) + 2] = (b << 3) | (b >> 2);
+        rgba[(i * 4) + 3] = 0xFF;
+    }
+}
+
+#if defined(_SHOT_X86)
+/* Eight RGBA5551 pixels, or four RGBA8888 pixels, per iteration */
+__attribute__((target("sse2")))
+void _shot_convert_sse2(uint8_t *rgba, const uint8_t *line, uint32_t width, uint8_t depth) {
+    const __m128i m5 = _mm_set1_epi16(0x1F);
+    const __m128i alpha16 = _mm_set1_epi16((short)0xFF00);
+    const __m128i alpha32 = _mm_set1_epi32((int)0xFF000000);
+    __m128i p, r, g, b;
+    uint32_t i = 0;
+
+    if (depth == 4) {
+        for (; (i + 4) <= width; i += 4) {
+            p = _mm_loadu_si128((const __m128i *)&line[i * 4]);
+            _mm_storeu_si128((__m128i *)&rgba[i * 4], _mm_or_si128(p, alpha32));
+        }
+    }
+    else {
+        for (; (i + 8) <= width; i += 8) {
+            p = _mm_loadu_si128((const __m128i *)&line[i * 2]);
+            p = _mm_or_si128(_mm_slli_epi16(p, 8), _mm_srli_epi16(p, 8));
+
+            r = _mm_srli_epi16(p, 11);
+            g = _mm_and_si128(_mm_srli_epi16(p, 6), m5);
+            b = _mm_and_si128(_mm_srli_epi16(p, 1), m5);
+            r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+            g = _mm_or_si128(_mm_slli_epi16(g, 3), _mm_srli_epi16(g, 2));
+            b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+
+            /* R | G << 8 and B | A << 8, interleaved into RGBA */
+            r = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+            b = _mm_or_si128(b, alpha16);
+            _mm_storeu_si128((__m128i *)&rgba[i * 4], _mm_unpacklo_epi16(r, b));
+            _mm_storeu_si128((__m128i *)&rgba[(i * 4) + 16], _mm_unpackhi_epi16(r, b));
+        }
+    }
+
+    _shot_convert_scalar(&rgba[i * 4], &line[i * depth], width - i, depth);
+}
+
+/* As SSE2, twice as wide; unpacking is per 128-bit lane, so the halves are reordered */
+__attribute__((target("avx2")))
+void _shot_convert_avx2(uint8_t *rgba, const uint8_t *line, uint32_t width, uint8_t depth) {
+    const __m256i m5 = _mm256_set1_epi16(0x1F);
+    const __m256i alpha16 = _mm256_set1_epi16((short)0xFF00);
+    const __m256i alpha32 = _mm256_set1_epi32((int)0xFF000000);
+    __m256i p, r, g, b, lo, hi;
+    uint32_t i = 0;
+
+    if (depth == 4) {
+        for (; (i + 8) <= width; i += 8) {
+            p = _mm256_loadu_si256((const __m256i *)&line[i * 4]);
+            _mm256_storeu_si256((__m256i *)&rgba[i * 4], _mm256_or_si256(p, alpha32));
+        }
+    }
+    else {
+        for (; (i + 16) <= width; i += 16) {
+            p = _mm256_loadu_si256((const __m256i *)&line[i * 2]);
+            p = _mm256_or_si256(_mm256_slli_epi16(p, 8), _mm256_srli_epi16(p, 8));
+
+            r = _mm256_srli_epi16(p, 11);
+            g = _mm256_and_si256(_mm256_srli_epi16(p, 6), m5);
+            b = _mm256_and_si256(_mm256_srli_epi16(p, 1), m5);
+            r = _mm256_or_si256(_mm256_slli_epi16(r, 3), _mm256_srli_epi16(r, 2));
+            g = _mm256_or_si256(_mm256_slli_epi16(g, 3), _mm256_srli_epi16(g, 2));
+            b = _mm256_or_si256(_mm256_slli_epi16(b, 3), _mm256_srli_epi16(b, 2));
+
+            r = _mm256_or_si256(r, _mm256_slli_epi16(g, 8));
+            b = _mm256_or_si256(b, alpha16);
+            lo = _mm256_unpacklo_epi16(r, b);
+            hi = _mm256_unpackhi_epi16(r, b);
+            _mm256_storeu_si256((__m256i *)&rgba[i * 4], _mm256_permute2x128_si256(lo, hi, 0x20));
+            _mm256_storeu_si256((__m256i *)&rgba[(i * 4) + 32], _mm256_permute2x128_si256(lo, hi, 0x31));
+        }
+    }
+
+    _shot_convert_sse2(&rgba[i * 4], &line[i * depth], width - i, depth);
+}
+#endif /* defined(_SHOT_X86) */
+
+/* Pick the widest kernel this CPU supports */
+SHOT_KERNEL _shot_select(const char **name) {
+    #if defined(_SHOT_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            *name = "avx2";
+            return _shot_convert_avx2;
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            *name = "sse2";
+            return _shot_convert_sse2;
+        }
+    #endif /* defined(_SHOT_X86) */
+
+    *name = "scalar";
+
+    return _shot_convert_scalar;
+}
+
+/* Start writing a frame */
+int _shot_open(SHOT *shot) {
+    SHOT_OUTPUT *out = &shot->out;
+    char *name;
+    const char *ext;
+    #if defined(HAS_ZLIB_H)
+        uint8_t ihdr[13] = { 0 };
+        static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    #endif /* defined(HAS_ZLIB_H) */
+
+    if (!out->png) {
+        return 0;
+    }
+
+    /* "shot.png" becomes "shot-0001.png" */
+    name = alloc(strlen(shot->filename) + 16);
+    if (shot->numbered) {
+        ext = &shot->filename[strlen(shot->filename) - 4];
+        sprintf(name, "%.*s-%04u%s", (int)(ext - shot->filename), shot->filename, shot->frames + 1, ext);
+    }
+    else {
+        strcpy(name, shot->filename);
+    }
+
+    out->fp = fopen(name, "wb");
+    if (!out->fp) {
+        fprintf(stderr, "Unable to open `%s` for writing\n", name);
+        free(name);
+        return 1;
+    }
+    free(name);
+
+    #if defined(HAS_ZLIB_H)
+        put_be32(&ihdr[0], shot->frame.width);
+        put_be32(&ihdr[4], shot->frame.height);
+        ihdr[8] = 8;    /* Bits per channel */
+        ihdr[9] = 6;    /* RGBA */
+        fwrite(signature, sizeof(signature), 1, out->fp);
+        _shot_png_chunk(out->fp, "IHDR", ihdr, sizeof(ihdr));
+
+        memset(&out->z, 0, sizeof(out->z));
+        deflateInit(&out->z, Z_DEFAULT_COMPRESSION);
+        out->z.next_out = out->buf;
+        out->z.avail_out = sizeof(out->buf);
+    #endif /* defined(HAS_ZLIB_H) */
+
+    return 0;
+}
+
+/* Convert and write one line */
+int _shot_row(SHOT *shot, const uint8_t *line) {
+    SHOT_OUTPUT *out = &shot->out;
+    uint32_t size = shot->frame.width * 4;
+
+    _shot_kernel(shot->rgba, line, shot->frame.width, shot->frame.depth);
+
+    #if defined(HAS_ZLIB_H)
+        if (out->png) {
+            static const uint8_t filter = 0;
+
+            out->z.next_in = (uint8_t *)&filter;
+            out->z.avail_in = 1;
+            if (_shot_png_deflate(out, Z_NO_FLUSH)) {
+                return 1;
+            }
+            out->z.next_in = shot->rgba;
+            out->z.avail_in = size;
+
+            return _shot_png_deflate(out, Z_NO_FLUSH);
+        }
+    #endif /* defined(HAS_ZLIB_H) */
+
+    return (fwrite(shot->rgba, size, 1, out->fp) != 1);
+}
+
+/* Finish writing a frame */
+int _shot_close(SHOT *shot) {
+    SHOT_OUTPUT *out = &shot->out;
+    int result = 0;
+
+    if (!out->png) {
+        return fflush(out->fp);
+    }
+
+    #if defined(HAS_ZLIB_H)
+        result = _shot_png_deflate(out, Z_FINISH);
+        deflateEnd(&out->z);
+        _shot_png_chunk(out->fp, "IEND", NULL, 0);
+    #endif /* defined(HAS_ZLIB_H) */
+
+    result |= ferror(out->fp);
+    result |= fclose(out->fp);
+    out->fp = NULL;
+
+    return result;
+}
+
+#if defined(HAS_ZLIB_H)
+void _shot_png_chunk(FILE *fp, const char *type, const uint8_t *data, uint32_t size) {
+    uint8_t buf[4];
+    uLong crc;
+
+    put_be32(buf, size);
+    fwrite(buf, 4, 1, fp);
+    fwrite(type, 4, 1, fp);
+    crc = crc32(0, (const Bytef *)type, 4);
+    if (size) {
+        fwrite(data, size, 1, fp);
+        crc = crc32(crc, data, size);
+    }
+
+    put_be32(buf, crc);
+    fwrite(buf, 4, 1, fp);
+}
+
+/* Compress pending input, writing an IDAT chunk whenever the buffer fills */
+int _shot_png_deflate(SHOT_OUTPUT *out, int flush) {
+    int ret;
+
+    do {
+        ret = deflate(&out->z, flush);
+        if (ret == Z_STREAM_ERROR) {
+            return 1;
+        }
+        if (!out->z.avail_out || ((ret == Z_STREAM_END) && (out->z.next_out != out->buf))) {
+            _shot_png_chunk(out->fp, "IDAT", out->buf, out->z.next_out - out->buf);
+            out->z.next_out = out->buf;
+            out->z.avail_out = sizeof(out->buf);
+        }
+    } while (out->z.avail_in || ((flush == Z_FINISH) && (ret != Z_STREAM_END)));
+
+    return 0;
+}
+#endif /* defined(HAS_ZLIB_H) */
+
+/* Lines from gs_screen_shot(); each is kept and written as it arrives */
+int _shot_sink_write(GS_SINK *sink, const uint8_t *buf, size_t size) {
+    SHOT *shot = sink->context;
+    uint8_t *line;
+
+    if (!shot->line) {
+        shot->pitch = shot->frame.width * shot->frame.depth;
+        if (_shot_open(shot)) {
+            return 1;
+        }
+    }
+    if ((size != shot->pitch) || (shot->line >= shot->frame.height)) {
+        return 1;
+    }
+
+    line = &shot->lines[shot->line * shot->pitch];
+    memcpy(line, buf, size);
+    shot->line++;
+    shot->fetched++;
+
+    return _shot_row(shot, line);
+}
+
+/* Find the displayed frame buffer through the VI; READ_ROM leaves PC-control */
+int _shot_origin(uint32_t *address) {
+    uint8_t buf[4];
+    GS_RANGE range[2] = {
+        {
+            GS_VI_ORIGIN,
+            4
+        },
+        {
+            0, 0
+        }
+    };
+
+    if (gs_enter() || gs_read_rom(buf, range, NULL)) {
+        return 1;
+    }
+    *address = MEMMAP_KSEG0 | (get_be32(buf) & 0x00FFFFFF);
+
+    return 0;
+}
+
+/*
+ * Compare the lines read back (packed in `fetch`, in `ranges` order) with the
+ * last frame, and take them in; returns how many lines changed.
+ */
+uint32_t _shot_changed(SHOT *shot, GS_RANGE *ranges) {
+    uint32_t changed = 0;
+    uint32_t offset = 0;
+    uint32_t start;
+    uint32_t end;
+    uint32_t next;
+    int64_t last = -1;
+    uint32_t y;
+
+    for (; ranges->size; ranges++) {
+        start = (ranges->address - shot->frame.address) & MEMMAP_PHYS_MASK;
+        end = start + ranges->size;
+
+        /* A span may cover parts of lines; a line counts once */
+        for (; start < end; start = next) {
+            y = start / shot->pitch;
+            next = MIN(end, (y + 1) * shot->pitch);
+            if (memcmp(&shot->lines[start], &shot->fetch[offset], next - start)) {
+                memcpy(&shot->lines[start], &shot->fetch[offset], next - start);
+                if (y != last) {
+                    changed++;
+                    last = y;
+                }
+            }
+            offset += next - start;
+        }
+    }
+
+    return changed;
+}
+
+
+/* Public functions */
+
+/* Convert one line of RGBA5551 (depth 2) or RGBA8888 (depth 4) pixels to RGBA */
+void shot_convert(uint8_t *rgba, const uint8_t *line, uint32_t width, uint8_t depth) {
+    const char *name;
+
+    if (!_shot_kernel) {
+        _shot_kernel = _shot_select(&name);
+    }
+    _shot_kernel(rgba, line, width, depth);
+}
+
+int shot_init(SHOT *shot, const char *filename) {
+    const char *name;
+    size_t len = strlen(filename);
+
+    memset(shot, 0, sizeof(SHOT));
+    shot->filename = filename;
+    shot->out.png = (len > 4) && !strcasecmp(&filename[len - 4], ".png");
+
+    #if !defined(HAS_ZLIB_H)
+        if (shot->out.png) {
+            fprintf(stderr, "%s\n", "PNG output needs zlib; use a raw output file");
+            return 1;
+        }
+    #endif /* !defined(HAS_ZLIB_H) */
+
+    if (!shot->out.png) {
+        shot->out.fp = fopen(filename, "wb");
+        if (!shot->out.fp) {
+            fprintf(stderr, "Unable to open `%s` for writing\n", filename);
+            return 1;
+        }
+    }
+
+    _shot_kernel = _shot_select(&name);
+    DEBUGPRINT("Pixel conversion: %s\n", name);
+
+    shot->lines = alloc(GS_FRAME_MAX_WIDTH * GS_FRAME_MAX_HEIGHT * 4);
+    shot->fetch = alloc(GS_FRAME_MAX_WIDTH * GS_FRAME_MAX_HEIGHT * 4);
+    shot->hashes = alloc(((GS_FRAME_MAX_WIDTH * GS_FRAME_MAX_HEIGHT * 4) / GS_FAST_HASH_PAGE) *
+        sizeof(uint64_t));
+    shot->rgba = alloc(GS_FRAME_MAX_WIDTH * 4);
+    shot->ranges = alloc((GS_FRAME_MAX_HEIGHT + 1) * sizeof(GS_RANGE));
+
+    return 0;
+}
+
+void shot_free(SHOT *shot) {
+    if (shot->out.fp) {
+        fclose(shot->out.fp);
+    }
+    free(shot->lines);
+    free(shot->fetch);
+    free(shot->hashes);
+    free(shot->rgba);
+    free(shot->ranges);
+    memset(shot, 0, sizeof(SHOT));
+}
+
+/*
+ * Capture and write one frame. With `incremental`, the frame buffer is found
+ * through the VI and read back with READ, and the lines are compared with the
+ * last frame on the host. With the fast stub, page hashes pick the parts to
+ * read; otherwise the whole frame is read in one READ.
+ */
+int shot_frame(SHOT *shot, bool incremental) {
+    GS_SINK sink;
+    GS_RANGE *range;
+    uint32_t address;
+    uint32_t size;
+    uint32_t pages;
+    uint32_t len;
+    uint32_t i;
+    uint32_t y;
+    uint32_t changed;
+    int result = 0;
+
+    if (incremental && shot->valid) {
+        if (_shot_origin(&address)) {
+            return 1;
+        }
+
+        /* A double-buffered game swaps buffers; anything odd is captured in full */
+        size = shot->pitch * shot->frame.height;
+        incremental = !(address & 3) &&
+            ((uint64_t)(address & MEMMAP_PHYS_MASK) + size <= MEMMAP_RAM_MAX);
+        if (incremental) {
+            shot->frame.address = address;
+        }
+    }
+    else {
+        incremental = false;
+    }
+
+    if (gs_enter()) {
+        return 1;
+    }
+
+    if (!incremental) {
+        shot->valid = false;
+        shot->line = 0;
+        memset(&shot->frame, 0, sizeof(GS_FRAME));
+        gs_sink_callback(&sink, _shot_sink_write, shot);
+        if (gs_screen_shot(&shot->frame, &sink, NULL) || gs_exit()) {
+            if (shot->out.png && shot->out.fp) {
+                _shot_close(shot);
+            }
+            return 1;
+        }
+        shot->valid = true;
+        shot->frames++;
+
+        return _shot_close(shot);
+    }
+
+    range = shot->ranges;
+    if (gs_fast_active()) {
+        /* Read only the pages whose hashes differ, merging neighbours into one range */
+        pages = (size + GS_FAST_HASH_PAGE - 1) / GS_FAST_HASH_PAGE;
+        if (gs_fast_hash_pages(shot->hashes, shot->frame.address, (size + 3) & ~3)) {
+            return 1;
+        }
+        for (i = 0; i < pages; i++) {
+            len = MIN(GS_FAST_HASH_PAGE, size - (i * GS_FAST_HASH_PAGE));
+            if (gs_fast_hash(&shot->lines[i * GS_FAST_HASH_PAGE], (len + 3) & ~3) == shot->hashes[i]) {
+                continue;
+            }
+            address = shot->frame.address + (i * GS_FAST_HASH_PAGE);
+            if ((range != shot->ranges) && (((range[-1].address + range[-1].size) & MEMMAP_PHYS_MASK) ==
+                (address & MEMMAP_PHYS_MASK))) {
+                range[-1].size += len;
+            }
+            else {
+                range->address = address;
+                range->size = len;
+                range++;
+            }
+        }
+    }
+    else {
+        range->address = shot->frame.address;
+        range->size = size;
+        range++;
+    }
+    range->address = 0;
+    range->size = 0;
+
+    /* Ranges the firmware would refuse are read through the other mirror */
+    for (range = shot->ranges; range->size; range++) {
+        if (gs_read_blocked(range->address)) {
+            range->address = MEMMAP_KSEG1 | (range->address & MEMMAP_PHYS_MASK);
+        }
+    }
+
+    if ((shot->ranges[0].size && gs_read(shot->fetch, shot->ranges, NULL)) || gs_exit()) {
+        return 1;
+    }
+    changed = _shot_changed(shot, shot->ranges);
+    shot->fetched += changed;
+    shot->reused += shot->frame.height - changed;
+
+    if (_shot_open(shot)) {
+        return 1;
+    }
+    for (y = 0; !result && (y < shot->frame.height); y++) {
+        result = _shot_row(shot, &shot->lines[y * shot->pitch]);
+    }
+    result |= _shot_close(shot);
+    shot->frames++;
+
+    return result;
+}
+
+/*
+ * Capture `frames` frames (0 for until Ctrl-C), one every `interval` microseconds.
+ * SCREEN_SHOT is a stock command, so a full capture unloads the fast stub;
+ * `resume(stub)` (when given) loads it again for the frames that follow.
+ */
+int shot_run(const char *filename, uint32_t interval, uint32_t frames,
+    int (*resume)(char *), char *stub) {
+    SHOT shot;
+    bool fast = gs_fast_active();
+    uint64_t start;
+    uint64_t next;
+    uint64_t t;
+    uint64_t overruns = 0;
+    int result = 0;
+
+    if (shot_init(&shot, filename)) {
+        return 1;
+    }
+    shot.numbered = (frames != 1);
+
+    _shot_stop = 0;
+    signal(SIGINT, _shot_signal);
+
+    start = next = now_ns();
+    while (!_shot_stop && (!frames || (shot.frames < frames))) {
+        sleep_until_ns(next);
+
+        if (shot_frame(&shot, true)) {
+            result = 1;
+            break;
+        }
+        if (fast && resume && !gs_fast_active() && resume(stub)) {
+            fast = false;
+        }
+        if (frames != 1) {
+            printf("\rFrame %u: %ux%u", shot.frames, shot.frame.width, shot.frame.height);
+            fflush(stdout);
+        }
+
+        /* Keep a fixed cadence; skip ahead if a frame overran its slot */
+        t = now_ns();
+        next += (uint64_t)interval * 1000;
+        if (next < t) {
+            next = t;
+            overruns++;
+        }
+    }
+
+    signal(SIGINT, SIG_DFL);
+
+    if (frames == 1) {
+        if (!result) {
+            printf("Frame: %ux%u, %u bytes per pixel\n",
+                shot.frame.width, shot.frame.height, shot.frame.depth);
+        }
+    }
+    else if (shot.frames) {
+        t = now_ns() - start;
+        printf("\n%u frames in %.2f s; %llu overruns\n",
+            shot.frames, t / 1e9, (unsigned long long)overruns);
+        printf("Lines: %llu changed, %llu unchanged\n",
+            (unsigned long long)shot.fetched, (unsigned long long)shot.reused);
+    }
+    shot_free(&shot);
+
+    return result;
+}
@@ -0,0 +1,63 @@
+
+#ifndef _SHOT_H_
+#define _SHOT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#if defined(HAS_ZLIB_H)
+    #include <zlib.h>
+#endif /* defined(HAS_ZLIB_H) */
+
+#include "gspro.h"
+
+
+/*
+ * Frames are written as 8-bit RGBA, as they arrive: to a PNG when the output
+ * name ends in ".png" (numbered per frame when capturing video), otherwise
+ * appended to a raw RGBA stream, e.g. for
+ * `ffmpeg -f rawvideo -pix_fmt rgba -s <width>x<height> -i <file>`.
+ */
+
+/* Frame output */
+struct _shot_output {
+    FILE *          fp;
+    bool            png;
+    #if defined(HAS_ZLIB_H)
+        z_stream    z;
+        uint8_t     buf[0x8000];
+    #endif /* defined(HAS_ZLIB_H) */
+};
+typedef struct _shot_output SHOT_OUTPUT;
+
+/* A capture session */
+struct _shot {
+    const char *    filename;
+    GS_FRAME        frame;
+    uint32_t        pitch;      /* Bytes per line */
+    uint8_t *       lines;      /* Last frame, as the console holds it */
+    uint64_t *      hashes;     /* Console-side page hashes, with the fast stub */
+    uint8_t *       fetch;      /* Lines read back, packed */
+    uint8_t *       rgba;       /* One converted line */
+    uint32_t        line;       /* Next line to arrive */
+    bool            valid;      /* `lines` holds a frame */
+    bool            numbered;   /* Number each frame's PNG */
+    uint32_t        frames;
+    uint64_t        fetched;    /* Lines that changed since the last frame */
+    uint64_t        reused;     /* Lines unchanged since the last frame */
+    GS_RANGE *      ranges;
+    SHOT_OUTPUT     out;
+};
+typedef struct _shot SHOT;
+
+
+/* Function declarations */
+void shot_convert(uint8_t *rgba, const uint8_t *line, uint32_t width, uint8_t depth);
+int shot_init(SHOT *shot, const char *filename);
+void shot_free(SHOT *shot);
+int shot_frame(SHOT *shot, bool incremental);
+int shot_run(const char *filename, uint32_t interval, uint32_t frames,
+    int (*resume)(char *), char *stub);
+
+#endif /* _SHOT_H_ */
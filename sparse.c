@@ -0,0 +1,318 @@
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define _SPARSE_X86
+    #include <immintrin.h>
+#endif /* defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) */
+
+#include "gspro.h"
+#include "stream.h"
+#include "n64rd.h"
+#include "sparse.h"
+
+
+/* Private function declarations */
+bool _sparse_zero_scalar(const uint8_t *buf, size_t size);
+#if defined(_SPARSE_X86)
+bool _sparse_zero_sse2(const uint8_t *buf, size_t size);
+bool _sparse_zero_avx2(const uint8_t *buf, size_t size);
+#endif /* defined(_SPARSE_X86) */
+void _sparse_region(SPARSE *sparse, uint64_t size, bool data);
+int _sparse_flush(SPARSE *sparse, const uint8_t *buf, size_t size, bool data);
+int _sparse_pages(SPARSE *sparse, const uint8_t *buf, size_t size);
+int _sparse_sink_write(GS_SINK *sink, const uint8_t *buf, size_t size);
+
+
+/* Private functions */
+
+/* Portable fallback: one 64-bit word at a time */
+bool _sparse_zero_scalar(const uint8_t *buf, size_t size) {
+    uint64_t x = 0;
+    uint64_t w;
+    size_t pos;
+
+    for (pos = 0; (pos + 8) <= size; pos += 8) {
+        memcpy(&w, &buf[pos], 8);
+        x |= w;
+    }
+    for (; pos < size; pos++) {
+        x |= buf[pos];
+    }
+
+    return !x;
+}
+
+#if defined(_SPARSE_X86)
+/* OR 64 bytes per iteration, stopping at the first non-zero block */
+__attribute__((target("sse2")))
+bool _sparse_zero_sse2(const uint8_t *buf, size_t size) {
+    __m128i x;
+    size_t pos;
+
+    for (pos = 0; (pos + 64) <= size; pos += 64) {
+        x = _mm_or_si128(
+            _mm_or_si128(_mm_loadu_si128((const __m128i *)&buf[pos]),
+                _mm_loadu_si128((const __m128i *)&buf[pos + 16])),
+            _mm_or_si128(_mm_loadu_si128((const __m128i *)&buf[pos + 32]),
+                _mm_loadu_si128((const __m128i *)&buf[pos + 48])));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_setzero_si128())) != 0xFFFF) {
+            return false;
+        }
+    }
+
+    return _sparse_zero_scalar(&buf[pos], size - pos);
+}
+
+/* OR 128 bytes per iteration */
+__attribute__((target("avx2")))
+bool _sparse_zero_avx2(const uint8_t *buf, size_t size) {
+    __m256i x;
+    size_t pos;
+
+    for (pos = 0; (pos + 128) <= size; pos += 128) {
+        x = _mm256_or_si256(
+            _mm256_or_si256(_mm256_loadu_si256((const __m256i *)&buf[pos]),
+                _mm256_loadu_si256((const __m256i *)&buf[pos + 32])),
+            _mm256_or_si256(_mm256_loadu_si256((const __m256i *)&buf[pos + 64]),
+                _mm256_loadu_si256((const __m256i *)&buf[pos + 96])));
+        if (!_mm256_testz_si256(x, x)) {
+            return false;
+        }
+    }
+
+    return _sparse_zero_sse2(&buf[pos], size - pos);
+}
+#endif /* defined(_SPARSE_X86) */
+
+/* Extend the region list */
+void _sparse_region(SPARSE *sparse, uint64_t size, bool data) {
+    SPARSE_REGION *region;
+
+    if (sparse->region_count && (sparse->regions[sparse->region_count - 1].data == data)) {
+        sparse->regions[sparse->region_count - 1].size += size;
+        return;
+    }
+
+    if (sparse->region_count == sparse->region_capacity) {
+        sparse->region_capacity = sparse->region_capacity ? (sparse->region_capacity * 2) : 0x40;
+        sparse->regions = realloc(sparse->regions, sparse->region_capacity * sizeof(SPARSE_REGION));
+        if (!sparse->regions) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+
+    region = &sparse->regions[sparse->region_count++];
+    region->offset = sparse->offset;
+    region->size = size;
+    region->data = data;
+}
+
+/* Write a run of populated pages, or step over a run of empty ones */
+int _sparse_flush(SPARSE *sparse, const uint8_t *buf, size_t size, bool data) {
+    ssize_t len;
+    size_t total = 0;
+
+    if (!size) {
+        return 0;
+    }
+    _sparse_region(sparse, size, data);
+
+    if (!data) {
+        sparse->hole_bytes += size;
+        sparse->offset += size;
+        return 0;
+    }
+
+    while (total < size) {
+        len = pwrite(sparse->fd, &buf[total], size - total, sparse->offset + total);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Write failed: %s\n", strerror(errno));
+            return 1;
+        }
+        total += len;
+    }
+    sparse->data_bytes += size;
+    sparse->offset += size;
+
+    return 0;
+}
+
+/*
+ * Write whole pages (the last may be partial), starting on a page boundary.
+ * Consecutive pages of the same kind are written or skipped together.
+ */
+int _sparse_pages(SPARSE *sparse, const uint8_t *buf, size_t size) {
+    size_t start = 0;
+    size_t pos;
+    size_t len;
+    bool data = true;
+    bool page;
+
+    for (pos = 0; pos < size; pos += len) {
+        len = MIN(size - pos, (size_t)SPARSE_PAGE);
+        page = !sparse->zero(&buf[pos], len);
+
+        if ((pos != start) && (page != data)) {
+            if (_sparse_flush(sparse, &buf[start], pos - start, data)) {
+                return 1;
+            }
+            start = pos;
+        }
+        data = page;
+    }
+
+    return _sparse_flush(sparse, &buf[start], pos - start, data);
+}
+
+int _sparse_sink_write(GS_SINK *sink, const uint8_t *buf, size_t size) {
+    return sparse_write(sink->context, buf, size);
+}
+
+
+/* Public functions */
+
+/* Pick the widest kernel this CPU supports */
+SPARSE_KERNEL sparse_kernel(const char **name) {
+    #if defined(_SPARSE_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            *name = "avx2";
+            return _sparse_zero_avx2;
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            *name = "sse2";
+            return _sparse_zero_sse2;
+        }
+    #endif /* defined(_SPARSE_X86) */
+
+    *name = "scalar";
+
+    return _sparse_zero_scalar;
+}
+
+int sparse_open(SPARSE *sparse, const char *filename) {
+    memset(sparse, 0, sizeof(SPARSE));
+
+    sparse->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (sparse->fd == -1) {
+        fprintf(stderr, "Unable to open `%s` for writing\n", filename);
+        return 1;
+    }
+    sparse->zero = sparse_kernel(&sparse->kernel);
+    DEBUGPRINT("Using %s kernel\n", sparse->kernel);
+
+    return 0;
+}
+
+/* Append `buf`; pages split across calls are completed in sparse->page first */
+int sparse_write(SPARSE *sparse, const uint8_t *buf, size_t size) {
+    size_t len;
+
+    if (sparse->fill) {
+        len = MIN(size, (size_t)(SPARSE_PAGE - sparse->fill));
+        memcpy(&sparse->page[sparse->fill], buf, len);
+        sparse->fill += len;
+        buf += len;
+        size -= len;
+        if (sparse->fill < SPARSE_PAGE) {
+            return 0;
+        }
+        sparse->fill = 0;
+        if (_sparse_pages(sparse, sparse->page, SPARSE_PAGE)) {
+            return 1;
+        }
+    }
+
+    len = size & ~(size_t)(SPARSE_PAGE - 1);
+    if (_sparse_pages(sparse, buf, len)) {
+        return 1;
+    }
+    sparse->fill = size - len;
+    memcpy(sparse->page, &buf[len], sparse->fill);
+
+    return 0;
+}
+
+/* Write any partial last page, set the final size (covering a trailing hole) and close */
+int sparse_close(SPARSE *sparse) {
+    int result = _sparse_pages(sparse, sparse->page, sparse->fill);
+
+    sparse->fill = 0;
+    if (ftruncate(sparse->fd, sparse->offset)) {
+        fprintf(stderr, "Unable to set the file size: %s\n", strerror(errno));
+        result = 1;
+    }
+    if (close(sparse->fd)) {
+        result = 1;
+    }
+    sparse->fd = -1;
+
+    return result;
+}
+
+/* Stream into the file, e.g. from gs_read_rom_sink() */
+void sparse_sink(SPARSE *sparse, GS_SINK *sink) {
+    gs_sink_callback(sink, _sparse_sink_write, sparse);
+}
+
+/* Summarize the populated and empty regions, as addresses from `address` */
+void sparse_print(SPARSE *sparse, uint32_t address) {
+    SPARSE_REGION *region;
+    uint32_t i;
+
+    for (i = 0; (i < sparse->region_count) && (i < SPARSE_PRINT); i++) {
+        region = &sparse->regions[i];
+        printf("  0x%08X - 0x%08X  %s\n", (uint32_t)(address + region->offset),
+            (uint32_t)(address + region->offset + region->size - 1), (region->data ? "data" : "empty"));
+    }
+    if (sparse->region_count > SPARSE_PRINT) {
+        printf("  ... %u more regions\n", sparse->region_count - SPARSE_PRINT);
+    }
+
+    printf("%llu KB populated, %llu KB empty (%.1f%% written)\n",
+        (unsigned long long)(sparse->data_bytes >> 10), (unsigned long long)(sparse->hole_bytes >> 10),
+        (sparse->offset ? ((sparse->data_bytes * 100.0) / sparse->offset) : 100.0));
+}
+
+void sparse_free(SPARSE *sparse) {
+    free(sparse->regions);
+    sparse->regions = NULL;
+    sparse->region_count = 0;
+    sparse->region_capacity = 0;
+}
+
+/* Write a dump held in memory, with a summary */
+int sparse_dump(const char *filename, const uint8_t *data, uint32_t address, uint32_t size) {
+    SPARSE sparse;
+    int result;
+
+    if (sparse_open(&sparse, filename)) {
+        return 1;
+    }
+
+    result = sparse_write(&sparse, data, size);
+    result |= sparse_close(&sparse);
+    if (result) {
+        fprintf(stderr, "Unable to write `%s`\n", filename);
+        unlink(filename);
+        sparse_free(&sparse);
+        return 1;
+    }
+
+    sparse_print(&sparse, address);
+    sparse_free(&sparse);
+
+    return 0;
+}
@@ -0,0 +1,57 @@
+
+#ifndef _SPARSE_H_
+#define _SPARSE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gspro.h"
+
+
+/*
+ * Sparse dump writer: pages of the output file that are all zero are skipped
+ * rather than written, leaving holes on filesystems that support them. The
+ * file reads back byte-identical either way.
+ */
+#define SPARSE_PAGE         0x1000
+#define SPARSE_PRINT        16      /* Regions listed by sparse_print() */
+
+/* Is `buf` all zero? */
+typedef bool (*SPARSE_KERNEL)(const uint8_t *buf, size_t size);
+
+/* A run of populated or empty pages */
+struct _sparse_region {
+    uint64_t        offset;
+    uint64_t        size;
+    bool            data;
+};
+typedef struct _sparse_region SPARSE_REGION;
+
+struct _sparse {
+    int             fd;
+    uint64_t        offset;     /* Bytes written or skipped so far */
+    uint64_t        data_bytes;
+    uint64_t        hole_bytes;
+    SPARSE_REGION * regions;
+    uint32_t        region_count;
+    uint32_t        region_capacity;
+    SPARSE_KERNEL   zero;
+    const char *    kernel;
+    uint8_t         page[SPARSE_PAGE];  /* A page split across writes */
+    uint32_t        fill;
+};
+typedef struct _sparse SPARSE;
+
+
+/* Function declarations */
+SPARSE_KERNEL sparse_kernel(const char **name);
+int sparse_open(SPARSE *sparse, const char *filename);
+int sparse_write(SPARSE *sparse, const uint8_t *buf, size_t size);
+int sparse_close(SPARSE *sparse);
+void sparse_sink(SPARSE *sparse, GS_SINK *sink);
+void sparse_print(SPARSE *sparse, uint32_t address);
+void sparse_free(SPARSE *sparse);
+int sparse_dump(const char *filename, const uint8_t *data, uint32_t address, uint32_t size);
+
+#endif /* _SPARSE_H_ */
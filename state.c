@@ -0,0 +1,354 @@
+
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gspro.h"
+#include "memmap.h"
+#include "store.h"
+#include "n64rd.h"
+#include "state.h"
+
+
+/* Private function declarations */
+char *_state_path(const char *path, const char *name, bool tmp);
+const char *_state_where(uint8_t where);
+int _state_hashed(uint8_t *dirty, const uint8_t *image, uint32_t size, uint32_t page_size);
+int _state_sampled(uint8_t *dirty, const uint8_t *image, uint32_t size, uint32_t page_size);
+
+
+/* Private functions */
+
+char *_state_path(const char *path, const char *name, bool tmp) {
+    char *rel = alloc(strlen(name) + 16);
+    char *p;
+
+    sprintf(rel, "states/%s%s", (tmp ? "." : ""), name);
+    p = store_path(path, rel);
+    free(rel);
+
+    return p;
+}
+
+const char *_state_where(uint8_t where) {
+    switch (where) {
+        case GS_WHERE_MENU:
+            return "menu";
+
+        case GS_WHERE_GAME:
+            return "in-game";
+    }
+
+    return "unknown";
+}
+
+/* Mark the pages whose console-side hashes differ from the image */
+int _state_hashed(uint8_t *dirty, const uint8_t *image, uint32_t size, uint32_t page_size) {
+    uint32_t pages = (size + page_size - 1) / page_size;
+    uint64_t *hashes = alloc(pages * sizeof(uint64_t));
+    uint32_t len;
+    uint32_t i;
+
+    if (gs_fast_hash_pages(hashes, MEMMAP_KSEG0, size)) {
+        free(hashes);
+        return 1;
+    }
+    for (i = 0; i < pages; i++) {
+        len = MIN(page_size, size - (i * page_size));
+        dirty[i] = (gs_fast_hash(&image[i * page_size], len) != hashes[i]);
+    }
+    free(hashes);
+
+    return 0;
+}
+
+/* Mark the pages where any of a few sampled spans differ; one READ for all of them */
+int _state_sampled(uint8_t *dirty, const uint8_t *image, uint32_t size, uint32_t page_size) {
+    uint32_t pages = size / page_size;
+    uint32_t stride = page_size / STATE_SAMPLES;
+    uint32_t slots = stride / STATE_SAMPLE_SIZE;
+    uint32_t seed = (uint32_t)time(NULL);
+    GS_RANGE *ranges = alloc(((pages * STATE_SAMPLES) + 1) * sizeof(GS_RANGE));
+    uint8_t *samples = alloc(pages * STATE_SAMPLES * STATE_SAMPLE_SIZE);
+    uint32_t offset;
+    uint32_t i;
+    int n = 0;
+    int j;
+
+    for (i = 0; i < pages; i++) {
+        for (j = 0; j < STATE_SAMPLES; j++) {
+            offset = (i * page_size) + (j * stride) +
+                (((seed + (i * 7) + (j * 3)) % slots) * STATE_SAMPLE_SIZE);
+            ranges[n].address = MEMMAP_KSEG0 + offset;
+            if (memmap_read_blocked(ranges[n].address)) {
+                ranges[n].address = MEMMAP_KSEG1 + offset;
+            }
+            ranges[n].size = STATE_SAMPLE_SIZE;
+            n++;
+        }
+    }
+    ranges[n].address = 0;
+    ranges[n].size = 0;
+
+    if (gs_read(samples, ranges, NULL)) {
+        free(samples);
+        free(ranges);
+        return 1;
+    }
+
+    for (i = 0, n = 0; i < pages; i++) {
+        dirty[i] = 0;
+        for (j = 0; j < STATE_SAMPLES; j++, n++) {
+            if (memcmp(&samples[n * STATE_SAMPLE_SIZE], &image[ranges[n].address & MEMMAP_PHYS_MASK],
+                STATE_SAMPLE_SIZE)) {
+                dirty[i] = 1;
+            }
+        }
+    }
+
+    free(samples);
+    free(ranges);
+
+    return 0;
+}
+
+
+/* Public functions */
+
+/* Write the manifest for a state whose snapshot has been committed */
+int state_save(const char *path, const char *name, STATE *state) {
+    uint8_t header[STATE_HEADER_SIZE];
+    char *tmp;
+    char *p;
+    FILE *fp;
+    int result = 0;
+
+    if (!store_valid_name(name)) {
+        fprintf(stderr, "Invalid state name `%s`\n", name);
+        return 1;
+    }
+
+    memset(header, 0, sizeof(header));
+    memcpy(header, STATE_MAGIC, 4);
+    put_le16(&header[4], STATE_VERSION);
+    header[6] = state->where;
+    put_le32(&header[8], state->ram);
+    put_le64(&header[16], state->time);
+
+    p = _state_path(path, name, false);
+    tmp = _state_path(path, name, true);
+
+    fp = fopen(tmp, "wb");
+    if (!fp) {
+        fprintf(stderr, "Unable to create `%s`\n", tmp);
+        result = 1;
+    }
+    else {
+        fwrite(header, sizeof(header), 1, fp);
+        fflush(fp);
+        fdatasync(fileno(fp));
+        result = ferror(fp);
+        result |= fclose(fp);
+        if (result || rename(tmp, p)) {
+            fprintf(stderr, "Unable to write `%s`\n", p);
+            unlink(tmp);
+            result = 1;
+        }
+    }
+
+    free(tmp);
+    free(p);
+
+    return result;
+}
+
+int state_load(const char *path, const char *name, STATE *state) {
+    uint8_t header[STATE_HEADER_SIZE];
+    char *p;
+    FILE *fp;
+    int result = 1;
+
+    if (!store_valid_name(name)) {
+        fprintf(stderr, "Invalid state name `%s`\n", name);
+        return 1;
+    }
+
+    p = _state_path(path, name, false);
+    fp = fopen(p, "rb");
+    free(p);
+    if (fp) {
+        if ((fread(header, sizeof(header), 1, fp) == 1) && !memcmp(header, STATE_MAGIC, 4) &&
+            (get_le16(&header[4]) == STATE_VERSION)) {
+            state->where = header[6];
+            state->ram = get_le32(&header[8]);
+            state->time = get_le64(&header[16]);
+            result = 0;
+        }
+        fclose(fp);
+    }
+    if (result) {
+        fprintf(stderr, "Unable to read state `%s`\n", name);
+    }
+
+    return result;
+}
+
+/* Print the states held in a repository */
+int state_list(const char *path) {
+    DIR *dir;
+    struct dirent *ent;
+    STATE state;
+    char *p;
+    char date[32];
+    time_t t;
+
+    p = store_path(path, "states");
+    dir = opendir(p);
+    free(p);
+    if (!dir) {
+        fprintf(stderr, "Unable to list states in `%s`\n", path);
+        return 1;
+    }
+
+    while ((ent = readdir(dir))) {
+        if (!store_valid_name(ent->d_name) || state_load(path, ent->d_name, &state)) {
+            continue;
+        }
+        t = state.time;
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&t));
+        printf("%-24s  %u MB  %-8s  %s\n", ent->d_name, state.ram >> 20, _state_where(state.where), date);
+    }
+    closedir(dir);
+
+    return 0;
+}
+
+/*
+ * Put RDRAM back as it was when state `name` was saved, writing only the pages
+ * that differ with one multi-range WRITE. The game stays paused from the
+ * comparison to the end of the write.
+ */
+int state_restore(const char *path, const char *name, uint32_t ram, void (*callback)(int, uint32_t)) {
+    STATE state;
+    SNAPSHOT snap;
+    GS_RANGE *ranges;
+    uint8_t *image;
+    uint8_t *dirty;
+    uint8_t *data;
+    uint8_t where;
+    uint32_t len;
+    uint32_t size = 0;
+    uint32_t count = 0;
+    uint32_t i;
+    bool hashed = gs_fast_active();
+    int n = 0;
+    int result = 0;
+
+    if (state_load(path, name, &state) || snapshot_open(&snap, path, name)) {
+        return 1;
+    }
+    if ((snap.address != MEMMAP_KSEG0) || (snap.size != state.ram) || (snap.page_size != STORE_PAGE_SIZE)) {
+        fprintf(stderr, "Snapshot `%s` does not hold the state's RDRAM\n", name);
+        snapshot_close(&snap);
+        return 1;
+    }
+    if (state.ram != ram) {
+        fprintf(stderr, "State `%s` was saved with %u MB of RDRAM; %u MB are installed\n",
+            name, state.ram >> 20, ram >> 20);
+        snapshot_close(&snap);
+        return 1;
+    }
+
+    /* Decompress everything first, so the game is paused for the transfer only */
+    image = alloc(snap.size);
+    if (snapshot_read(&snap, snap.address, image, snap.size)) {
+        free(image);
+        snapshot_close(&snap);
+        return 1;
+    }
+
+    if (gs_enter() || gs_where(&where)) {
+        free(image);
+        snapshot_close(&snap);
+        return 1;
+    }
+    if ((where != GS_WHERE_GAME) || (where != state.where)) {
+        fprintf(stderr, "State `%s` was saved %s; it can only be restored in-game\n",
+            name, _state_where(state.where));
+        free(image);
+        snapshot_close(&snap);
+        return 1;
+    }
+
+    /* WHERE left PC-control; pause again for the comparison and the writes */
+    if (gs_enter()) {
+        free(image);
+        snapshot_close(&snap);
+        return 1;
+    }
+
+    printf("Restoring `%s` (%s comparison)...\n", name, (hashed ? "hashed" : "sampled"));
+
+    dirty = alloc(snap.pages);
+    ranges = alloc((snap.pages + 1) * sizeof(GS_RANGE));
+    data = alloc(snap.size);
+
+    if (hashed) {
+        result = _state_hashed(dirty, image, snap.size, snap.page_size);
+    }
+    else {
+        result = _state_sampled(dirty, image, snap.size, snap.page_size);
+    }
+    if (result) {
+        fprintf(stderr, "%s(): comparison failed\n", __FUNCTION__);
+    }
+
+    /* Merge runs of differing pages into ranges, packing their contents */
+    for (i = 0; !result && (i < snap.pages); i++) {
+        if (!dirty[i]) {
+            continue;
+        }
+        len = MIN(snap.page_size, snap.size - (i * snap.page_size));
+        memcpy(&data[size], &image[i * snap.page_size], len);
+
+        if (i && dirty[i - 1]) {
+            ranges[n - 1].size += len;
+        }
+        else {
+            ranges[n].address = snap.address + (i * snap.page_size);
+            ranges[n].size = len;
+            n++;
+        }
+        size += len;
+        count++;
+    }
+    ranges[n].address = 0;
+    ranges[n].size = 0;
+
+    if (!result && size && gs_write(data, ranges, callback)) {
+        fprintf(stderr, "%s(): restore failed\n", __FUNCTION__);
+        result = 1;
+    }
+    result |= gs_exit();
+    if (size && callback) {
+        printf("\n");
+    }
+
+    if (!result) {
+        printf("%u of %u pages differed; %u KB written in %d ranges\n",
+            count, snap.pages, size >> 10, n);
+    }
+
+    free(data);
+    free(ranges);
+    free(dirty);
+    free(image);
+    snapshot_close(&snap);
+
+    return result;
+}
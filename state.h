@@ -0,0 +1,45 @@
+
+#ifndef _STATE_H_
+#define _STATE_H_
+
+#include <stdint.h>
+
+
+/*
+ * Savestates: all of the installed RDRAM, stored as the snapshot of the same
+ * name, plus what is needed to put it back.
+ *
+ * State manifest (<repo>/states/<name>, little-endian):
+ *
+ *   "N64T", version (u16), gs_where() state (u8), reserved (u8), RDRAM size
+ *   (u32), reserved (u32), time (u64), then reserved bytes up to
+ *   STATE_HEADER_SIZE.
+ *
+ * Restoring only writes the pages that differ from the console. With a fast
+ * transfer stub, pages are compared by hashes taken on the console, which is
+ * exact. Otherwise STATE_SAMPLES spans of STATE_SAMPLE_SIZE bytes per page are
+ * read and compared; a page whose samples all match is assumed unchanged.
+ * The sample offsets move between restores, so repeating one catches what the
+ * last missed.
+ */
+#define STATE_MAGIC         "N64T"
+#define STATE_VERSION       1
+#define STATE_HEADER_SIZE   32
+#define STATE_SAMPLES       4
+#define STATE_SAMPLE_SIZE   16
+
+struct _state {
+    uint8_t     where;
+    uint32_t    ram;
+    uint64_t    time;
+};
+typedef struct _state STATE;
+
+
+/* Function declarations */
+int state_save(const char *path, const char *name, STATE *state);
+int state_load(const char *path, const char *name, STATE *state);
+int state_list(const char *path);
+int state_restore(const char *path, const char *name, uint32_t ram, void (*callback)(int, uint32_t));
+
+#endif /* _STATE_H_ */
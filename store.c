@@ -0,0 +1,709 @@
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(HAS_ZLIB_H)
+    #include <zlib.h>
+#endif /* defined(HAS_ZLIB_H) */
+
+#include "gspro.h"
+#include "stream.h"
+#include "n64rd.h"
+#include "store.h"
+
+
+/* Every stored page has data or is the zero page, so empty slots are all-zero */
+#define _STORE_USED(_r) ((_r).csize || (_r).codec)
+
+
+/* Private function declarations */
+STORE_RECORD *_store_match(STORE *store, const uint8_t *data, uint32_t size, uint64_t hash);
+void _store_insert(STORE *store, STORE_RECORD *record);
+int _store_write_all(int fd, const uint8_t *buf, size_t size);
+int _store_flush_page(STORE_WRITER *writer);
+int _store_sink_write(GS_SINK *sink, const uint8_t *buf, size_t size);
+
+
+/* Private functions */
+
+/* Look up an object by hash, size and contents; returns NULL when not present */
+STORE_RECORD *_store_match(STORE *store, const uint8_t *data, uint32_t size, uint64_t hash) {
+    uint32_t mask = store->table_size - 1;
+    uint32_t i = hash & mask;
+    uint8_t *check = NULL;
+    STORE_RECORD *found = NULL;
+
+    for (; !found && _STORE_USED(store->table[i]); i = (i + 1) & mask) {
+        if ((store->table[i].hash != hash) || (store->table[i].size && (store->table[i].size != size))) {
+            continue;
+        }
+        if (!check) {
+            check = alloc(size ? size : 1);
+        }
+        if (!store_get(store, &store->table[i], check, size) && !memcmp(check, data, size)) {
+            found = &store->table[i];
+        }
+    }
+    free(check);
+
+    return found;
+}
+
+/* Add a page to the in-memory index, growing it past half full */
+void _store_insert(STORE *store, STORE_RECORD *record) {
+    STORE_RECORD *old = store->table;
+    uint32_t old_size = store->table_size;
+    uint32_t mask;
+    uint32_t i;
+
+    if (((store->count + 1) * 2) > store->table_size) {
+        store->table_size = old_size * 2;
+        store->table = alloc(store->table_size * sizeof(STORE_RECORD));
+        store->count = 0;
+        for (i = 0; i < old_size; i++) {
+            if (_STORE_USED(old[i])) {
+                _store_insert(store, &old[i]);
+            }
+        }
+        free(old);
+    }
+
+    mask = store->table_size - 1;
+    i = record->hash & mask;
+    while (_STORE_USED(store->table[i])) {
+        i = (i + 1) & mask;
+    }
+    store->table[i] = *record;
+    store->count++;
+}
+
+int _store_write_all(int fd, const uint8_t *buf, size_t size) {
+    ssize_t len;
+
+    while (size) {
+        len = write(fd, buf, size);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ERRORPRINT("write() failed: %s\n", strerror(errno));
+
+            return 1;
+        }
+        buf += len;
+        size -= len;
+    }
+
+    return 0;
+}
+
+/* Store the (possibly partial) page held by the writer */
+int _store_flush_page(STORE_WRITER *writer) {
+    uint32_t index = (writer->written - 1) / writer->page_size;
+    uint32_t size = writer->written - (index * writer->page_size);
+    uint64_t pack_size = writer->store->pack_size;
+    uint32_t count = writer->store->count;
+
+    if (store_put(writer->store, writer->page, size, &writer->records[index])) {
+        return 1;
+    }
+    if (writer->store->count != count) {
+        writer->new_pages++;
+        writer->new_bytes += writer->store->pack_size - pack_size;
+    }
+
+    return 0;
+}
+
+int _store_sink_write(GS_SINK *sink, const uint8_t *buf, size_t size) {
+    return store_write(sink->context, buf, size);
+}
+
+
+/* Public functions */
+
+/* Join a repository path and a relative name */
+char *store_path(const char *path, const char *name) {
+    char *p = alloc(strlen(path) + strlen(name) + 2);
+
+    sprintf(p, "%s/%s", path, name);
+
+    return p;
+}
+
+bool store_valid_name(const char *name) {
+    return name[0] && (name[0] != '.') && !strchr(name, '/');
+}
+
+void store_pack_record(uint8_t *buf, STORE_RECORD *record) {
+    memset(buf, 0, STORE_RECORD_SIZE);
+    put_le64(&buf[0], record->hash);
+    put_le64(&buf[8], record->offset);
+    put_le32(&buf[16], record->csize);
+    buf[20] = record->codec;
+    buf[21] = record->size;
+    buf[22] = record->size >> 8;
+    buf[23] = record->size >> 16;
+}
+
+void store_unpack_record(const uint8_t *buf, STORE_RECORD *record) {
+    record->hash = get_le64(&buf[0]);
+    record->offset = get_le64(&buf[8]);
+    record->csize = get_le32(&buf[16]);
+    record->codec = buf[20];
+    record->size = buf[21] | (buf[22] << 8) | (buf[23] << 16);
+}
+
+/* Open a repository (creating its directories when asked) */
+int store_open(STORE *store, const char *path, bool create) {
+    STORE_RECORD record;
+    uint8_t buf[STORE_RECORD_SIZE];
+    struct stat st;
+    char *p;
+    int flags = O_RDWR | O_APPEND | (create ? O_CREAT : 0);
+
+    memset(store, 0, sizeof(STORE));
+    store->pack_fd = -1;
+    store->idx_fd = -1;
+    store->path = strdup(path);
+
+    if (create) {
+        mkdir(path, 0777);
+        p = store_path(path, "snapshots");
+        mkdir(p, 0777);
+        free(p);
+        p = store_path(path, "paks");
+        mkdir(p, 0777);
+        free(p);
+        p = store_path(path, "states");
+        mkdir(p, 0777);
+        free(p);
+    }
+
+    p = store_path(path, "objects.pack");
+    store->pack_fd = open(p, flags, 0666);
+    free(p);
+    p = store_path(path, "objects.idx");
+    store->idx_fd = open(p, flags, 0666);
+    free(p);
+    if ((store->pack_fd == -1) || (store->idx_fd == -1)) {
+        fprintf(stderr, "Unable to open snapshot repository `%s`: %s\n", path, strerror(errno));
+        store_close(store);
+
+        return 1;
+    }
+
+    fstat(store->pack_fd, &st);
+    store->pack_size = st.st_size;
+
+    /* Load the dedup index */
+    store->table_size = 4096;
+    store->table = alloc(store->table_size * sizeof(STORE_RECORD));
+
+    lseek(store->idx_fd, 0, SEEK_SET);
+    while (read(store->idx_fd, buf, sizeof(buf)) == sizeof(buf)) {
+        store_unpack_record(buf, &record);
+        _store_insert(store, &record);
+    }
+
+    return 0;
+}
+
+void store_close(STORE *store) {
+    if (store->pack_fd != -1) {
+        close(store->pack_fd);
+    }
+    if (store->idx_fd != -1) {
+        close(store->idx_fd);
+    }
+    free(store->table);
+    free(store->path);
+    memset(store, 0, sizeof(STORE));
+    store->pack_fd = -1;
+    store->idx_fd = -1;
+}
+
+/* Store one page, unless an identical page is already present */
+int store_put(STORE *store, const uint8_t *data, uint32_t size, STORE_RECORD *record) {
+    STORE_RECORD *found;
+    uint8_t buf[STORE_RECORD_SIZE];
+    const uint8_t *payload = data;
+    uint32_t i;
+    #if defined(HAS_ZLIB_H)
+        static uint8_t *cbuf = NULL;
+        static uLongf cbuf_size = 0;
+        uLongf csize;
+    #endif /* defined(HAS_ZLIB_H) */
+
+    if (size > STORE_OBJECT_MAX) {
+        ERRORPRINT("Object too large: 0x%08X bytes\n", size);
+
+        return 1;
+    }
+
+    record->hash = hash64(data, size, 0);
+    found = _store_match(store, data, size, record->hash);
+    if (found) {
+        *record = *found;
+
+        return 0;
+    }
+
+    record->size = size;
+    record->offset = store->pack_size;
+    record->csize = size;
+    record->codec = STORE_CODEC_RAW;
+
+    for (i = 0; (i < size) && !data[i]; i++);
+    if (i == size) {
+        record->offset = 0;
+        record->csize = 0;
+        record->codec = STORE_CODEC_ZERO;
+    }
+    #if defined(HAS_ZLIB_H)
+    else {
+        if (cbuf_size < compressBound(size)) {
+            free(cbuf);
+            cbuf_size = compressBound(size);
+            cbuf = alloc(cbuf_size);
+        }
+        csize = cbuf_size;
+        if ((compress2(cbuf, &csize, data, size, Z_BEST_SPEED) == Z_OK) && (csize < size)) {
+            payload = cbuf;
+            record->csize = csize;
+            record->codec = STORE_CODEC_DEFLATE;
+        }
+    }
+    #endif /* defined(HAS_ZLIB_H) */
+
+    if (record->csize) {
+        if (_store_write_all(store->pack_fd, payload, record->csize)) {
+            return 1;
+        }
+        store->pack_size += record->csize;
+    }
+
+    store_pack_record(buf, record);
+    if (_store_write_all(store->idx_fd, buf, sizeof(buf))) {
+        return 1;
+    }
+    _store_insert(store, record);
+
+    return 0;
+}
+
+/* Read back an object of `size` bytes stored with store_put() */
+int store_get(STORE *store, STORE_RECORD *record, uint8_t *out, uint32_t size) {
+    uint8_t *buf;
+    int result = 1;
+    #if defined(HAS_ZLIB_H)
+        uLongf len = size;
+    #endif /* defined(HAS_ZLIB_H) */
+
+    if (record->size && (record->size != size)) {
+        ERRORPRINT("Object %016llX is 0x%X bytes, not 0x%X\n", (unsigned long long)record->hash,
+            record->size, size);
+
+        return 1;
+    }
+    if (record->codec == STORE_CODEC_ZERO) {
+        memset(out, 0, size);
+
+        return 0;
+    }
+    if ((record->offset + record->csize) > store->pack_size) {
+        ERRORPRINT("Object %016llX points outside the pack\n", (unsigned long long)record->hash);
+
+        return 1;
+    }
+
+    buf = alloc(record->csize);
+    if (pread(store->pack_fd, buf, record->csize, record->offset) == record->csize) {
+        switch (record->codec) {
+            case STORE_CODEC_RAW:
+                if (record->csize == size) {
+                    memcpy(out, buf, size);
+                    result = 0;
+                }
+                break;
+
+            #if defined(HAS_ZLIB_H)
+            case STORE_CODEC_DEFLATE:
+                result = (uncompress(out, &len, buf, record->csize) != Z_OK) || (len != size);
+                break;
+            #endif /* defined(HAS_ZLIB_H) */
+        }
+    }
+    free(buf);
+
+    if (result) {
+        ERRORPRINT("Object %016llX is corrupt\n", (unsigned long long)record->hash);
+    }
+
+    return result;
+}
+
+/* Print the snapshots held in a repository */
+int store_list(const char *path) {
+    SNAPSHOT snap;
+    STORE store;
+    DIR *dir;
+    struct dirent *ent;
+    char *p;
+    char date[32];
+    time_t t;
+
+    if (store_open(&store, path, false)) {
+        return 1;
+    }
+    printf("%u unique pages, %llu bytes packed\n\n",
+        store.count, (unsigned long long)store.pack_size);
+    store_close(&store);
+
+    p = store_path(path, "snapshots");
+    dir = opendir(p);
+    free(p);
+    if (!dir) {
+        fprintf(stderr, "Unable to list snapshots in `%s`\n", path);
+        return 1;
+    }
+
+    while ((ent = readdir(dir))) {
+        if (!store_valid_name(ent->d_name) || snapshot_open(&snap, path, ent->d_name)) {
+            continue;
+        }
+        t = snap.time;
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&t));
+        printf("%-24s  0x%08X  0x%08X  %s\n", ent->d_name, snap.address, snap.size, date);
+        snapshot_close(&snap);
+    }
+    closedir(dir);
+
+    return 0;
+}
+
+/* Start capturing a snapshot of `size` bytes at `address` */
+int store_begin(STORE_WRITER *writer, STORE *store, const char *name, uint32_t address, uint32_t size) {
+    memset(writer, 0, sizeof(STORE_WRITER));
+
+    if (!store_valid_name(name)) {
+        fprintf(stderr, "Invalid snapshot name `%s`\n", name);
+        return 1;
+    }
+    if (!size) {
+        fprintf(stderr, "%s\n", "Cannot capture an empty snapshot");
+        return 1;
+    }
+
+    writer->store = store;
+    writer->name = strdup(name);
+    writer->address = address;
+    writer->size = size;
+    writer->page_size = STORE_PAGE_SIZE;
+    writer->pages = ((uint64_t)size + writer->page_size - 1) / writer->page_size;
+    writer->records = alloc(writer->pages * sizeof(STORE_RECORD));
+    writer->page = alloc(writer->page_size);
+
+    return 0;
+}
+
+/* Accept captured data; pages are stored as soon as they fill */
+int store_write(STORE_WRITER *writer, const uint8_t *data, size_t size) {
+    uint32_t offset;
+    uint32_t len;
+
+    if (size > (size_t)(writer->size - writer->written)) {
+        ERRORPRINT("%s\n", "Snapshot data exceeds its declared size");
+        return 1;
+    }
+
+    while (size) {
+        offset = writer->written % writer->page_size;
+        len = MIN((size_t)(writer->page_size - offset), size);
+
+        memcpy(&writer->page[offset], data, len);
+        writer->written += len;
+        data += len;
+        size -= len;
+
+        if ((offset + len) == writer->page_size) {
+            if (_store_flush_page(writer)) {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Make the snapshot visible; the pack and index are synced first */
+int store_commit(STORE_WRITER *writer) {
+    uint8_t header[STORE_HEADER_SIZE];
+    uint8_t buf[STORE_RECORD_SIZE];
+    char *tmp;
+    char *path;
+    char *name;
+    FILE *fp;
+    uint32_t i;
+    int result = 0;
+
+    if (writer->written != writer->size) {
+        ERRORPRINT("Snapshot incomplete (0x%X of 0x%X bytes)\n", writer->written, writer->size);
+        store_abort(writer);
+
+        return 1;
+    }
+    if ((writer->written % writer->page_size) && _store_flush_page(writer)) {
+        store_abort(writer);
+
+        return 1;
+    }
+
+    fdatasync(writer->store->pack_fd);
+    fdatasync(writer->store->idx_fd);
+
+    name = alloc(strlen(writer->name) + 16);
+    sprintf(name, "snapshots/%s", writer->name);
+    path = store_path(writer->store->path, name);
+    sprintf(name, "snapshots/.%s", writer->name);
+    tmp = store_path(writer->store->path, name);
+    free(name);
+
+    memset(header, 0, sizeof(header));
+    memcpy(header, STORE_MAGIC, 4);
+    put_le16(&header[4], STORE_VERSION);
+    put_le32(&header[8], writer->address);
+    put_le32(&header[12], writer->size);
+    put_le32(&header[16], writer->page_size);
+    put_le32(&header[20], writer->pages);
+    put_le64(&header[24], time(NULL));
+
+    fp = fopen(tmp, "wb");
+    if (!fp) {
+        fprintf(stderr, "Unable to create `%s`\n", tmp);
+        result = 1;
+    }
+    else {
+        fwrite(header, sizeof(header), 1, fp);
+        for (i = 0; i < writer->pages; i++) {
+            store_pack_record(buf, &writer->records[i]);
+            fwrite(buf, sizeof(buf), 1, fp);
+        }
+        fflush(fp);
+        fdatasync(fileno(fp));
+        result = ferror(fp);
+        result |= fclose(fp);
+        if (result || rename(tmp, path)) {
+            fprintf(stderr, "Unable to write `%s`\n", path);
+            unlink(tmp);
+            result = 1;
+        }
+    }
+
+    free(tmp);
+    free(path);
+    store_abort(writer);
+
+    return result;
+}
+
+/* Discard writer state (pages already packed stay as unreferenced objects) */
+void store_abort(STORE_WRITER *writer) {
+    free(writer->name);
+    free(writer->records);
+    free(writer->page);
+    writer->name = NULL;
+    writer->records = NULL;
+    writer->page = NULL;
+}
+
+/* Feed a writer from gs_read_rom_sink() */
+void store_sink(STORE_WRITER *writer, GS_SINK *sink) {
+    gs_sink_callback(sink, _store_sink_write, writer);
+}
+
+/* Map a committed snapshot and the pack it refers to */
+int snapshot_open(SNAPSHOT *snap, const char *path, const char *name) {
+    struct stat st;
+    char *p;
+    char *rel;
+    int fd;
+
+    memset(snap, 0, sizeof(SNAPSHOT));
+
+    if (!store_valid_name(name)) {
+        fprintf(stderr, "Invalid snapshot name `%s`\n", name);
+        return 1;
+    }
+
+    rel = alloc(strlen(name) + 16);
+    sprintf(rel, "snapshots/%s", name);
+    p = store_path(path, rel);
+    free(rel);
+    fd = open(p, O_RDONLY);
+    if ((fd == -1) || fstat(fd, &st) || (st.st_size < STORE_HEADER_SIZE)) {
+        fprintf(stderr, "Unable to open snapshot `%s`\n", p);
+        if (fd != -1) close(fd);
+        free(p);
+        return 1;
+    }
+    free(p);
+
+    snap->map_size = st.st_size;
+    snap->map = mmap(NULL, snap->map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (snap->map == MAP_FAILED) {
+        snap->map = NULL;
+        return 1;
+    }
+
+    if (memcmp(snap->map, STORE_MAGIC, 4) || (get_le16(&snap->map[4]) != STORE_VERSION)) {
+        fprintf(stderr, "`%s` is not a snapshot\n", name);
+        snapshot_close(snap);
+        return 1;
+    }
+    snap->address = get_le32(&snap->map[8]);
+    snap->size = get_le32(&snap->map[12]);
+    snap->page_size = get_le32(&snap->map[16]);
+    snap->pages = get_le32(&snap->map[20]);
+    snap->time = get_le64(&snap->map[24]);
+    snap->records = &snap->map[STORE_HEADER_SIZE];
+    if (!snap->page_size ||
+        (((uint64_t)snap->pages * STORE_RECORD_SIZE) > (snap->map_size - STORE_HEADER_SIZE))) {
+        fprintf(stderr, "Snapshot `%s` is truncated\n", name);
+        snapshot_close(snap);
+        return 1;
+    }
+
+    p = store_path(path, "objects.pack");
+    fd = open(p, O_RDONLY);
+    free(p);
+    if ((fd == -1) || fstat(fd, &st)) {
+        fprintf(stderr, "Unable to open pack for `%s`\n", name);
+        if (fd != -1) close(fd);
+        snapshot_close(snap);
+        return 1;
+    }
+    if (st.st_size) {
+        snap->pack_size = st.st_size;
+        snap->pack = mmap(NULL, snap->pack_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (snap->pack == MAP_FAILED) {
+            snap->pack = NULL;
+            snap->pack_size = 0;
+        }
+    }
+    close(fd);
+
+    return 0;
+}
+
+void snapshot_close(SNAPSHOT *snap) {
+    if (snap->map) {
+        munmap(snap->map, snap->map_size);
+    }
+    if (snap->pack) {
+        munmap(snap->pack, snap->pack_size);
+    }
+    memset(snap, 0, sizeof(SNAPSHOT));
+}
+
+void snapshot_record(SNAPSHOT *snap, uint32_t index, STORE_RECORD *record) {
+    store_unpack_record(&snap->records[index * STORE_RECORD_SIZE], record);
+}
+
+/* Decompress one page; `out` must hold page_size bytes */
+int snapshot_read_page(SNAPSHOT *snap, uint32_t index, uint8_t *out) {
+    STORE_RECORD record;
+    uint32_t size;
+    #if defined(HAS_ZLIB_H)
+        uLongf len;
+    #endif /* defined(HAS_ZLIB_H) */
+
+    if (index >= snap->pages) {
+        return 1;
+    }
+    size = MIN(snap->page_size, snap->size - (index * snap->page_size));
+    snapshot_record(snap, index, &record);
+
+    if ((record.offset + record.csize) > snap->pack_size) {
+        ERRORPRINT("Page %u points outside the pack\n", index);
+        return 1;
+    }
+
+    switch (record.codec) {
+        case STORE_CODEC_ZERO:
+            memset(out, 0, size);
+            return 0;
+
+        case STORE_CODEC_RAW:
+            if (record.csize != size) {
+                break;
+            }
+            memcpy(out, &snap->pack[record.offset], size);
+            return 0;
+
+        #if defined(HAS_ZLIB_H)
+        case STORE_CODEC_DEFLATE:
+            len = size;
+            if ((uncompress(out, &len, &snap->pack[record.offset], record.csize) != Z_OK) ||
+                (len != size)) {
+                break;
+            }
+            return 0;
+        #endif /* defined(HAS_ZLIB_H) */
+
+        default:
+            ERRORPRINT("Page %u uses unsupported codec %u\n", index, record.codec);
+            return 1;
+    }
+
+    ERRORPRINT("Page %u is corrupt\n", index);
+
+    return 1;
+}
+
+/* Read an arbitrary span of a snapshot, decompressing only the pages it covers */
+int snapshot_read(SNAPSHOT *snap, uint32_t address, uint8_t *out, uint32_t size) {
+    uint8_t *page;
+    uint32_t offset;
+    uint32_t index;
+    uint32_t skip;
+    uint32_t len;
+
+    if ((address < snap->address) ||
+        (((uint64_t)address + size) > ((uint64_t)snap->address + snap->size))) {
+        fprintf(stderr, "Range 0x%08X-0x%08X is outside the snapshot\n", address, address + size);
+        return 1;
+    }
+
+    page = alloc(snap->page_size);
+    offset = address - snap->address;
+    while (size) {
+        index = offset / snap->page_size;
+        skip = offset % snap->page_size;
+        len = MIN(snap->page_size - skip, size);
+
+        if (snapshot_read_page(snap, index, page)) {
+            free(page);
+            return 1;
+        }
+        memcpy(out, &page[skip], len);
+
+        out += len;
+        offset += len;
+        size -= len;
+    }
+    free(page);
+
+    return 0;
+}
@@ -0,0 +1,124 @@
+
+#ifndef _STORE_H_
+#define _STORE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gspro.h"
+
+
+/*
+ * Snapshot repository layout:
+ *
+ *   <repo>/objects.pack      Compressed pages, appended back-to-back.
+ *   <repo>/objects.idx       One STORE_RECORD per unique page (dedup index).
+ *   <repo>/snapshots/<name>  Snapshot header followed by one STORE_RECORD
+ *                            per page, in address order.
+ *   <repo>/paks/<name>       Controller Pak backup manifest (see mempak.h).
+ *   <repo>/states/<name>     Savestate manifest (see state.h).
+ *
+ * Pages are addressed by a 64-bit hash of their uncompressed contents, so a
+ * page shared by many snapshots is stored once. The hash only finds
+ * candidates: an object is reused once its size matches and its stored bytes
+ * read back equal, so a collision costs a second copy, never wrong data. Every snapshot record points
+ * straight into the pack file; reading one page of one snapshot is a lookup in
+ * the mapped snapshot file plus one page-sized decompress from the mapped pack.
+ *
+ * A STORE_RECORD is hash (u64), pack offset (u64), stored size (u32), codec
+ * (u8) and object size (u24; zero in repositories written before it was kept).
+ *
+ * All on-disk integers are little-endian.
+ */
+#define STORE_PAGE_SIZE     0x1000
+#define STORE_RECORD_SIZE   24
+#define STORE_HEADER_SIZE   32
+#define STORE_MAGIC         "N64S"
+#define STORE_VERSION       1
+#define STORE_OBJECT_MAX    0x00FFFFFF  /* Largest object a record can size */
+
+/* Page codecs */
+enum _store_codecs {
+    STORE_CODEC_RAW     = 0,
+    STORE_CODEC_ZERO    = 1,    /* All-zero page; no data in the pack */
+    STORE_CODEC_DEFLATE = 2
+};
+
+/* Location of one page in the pack */
+struct _store_record {
+    uint64_t    hash;
+    uint64_t    offset;
+    uint32_t    csize;
+    uint8_t     codec;
+    uint32_t    size;       /* Uncompressed; zero when not known */
+};
+typedef struct _store_record STORE_RECORD;
+
+/* An open repository */
+struct _store {
+    char *          path;
+    int             pack_fd;
+    int             idx_fd;
+    uint64_t        pack_size;
+    STORE_RECORD *  table;      /* Open-addressed on hash */
+    uint32_t        table_size;
+    uint32_t        count;
+};
+typedef struct _store STORE;
+
+/* A snapshot being captured */
+struct _store_writer {
+    STORE *         store;
+    char *          name;
+    uint32_t        address;
+    uint32_t        size;
+    uint32_t        page_size;
+    uint32_t        pages;
+    STORE_RECORD *  records;
+    uint32_t        written;    /* Bytes received so far */
+    uint8_t *       page;
+    uint32_t        new_pages;
+    uint64_t        new_bytes;
+};
+typedef struct _store_writer STORE_WRITER;
+
+/* A committed snapshot, mapped for reading */
+struct _snapshot {
+    uint32_t        address;
+    uint32_t        size;
+    uint32_t        page_size;
+    uint32_t        pages;
+    uint64_t        time;
+    const uint8_t * records;
+    uint8_t *       map;
+    size_t          map_size;
+    uint8_t *       pack;
+    size_t          pack_size;
+};
+typedef struct _snapshot SNAPSHOT;
+
+
+/* Function declarations */
+char *store_path(const char *path, const char *name);
+bool store_valid_name(const char *name);
+void store_pack_record(uint8_t *buf, STORE_RECORD *record);
+void store_unpack_record(const uint8_t *buf, STORE_RECORD *record);
+int store_open(STORE *store, const char *path, bool create);
+void store_close(STORE *store);
+int store_put(STORE *store, const uint8_t *data, uint32_t size, STORE_RECORD *record);
+int store_get(STORE *store, STORE_RECORD *record, uint8_t *out, uint32_t size);
+int store_list(const char *path);
+
+int store_begin(STORE_WRITER *writer, STORE *store, const char *name, uint32_t address, uint32_t size);
+int store_write(STORE_WRITER *writer, const uint8_t *data, size_t size);
+int store_commit(STORE_WRITER *writer);
+void store_abort(STORE_WRITER *writer);
+void store_sink(STORE_WRITER *writer, GS_SINK *sink);
+
+int snapshot_open(SNAPSHOT *snap, const char *path, const char *name);
+void snapshot_close(SNAPSHOT *snap);
+void snapshot_record(SNAPSHOT *snap, uint32_t index, STORE_RECORD *record);
+int snapshot_read_page(SNAPSHOT *snap, uint32_t index, uint8_t *out);
+int snapshot_read(SNAPSHOT *snap, uint32_t address, uint8_t *out, uint32_t size);
+
+#endif /* _STORE_H_ */
@@ -0,0 +1,252 @@
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gspro.h"
+#include "stream.h"
+
+
+/* Private function declarations */
+size_t _gs_source_memory_read(GS_SOURCE *source, uint8_t *buf, size_t size);
+size_t _gs_source_fd_read(GS_SOURCE *source, uint8_t *buf, size_t size);
+void _gs_source_fd_close(GS_SOURCE *source);
+void _gs_source_mmap_close(GS_SOURCE *source);
+GS_STATUS _gs_source_map_fd(GS_SOURCE *source, int fd);
+int _gs_sink_memory_write(GS_SINK *sink, const uint8_t *buf, size_t size);
+int _gs_sink_fd_write(GS_SINK *sink, const uint8_t *buf, size_t size);
+
+
+/* Private functions */
+
+/* Copy the next chunk out of a memory (or mapped) buffer */
+size_t _gs_source_memory_read(GS_SOURCE *source, uint8_t *buf, size_t size) {
+    size = MIN(size, (size_t)(source->size - source->offset));
+    memcpy(buf, &source->data[source->offset], size);
+    source->offset += size;
+
+    return size;
+}
+
+/* Read the next chunk from a file descriptor, retrying short reads */
+size_t _gs_source_fd_read(GS_SOURCE *source, uint8_t *buf, size_t size) {
+    size_t total = 0;
+    ssize_t len;
+
+    while (total < size) {
+        len = read(source->fd, &buf[total], size - total);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ERRORPRINT("read() failed: %s\n", strerror(errno));
+            break;
+        }
+        if (!len) {
+            break;
+        }
+        total += len;
+    }
+    source->offset += total;
+
+    return total;
+}
+
+void _gs_source_fd_close(GS_SOURCE *source) {
+    close(source->fd);
+    source->fd = -1;
+}
+
+void _gs_source_mmap_close(GS_SOURCE *source) {
+    munmap(source->data, source->map_size);
+    source->data = NULL;
+    source->map_size = 0;
+}
+
+/* Map a regular file; the descriptor may be closed afterward */
+GS_STATUS _gs_source_map_fd(GS_SOURCE *source, int fd) {
+    struct stat st;
+
+    memset(source, 0, sizeof(GS_SOURCE));
+    source->fd = -1;
+
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || !st.st_size) {
+        return GS_ERROR;
+    }
+
+    source->map_size = st.st_size;
+    source->data = mmap(NULL, source->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (source->data == MAP_FAILED) {
+        source->data = NULL;
+        source->map_size = 0;
+
+        return GS_ERROR;
+    }
+    madvise(source->data, source->map_size, MADV_SEQUENTIAL);
+
+    source->read = _gs_source_memory_read;
+    source->close = _gs_source_mmap_close;
+    source->size = MIN(st.st_size, (off_t)UINT32_MAX);
+
+    return GS_SUCCESS;
+}
+
+/* Copy the next chunk into a memory buffer */
+int _gs_sink_memory_write(GS_SINK *sink, const uint8_t *buf, size_t size) {
+    if (size > (size_t)(sink->size - sink->offset)) {
+        return 1;
+    }
+    memcpy(&sink->data[sink->offset], buf, size);
+    sink->offset += size;
+
+    return 0;
+}
+
+/* Write the next chunk to a file descriptor, retrying short writes */
+int _gs_sink_fd_write(GS_SINK *sink, const uint8_t *buf, size_t size) {
+    size_t total = 0;
+    ssize_t len;
+
+    while (total < size) {
+        len = write(sink->fd, &buf[total], size - total);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ERRORPRINT("write() failed: %s\n", strerror(errno));
+
+            return 1;
+        }
+        total += len;
+    }
+    sink->offset += total;
+
+    return 0;
+}
+
+
+/* Public functions */
+
+/* Read from a caller-owned memory buffer */
+GS_STATUS gs_source_memory(GS_SOURCE *source, uint8_t *data, uint32_t size) {
+    memset(source, 0, sizeof(GS_SOURCE));
+    source->read = _gs_source_memory_read;
+    source->size = size;
+    source->fd = -1;
+    source->data = data;
+
+    return GS_SUCCESS;
+}
+
+/* Read from an open file descriptor (size is known only for regular files) */
+GS_STATUS gs_source_fd(GS_SOURCE *source, int fd) {
+    struct stat st;
+
+    memset(source, 0, sizeof(GS_SOURCE));
+    source->read = _gs_source_fd_read;
+    source->fd = fd;
+
+    if (!fstat(fd, &st) && S_ISREG(st.st_mode)) {
+        source->size = MIN(st.st_size, (off_t)UINT32_MAX);
+    }
+
+    return GS_SUCCESS;
+}
+
+/* Map a file into memory; pages are faulted in as they are sent */
+GS_STATUS gs_source_mmap(GS_SOURCE *source, const char *filename) {
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        ERRORPRINT("Unable to open '%s' for reading: %s\n", filename, strerror(errno));
+
+        return GS_ERROR;
+    }
+
+    if (_gs_source_map_fd(source, fd)) {
+        ERRORPRINT("Unable to map '%s'\n", filename);
+        close(fd);
+
+        return GS_ERROR;
+    }
+    close(fd);
+
+    return GS_SUCCESS;
+}
+
+/* Open a file by name; mapped when possible, streamed otherwise */
+GS_STATUS gs_source_file(GS_SOURCE *source, const char *filename) {
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        ERRORPRINT("Unable to open '%s' for reading: %s\n", filename, strerror(errno));
+
+        return GS_ERROR;
+    }
+
+    if (!_gs_source_map_fd(source, fd)) {
+        close(fd);
+
+        return GS_SUCCESS;
+    }
+
+    /* Pipes, character devices and empty files are streamed instead */
+    gs_source_fd(source, fd);
+    source->close = _gs_source_fd_close;
+
+    return GS_SUCCESS;
+}
+
+/* Release anything the source opened itself */
+void gs_source_close(GS_SOURCE *source) {
+    if (source->close) {
+        source->close(source);
+    }
+    source->close = NULL;
+    source->read = NULL;
+}
+
+/* Write into a caller-owned memory buffer of `size` bytes */
+GS_STATUS gs_sink_memory(GS_SINK *sink, uint8_t *data, uint32_t size) {
+    memset(sink, 0, sizeof(GS_SINK));
+    sink->write = _gs_sink_memory_write;
+    sink->size = size;
+    sink->fd = -1;
+    sink->data = data;
+
+    return GS_SUCCESS;
+}
+
+/* Write to an open file descriptor */
+GS_STATUS gs_sink_fd(GS_SINK *sink, int fd) {
+    memset(sink, 0, sizeof(GS_SINK));
+    sink->write = _gs_sink_fd_write;
+    sink->fd = fd;
+
+    return GS_SUCCESS;
+}
+
+/* Hand each chunk to a caller-supplied function */
+GS_STATUS gs_sink_callback(GS_SINK *sink, int (*write)(GS_SINK *, const uint8_t *, size_t), void *context) {
+    memset(sink, 0, sizeof(GS_SINK));
+    sink->write = write;
+    sink->fd = -1;
+    sink->context = context;
+
+    return GS_SUCCESS;
+}
+
+/* Release anything the sink opened itself */
+void gs_sink_close(GS_SINK *sink) {
+    if (sink->close) {
+        sink->close(sink);
+    }
+    sink->close = NULL;
+    sink->write = NULL;
+}
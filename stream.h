@@ -0,0 +1,36 @@
+
+#ifndef _STREAM_H_
+#define _STREAM_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <stdint.h>
+
+#include "gspro.h"
+
+
+/* Chunk size used when pulling data from a source */
+#define GS_SOURCE_CHUNK 0x1000
+
+/* Chunk size used when pushing data into a sink */
+#define GS_SINK_CHUNK 0x4000
+
+
+/* Function declarations */
+GS_STATUS gs_source_memory(GS_SOURCE *source, uint8_t *data, uint32_t size);
+GS_STATUS gs_source_fd(GS_SOURCE *source, int fd);
+GS_STATUS gs_source_mmap(GS_SOURCE *source, const char *filename);
+GS_STATUS gs_source_file(GS_SOURCE *source, const char *filename);
+void gs_source_close(GS_SOURCE *source);
+GS_STATUS gs_sink_memory(GS_SINK *sink, uint8_t *data, uint32_t size);
+GS_STATUS gs_sink_fd(GS_SINK *sink, int fd);
+GS_STATUS gs_sink_callback(GS_SINK *sink, int (*write)(GS_SINK *, const uint8_t *, size_t), void *context);
+void gs_sink_close(GS_SINK *sink);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _STREAM_H_ */
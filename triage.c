@@ -0,0 +1,259 @@
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gspro.h"
+#include "memmap.h"
+#include "n64rd.h"
+#include "triage.h"
+
+
+/* A dump in progress */
+struct _triage {
+    int             fd;
+    FILE *          log;
+    uint8_t *       covered;    /* One flag per TRIAGE_UNIT */
+    uint64_t        start;
+    uint32_t        written;
+    uint32_t        failed;
+};
+typedef struct _triage TRIAGE;
+
+
+/* Private variables */
+
+/* Read before anything else */
+static const TRIAGE_REGION _triage_defaults[] = {
+    { 0x80000000, 0x200, "exception vectors" },
+    { 0x80000300, 0x100, "boot parameters" }
+};
+
+
+/* Private function declarations */
+int _triage_write(TRIAGE *t, uint32_t phys, const uint8_t *buf, uint32_t size, const char *name);
+int _triage_read(TRIAGE *t, uint32_t phys, uint32_t size, const char *name);
+void _triage_region(TRIAGE *t, uint32_t phys, uint32_t size, const char *name);
+
+
+/* Private functions */
+
+/* Put one region in place, then log it; each is synced before the next is read */
+int _triage_write(TRIAGE *t, uint32_t phys, const uint8_t *buf, uint32_t size, const char *name) {
+    ssize_t len;
+    uint32_t total = 0;
+
+    while (total < size) {
+        len = pwrite(t->fd, &buf[total], size - total, phys + total);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Write failed: %s\n", strerror(errno));
+            return 1;
+        }
+        total += len;
+    }
+    fdatasync(t->fd);
+
+    fprintf(t->log, "0x%08X 0x%08X %s\n", MEMMAP_KSEG0 + phys, size, name);
+    fflush(t->log);
+    fdatasync(fileno(t->log));
+
+    return 0;
+}
+
+int _triage_read(TRIAGE *t, uint32_t phys, uint32_t size, const char *name) {
+    uint8_t *buf = alloc(size);
+    uint32_t i;
+    GS_RANGE range[2] = {
+        {
+            MEMMAP_KSEG0 + phys,
+            size
+        },
+        {
+            0, 0
+        }
+    };
+
+    if (gs_enter() || gs_read_rom(buf, range, NULL)) {
+        fprintf(stderr, "Unable to read 0x%08X - 0x%08X (%s)\n",
+            range[0].address, range[0].address + size - 1, name);
+        t->failed += size;
+        free(buf);
+        return 1;
+    }
+    if (_triage_write(t, phys, buf, size, name)) {
+        free(buf);
+        return 1;
+    }
+    free(buf);
+
+    for (i = phys / TRIAGE_UNIT; i < ((phys + size) / TRIAGE_UNIT); i++) {
+        t->covered[i] = 1;
+    }
+    t->written += size;
+
+    return 0;
+}
+
+/* Read the parts of [phys, phys + size) not already read, one run at a time */
+void _triage_region(TRIAGE *t, uint32_t phys, uint32_t size, const char *name) {
+    uint32_t unit = phys / TRIAGE_UNIT;
+    uint32_t end = (phys + size) / TRIAGE_UNIT;
+    uint32_t run;
+
+    while (unit < end) {
+        if (t->covered[unit]) {
+            unit++;
+            continue;
+        }
+        /* Long runs are split, so a cut-short dump loses at most one chunk */
+        for (run = 1; ((unit + run) < end) && !t->covered[unit + run] &&
+            (run < (TRIAGE_CHUNK / TRIAGE_UNIT)); run++);
+
+        _triage_read(t, unit * TRIAGE_UNIT, run * TRIAGE_UNIT, name);
+        unit += run;
+    }
+}
+
+
+/* Public functions */
+
+/* Parse "[name=]address:size,..." */
+int triage_parse(char *spec, TRIAGE_REGION **regions, int *count) {
+    char *p = spec;
+    char *err = NULL;
+    char *eq;
+    int n = 1;
+
+    for (; *p; p++) {
+        if (*p == ',') n++;
+    }
+    *regions = alloc(n * sizeof(TRIAGE_REGION));
+    *count = 0;
+
+    p = spec;
+    while (*p) {
+        TRIAGE_REGION *r = &(*regions)[*count];
+        char *next = strchr(p, ',');
+
+        if (next) {
+            *next = '\0';
+        }
+        r->name = "given";
+        eq = strchr(p, '=');
+        if (eq) {
+            *eq = '\0';
+            r->name = p;
+            p = eq + 1;
+        }
+
+        r->address = strtoul(p, &err, 0);
+        if ((err == p) || (*err != ':')) {
+            fprintf(stderr, "Invalid triage address\n");
+            parse_error(spec, (err - spec));
+            return 1;
+        }
+        p = err + 1;
+        r->size = strtoul(p, &err, 0);
+        if ((err == p) || *err || !r->size) {
+            fprintf(stderr, "Invalid triage size\n");
+            parse_error(spec, (err - spec));
+            return 1;
+        }
+
+        (*count)++;
+        p = next ? next + 1 : err;
+    }
+
+    if (!*count) {
+        fprintf(stderr, "Empty triage list\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Dump `ram` bytes of RDRAM to `filename`, most useful regions first */
+int triage_run(const char *filename, TRIAGE_REGION *regions, int count, uint32_t ram) {
+    TRIAGE t;
+    const TRIAGE_REGION *r;
+    char *logname;
+    uint64_t start;
+    uint64_t end;
+    uint32_t phys;
+    uint32_t chunk;
+    int defaults = sizeof(_triage_defaults) / sizeof(TRIAGE_REGION);
+    int i;
+
+    memset(&t, 0, sizeof(TRIAGE));
+
+    t.fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (t.fd == -1) {
+        fprintf(stderr, "Unable to open `%s` for writing\n", filename);
+        return 1;
+    }
+    logname = alloc(strlen(filename) + 5);
+    sprintf(logname, "%s.log", filename);
+    t.log = fopen(logname, "w");
+    if (!t.log) {
+        fprintf(stderr, "Unable to open `%s` for writing\n", logname);
+        free(logname);
+        close(t.fd);
+        return 1;
+    }
+
+    /* The image is full size from the start; unread parts are holes */
+    if (ftruncate(t.fd, ram)) {
+        fprintf(stderr, "Unable to set the file size: %s\n", strerror(errno));
+    }
+    t.covered = alloc(ram / TRIAGE_UNIT);
+    memset(t.covered, 0, ram / TRIAGE_UNIT);
+    t.start = now_ns();
+
+    printf("Triage dump of %u MB to `%s` (log in `%s`)\n", ram >> 20, filename, logname);
+
+    for (i = 0; i < (defaults + count); i++) {
+        r = ((i < defaults) ? &_triage_defaults[i] : &regions[i - defaults]);
+
+        /* Only RDRAM, through either mirror */
+        phys = r->address & MEMMAP_PHYS_MASK;
+        if ((r->address < MEMMAP_KSEG0) || (r->address >= 0xC0000000) || (phys >= ram)) {
+            fprintf(stderr, "Skipping %s: 0x%08X is not in the installed RDRAM\n", r->name, r->address);
+            continue;
+        }
+        start = phys & ~(uint64_t)(TRIAGE_UNIT - 1);
+        end = MIN((uint64_t)phys + r->size, ram);
+        end = (end + TRIAGE_UNIT - 1) & ~(uint64_t)(TRIAGE_UNIT - 1);
+
+        _triage_region(&t, start, end - start, r->name);
+        printf("  0x%08X - 0x%08X  %-20s %8.2f s\n", (uint32_t)(MEMMAP_KSEG0 + start),
+            (uint32_t)(MEMMAP_KSEG0 + end - 1), r->name, (now_ns() - t.start) / 1e9);
+    }
+
+    /* Everything else, a chunk at a time */
+    for (chunk = 0; chunk < ram; chunk += TRIAGE_CHUNK) {
+        _triage_region(&t, chunk, MIN(TRIAGE_CHUNK, ram - chunk), "remaining");
+        printf(".");
+        fflush(stdout);
+    }
+    printf("\n");
+
+    printf("%u of %u KB written in %.2f s", t.written >> 10, ram >> 10, (now_ns() - t.start) / 1e9);
+    if (t.failed) {
+        printf(", %u KB could not be read", t.failed >> 10);
+    }
+    printf("\n");
+
+    fclose(t.log);
+    close(t.fd);
+    free(t.covered);
+    free(logname);
+
+    return (t.written != ram);
+}
@@ -0,0 +1,38 @@
+
+#ifndef _TRIAGE_H_
+#define _TRIAGE_H_
+
+#include <stdint.h>
+
+
+/*
+ * Triage dumps: RDRAM in priority order, for a crashed game that may be
+ * power-cycled before a full dump finishes.
+ *
+ *   <file>       Image of RDRAM from 0x80000000. Each region is written in
+ *                place and synced as soon as it has been read, so the parts
+ *                not read yet are holes (zeros).
+ *   <file>.log   One line per region written: address, size and name, synced
+ *                after the image, so a cut-short dump says what it holds.
+ *
+ * The built-in regions are read first, then those given on the command line,
+ * then the rest of RDRAM in TRIAGE_CHUNK pieces, lowest address first. Nothing
+ * is read twice. Everything is read with READ_ROM, which does not need the game
+ * to be running normally.
+ */
+#define TRIAGE_CHUNK        0x10000
+#define TRIAGE_UNIT         0x10        /* Regions are rounded out to this */
+
+struct _triage_region {
+    uint32_t        address;
+    uint32_t        size;
+    const char *    name;
+};
+typedef struct _triage_region TRIAGE_REGION;
+
+
+/* Function declarations */
+int triage_parse(char *spec, TRIAGE_REGION **regions, int *count);
+int triage_run(const char *filename, TRIAGE_REGION *regions, int count, uint32_t ram);
+
+#endif /* _TRIAGE_H_ */
@@ -0,0 +1,195 @@
+
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "n64rd.h"
+
+
+void *alloc(size_t size) {
+    void *p = calloc(size, 1);
+    if (!p) {
+        abort();
+    }
+
+    return p;
+}
+
+/* Monotonic clock, in nanoseconds */
+uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/* CPU time consumed by this process, in nanoseconds */
+uint64_t cpu_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/* Sleep until an absolute monotonic deadline */
+void sleep_until_ns(uint64_t deadline) {
+    struct timespec ts;
+
+    ts.tv_sec = deadline / 1000000000ULL;
+    ts.tv_nsec = deadline % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+void stats_add(STATS *stats, double value) {
+    double delta;
+
+    if (!stats->count || (value < stats->min)) {
+        stats->min = value;
+    }
+    if (!stats->count || (value > stats->max)) {
+        stats->max = value;
+    }
+
+    stats->count++;
+    delta = value - stats->mean;
+    stats->mean += delta / stats->count;
+    stats->m2 += delta * (value - stats->mean);
+}
+
+double stats_stddev(STATS *stats) {
+    if (stats->count < 2) {
+        return 0.0;
+    }
+
+    return sqrt(stats->m2 / (stats->count - 1));
+}
+
+/*
+ * 64-bit content hash for page deduplication (a MurmurHash3-style mix over
+ * little-endian words; not cryptographic)
+ */
+#define _ROTL64(_x, _r) (((_x) << (_r)) | ((_x) >> (64 - (_r))))
+
+uint64_t hash64(const void *data, size_t size, uint64_t seed) {
+    const uint8_t *p = data;
+    uint64_t h = seed ^ (size * 0x9E3779B97F4A7C15ULL);
+    uint64_t k;
+    uint8_t tail[8];
+
+    while (size >= 8) {
+        k = get_le64(p);
+        k *= 0x87C37B91114253D5ULL;
+        k = _ROTL64(k, 31);
+        k *= 0x4CF5AD432745937FULL;
+        h ^= k;
+        h = (_ROTL64(h, 27) * 5) + 0x52DCE729;
+        p += 8;
+        size -= 8;
+    }
+
+    if (size) {
+        memset(tail, 0, sizeof(tail));
+        memcpy(tail, p, size);
+        k = get_le64(tail);
+        k *= 0x87C37B91114253D5ULL;
+        k = _ROTL64(k, 31);
+        k *= 0x4CF5AD432745937FULL;
+        h ^= k;
+    }
+
+    /* Finalize */
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+/* Little-endian packing for on-disk formats */
+void put_le16(uint8_t *p, uint16_t value) {
+    p[0] = value >> 0;
+    p[1] = value >> 8;
+}
+
+void put_le32(uint8_t *p, uint32_t value) {
+    put_le16(&p[0], value >> 0);
+    put_le16(&p[2], value >> 16);
+}
+
+void put_le64(uint8_t *p, uint64_t value) {
+    put_le32(&p[0], value >> 0);
+    put_le32(&p[4], value >> 32);
+}
+
+uint16_t get_le16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+uint32_t get_le32(const uint8_t *p) {
+    return get_le16(&p[0]) | ((uint32_t)get_le16(&p[2]) << 16);
+}
+
+uint64_t get_le64(const uint8_t *p) {
+    return get_le32(&p[0]) | ((uint64_t)get_le32(&p[4]) << 32);
+}
+
+/* Big-endian, as the N64 stores it */
+void put_be16(uint8_t *p, uint16_t value) {
+    p[0] = value >> 8;
+    p[1] = value >> 0;
+}
+
+void put_be32(uint8_t *p, uint32_t value) {
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value >> 0;
+}
+
+uint16_t get_be16(const uint8_t *p) {
+    return (p[0] << 8) | p[1];
+}
+
+uint32_t get_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+void hex_dump(uint8_t *data, uint32_t address, uint32_t size) {
+    char ascii[16 + 1] = { 0 };
+    int i;
+
+    for (i = 0; i < size; i++) {
+        /* Address */
+        if (!(i % 16)) {
+            printf("%08X  ", address + i);
+        }
+
+        /* Hex */
+        printf("%02X ", data[i]);
+
+        /* ASCII */
+        sprintf(&ascii[i % 16], "%c", isprint(data[i]) ? data[i] : '.');
+        if ((i % 16) == 15) {
+            printf(" %s\n", ascii);
+        }
+    }
+
+    /* Pad the output, if necessary */
+    if (size & 15) {
+        for (i = 0; i < (16 - (size & 15)); i++) {
+            printf("   ");
+        }
+        printf(" %s\n", ascii);
+    }
+
+    printf("\n");
+}
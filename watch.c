@@ -0,0 +1,415 @@
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gspro.h"
+#include "n64rd.h"
+#include "memmap.h"
+#include "watch.h"
+
+
+/* Block writer for the columnar watch file */
+struct _watch_file {
+    FILE *      fp;
+    uint64_t    start;      /* Unix time of the header, in nanoseconds */
+    uint32_t    count;
+    uint64_t    times[WATCH_BLOCK_SAMPLES];
+    uint8_t *   columns;
+    uint32_t    row_size;
+};
+typedef struct _watch_file WATCH_FILE;
+
+
+/* Private variables */
+static volatile sig_atomic_t _watch_stop = 0;
+
+
+/* Private function declarations */
+void _watch_signal(int sig);
+int _watch_compare(const void *a, const void *b);
+GS_RANGE *_watch_ranges(WATCH_ENTRY *entries, int count, uint32_t *total);
+int _watch_open(WATCH_FILE *wf, char *filename, WATCH_ENTRY *entries, int count, uint32_t interval);
+void _watch_flush(WATCH_FILE *wf, WATCH_ENTRY *entries, int count);
+int _watch_tick(uint8_t *buffer, GS_RANGE *ranges);
+void _watch_print(uint8_t *buffer, uint64_t time, WATCH_ENTRY *entries, int count);
+
+
+/* Private functions */
+
+void _watch_signal(int sig) {
+    _watch_stop = 1;
+}
+
+int _watch_compare(const void *a, const void *b) {
+    const WATCH_ENTRY *ea = *(const WATCH_ENTRY **)a;
+    const WATCH_ENTRY *eb = *(const WATCH_ENTRY **)b;
+
+    return (ea->address > eb->address) - (ea->address < eb->address);
+}
+
+/*
+ * Merge overlapping and adjacent entries into the fewest READ ranges, and
+ * record where each entry lands in the packed read buffer. A range starting
+ * where READ is refused is read through KSEG1; returns NULL if that can't help.
+ */
+GS_RANGE *_watch_ranges(WATCH_ENTRY *entries, int count, uint32_t *total) {
+    WATCH_ENTRY **sorted = alloc(count * sizeof(WATCH_ENTRY *));
+    GS_RANGE *ranges = alloc((count + 1) * sizeof(GS_RANGE));
+    GS_RANGE *last = NULL;
+    uint32_t last_offset = 0;
+    uint32_t end;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        sorted[i] = &entries[i];
+    }
+    qsort(sorted, count, sizeof(WATCH_ENTRY *), _watch_compare);
+
+    *total = 0;
+    for (i = 0; i < count; i++) {
+        end = sorted[i]->address + sorted[i]->width;
+
+        if (last && (sorted[i]->address <= (last->address + last->size))) {
+            last->size = MAX(last->size, end - last->address);
+        }
+        else {
+            if (last) {
+                *total += last->size;
+                last++;
+            }
+            else {
+                last = ranges;
+            }
+            last->address = sorted[i]->address;
+            last->size = sorted[i]->width;
+            last_offset = *total;
+        }
+        sorted[i]->offset = last_offset + (sorted[i]->address - last->address);
+    }
+    if (last) {
+        *total += last->size;
+    }
+    free(sorted);
+
+    for (i = 0; ranges[i].size; i++) {
+        if (memmap_read_blocked(ranges[i].address)) {
+            ranges[i].address = MEMMAP_KSEG1 | (ranges[i].address & MEMMAP_PHYS_MASK);
+        }
+        if (memmap_read_blocked(ranges[i].address)) {
+            fprintf(stderr, "Unable to watch 0x%08X: READ refuses it in every mirror\n", ranges[i].address);
+            free(ranges);
+            return NULL;
+        }
+    }
+
+    return ranges;
+}
+
+/* Open (or append to) a watch file; on failure, nothing is left open */
+int _watch_open(WATCH_FILE *wf, char *filename, WATCH_ENTRY *entries, int count, uint32_t interval) {
+    uint8_t header[20];
+    uint8_t entry[8];
+    struct timespec ts;
+    long size;
+    int i;
+
+    memset(wf, 0, sizeof(WATCH_FILE));
+    for (i = 0; i < count; i++) {
+        wf->row_size += entries[i].width;
+    }
+    wf->columns = alloc(wf->row_size * WATCH_BLOCK_SAMPLES);
+
+    wf->fp = fopen(filename, "a+b");
+    if (!wf->fp) {
+        fprintf(stderr, "Unable to open `%s` for writing\n", filename);
+        goto fail;
+    }
+
+    fseek(wf->fp, 0, SEEK_END);
+    size = ftell(wf->fp);
+    if (size > 0) {
+        /* Appending: the existing header must describe the same entries */
+        rewind(wf->fp);
+        if ((fread(header, sizeof(header), 1, wf->fp) != 1) ||
+            memcmp(header, WATCH_MAGIC, 4) ||
+            (get_le16(&header[4]) != WATCH_VERSION) ||
+            (get_le16(&header[6]) != count)) {
+            fprintf(stderr, "`%s` is not a compatible watch file\n", filename);
+            goto fail;
+        }
+        for (i = 0; i < count; i++) {
+            if ((fread(entry, sizeof(entry), 1, wf->fp) != 1) ||
+                (get_le32(&entry[0]) != entries[i].address) ||
+                (get_le32(&entry[4]) != entries[i].width)) {
+                fprintf(stderr, "`%s` watches a different entry list\n", filename);
+                goto fail;
+            }
+        }
+        wf->start = get_le64(&header[12]);
+        fseek(wf->fp, 0, SEEK_END);
+
+        return 0;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    wf->start = ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+
+    memcpy(header, WATCH_MAGIC, 4);
+    put_le16(&header[4], WATCH_VERSION);
+    put_le16(&header[6], count);
+    put_le32(&header[8], interval);
+    put_le64(&header[12], wf->start);
+    fwrite(header, sizeof(header), 1, wf->fp);
+
+    for (i = 0; i < count; i++) {
+        put_le32(&entry[0], entries[i].address);
+        put_le32(&entry[4], entries[i].width);
+        fwrite(entry, sizeof(entry), 1, wf->fp);
+    }
+
+    return 0;
+
+fail:
+    if (wf->fp) {
+        fclose(wf->fp);
+    }
+    free(wf->columns);
+    memset(wf, 0, sizeof(WATCH_FILE));
+
+    return 1;
+}
+
+/* Write out the pending block, one column per entry */
+void _watch_flush(WATCH_FILE *wf, WATCH_ENTRY *entries, int count) {
+    uint8_t buf[8];
+    uint32_t offset = 0;
+    uint32_t i;
+
+    if (!wf->count) {
+        return;
+    }
+
+    put_le32(buf, wf->count);
+    fwrite(buf, 4, 1, wf->fp);
+    for (i = 0; i < wf->count; i++) {
+        put_le64(buf, wf->times[i]);
+        fwrite(buf, 8, 1, wf->fp);
+    }
+
+    /* Columns are stored back-to-back in the block buffer already */
+    for (i = 0; i < count; i++) {
+        fwrite(&wf->columns[offset * WATCH_BLOCK_SAMPLES], entries[i].width, wf->count, wf->fp);
+        offset += entries[i].width;
+    }
+
+    fflush(wf->fp);
+    wf->count = 0;
+}
+
+/* Take one sample: a single paused READ of every range */
+int _watch_tick(uint8_t *buffer, GS_RANGE *ranges) {
+    GS_ENTER();
+    GS_READ(buffer, ranges, NULL);
+    GS_EXIT();
+
+    return 0;
+}
+
+void _watch_print(uint8_t *buffer, uint64_t time, WATCH_ENTRY *entries, int count) {
+    uint32_t i;
+    int j;
+
+    printf("%12.6f", time / 1e9);
+    for (j = 0; j < count; j++) {
+        printf("  %08X=", entries[j].address);
+        for (i = 0; i < entries[j].width; i++) {
+            printf("%02X", buffer[entries[j].offset + i]);
+        }
+    }
+    printf("\n");
+}
+
+
+/* Public functions */
+
+/* Parse "address[:width],address[:width],..." (width defaults to 4) */
+int watch_parse(char *spec, WATCH_ENTRY **entries, int *count) {
+    char *p = spec;
+    char *err = NULL;
+    int n = 1;
+
+    for (; *p; p++) {
+        if (*p == ',') n++;
+    }
+    *entries = alloc(n * sizeof(WATCH_ENTRY));
+    *count = 0;
+
+    p = spec;
+    while (*p) {
+        WATCH_ENTRY *e = &(*entries)[*count];
+
+        e->address = strtoul(p, &err, 0);
+        e->width = 4;
+        if (err == p) {
+            fprintf(stderr, "Invalid watch address\n");
+            parse_error(spec, (err - spec));
+            return 1;
+        }
+        if (*err == ':') {
+            p = err + 1;
+            e->width = strtoul(p, &err, 0);
+        }
+        if ((e->width != 1) && (e->width != 2) && (e->width != 4) && (e->width != 8)) {
+            fprintf(stderr, "Invalid watch width (must be 1, 2, 4 or 8)\n");
+            parse_error(spec, (p - spec));
+            return 1;
+        }
+        if (*err && (*err != ',')) {
+            fprintf(stderr, "Invalid watch entry\n");
+            parse_error(spec, (err - spec));
+            return 1;
+        }
+
+        (*count)++;
+        p = *err ? err + 1 : err;
+    }
+
+    if (!*count) {
+        fprintf(stderr, "Empty watch list\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Poll the watch list every `interval` microseconds until `samples` have been
+ * taken (or forever, if zero) or SIGINT arrives. The game only runs between
+ * ticks, so each tick is exactly one enter/READ/exit cycle.
+ */
+int watch_run(WATCH_ENTRY *entries, int count, char *filename, uint32_t interval, uint32_t samples) {
+    WATCH_FILE wf;
+    GS_RANGE *ranges;
+    uint8_t *buffer;
+    uint32_t total = 0;
+    uint32_t offset;
+    uint64_t start, next, prev = 0, t, t_end;
+    uint64_t taken = 0;
+    uint64_t overruns = 0;
+    STATS period = { 0 };
+    STATS latency = { 0 };
+    uint8_t check;
+    int result = 0;
+    int i;
+
+    ranges = _watch_ranges(entries, count, &total);
+    if (!ranges) {
+        return 1;
+    }
+    buffer = alloc(total);
+
+    for (i = 0; ranges[i].size; i++) {
+        DEBUGPRINT("Range %d: 0x%08X, 0x%X bytes\n", i, ranges[i].address, ranges[i].size);
+    }
+    printf("Watching %d entries in %d ranges (%u bytes per sample)\n", count, i, total);
+
+    memset(&wf, 0, sizeof(wf));
+    if (filename && _watch_open(&wf, filename, entries, count, interval)) {
+        result = 1;
+        goto done;
+    }
+
+    /* Verify GS is in-game */
+    if (gs_enter() || gs_where(&check)) {
+        result = 1;
+        goto done;
+    }
+    if (check != GS_WHERE_GAME) {
+        fprintf(stderr, "Watch is only available while in-game\n");
+        result = 1;
+        goto done;
+    }
+
+    _watch_stop = 0;
+    signal(SIGINT, _watch_signal);
+
+    start = next = now_ns();
+    if (wf.fp) {
+        struct timespec ts;
+
+        /* Express sample times relative to the file's start time */
+        clock_gettime(CLOCK_REALTIME, &ts);
+        start -= (((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec) - wf.start;
+    }
+
+    while (!_watch_stop && (!samples || (taken < samples))) {
+        sleep_until_ns(next);
+
+        t = now_ns();
+        if (_watch_tick(buffer, ranges)) {
+            result = 1;
+            break;
+        }
+        t_end = now_ns();
+
+        if (taken) {
+            stats_add(&period, (t - prev) / 1e3);
+        }
+        stats_add(&latency, (t_end - t) / 1e3);
+        prev = t;
+        taken++;
+
+        if (wf.fp) {
+            wf.times[wf.count] = t - start;
+            offset = 0;
+            for (i = 0; i < count; i++) {
+                memcpy(&wf.columns[(offset * WATCH_BLOCK_SAMPLES) + (wf.count * entries[i].width)],
+                    &buffer[entries[i].offset], entries[i].width);
+                offset += entries[i].width;
+            }
+            if (++wf.count == WATCH_BLOCK_SAMPLES) {
+                _watch_flush(&wf, entries, count);
+            }
+        }
+        else {
+            _watch_print(buffer, t - start, entries, count);
+        }
+
+        /* Keep a fixed cadence; skip ahead if a tick overran its slot */
+        next += (uint64_t)interval * 1000;
+        if (next < t_end) {
+            next = t_end;
+            overruns++;
+        }
+    }
+
+    signal(SIGINT, SIG_DFL);
+
+    printf("\n");
+    printf("Samples:  %llu (%llu overruns)\n", (unsigned long long)taken, (unsigned long long)overruns);
+    if (period.count) {
+        printf("Rate:     %.2f Hz (target %.2f Hz)\n",
+            1e6 / period.mean, (interval ? (1e6 / interval) : 0.0));
+        printf("Period:   mean %.1f us, jitter %.1f us (min %.1f, max %.1f)\n",
+            period.mean, stats_stddev(&period), period.min, period.max);
+    }
+    if (latency.count) {
+        printf("Latency:  mean %.1f us, stddev %.1f us\n", latency.mean, stats_stddev(&latency));
+    }
+
+done:
+    if (wf.fp) {
+        _watch_flush(&wf, entries, count);
+        fclose(wf.fp);
+    }
+    free(wf.columns);
+    free(buffer);
+    free(ranges);
+
+    return result;
+}
@@ -0,0 +1,39 @@
+
+#ifndef _WATCH_H_
+#define _WATCH_H_
+
+#include <stdint.h>
+
+
+/*
+ * Watch file format (all fields little-endian):
+ *
+ *   Header:  "N64W", version (u16), entry count (u16), interval in
+ *            microseconds (u32), start time in Unix nanoseconds (u64),
+ *            then per entry: address (u32), width (u32).
+ *   Blocks:  sample count (u32), timestamps in nanoseconds since start
+ *            (u64 * count), then one column per entry holding `count` raw
+ *            values of `width` bytes each, in console (big-endian) order.
+ *
+ * Appending to an existing file adds blocks after the existing ones; the
+ * entry list must match the header. Timestamps in appended blocks are
+ * relative to the original header start time.
+ */
+#define WATCH_MAGIC "N64W"
+#define WATCH_VERSION 1
+#define WATCH_BLOCK_SAMPLES 256
+
+/* One watched variable */
+struct _watch_entry {
+    uint32_t    address;
+    uint32_t    width;
+    uint32_t    offset;     /* Offset into the packed read buffer */
+};
+typedef struct _watch_entry WATCH_ENTRY;
+
+
+/* Function declarations */
+int watch_parse(char *spec, WATCH_ENTRY **entries, int *count);
+int watch_run(WATCH_ENTRY *entries, int count, char *filename, uint32_t interval, uint32_t samples);
+
+#endif /* _WATCH_H_ */